@@ -2,8 +2,17 @@
 #define __PERSISTENCE_FILTER_H__
 
 #include <functional>
+#include <limits>
+#include <stdexcept>
+#include <vector>
 #include <boost/optional.hpp>
-#include <gsl/gsl_sf_exp.h>
+
+#include "persistence_filter_detector_model.h"
+#include "persistence_filter_instrumentation.h"
+#include "persistence_filter_math.h"
+#include "persistence_filter_priors.h"
+#include "persistence_filter_simd.h"
+#include "persistence_filter_utils.h"
 
 
 /** This class implements the persistence filter algorithm for computing
@@ -11,9 +20,23 @@
  * environments, as described in the paper "Towards Lifelong Feature-Based
  * Mapping in Semi-Static Environments", by D.M. Rosen, J. Mason, and J.J.
  * Leonard.
+ *
+ * The filter is templated on the type of its survival time prior (see
+ * persistence_filter_priors.h), so that filters whose prior is known at
+ * compile time evaluate it without any indirect calls.  PersistenceFilter is
+ * the filter with a type-erased prior, which accepts any log-survival
+ * function.
+ *
+ * Constructing a filter only copies its prior.  Copies of a
+ * LogSurvivalFunction share the wrapped prior, so constructing a
+ * PersistenceFilter from an existing LogSurvivalFunction never allocates;
+ * SharedPriorPersistenceFilter merely stores a pointer to its prior.  Maps
+ * that create and destroy filters continually can also draw their storage
+ * from a PersistenceFilterPool (see persistence_filter_pool.h).
  */
 
-class PersistenceFilter
+template<typename SurvivalPrior>
+class BasicPersistenceFilter
 {
  protected:
 
@@ -23,6 +46,9 @@ class PersistenceFilter
   /** The time of the last observation*/
   double tN_;
 
+  /** The natural logarithm of the shifted survival function S_T(t_N - initialization_time) at the time of the last observation (0 before the first observation), which the next update needs again*/
+  double logS_tN_;
+
   /** The natural logarithm of the likelihood probability p(Y_{1:N} | t_N)*/
   double logpY_tN_;
 
@@ -32,45 +58,57 @@ class PersistenceFilter
   /** The natural logarithm of the marginal (evidence) probability p(Y_{1:N})*/
   double logpY_;
 
-  /** A function returning the natural logarithm of the survival function S_T() for the survival time prior p_T()*/
-  std::function<double(double)> logS_;
-
-  /** A function returning the natural logarithm of the time-shifted survival function S_T(t - initialization_time)*/
-  std::function<double(double)> shifted_logS_;
+  /** The survival time prior p_T():  a function returning the natural logarithm of the survival function S_T()*/
+  SurvivalPrior logS_;
 
-  /** A helper function that computes the logarithm of the prior probability assigned to the range [t0, t1) by the shiftd survival time prior*/
-  double shifted_logdF(double t1, double t0);
+  /** Incorporate a new detector output, whose likelihoods are given by 'likelihoods', obtained at time 'observation_time' (which has already been validated)*/
+  void update_likelihoods(double observation_time, const DetectorLikelihoods& likelihoods);
 
 
  public:
-  /** One argument-constructor accepting a function that returns the logarithm of the survival function S_T() for the survival time prior p_T().*/
- PersistenceFilter(const std::function<double(double)>& log_survival_function, double initialization_time = 0.0) : init_time_(initialization_time),  tN_(initialization_time), logpY_tN_(0.0), logLY_(boost::none), logpY_(0.0), logS_(log_survival_function)
-
-    {
-      // GO GO GADGET LAMBDA CALCULUS!!!
-      // A lambda function that we will use to shift observation and query times by the initialization time
-      auto time_shifter = [](double time, double time_shift){ return time - time_shift; };
-
-      // logS now
-      shifted_logS_ = std::bind(logS_, std::bind(time_shifter, std::placeholders::_1, init_time_));
-    }
+  /** One argument-constructor accepting the survival time prior p_T(), i.e. a function that returns the logarithm of the survival function S_T().*/
+ BasicPersistenceFilter(const SurvivalPrior& log_survival_function, double initialization_time = 0.0) : init_time_(initialization_time),  tN_(initialization_time), logS_tN_(0.0), logpY_tN_(0.0), logLY_(boost::none), logpY_(0.0), logS_(log_survival_function) {}
 
   /** Updates the filter by incorporating a new detector output.  Here 'detector_output' is a boolean value output by the detector indicating whether the given feature was detected, 'observation_time' is the timestamp for the detection, and 'P_M' and 'P_F' give the detector's missed detection and false alarm probabilities for this observation, respectively.*/
   void update(bool detector_output, double observation_time, double P_M, double P_F);
 
+  /** Updates the filter by incorporating a new detector output from a detector whose error rates are described by 'detector_model'.  This is equivalent to update(detector_output, observation_time, detector_model.P_M(), detector_model.P_F()), but uses the likelihoods precomputed by the model.*/
+  void update(bool detector_output, double observation_time, const DetectorModel& detector_model);
+
   /** Compute the posterior feature persistence time p(X_t = 1 | Y_{1:N}) at time t >= tN (the time of the last observation).*/
   double predict(double prediction_time) const;
 
+  /** Compute the posterior feature persistence probabilities at the 'num_times' times prediction_times[0], ..., prediction_times[num_times - 1] (each of which must be at least tN), writing the result for prediction_times[j] into beliefs[j].  This is equivalent to calling predict() at each time in turn, but evaluates the exponentials using the vectorized kernels in persistence_filter_simd.h.  All of the times are validated before any output is written.  'beliefs' may alias 'prediction_times'.*/
+  void predict_many(const double* prediction_times, size_t num_times, double* beliefs) const;
+
+  /** Vector form of predict_many().  'beliefs' is resized to match 'prediction_times'.*/
+  void predict_many(const std::vector<double>& prediction_times, std::vector<double>& beliefs) const
+  {
+    beliefs.resize(prediction_times.size());
+    if(!prediction_times.empty())
+      {
+	predict_many(&prediction_times[0], prediction_times.size(), &beliefs[0]);
+      }
+  }
+
   /** Return the function computing the logarithm of the survival function.*/
-  const std::function<double(double)>& logS() const
+  const SurvivalPrior& logS() const
     {
       return logS_;
     }
 
-  /** Return the function computing the logarithm of the shifted survival function*/
-  const std::function<double(double)>& shifted_logS() const
+  /** Compute the logarithm of the time-shifted survival function S_T(t - initialization_time)*/
+  double shifted_logS(double t) const
+  {
+    return logS_(t - init_time_);
+  }
+
+  /** Return a function computing the logarithm of the shifted survival function*/
+  std::function<double(double)> shifted_logS() const
     {
-      return shifted_logS_;
+      SurvivalPrior logS = logS_;
+      double init_time = init_time_;
+      return [logS, init_time](double t) { return logS(t - init_time); };
     }
 
   /** Return the time of the last observation*/
@@ -88,27 +126,186 @@ class PersistenceFilter
   /** Return the likelihood probability p(Y_{1:N} | T >= t_N)*/
   double likelihood() const
   {
-    return gsl_sf_exp(logpY_tN_);
+    return clamped_exp(logpY_tN_);
   }
 
   /** Return the evidence probability p(Y_{1:N})*/
   double evidence() const
   {
-    return gsl_sf_exp(logpY_);
+    return clamped_exp(logpY_);
   }
 
   /** Return the lower-sum probability L(Y_{1:N})*/
   double evidence_lower_sum() const
   {
     if(logLY_)
-      return gsl_sf_exp(*logLY_);
+      return clamped_exp(*logLY_);
     else
       return 0.0;
   }
 
 
   /** Nothing to do here*/
-  ~PersistenceFilter() {}
+  ~BasicPersistenceFilter() {}
 };
 
+
+/** The persistence filter with a type-erased survival time prior*/
+typedef BasicPersistenceFilter<LogSurvivalFunction> PersistenceFilter;
+
+/** The persistence filter with a reference to a type-erased survival time prior shared by many filters (which must outlive them).  Constructing one never allocates.*/
+typedef BasicPersistenceFilter<SurvivalPriorReference<LogSurvivalFunction> > SharedPriorPersistenceFilter;
+
+
+template<typename SurvivalPrior>
+void BasicPersistenceFilter<SurvivalPrior>::update(bool detector_output, double observation_time, double P_M, double P_F)
+{
+  PERSISTENCE_FILTER_INSTRUMENT_CALL(FILTER_UPDATE);
+
+  // Input checking:
+  if(observation_time < tN_)
+    {
+      throw std::domain_error("Current observation must be at least as recent as the last incorporated observation (observation_time >= last_observation_time)");
+    }
+
+  if( (P_M < 0) || (P_M > 1) )
+    {
+      throw std::domain_error("Probability of missed detection must be between 0 and 1");
+    }
+
+  if( (P_F < 0) || (P_F > 1) )
+    {
+      throw std::domain_error("Probability of false alarm must be between 0 and 1");
+    }
+
+  update_likelihoods(observation_time, DetectorLikelihoods::compute(detector_output, P_M, P_F));
+}
+
+template<typename SurvivalPrior>
+void BasicPersistenceFilter<SurvivalPrior>::update(bool detector_output, double observation_time, const DetectorModel& detector_model)
+{
+  PERSISTENCE_FILTER_INSTRUMENT_CALL(FILTER_UPDATE);
+
+  // Input checking (the model's error rates were validated when it was constructed):
+  if(observation_time < tN_)
+    {
+      throw std::domain_error("Current observation must be at least as recent as the last incorporated observation (observation_time >= last_observation_time)");
+    }
+
+  update_likelihoods(observation_time, detector_model.likelihoods(detector_output));
+}
+
+template<typename SurvivalPrior>
+void BasicPersistenceFilter<SurvivalPrior>::update_likelihoods(double observation_time, const DetectorLikelihoods& likelihoods)
+{
+  // We update the lower sum LY and the evidence pY according to the paper:
+  //
+  // L(Y_{1:N+1}) = [L(Y_{1:N}) + p(Y_{1:N} | t_N) (F_T(t_{N+1}) - F_T(t_N))] p(y_{N+1} | X = 0)
+  // p(Y_{1:N+1}) = L(Y_{1:N+1}) + p(Y_{1:N+1} | t_{N+1}) S_T(t_{N+1})
+  //
+  // Before the first observation, L(Y_{1:0}) = 0 and F_T(t_0) = 1 - S_T(0) = 0,
+  // so that L(Y_{1:1}) = p(y_1 | X = 0) (1 - S_T(t_1)); we represent this by
+  // taking log L(Y_{1:0}) = -infinity and log S_T(t_0) = 0.  The value of
+  // log S_T(t_N) was saved by the previous update, so each update evaluates
+  // the prior only once; fused_log_update() then evaluates both sums at once.
+  double logLY = logLY_ ? *logLY_ : -std::numeric_limits<double>::infinity();
+  double logS1 = shifted_logS(observation_time);
+  PERSISTENCE_FILTER_COUNT_FALLBACK_IF(!logLY_ && (logS1 < PERSISTENCE_FILTER_LOG_DBL_MIN), SURVIVAL_UNDERFLOW);
+  double log_ratio = log_survival_ratio(logS_, tN_ - init_time_, observation_time - init_time_, logS_tN_, logS1, 0);
+
+  double updated_logLY;
+  fused_log_update(logLY, logpY_tN_, logS_tN_, logS1, log_ratio, likelihoods, updated_logLY, logpY_);
+  logLY_ = updated_logLY;
+
+  // Postcondition:  At this point logLY is properly initialized.
+
+  //Update the measurement likelihood pY_tN
+  logpY_tN_ += likelihoods.log_present;
+
+  //Update the current observation time
+  tN_ = observation_time;
+  logS_tN_ = logS1;
+}
+ 
+template<typename SurvivalPrior>
+double BasicPersistenceFilter<SurvivalPrior>::predict(double prediction_time) const
+{
+  PERSISTENCE_FILTER_INSTRUMENT_CALL(FILTER_PREDICT);
+
+  // Input checking
+  if(prediction_time < tN_)
+    {
+      throw std::domain_error("Prediction time must be at least as recent as the last incorporated observation (prediction_time >= last_observation_time)");
+    }
+  
+  // If the exponential underflows, the posterior persistence probability is 0
+  double log_belief = logpY_tN_ - logpY_ + shifted_logS(prediction_time);
+  PERSISTENCE_FILTER_COUNT_FALLBACK_IF(log_belief < PERSISTENCE_FILTER_LOG_DBL_MIN, BELIEF_UNDERFLOW);
+  return clamped_exp(log_belief);
+}
+
+template<typename SurvivalPrior>
+void BasicPersistenceFilter<SurvivalPrior>::predict_many(const double* prediction_times, size_t num_times, double* beliefs) const
+{
+  PERSISTENCE_FILTER_INSTRUMENT_CALL(FILTER_PREDICT);
+
+  // Input checking
+  for(size_t j = 0; j < num_times; ++j)
+    {
+      if(prediction_times[j] < tN_)
+	{
+	  throw std::domain_error("Prediction time must be at least as recent as the last incorporated observation (prediction_time >= last_observation_time)");
+	}
+    }
+
+  // The log-likelihood ratio is the same at every prediction time
+  double log_ratio = logpY_tN_ - logpY_;
+  for(size_t j = 0; j < num_times; ++j)
+    {
+      beliefs[j] = log_ratio + shifted_logS(prediction_times[j]);
+      PERSISTENCE_FILTER_COUNT_FALLBACK_IF(beliefs[j] < PERSISTENCE_FILTER_LOG_DBL_MIN, BELIEF_UNDERFLOW);
+    }
+
+  exp_batch(beliefs, beliefs, num_times);
+}
+
+
+
+/** Runs 'filter' over an entire sequence of observations, evaluating its belief at a sequence of query times as it goes.  The i-th observation (for i = 0, ..., num_observations - 1) is detector output detector_outputs[i], obtained at time observation_times[i] with error rates P_M[i * P_M_stride] and P_F[i * P_F_stride] (so that a stride of 0 applies the same error rate to every observation).  Observation times and query times must both be nondecreasing.  For each query time, the posterior persistence probability given all of the observations made no later than that time is written to beliefs[j].  (This is the C++ counterpart of run_persistence_filter() in experiments/persistence_filter_test_utils.py.)*/
+template<typename SurvivalPrior>
+void run_persistence_filter(BasicPersistenceFilter<SurvivalPrior>& filter, size_t num_observations, const bool* detector_outputs, const double* observation_times, const double* P_M, size_t P_M_stride, const double* P_F, size_t P_F_stride, size_t num_queries, const double* query_times, double* beliefs)
+{
+  // Input checking
+  for(size_t j = 1; j < num_queries; ++j)
+    {
+      if(query_times[j] < query_times[j - 1])
+	{
+	  throw std::domain_error("Query times must be sorted in nondecreasing order");
+	}
+    }
+
+  size_t j = 0;
+  for(size_t i = 0; i < num_observations; ++i)
+    {
+      // PREDICT at the query times preceding this observation
+      for(; (j < num_queries) && (query_times[j] < observation_times[i]); ++j)
+	{
+	  beliefs[j] = filter.predict(query_times[j]);
+	}
+
+      // UPDATE
+      filter.update(detector_outputs[i], observation_times[i], P_M[i * P_M_stride], P_F[i * P_F_stride]);
+    }
+
+  // PREDICT at the query times following the last observation
+  for(; j < num_queries; ++j)
+    {
+      beliefs[j] = filter.predict(query_times[j]);
+    }
+}
+
+// PersistenceFilter and SharedPriorPersistenceFilter are explicitly instantiated in persistence_filter.cc
+extern template class BasicPersistenceFilter<LogSurvivalFunction>;
+extern template class BasicPersistenceFilter<SurvivalPriorReference<LogSurvivalFunction> >;
+
 #endif //__PERSISTENCE_FILTER_H__
@@ -0,0 +1,300 @@
+#ifndef __PERSISTENCE_FILTER_BANK_H__
+#define __PERSISTENCE_FILTER_BANK_H__
+
+#include <cstddef>
+#include <limits>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "persistence_filter_detector_model.h"
+#include "persistence_filter_math.h"
+#include "persistence_filter_priors.h"
+
+
+/** This class maintains a collection of persistence filters that share a
+ * single survival-time prior, one per map feature.  Rather than storing an
+ * array of PersistenceFilter objects (each of which carries its own copies of
+ * the log-survival function), the bank stores the state of every filter in a
+ * structure-of-arrays layout, so that per-feature storage is only a handful of
+ * doubles and sweeps over the entire map touch contiguous memory.
+ *
+ * Features are addressed by a user-supplied FeatureID.  Internally each
+ * feature occupies a "slot" in the state arrays; removing a feature only marks
+ * its slot as dead, and compact() squeezes out dead slots (invalidating slot
+ * indices, but not feature IDs).
+ */
+
+class PersistenceFilterBank
+{
+ public:
+
+  /** The type used to identify features stored in the bank*/
+  typedef uint64_t FeatureID;
+
+ protected:
+
+  /** The survival time prior p_T() shared by every filter in the bank:  a function returning the natural logarithm of the survival function S_T()*/
+  LogSurvivalFunction logS_;
+
+  /** The ID of the feature stored in each slot*/
+  std::vector<FeatureID> ids_;
+
+  /** Whether each slot currently holds a live feature (1) or a removed one (0)*/
+  std::vector<unsigned char> live_;
+
+  /** The absolute time (wall-time) at which each filter was initialized*/
+  std::vector<double> init_time_;
+
+  /** The time of the last observation for each filter*/
+  std::vector<double> tN_;
+
+  /** The natural logarithm of the shifted survival function S_T(t_N - init_time) at the time of the last observation for each filter (0 before the first observation), which the next update needs again*/
+  std::vector<double> logS_tN_;
+
+  /** The natural logarithm of the likelihood probability p(Y_{1:N} | t_N) for each filter*/
+  std::vector<double> logpY_tN_;
+
+  /** The natural logarithm of the lower evidence sum L(Y_{1:N}) for each filter.  Since L(Y_{1:0}) = 0, an uninitialized running sum is stored as -infinity.  Note that a lower sum may also vanish after observations have been incorporated (e.g. after a first observation at the initialization time, or a detection with P_F = 0), so -infinity alone does not mean that a filter has never been updated; see observed_.*/
+  std::vector<double> logLY_;
+
+  /** Whether each filter has incorporated at least one observation (1) or not (0); this plays the role of PersistenceFilter's boost::optional lower sum*/
+  std::vector<unsigned char> observed_;
+
+  /** The natural logarithm of the marginal (evidence) probability p(Y_{1:N}) for each filter*/
+  std::vector<double> logpY_;
+
+  /** A map from feature IDs to the slots holding their state*/
+  std::unordered_map<FeatureID, size_t> slots_;
+
+  /** Return the slot holding the state for feature 'id', throwing std::out_of_range if there is no such feature*/
+  size_t checked_slot(FeatureID id) const;
+
+  /** The time-shifted log-survival function log S_T(t - init_time) for the filter in slot 'slot'*/
+  double shifted_logS(size_t slot, double t) const
+  {
+    return logS_(t - init_time_[slot]);
+  }
+
+  /** Set observed_[slot] and logS_tN_[slot] for a filter in slot 'slot' whose state has just been restored from the quantities returned by the accessors.  These do not record whether the filter has been updated, so we infer it:  a filter has been updated if its last observation time has advanced, or if its lower sum is nonzero.  (A filter that has only incorporated observations at its initialization time is taken to be unobserved; this is harmless, since its state is then identical to that of an observed one, with log S_T(t_N) = log S_T(0) = 0.)*/
+  void restore_observed(size_t slot)
+  {
+    observed_[slot] = ( (tN_[slot] != init_time_[slot]) || (logLY_[slot] != -std::numeric_limits<double>::infinity()) ) ? 1 : 0;
+    logS_tN_[slot] = observed_[slot] ? shifted_logS(slot, tN_[slot]) : 0.0;
+  }
+
+  /** Incorporate a new detector output, whose likelihoods are given by 'likelihoods', obtained at time 'observation_time' (which has already been validated) into the filter stored in slot 'slot'*/
+  void update_slot_likelihoods(size_t slot, double observation_time, const DetectorLikelihoods& likelihoods);
+
+  /** Whether the batch operations memoize evaluations of the prior in a LogSurvivalCache (which is not worthwhile for exponential priors, whose evaluation is cheaper than a lookup)*/
+  bool cache_log_survival_;
+
+  /** Scratch storage for update_batch(), retained between calls to avoid reallocation*/
+  std::vector<size_t> batch_slots_;
+  std::vector<size_t> batch_sorted_slots_;
+  std::vector<double> batch_logLY_;
+  std::vector<double> batch_logpY_tN_;
+  std::vector<double> batch_logS0_;
+  std::vector<double> batch_logS1_;
+  std::vector<double> batch_log_ratio_;
+  std::vector<unsigned char> batch_detector_outputs_;
+
+  /** The implementation of update_batch(), templated on the container of detector outputs*/
+  template<typename DetectorOutputs>
+    void update_batch_impl(const FeatureID* ids, const DetectorOutputs& detector_outputs, size_t num_features, double observation_time, double P_M, double P_F);
+
+ public:
+
+  /** Constructor accepting the survival time prior p_T() shared by all filters in the bank, i.e. a function that returns the logarithm of the survival function S_T().*/
+  PersistenceFilterBank(const LogSurvivalFunction& log_survival_function) : logS_(log_survival_function), cache_log_survival_(log_survival_function.descriptor().kind != SurvivalPriorDescriptor::EXPONENTIAL) {}
+
+  /** Reserve storage for 'num_features' slots*/
+  void reserve(size_t num_features);
+
+  /** Add a new feature with ID 'id' whose filter is initialized at 'initialization_time'.  Throws std::invalid_argument if the bank already contains a feature with this ID.  Returns the slot holding the new filter's state.*/
+  size_t add(FeatureID id, double initialization_time = 0.0);
+
+  /** Add the 'num_features' features ids[0], ..., ids[num_features - 1], whose filters have the (previously saved) states given by the remaining arguments, which hold the same quantities as the accessors of the same names.  Throws std::invalid_argument (leaving the bank unmodified) if any of the IDs is repeated or already present.*/
+  void append(size_t num_features, const FeatureID* ids, const double* initialization_times, const double* last_observation_times, const double* log_likelihoods, const double* log_evidence_lower_sums, const double* log_evidences);
+
+  /** Remove the feature with ID 'id' from the bank.  Its slot is marked as dead until the next call to compact().  Returns false if there is no such feature.*/
+  bool remove(FeatureID id);
+
+  /** Squeeze out the slots of removed features, preserving the relative order of the remaining ones.  This invalidates any previously-obtained slot indices.*/
+  void compact();
+
+  /** Return true if the bank contains a feature with ID 'id'*/
+  bool contains(FeatureID id) const
+  {
+    return slots_.find(id) != slots_.end();
+  }
+
+  /** Return the slot holding the state of feature 'id'.  Throws std::out_of_range if there is no such feature.*/
+  size_t slot(FeatureID id) const
+  {
+    return checked_slot(id);
+  }
+
+  /** Return the number of live features in the bank*/
+  size_t size() const
+  {
+    return slots_.size();
+  }
+
+  /** Return the number of slots (live or dead) in the state arrays*/
+  size_t num_slots() const
+  {
+    return ids_.size();
+  }
+
+  /** Return true if slot 'slot' holds a live feature*/
+  bool is_live(size_t slot) const
+  {
+    return live_[slot] != 0;
+  }
+
+  /** Return the ID of the feature stored in slot 'slot'*/
+  FeatureID id(size_t slot) const
+  {
+    return ids_[slot];
+  }
+
+  /** Return the absolute time (wall-time) at which the filter stored in slot 'slot' was initialized*/
+  double initialization_time_slot(size_t slot) const
+  {
+    return init_time_[slot];
+  }
+
+  /** Return the time of the last observation incorporated by the filter stored in slot 'slot'*/
+  double last_observation_time_slot(size_t slot) const
+  {
+    return tN_[slot];
+  }
+
+  /** Return the natural logarithm of the likelihood p(Y_{1:N} | T >= t_N) for the filter stored in slot 'slot'*/
+  double log_likelihood_slot(size_t slot) const
+  {
+    return logpY_tN_[slot];
+  }
+
+  /** Return the natural logarithm of the lower-sum probability L(Y_{1:N}) for the filter stored in slot 'slot' (-infinity if the lower sum is zero, e.g. if it has not incorporated any observations)*/
+  double log_evidence_lower_sum_slot(size_t slot) const
+  {
+    return logLY_[slot];
+  }
+
+  /** Return true if the filter stored in slot 'slot' has incorporated at least one observation*/
+  bool is_observed(size_t slot) const
+  {
+    return observed_[slot] != 0;
+  }
+
+  /** Return the natural logarithm of the evidence p(Y_{1:N}) for the filter stored in slot 'slot'*/
+  double log_evidence_slot(size_t slot) const
+  {
+    return logpY_[slot];
+  }
+
+  /** Updates the filter for feature 'id' by incorporating a new detector output.  The arguments have the same meaning as in PersistenceFilter::update().*/
+  void update(FeatureID id, bool detector_output, double observation_time, double P_M, double P_F)
+  {
+    update_slot(checked_slot(id), detector_output, observation_time, P_M, P_F);
+  }
+
+  /** Updates the filter stored in slot 'slot' by incorporating a new detector output*/
+  void update_slot(size_t slot, bool detector_output, double observation_time, double P_M, double P_F);
+
+  /** Updates the filter for feature 'id' by incorporating a new detector output from a detector whose error rates are described by 'detector_model'.  The arguments have the same meaning as in the corresponding overload of PersistenceFilter::update().*/
+  void update(FeatureID id, bool detector_output, double observation_time, const DetectorModel& detector_model)
+  {
+    update_slot(checked_slot(id), detector_output, observation_time, detector_model);
+  }
+
+  /** Updates the filter stored in slot 'slot' by incorporating a new detector output from a detector whose error rates are described by 'detector_model'*/
+  void update_slot(size_t slot, bool detector_output, double observation_time, const DetectorModel& detector_model);
+
+  /** Overwrite the state of the filter stored in slot 'slot' with a previously saved state, given by arguments that hold the same quantities as the accessors of the same names (e.g. when replaying a PersistenceFilterJournal)*/
+  void set_state_slot(size_t slot, double last_observation_time, double log_likelihood, double log_evidence_lower_sum, double log_evidence)
+  {
+    tN_[slot] = last_observation_time;
+    logpY_tN_[slot] = log_likelihood;
+    logLY_[slot] = log_evidence_lower_sum;
+    logpY_[slot] = log_evidence;
+    restore_observed(slot);
+  }
+
+  /** Compute the posterior feature persistence probability p(X_t = 1 | Y_{1:N}) for feature 'id' at time t >= tN (the time of its last observation).*/
+  double predict(FeatureID id, double prediction_time) const
+  {
+    return predict_slot(checked_slot(id), prediction_time);
+  }
+
+  /** Compute the posterior feature persistence probability for the filter stored in slot 'slot'*/
+  double predict_slot(size_t slot, double prediction_time) const;
+
+  /** Updates the filters for the 'num_features' features ids[0], ..., ids[num_features - 1] by incorporating the detector outputs detector_outputs[0], ..., detector_outputs[num_features - 1], all of which were obtained at the same 'observation_time' with the same detector error rates P_M and P_F.  This is equivalent to calling update() on each feature in turn, but evaluates the fused log-domain update for the entire batch using the vectorized fused_log_update_batch() kernel in persistence_filter_simd.h, and evaluates the prior only once for each distinct elapsed time in the batch.  All inputs are validated before any filter is modified.*/
+  void update_batch(const FeatureID* ids, const bool* detector_outputs, size_t num_features, double observation_time, double P_M, double P_F);
+
+  /** Vector form of update_batch()*/
+  void update_batch(const std::vector<FeatureID>& ids, const std::vector<bool>& detector_outputs, double observation_time, double P_M, double P_F);
+
+  /** Compute the posterior feature persistence probabilities p(X_t = 1 | Y_{1:N}) at time 'prediction_time' for the 'num_features' features ids[0], ..., ids[num_features - 1], writing the result for ids[i] into beliefs[i].  This is equivalent to calling predict() on each feature in turn, but evaluates the exponentials using the vectorized kernels in persistence_filter_simd.h, and the prior only once for each distinct elapsed time.*/
+  void predict_batch(const FeatureID* ids, size_t num_features, double prediction_time, double* beliefs) const;
+
+  /** Vector form of predict_batch().  'beliefs' is resized to match 'ids'.*/
+  void predict_batch(const std::vector<FeatureID>& ids, double prediction_time, std::vector<double>& beliefs) const;
+
+  /** Compute the posterior feature persistence probabilities of the 'num_features' features ids[0], ..., ids[num_features - 1] at each of the 'num_times' times prediction_times[0], ..., prediction_times[num_times - 1], writing them into the row-major num_features x num_times matrix 'beliefs' (so that the belief of ids[i] at prediction_times[j] is beliefs[i * num_times + j]).  Every prediction time must be at least as recent as the last observation of every feature; all inputs are validated before any output is written.  As in predict_batch(), the exponentials are evaluated using the vectorized kernels in persistence_filter_simd.h, and the prior only once for each distinct elapsed time.*/
+  void predict_many(const FeatureID* ids, size_t num_features, const double* prediction_times, size_t num_times, double* beliefs) const;
+
+  /** Vector form of predict_many().  'beliefs' is resized to hold ids.size() x prediction_times.size() values.*/
+  void predict_many(const std::vector<FeatureID>& ids, const std::vector<double>& prediction_times, std::vector<double>& beliefs) const;
+
+  /** Compute the posterior feature persistence probability at time 'prediction_time' for every slot in the bank, writing the result for slot i into beliefs[i].  Dead slots, and slots whose last observation is more recent than 'prediction_time', receive NaN.  'beliefs' must have room for num_slots() values.*/
+  void predict_all(double prediction_time, double* beliefs) const;
+
+  /** Return the function computing the logarithm of the survival function.*/
+  const LogSurvivalFunction& logS() const
+    {
+      return logS_;
+    }
+
+  /** Return the time of the last observation of feature 'id'*/
+  double last_observation_time(FeatureID id) const
+  {
+    return tN_[checked_slot(id)];
+  }
+
+  /** Return the absolute time (wall-time) at which the filter for feature 'id' was initialized*/
+  double initialization_time(FeatureID id) const
+  {
+    return init_time_[checked_slot(id)];
+  }
+
+  /** Return the likelihood probability p(Y_{1:N} | T >= t_N) for feature 'id'*/
+  double likelihood(FeatureID id) const
+  {
+    return clamped_exp(logpY_tN_[checked_slot(id)]);
+  }
+
+  /** Return the evidence probability p(Y_{1:N}) for feature 'id'*/
+  double evidence(FeatureID id) const
+  {
+    return clamped_exp(logpY_[checked_slot(id)]);
+  }
+
+  /** Return the lower-sum probability L(Y_{1:N}) for feature 'id'*/
+  double evidence_lower_sum(FeatureID id) const
+  {
+    double logLY = logLY_[checked_slot(id)];
+    if(logLY == -std::numeric_limits<double>::infinity())
+      return 0.0;
+    else
+      return clamped_exp(logLY);
+  }
+
+  /** Nothing to do here*/
+  ~PersistenceFilterBank() {}
+};
+
+#endif //__PERSISTENCE_FILTER_BANK_H__
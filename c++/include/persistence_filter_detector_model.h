@@ -0,0 +1,152 @@
+#ifndef __PERSISTENCE_FILTER_DETECTOR_MODEL_H__
+#define __PERSISTENCE_FILTER_DETECTOR_MODEL_H__
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "persistence_filter_instrumentation.h"
+#include "persistence_filter_math.h"
+
+
+/** The likelihoods of a detector output under each hypothesis about a feature's persistence:  p(y | X = 1) and p(y | X = 0), together with their logarithms*/
+struct DetectorLikelihoods
+{
+  double present;  // p(y | X = 1)
+  double log_present;
+  double absent;  // p(y | X = 0)
+  double log_absent;
+
+  /** The likelihoods of detector output 'detector_output' for a detector with missed detection and false alarm probabilities P_M and P_F (which are not validated here)*/
+  static DetectorLikelihoods compute(bool detector_output, double P_M, double P_F)
+  {
+    DetectorLikelihoods likelihoods;
+    likelihoods.present = detector_output ? 1.0 - P_M : P_M;
+    likelihoods.absent = detector_output ? P_F : 1 - P_F;
+    likelihoods.log_present = std::log(likelihoods.present);
+    likelihoods.log_absent = std::log(likelihoods.absent);
+    return likelihoods;
+  }
+};
+
+
+/** A detector with fixed missed detection and false alarm probabilities P_M and P_F.  The likelihoods of both detector outputs (and their logarithms) are computed once, at construction, so that filters updated through a DetectorModel evaluate no logarithms of the error rates.*/
+class DetectorModel
+{
+ protected:
+  double P_M_;
+  double P_F_;
+
+  /** The likelihoods of the detector outputs false (0) and true (1)*/
+  DetectorLikelihoods likelihoods_[2];
+
+ public:
+  /** Construct the model of a detector with missed detection probability P_M and false alarm probability P_F.  Throws std::domain_error if either is not a probability.*/
+  DetectorModel(double P_M, double P_F) : P_M_(P_M), P_F_(P_F)
+    {
+      // Input checking
+      if( (P_M < 0) || (P_M > 1) )
+	{
+	  throw std::domain_error("Probability of missed detection must be between 0 and 1");
+	}
+
+      if( (P_F < 0) || (P_F > 1) )
+	{
+	  throw std::domain_error("Probability of false alarm must be between 0 and 1");
+	}
+
+      likelihoods_[0] = DetectorLikelihoods::compute(false, P_M, P_F);
+      likelihoods_[1] = DetectorLikelihoods::compute(true, P_M, P_F);
+    }
+
+  /** Return the likelihoods of detector output 'detector_output'*/
+  const DetectorLikelihoods& likelihoods(bool detector_output) const
+  {
+    return likelihoods_[detector_output ? 1 : 0];
+  }
+
+  double P_M() const
+  {
+    return P_M_;
+  }
+
+  double P_F() const
+  {
+    return P_F_;
+  }
+};
+
+
+/** One step of the persistence filter recursion, in the log domain.  Given the logarithms of a filter's lower evidence sum L(Y_{1:N}) ('logLY', -infinity before the first observation), its likelihood p(Y_{1:N} | t_N) ('logpY_tN'), and the shifted survival function at the last and current observation times ('logS0' = log S_T(t_N), which is 0 before the first observation, and 'logS1' = log S_T(t_{N+1})), together with log_ratio = log(S_T(t_{N+1}) / S_T(t_N)) and the likelihoods of the new detector output, this computes the updated lower sum
+ *
+ *   log L(Y_{1:N+1}) = log[L(Y_{1:N}) + p(Y_{1:N} | t_N) (S_T(t_N) - S_T(t_{N+1}))] + log p(y | X = 0)
+ *
+ * and evidence
+ *
+ *   log p(Y_{1:N+1}) = log[L(Y_{1:N+1}) + p(Y_{1:N} | t_N) p(y | X = 1) S_T(t_{N+1})].
+ *
+ * (The updated likelihood is simply logpY_tN + log p(y | X = 1).)  Computed
+ * separately, the interval mass, the lower sum and the evidence take one
+ * logdiff() and two logsum() calls, six transcendental functions in all.
+ * Here all three terms are scaled by the larger of L(Y_{1:N}) and
+ * p(Y_{1:N} | t_N) S_T(t_N), so that a single exp() (or expm1()) of the log
+ * ratio yields both S_T(t_{N+1}) / S_T(t_N) and the interval mass
+ * 1 - S_T(t_{N+1}) / S_T(t_N) to full relative precision, and the update
+ * takes four transcendental functions.  If the scaled sums underflow (or
+ * the filter's probabilities are degenerate), the update is recomputed with
+ * logsum().*/
+inline void fused_log_update(double logLY, double logpY_tN, double logS0, double logS1, double log_ratio, const DetectorLikelihoods& likelihoods, double& updated_logLY, double& updated_logpY)
+{
+  // S_T(t_{N+1}) / S_T(t_N) and 1 - S_T(t_{N+1}) / S_T(t_N), each to full relative precision
+  // (The ratio is NaN if the prior is, or if S_T(t_N) = S_T(t_{N+1}) = 0; we then skip straight to the fallback below.)
+  double ratio, mass;
+  bool nan_ratio = std::isnan(log_ratio);
+  if(log_ratio > 0)
+    log_ratio = 0;
+  if(log_ratio > -0.69314718055994530942)
+    {
+      mass = -std::expm1(log_ratio);
+      ratio = 1 - mass;
+    }
+  else
+    {
+      ratio = std::exp(log_ratio);
+      mass = 1 - ratio;
+    }
+
+  // Scale by the larger of L(Y_{1:N}) and p(Y_{1:N} | t_N) S_T(t_N)
+  double log_upper = logpY_tN + logS0;
+  double log_scale, lower_sum, upper;
+  if(logLY >= log_upper)
+    {
+      log_scale = logLY;
+      upper = std::exp(log_upper - logLY);
+      lower_sum = 1 + upper * mass;
+    }
+  else
+    {
+      log_scale = log_upper;
+      upper = 1;
+      lower_sum = std::exp(logLY - log_upper) + mass;
+    }
+  double evidence = lower_sum * likelihoods.absent + upper * ratio * likelihoods.present;
+
+  bool fallback = nan_ratio || !( (lower_sum >= std::numeric_limits<double>::min()) && (evidence >= std::numeric_limits<double>::min()) && std::isfinite(log_scale) );
+  PERSISTENCE_FILTER_COUNT_FALLBACK_IF(fallback, FUSED_UPDATE_UNSCALED);
+  if(!fallback)
+    {
+      updated_logLY = log_scale + std::log(lower_sum) + likelihoods.log_absent;
+      updated_logpY = log_scale + std::log(evidence);
+    }
+  else
+    {
+      // log p(Y_{1:N} | t_N) + log(S_T(t_N) - S_T(t_{N+1})), which is -infinity whenever p(Y_{1:N} | t_N) S_T(t_N) = 0
+      // (in particular when S_T(t_N) = S_T(t_{N+1}) = 0, whose ratio is undefined)
+      double log_interval = (log_upper == -std::numeric_limits<double>::infinity()) ? -std::numeric_limits<double>::infinity() : log_upper + std::log(mass);
+
+      updated_logLY = logsum(logLY, log_interval) + likelihoods.log_absent;
+      updated_logpY = logsum(updated_logLY, logpY_tN + likelihoods.log_present + logS1);
+    }
+}
+
+#endif //__PERSISTENCE_FILTER_DETECTOR_MODEL_H__
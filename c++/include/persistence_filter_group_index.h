@@ -0,0 +1,335 @@
+#ifndef __PERSISTENCE_FILTER_GROUP_INDEX_H__
+#define __PERSISTENCE_FILTER_GROUP_INDEX_H__
+
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "persistence_filter_bank.h"
+
+
+/** This class maintains summaries of the beliefs of groups of features in a
+ * PersistenceFilterBank (e.g. the features in a spatial region, or of a
+ * semantic class), so that aggregate queries such as "the expected number of
+ * features in region R that persist at time t" or "the features of class C
+ * whose beliefs exceed p" can be answered without predicting every member.
+ *
+ * Between observations, the belief for feature i is
+ *
+ *   p(X_t = 1 | Y_{1:N}) = c_i S_T(t - t_init,i),   c_i = p(Y_{1:N} | t_N) / p(Y_{1:N}),
+ *
+ * where the coefficient c_i is fixed until the feature's next update.  Each
+ * group therefore partitions its members into cohorts by their exact
+ * initialization times:  the members of a cohort share the factor
+ * S_T(t - t_init), so the cohort's expected count at any time t >= t_N is
+ * S_T(t - t_init) times the sum of its coefficients, and the ordering of its
+ * members' beliefs does not change with t.  Each cohort keeps this sum
+ * (relative to its largest coefficient, so that it neither overflows nor loses
+ * precision when the survival function is small) together with its smallest
+ * and largest coefficients, from which
+ *
+ *  - expected_count() is the exact sum of the members' beliefs, with one evaluation of the survival function per cohort,
+ *  - belief_bounds() are the beliefs of the extreme members, and
+ *  - crossing_time() is the time at which the least-believed member's belief falls below a threshold.
+ *
+ * (When features are initialized at a common set of times, such as the frames
+ * of a detection log, the number of cohorts is independent of the number of
+ * features.)
+ *
+ * The cohorts are in turn indexed by a fixed array of num_buckets() buckets
+ * per group, allocated when the group is created, each covering an interval
+ * of initialization times of width time_quantum().  Each bucket records the
+ * extreme coefficients and initialization times of its cohorts, which bound
+ * the beliefs of all of their members at once; belief_bounds(),
+ * features_above() and crossing_time() use these bounds to skip every bucket
+ * that cannot affect their results, and examine the cohorts of the rest.  If a
+ * feature's initialization time falls outside the span of the buckets, the
+ * quantum is doubled (and the bucket bounds recomputed from the cohorts) until
+ * every cohort fits.  The quantization affects only which cohorts a query
+ * examines, never its result.
+ *
+ * Groups form a forest:  each group may have a parent group (e.g. a room
+ * within a building), and a feature assigned to a group also contributes to
+ * the cohorts and buckets of all of that group's ancestors, so that queries at
+ * any level of the hierarchy cost the same.  Each feature is stored only in
+ * the group to which it is assigned.  After updating a feature in the bank,
+ * call update() to replace its contributions, which takes O(d log N) time
+ * (where d is the depth of its group in the hierarchy), plus time
+ * proportional to the number of child groups, or to the number of cohorts in a
+ * bucket, along the way when it was one of the extreme members of a cohort or
+ * bucket.
+ *
+ * All of the queries describe the group at times t that are no earlier than
+ * the last observation of any of its members (the group's
+ * latest_observation_time()), where every member's belief is given by the
+ * formula above.
+ */
+
+class PersistenceGroupIndex
+{
+ public:
+
+  /** The type used to identify features*/
+  typedef PersistenceFilterBank::FeatureID FeatureID;
+
+  /** The type used to identify groups*/
+  typedef uint64_t GroupID;
+
+  /** The default number of buckets per group*/
+  static const size_t DEFAULT_NUM_BUCKETS = 64;
+
+ protected:
+
+  /** A summary of the members of a group that share an initialization time*/
+  struct Cohort
+  {
+    /** The number of members*/
+    size_t count;
+
+    /** The logarithm of the scale relative to which the coefficients are summed (at least the largest coefficient since the sum was last recomputed)*/
+    double log_scale;
+
+    /** The sum of c_i / exp(log_scale) over the members*/
+    double sum;
+
+    /** The logarithms of the smallest and largest coefficients*/
+    double min_log_coefficient;
+    double max_log_coefficient;
+  };
+
+  /** Bounds on the cohorts of a group whose initialization times fall in one quantum*/
+  struct Bucket
+  {
+    /** The number of members of these cohorts*/
+    size_t count;
+
+    /** The logarithms of the smallest and largest coefficients of any member*/
+    double min_log_coefficient;
+    double max_log_coefficient;
+
+    /** The earliest and latest initialization times of any member*/
+    double earliest_initialization_time;
+    double latest_initialization_time;
+  };
+
+  /** A member of a group, ordered by initialization time and then by coefficient*/
+  struct Member
+  {
+    double initialization_time;
+    double log_coefficient;
+    FeatureID id;
+
+    bool operator<(const Member& other) const
+    {
+      if(initialization_time != other.initialization_time)
+	return initialization_time < other.initialization_time;
+      if(log_coefficient != other.log_coefficient)
+	return log_coefficient < other.log_coefficient;
+      return id < other.id;
+    }
+  };
+
+  struct Group
+  {
+    bool has_parent;
+    GroupID parent;
+    std::vector<GroupID> children;
+
+    /** The cohorts of this group's and its descendants' members, keyed by initialization time*/
+    std::map<double, Cohort> cohorts;
+
+    /** The cohorts of the members assigned directly to this group, keyed by initialization time*/
+    std::map<double, Cohort> own_cohorts;
+
+    /** Bounds on 'cohorts', one per bucket*/
+    std::vector<Bucket> buckets;
+
+    /** The members assigned directly to this group*/
+    std::set<Member> members;
+
+    /** The last observation times of the members assigned directly to this group*/
+    std::multiset<double> observation_times;
+
+    /** The number of features assigned to this group or its descendants*/
+    size_t size;
+
+    /** The latest last observation time of any feature assigned to this group or its descendants*/
+    double latest_observation_time;
+  };
+
+  struct Membership
+  {
+    GroupID group;
+    double initialization_time;
+    double last_observation_time;
+
+    /** log c_i, as of the feature's last update*/
+    double log_coefficient;
+  };
+
+  /** The bank whose features are grouped*/
+  const PersistenceFilterBank& bank_;
+
+  /** The width of a bucket of initialization times*/
+  double time_quantum_;
+
+  /** The number of buckets per group*/
+  size_t num_buckets_;
+
+  /** The index floor(t_init / time_quantum_) of the quantum covered by bucket 0*/
+  double first_quantum_;
+
+  std::unordered_map<GroupID, Group> groups_;
+
+  /** The group and current contribution of each assigned feature*/
+  std::unordered_map<FeatureID, Membership> memberships_;
+
+  /** Return the group with ID 'group', throwing std::out_of_range if there is none*/
+  Group& checked_group(GroupID group);
+  const Group& checked_group(GroupID group) const;
+
+  /** Return the bucket covering 'initialization_time' (which must lie in the span of the buckets)*/
+  size_t bucket_of(double initialization_time) const
+  {
+    return static_cast<size_t>(std::floor(initialization_time / time_quantum_) - first_quantum_);
+  }
+
+  /** Return the first of 'cohorts' whose bucket is 'bucket' or later*/
+  std::map<double, Cohort>::const_iterator first_cohort(const std::map<double, Cohort>& cohorts, size_t bucket) const;
+
+  /** Coarsen the quantum (and recompute every group's buckets) if the buckets do not cover 'initialization_time'*/
+  void cover(double initialization_time);
+
+  /** Compute the current contribution of feature 'id' from its state in the bank*/
+  Membership compute_membership(FeatureID id, GroupID group) const;
+
+  /** Add (or remove) the contribution of 'membership' of feature 'id' to the summaries of its group and all of that group's ancestors*/
+  void insert_contribution(FeatureID id, const Membership& membership);
+  void erase_contribution(FeatureID id, const Membership& membership);
+
+  /** Return the summary of a cohort with no members*/
+  static Cohort empty_cohort();
+
+  /** Add a member with coefficient exp(log_coefficient) to 'cohort'*/
+  static void add_to_cohort(Cohort& cohort, double log_coefficient);
+
+  /** Add the members summarized by 'from' to the summary 'into'*/
+  static void merge_cohort(Cohort& into, const Cohort& from);
+
+  /** Return the bounds of a bucket with no members*/
+  static Bucket empty_bucket();
+
+  /** Add the members of 'cohort', initialized at 'initialization_time', to the bounds 'bucket'*/
+  static void add_to_bucket(Bucket& bucket, double initialization_time, const Cohort& cohort);
+
+  /** Recompute the cohort of 'group' initialized at 'initialization_time' from its own members' cohort and its children's cohorts, erasing it if it has no members*/
+  void recompute_cohort(Group& group, double initialization_time);
+
+  /** Recompute the bounds of bucket 'bucket' of 'group' from its cohorts*/
+  void recompute_bucket(Group& group, size_t bucket) const;
+
+  /** Recompute the latest observation time of 'group' from its own members and its children*/
+  void recompute_latest_observation_time(Group& group);
+
+  /** Recompute the sum of the cohort of the members assigned directly to 'group' at 'initialization_time', relative to its largest coefficient*/
+  static void rescale_own_cohort(Group& group, double initialization_time);
+
+  /** Throw std::domain_error if 'prediction_time' precedes the last observation of a member of 'group'*/
+  static void check_prediction_time(const Group& group, double prediction_time);
+
+ public:
+
+  /** Constructor accepting the bank whose features are to be grouped (which must outlive the index), the initial width 'time_quantum' of a bucket of initialization times, and the number of buckets per group.  The index initially contains no groups.  Throws std::domain_error if the quantum is not positive or there are no buckets.*/
+  PersistenceGroupIndex(const PersistenceFilterBank& bank, double time_quantum = 1.0, size_t num_buckets = DEFAULT_NUM_BUCKETS);
+
+  /** Create a new top-level group with ID 'group'.  Throws std::invalid_argument if the group already exists.*/
+  void add_group(GroupID group);
+
+  /** Create a new group with ID 'group' as a child of the existing group 'parent'.  Throws std::invalid_argument if the group already exists, and std::out_of_range if the parent does not.*/
+  void add_group(GroupID group, GroupID parent);
+
+  /** Assign feature 'id' (which must be live in the bank) to group 'group', moving it from its current group if it has one.  Throws std::out_of_range if either the feature or the group does not exist.*/
+  void assign(FeatureID id, GroupID group);
+
+  /** Recompute the contribution of feature 'id' to its group's summaries; call this after updating the feature in the bank.  Throws std::out_of_range if the feature has not been assigned to a group.*/
+  void update(FeatureID id);
+
+  /** Call update() for each of the 'num_features' features ids[0], ..., ids[num_features - 1] that has been assigned to a group (e.g. after PersistenceFilterBank::update_batch())*/
+  void update_batch(const FeatureID* ids, size_t num_features);
+
+  /** Remove feature 'id' from its group; returns false if it was not assigned to one.  Call this before (or after) removing the feature from the bank.*/
+  bool remove(FeatureID id);
+
+  /** Return the expected number of features in group 'group' (and its descendants) that persist at time 'prediction_time', i.e. the sum of their posterior persistence probabilities p(X_t = 1 | Y_{1:N}).  Throws std::domain_error if 'prediction_time' precedes the group's latest observation time.*/
+  double expected_count(GroupID group, double prediction_time) const;
+
+  /** Compute the smallest and largest posterior persistence probabilities at time 'prediction_time' of the features in group 'group' (and its descendants).  Returns false (leaving 'lower' and 'upper' unchanged) if the group has no members.  Throws std::domain_error if 'prediction_time' precedes the group's latest observation time.*/
+  bool belief_bounds(GroupID group, double prediction_time, double& lower, double& upper) const;
+
+  /** Append to 'features' the IDs of the features in group 'group' (and its descendants) whose posterior persistence probabilities at time 'prediction_time' exceed 'threshold', returning their number.  This takes time proportional to the number of groups in the hierarchy below 'group', the number of buckets, the number of cohorts in the buckets whose bounds admit such features, and the number of features returned.  Throws std::domain_error if 'prediction_time' precedes the group's latest observation time.*/
+  size_t features_above(GroupID group, double prediction_time, double threshold, std::vector<FeatureID>& features) const;
+
+  /** Return the earliest time t >= 'prediction_time' at which the posterior persistence probability of any feature in group 'group' (or its descendants) is below 'threshold', computed to within a relative tolerance of 'tolerance' (see inverse_log_survival()), or +infinity if there is no such time.  Throws std::domain_error if 'prediction_time' precedes the group's latest observation time, or if the threshold is not in (0, 1].*/
+  double crossing_time(GroupID group, double threshold, double prediction_time, double tolerance = 1e-9) const;
+
+  /** Return the latest last observation time of any feature currently assigned to group 'group' or its descendants (-infinity if there is none)*/
+  double latest_observation_time(GroupID group) const
+  {
+    return checked_group(group).latest_observation_time;
+  }
+
+  /** Return the number of features in group 'group' and its descendants*/
+  size_t group_size(GroupID group) const
+  {
+    return checked_group(group).size;
+  }
+
+  /** Return the number of distinct initialization times of the features in group 'group' and its descendants (the number of survival function evaluations made by expected_count())*/
+  size_t num_cohorts(GroupID group) const
+  {
+    return checked_group(group).cohorts.size();
+  }
+
+  /** Return the number of buckets per group*/
+  size_t num_buckets() const
+  {
+    return num_buckets_;
+  }
+
+  /** Return the current width of a bucket of initialization times*/
+  double time_quantum() const
+  {
+    return time_quantum_;
+  }
+
+  /** Return the group to which feature 'id' is assigned, throwing std::out_of_range if it has not been assigned to one*/
+  GroupID group(FeatureID id) const;
+
+  /** Return true if the group with ID 'group' exists*/
+  bool contains_group(GroupID group) const
+  {
+    return groups_.find(group) != groups_.end();
+  }
+
+  /** Return true if feature 'id' has been assigned to a group*/
+  bool contains(FeatureID id) const
+  {
+    return memberships_.find(id) != memberships_.end();
+  }
+
+  /** Return the number of features assigned to groups*/
+  size_t size() const
+  {
+    return memberships_.size();
+  }
+
+  /** Nothing to do here*/
+  ~PersistenceGroupIndex() {}
+};
+
+#endif //__PERSISTENCE_FILTER_GROUP_INDEX_H__
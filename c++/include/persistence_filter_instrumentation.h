@@ -0,0 +1,191 @@
+#ifndef __PERSISTENCE_FILTER_INSTRUMENTATION_H__
+#define __PERSISTENCE_FILTER_INSTRUMENTATION_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <stdint.h>
+
+
+/** Optional instrumentation of the library's hot paths.
+ *
+ * When the library is built with PERSISTENCE_FILTER_INSTRUMENTATION defined
+ * (the CMake option of the same name), it records:
+ *
+ * - the number of calls to each of its main entry points,
+ *
+ * - the number of times each numerical fallback is taken (e.g. switching to
+ *   the asymptotic expansion of E1, or a belief that underflows to 0), and
+ *
+ * - for a sample of the calls to each entry point (one in
+ *   sampling_period()), the latency of the call, in a histogram with
+ *   logarithmically-spaced buckets.
+ *
+ * Each thread records into its own counters (which only that thread
+ * modifies, so recording requires no atomic read-modify-write operations or
+ * locks); report() sums the counters of every thread on demand.  The counts
+ * of threads that have exited are retained.
+ *
+ * When PERSISTENCE_FILTER_INSTRUMENTATION is not defined, the recording
+ * macros below expand to nothing, so the instrumentation costs nothing; the
+ * reporting functions remain available, and report zeros.  (The macro must be
+ * defined consistently for the library and for any client code that
+ * instantiates its templates.)
+ */
+
+class PersistenceFilterInstrumentation
+{
+ public:
+
+  /** The instrumented entry points*/
+  enum EntryPoint
+  {
+    FILTER_UPDATE,  // BasicPersistenceFilter::update()
+    FILTER_PREDICT,  // BasicPersistenceFilter::predict() and predict_many() (one call per batch)
+    BANK_UPDATE,  // PersistenceFilterBank::update() and update_slot()
+    BANK_PREDICT,  // PersistenceFilterBank::predict() and predict_slot()
+    BANK_UPDATE_BATCH,  // PersistenceFilterBank::update_batch() (one call per batch)
+    BANK_PREDICT_BATCH,  // PersistenceFilterBank::predict_batch(), predict_many() and predict_all() (one call per batch)
+    GENERAL_PURPOSE_SURVIVAL_FUNCTION,  // log_general_purpose_survival_function()
+    NUM_ENTRY_POINTS
+  };
+
+  /** The numerical fallbacks*/
+  enum Fallback
+  {
+    E1_ASYMPTOTIC_EXPANSION,  // E1(x) evaluated by its asymptotic expansion rather than by GSL, since it would underflow
+    SURVIVAL_UNDERFLOW,  // S_T(t_1) underflowed when incorporating a filter's first observation, so log(1 - S_T(t_1)) = 0
+    BELIEF_UNDERFLOW,  // A posterior persistence probability underflowed to 0
+    DEGENERATE_LOG_ARITHMETIC,  // logsum() or logdiff() received two zero probabilities (or a NaN), and returned the larger argument
+    BANK_BATCH_SEQUENTIAL,  // A PersistenceFilterBank batch update contained repeated features, and was applied sequentially
+    FUSED_UPDATE_UNSCALED,  // fused_log_update()'s scaled sums underflowed (or were degenerate), and the update was recomputed with logsum()
+    NUM_FALLBACKS
+  };
+
+  /** The number of latency histogram buckets; bucket k counts sampled calls taking [2^k, 2^{k+1}) nanoseconds (with bucket 0 also counting calls taking less than 1 ns)*/
+  static const size_t NUM_LATENCY_BUCKETS = 40;
+
+  /** The aggregated counts of all threads*/
+  struct Report
+  {
+    uint64_t calls[NUM_ENTRY_POINTS];
+    uint64_t fallbacks[NUM_FALLBACKS];
+    uint64_t latency_histogram[NUM_ENTRY_POINTS][NUM_LATENCY_BUCKETS];
+
+    /** Return the number of calls to 'entry_point' whose latency was sampled*/
+    uint64_t num_samples(EntryPoint entry_point) const;
+
+    /** Return an upper bound (in nanoseconds, accurate to within a factor of 2) on the q-th quantile of the sampled latencies of 'entry_point', or 0 if there are no samples*/
+    double latency_quantile(EntryPoint entry_point, double q) const;
+
+    /** Write a human-readable summary of the report*/
+    void write(std::ostream& out) const;
+  };
+
+  /** The counters of a single thread*/
+  struct ThreadCounters
+  {
+    std::atomic<uint64_t> calls[NUM_ENTRY_POINTS];
+    std::atomic<uint64_t> fallbacks[NUM_FALLBACKS];
+    std::atomic<uint64_t> latency_histogram[NUM_ENTRY_POINTS][NUM_LATENCY_BUCKETS];
+  };
+
+  /** Return true if the library was built with instrumentation enabled*/
+  static bool enabled();
+
+  /** Return the aggregated counts of all threads*/
+  static Report report();
+
+  /** Reset all counts to zero.  (Counts recorded concurrently by other threads may be lost.)*/
+  static void reset();
+
+  /** Return (or set) the latency sampling period:  one in every 'period' calls to each entry point (per thread) is timed.  The period must be a power of 2 (default 64).*/
+  static uint64_t sampling_period();
+  static void set_sampling_period(uint64_t period);
+
+  /** Return the names of entry points and fallbacks*/
+  static const char* name(EntryPoint entry_point);
+  static const char* name(Fallback fallback);
+
+  /// RECORDING (used through the macros below)
+
+  /** Return the calling thread's counters, creating them on first use*/
+  static ThreadCounters& thread_counters()
+  {
+    ThreadCounters* counters = thread_counters_;
+    return counters ? *counters : register_thread();
+  }
+
+  /** Increment a counter that is only modified by the calling thread*/
+  static uint64_t increment(std::atomic<uint64_t>& counter)
+  {
+    uint64_t value = counter.load(std::memory_order_relaxed) + 1;
+    counter.store(value, std::memory_order_relaxed);
+    return value;
+  }
+
+  static void count(Fallback fallback)
+  {
+    increment(thread_counters().fallbacks[fallback]);
+  }
+
+  /** Counts a call to an entry point, and times it if it is sampled*/
+  class ScopedCall
+  {
+   protected:
+    ThreadCounters& counters_;
+    EntryPoint entry_point_;
+    bool sampled_;
+    std::chrono::steady_clock::time_point start_;
+
+   public:
+    ScopedCall(EntryPoint entry_point) : counters_(thread_counters()), entry_point_(entry_point)
+    {
+      sampled_ = (increment(counters_.calls[entry_point]) & (sampling_period_.load(std::memory_order_relaxed) - 1)) == 0;
+      if(sampled_)
+	{
+	  start_ = std::chrono::steady_clock::now();
+	}
+    }
+
+    ~ScopedCall()
+    {
+      if(sampled_)
+	{
+	  record_latency(counters_, entry_point_, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count());
+	}
+    }
+
+   private:
+    ScopedCall(const ScopedCall&);
+    ScopedCall& operator=(const ScopedCall&);
+  };
+
+ protected:
+  struct ThreadRegistration;
+
+  static thread_local ThreadCounters* thread_counters_;
+  static std::atomic<uint64_t> sampling_period_;
+
+  static ThreadCounters& register_thread();
+  static void record_latency(ThreadCounters& counters, EntryPoint entry_point, int64_t nanoseconds);
+};
+
+
+#ifdef PERSISTENCE_FILTER_INSTRUMENTATION
+
+/** Count (and sample the latency of) the enclosing call to 'entry_point'*/
+#define PERSISTENCE_FILTER_INSTRUMENT_CALL(entry_point) PersistenceFilterInstrumentation::ScopedCall persistence_filter_scoped_call_(PersistenceFilterInstrumentation::entry_point)
+
+/** Count the numerical fallback 'fallback' if 'condition' holds.  (The condition is not evaluated when instrumentation is disabled.)*/
+#define PERSISTENCE_FILTER_COUNT_FALLBACK_IF(condition, fallback) do { if(condition) PersistenceFilterInstrumentation::count(PersistenceFilterInstrumentation::fallback); } while(0)
+
+#else
+
+#define PERSISTENCE_FILTER_INSTRUMENT_CALL(entry_point) do {} while(0)
+#define PERSISTENCE_FILTER_COUNT_FALLBACK_IF(condition, fallback) do {} while(0)
+
+#endif
+
+#endif //__PERSISTENCE_FILTER_INSTRUMENTATION_H__
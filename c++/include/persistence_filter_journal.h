@@ -0,0 +1,178 @@
+#ifndef __PERSISTENCE_FILTER_JOURNAL_H__
+#define __PERSISTENCE_FILTER_JOURNAL_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "persistence_filter_bank.h"
+
+
+/** An append-only journal of the changes made to a PersistenceFilterBank,
+ * which together with a base snapshot (see persistence_filter_snapshot.h)
+ * allows the bank to be recovered after a crash without rewriting its entire
+ * state on every update.
+ *
+ * A journal file consists of a 32-byte header followed by fixed-size 48-byte
+ * records, each holding a feature ID, the kind of change, a checksum, and
+ * (for additions and updates) the feature's complete filter state after the
+ * change:
+ *
+ *   last_observation_time    double    t_N (for an addition, the initialization time)
+ *   log_likelihood           double    log p(Y_{1:N} | t_N)
+ *   log_evidence_lower_sum   double    log L(Y_{1:N}) (-infinity before the first observation)
+ *   log_evidence             double    log p(Y_{1:N})
+ *
+ * Since every record carries absolute state rather than a detector output,
+ * replaying a record never re-runs the filter recursion, and replaying any
+ * suffix of the journal over a state that already reflects the records
+ * preceding it yields the same final state.
+ *
+ * Records are buffered in memory and written in groups (group commit):  the
+ * buffer is written with a single system call (followed by fdatasync(), if the
+ * journal is synchronous) whenever it fills, or when commit() is called, so
+ * logging an update costs only a copy into the buffer.  Records that have not
+ * yet been committed are lost in a crash.  checkpoint() compacts the journal
+ * by saving the bank to a snapshot and then truncating the journal, so that
+ * recovery (restoring the snapshot and then calling replay()) takes time
+ * proportional to the changes made since the last checkpoint, rather than
+ * to the history of the map.
+ *
+ * Numbers are stored in the byte order of the machine that wrote the file;
+ * the header records this so that a mismatch is detected on opening.  Every
+ * change to the bank must be logged for the journal to reproduce it.
+ */
+
+
+/** The current version of the journal file format*/
+#define PERSISTENCE_FILTER_JOURNAL_VERSION 1
+
+/** The layout of the header at the start of each journal file*/
+struct PersistenceFilterJournalHeader
+{
+  char magic[8];  // "PFJRNL\r\n"
+  uint32_t version;  // PERSISTENCE_FILTER_JOURNAL_VERSION
+  uint32_t byte_order;  // 0x01020304, as written by the producing machine
+  uint32_t record_size;  // sizeof(PersistenceFilterJournalRecord)
+  uint32_t reserved;
+  uint64_t reserved2;
+};
+
+/** The layout of each record in a journal file*/
+struct PersistenceFilterJournalRecord
+{
+  /** The kinds of change recorded in a journal (0 is never a valid kind, so that zero-filled space is not mistaken for a record)*/
+  enum Kind
+  {
+    ADD = 1,
+    UPDATE = 2,
+    REMOVE = 3
+  };
+
+  uint64_t id;
+  uint32_t kind;  // A Kind
+  uint32_t checksum;  // A hash of the other fields, with which torn writes are detected
+  double last_observation_time;
+  double log_likelihood;
+  double log_evidence_lower_sum;
+  double log_evidence;
+};
+
+
+class PersistenceFilterJournal
+{
+ public:
+
+  /** The type used to identify features*/
+  typedef PersistenceFilterBank::FeatureID FeatureID;
+
+  typedef PersistenceFilterJournalRecord Record;
+
+ protected:
+
+  std::string filename_;
+
+  /** The open journal file*/
+  int fd_;
+
+  /** Records that have been logged but not yet written*/
+  std::vector<Record> buffer_;
+
+  /** The number of records buffered before they are committed automatically*/
+  size_t group_size_;
+
+  /** Whether commit() waits until the records are durably stored*/
+  bool sync_;
+
+  /** The number of records written to the file*/
+  size_t num_committed_;
+
+  /** Append a record describing the state of the filter in slot 'slot' of 'bank'*/
+  void log_state(Record::Kind kind, const PersistenceFilterBank& bank, size_t slot);
+
+  /** Append 'record' (whose checksum is computed here) to the buffer, committing the group if it is full*/
+  void push(Record& record);
+
+  /** Write 'size' bytes from 'data' to the end of the file, throwing std::runtime_error on failure*/
+  void write_fully(const void* data, size_t size);
+
+ public:
+
+  /** Open (or create) the journal file 'filename'.  Up to 'group_size' records are buffered before they are written; if 'sync' is true, commit() does not return until the written records are durably stored.  If the file ends with a partially-written (torn) record, as may be left by a crash, it is truncated to the last complete record.  Throws std::runtime_error if the file cannot be opened or is not a valid journal.*/
+  PersistenceFilterJournal(const std::string& filename, size_t group_size = 4096, bool sync = true);
+
+  /** Log the addition of feature 'id' to 'bank'; call this after adding it*/
+  void log_add(const PersistenceFilterBank& bank, FeatureID id)
+  {
+    log_state(Record::ADD, bank, bank.slot(id));
+  }
+
+  /** Log the new state of feature 'id' in 'bank'; call this after updating it*/
+  void log_update(const PersistenceFilterBank& bank, FeatureID id)
+  {
+    log_state(Record::UPDATE, bank, bank.slot(id));
+  }
+
+  /** Log the new state of the filter in slot 'slot' of 'bank'*/
+  void log_update_slot(const PersistenceFilterBank& bank, size_t slot)
+  {
+    log_state(Record::UPDATE, bank, slot);
+  }
+
+  /** Log the new states of the 'num_features' features ids[0], ..., ids[num_features - 1] in 'bank'; call this after PersistenceFilterBank::update_batch()*/
+  void log_update_batch(const PersistenceFilterBank& bank, const FeatureID* ids, size_t num_features);
+
+  /** Log the removal of feature 'id'*/
+  void log_remove(FeatureID id);
+
+  /** Write every buffered record to the file (and, if the journal is synchronous, wait until they are durably stored).  Throws std::runtime_error on I/O failure.*/
+  void commit();
+
+  /** Commit the buffered records, save every live feature in 'bank' to the snapshot file 'snapshot_filename', and truncate the journal.  The journal is truncated only once the snapshot is durably stored (whether or not the journal is synchronous), so a crash never loses both.  (A crash between the two leaves a journal whose records the new snapshot already reflects, and replaying them over it is harmless.)*/
+  void checkpoint(const PersistenceFilterBank& bank, const std::string& snapshot_filename);
+
+  /** Apply every committed record to 'bank', which must hold the state saved by the most recent checkpoint (or, if there has been none, the state of the bank when the journal was created).  Records for features that are absent from the bank are ignored if they are updates (they can only arise from a crash during checkpoint(), in which case a later record removes the feature).  Returns the number of records applied.  Throws std::runtime_error on I/O failure.*/
+  size_t replay(PersistenceFilterBank& bank) const;
+
+  /** Return the number of records written to the file since the last checkpoint*/
+  size_t num_committed() const
+  {
+    return num_committed_;
+  }
+
+  /** Return the number of records logged but not yet written*/
+  size_t num_buffered() const
+  {
+    return buffer_.size();
+  }
+
+  /** Commits any buffered records (ignoring errors), and closes the file*/
+  ~PersistenceFilterJournal();
+
+ private:
+  PersistenceFilterJournal(const PersistenceFilterJournal&);
+  PersistenceFilterJournal& operator=(const PersistenceFilterJournal&);
+};
+
+#endif //__PERSISTENCE_FILTER_JOURNAL_H__
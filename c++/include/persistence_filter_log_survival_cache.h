@@ -0,0 +1,127 @@
+#ifndef __PERSISTENCE_FILTER_LOG_SURVIVAL_CACHE_H__
+#define __PERSISTENCE_FILTER_LOG_SURVIVAL_CACHE_H__
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+
+/** A memo table of log-survival values log S_T(t) for a single prior,
+ * keyed by the elapsed time t.
+ *
+ * Every feature observed in a frame is updated at the same observation time,
+ * and the filters in a PersistenceFilterBank share one prior, so whenever
+ * several features were initialized at the same time (or on a common grid)
+ * a batch evaluates log S_T() at the same elapsed time many times over.  The
+ * batch operations of PersistenceFilterBank look these values up in a
+ * LogSurvivalCache, so that each distinct value is computed only once per
+ * batch.
+ *
+ * The table has a fixed size, and uses open addressing with linear probing.
+ * Each entry is stamped with the generation in which it was written, so
+ * clear() invalidates every entry in constant time by advancing the
+ * generation.  The cache does not record which prior produced its values:  it
+ * must be cleared before it is used with a different prior.
+ */
+
+class LogSurvivalCache
+{
+ protected:
+
+  struct Entry
+  {
+    uint64_t key;  // The bit pattern of the elapsed time
+    uint32_t generation;  // The generation in which this entry was written (entries from earlier generations are empty)
+    double value;
+  };
+
+  /** The hash table, whose size is a power of 2*/
+  std::vector<Entry> entries_;
+
+  /** The current generation (never 0, which marks entries that have never been written)*/
+  uint32_t generation_;
+
+  /** The number of entries written in the current generation*/
+  size_t size_;
+
+  /** The shift mapping a 64-bit hash to an index into entries_*/
+  unsigned int shift_;
+
+  /** Return the slot at which to begin probing for 'key'*/
+  size_t home(uint64_t key) const
+  {
+    // Fibonacci hashing:  the high bits of the product depend upon every bit of the key
+    return static_cast<size_t>( (key * 0x9E3779B97F4A7C15ULL) >> shift_);
+  }
+
+ public:
+
+  /** Construct an empty cache that holds up to 'capacity' values (rounded up to a power of 2)*/
+  LogSurvivalCache(size_t capacity = 1024) : generation_(1), size_(0), shift_(63)
+    {
+      // The table is kept at most half full
+      size_t table_size = 2;
+      while(table_size < 2 * capacity)
+	{
+	  table_size *= 2;
+	  --shift_;
+	}
+      entries_.assign(table_size, Entry());
+    }
+
+  /** Remove every entry*/
+  void clear()
+  {
+    size_ = 0;
+    if(++generation_ == 0)
+      {
+	// The generation counter wrapped around, so entries written 2^32 generations ago would appear current
+	entries_.assign(entries_.size(), Entry());
+	generation_ = 1;
+      }
+  }
+
+  /** Return log_survival_function(t), evaluating it only if the value for t is not already in the cache.  Once the cache is full, it simply evaluates the function until it is next cleared:  a batch with that many distinct elapsed times has little to gain from memoization, and probing a large table would only add cache misses.*/
+  template<typename LogSurvival>
+    double operator()(const LogSurvival& log_survival_function, double t)
+  {
+    if(2 * size_ >= entries_.size())
+      {
+	return log_survival_function(t);
+      }
+
+    // Adding 0.0 maps -0.0 to +0.0, so that the two share an entry
+    double u = t + 0.0;
+    uint64_t key;
+    std::memcpy(&key, &u, sizeof(key));
+
+    size_t mask = entries_.size() - 1;
+    size_t i = home(key);
+    for(; entries_[i].generation == generation_; i = (i + 1) & mask)
+      {
+	if(entries_[i].key == key)
+	  {
+	    return entries_[i].value;
+	  }
+      }
+
+    // A miss:  we evaluate the function before modifying the table, in case it throws
+    double value = log_survival_function(t);
+
+    Entry& entry = entries_[i];
+    entry.key = key;
+    entry.generation = generation_;
+    entry.value = value;
+    ++size_;
+    return value;
+  }
+
+  /** Return the number of values currently stored*/
+  size_t size() const
+  {
+    return size_;
+  }
+};
+
+#endif //__PERSISTENCE_FILTER_LOG_SURVIVAL_CACHE_H__
@@ -0,0 +1,278 @@
+#ifndef __PERSISTENCE_FILTER_MANAGER_H__
+#define __PERSISTENCE_FILTER_MANAGER_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "persistence_filter_bank.h"
+#include "persistence_filter_mpsc_queue.h"
+#include "persistence_filter_priors.h"
+
+
+/** This class maintains a collection of persistence filters that may be
+ * updated and queried concurrently from any number of threads.
+ *
+ * Features are partitioned by ID into shards, each of which owns a
+ * PersistenceFilterBank and a worker thread.  Calls to add(), remove() and
+ * update() never block:  they validate their arguments, push a command onto
+ * the owning shard's lock-free MPSC queue, and return.  Each worker repeatedly
+ * drains its queue, applies the commands to its bank, and then publishes an
+ * immutable Snapshot of the shard's filter states (sharing the parts that did
+ * not change with the previous one).  Queries such as predict() read the most
+ * recently published snapshot, and so never block (or are blocked by) the
+ * workers.
+ *
+ * Within each drained batch, the updates lying between consecutive add() or
+ * remove() commands are applied in timestamp order, so that detections
+ * produced out of order by different threads are sorted before they reach the
+ * filters.  An update that is older than the last observation already
+ * incorporated by its feature's filter, or that refers to a feature the shard
+ * does not contain, cannot be applied; it is discarded and counted in
+ * dropped_updates().
+ *
+ * Queries reflect the state of the filters as of the last published snapshot;
+ * call flush() to wait until every previously-submitted command is visible.
+ * The survival prior is copied into each shard, and must be safe to evaluate
+ * concurrently with its copies.
+ */
+
+class PersistenceFilterManager
+{
+ public:
+
+  /** The type used to identify features*/
+  typedef PersistenceFilterBank::FeatureID FeatureID;
+
+  /** The number of features stored in each chunk of a Snapshot*/
+  static const size_t SNAPSHOT_CHUNK_SIZE = 64;
+
+  /** An immutable copy of the filter states of a run of consecutive features in one shard, sorted by feature ID*/
+  struct SnapshotChunk
+  {
+    /** The IDs of the features in the chunk, in increasing order*/
+    std::vector<FeatureID> ids;
+
+    /** The absolute time (wall-time) at which each filter was initialized*/
+    std::vector<double> initialization_time;
+
+    /** The time of the last observation incorporated by each filter*/
+    std::vector<double> last_observation_time;
+
+    /** The natural logarithm of the likelihood p(Y_{1:N} | T >= t_N) for each filter*/
+    std::vector<double> log_likelihood;
+
+    /** The natural logarithm of the evidence p(Y_{1:N}) for each filter*/
+    std::vector<double> log_evidence;
+  };
+
+  /** An immutable copy of the filter states in one shard, sorted by feature ID.
+   *
+   * The states are divided into chunks of SNAPSHOT_CHUNK_SIZE features (only
+   * the last of which may be partial), so that feature i is entry
+   * i % SNAPSHOT_CHUNK_SIZE of chunk i / SNAPSHOT_CHUNK_SIZE.  Chunks are
+   * shared between consecutive snapshots:  publishing a batch of updates only
+   * copies the chunks containing the updated features.*/
+  struct Snapshot
+  {
+    /** The chunks holding the filter states*/
+    std::vector<std::shared_ptr<const SnapshotChunk> > chunks;
+
+    /** The number of features in the shard*/
+    size_t num_features;
+
+    /** The number of commands submitted to the shard that had been applied when this snapshot was taken*/
+    uint64_t version;
+
+    Snapshot() : num_features(0), version(0) {}
+
+    /** Return the number of features in the shard*/
+    size_t size() const
+    {
+      return num_features;
+    }
+
+    /** Return the index of feature 'id' in this snapshot, or size() if it is not present*/
+    size_t find(FeatureID id) const;
+
+    /** Return the chunk holding the state of feature i*/
+    const SnapshotChunk& chunk(size_t i) const
+    {
+      return *chunks[i / SNAPSHOT_CHUNK_SIZE];
+    }
+
+    /** Return the ID of feature i*/
+    FeatureID id(size_t i) const
+    {
+      return chunk(i).ids[i % SNAPSHOT_CHUNK_SIZE];
+    }
+
+    /** Return the absolute time (wall-time) at which the filter for feature i was initialized*/
+    double initialization_time(size_t i) const
+    {
+      return chunk(i).initialization_time[i % SNAPSHOT_CHUNK_SIZE];
+    }
+
+    /** Return the time of the last observation incorporated by the filter for feature i*/
+    double last_observation_time(size_t i) const
+    {
+      return chunk(i).last_observation_time[i % SNAPSHOT_CHUNK_SIZE];
+    }
+
+    /** Return the natural logarithm of the likelihood p(Y_{1:N} | T >= t_N) for feature i*/
+    double log_likelihood(size_t i) const
+    {
+      return chunk(i).log_likelihood[i % SNAPSHOT_CHUNK_SIZE];
+    }
+
+    /** Return the natural logarithm of the evidence p(Y_{1:N}) for feature i*/
+    double log_evidence(size_t i) const
+    {
+      return chunk(i).log_evidence[i % SNAPSHOT_CHUNK_SIZE];
+    }
+  };
+
+ protected:
+
+  /** A request to modify the filters, as passed from the submitting threads to a shard's worker*/
+  struct Command
+  {
+    enum Type {ADD, REMOVE, UPDATE};
+
+    Type type;
+    FeatureID id;
+    double time;  // Initialization time for ADD, observation time for UPDATE
+    bool detector_output;
+    double P_M;
+    double P_F;
+    uint64_t sequence;  // The order in which commands were submitted to the shard
+  };
+
+  /** The state owned by each shard*/
+  struct Shard
+  {
+    /** Commands awaiting application by the worker*/
+    MPSCQueue<Command> queue;
+
+    /** The filters for the features in this shard; accessed only by the worker*/
+    PersistenceFilterBank bank;
+
+    /** The slots of the bank's live features, sorted by feature ID; accessed only by the worker*/
+    std::vector<size_t> order;
+
+    /** The index in 'order' of each live slot; accessed only by the worker*/
+    std::vector<size_t> position;
+
+    /** The slots updated since the last snapshot was taken; accessed only by the worker*/
+    std::vector<size_t> updated_slots;
+
+    /** Flags marking the chunks of the last snapshot that are out of date; accessed only by the worker*/
+    std::vector<unsigned char> stale_chunks;
+
+    /** The most recently published snapshot; read and written only with std::atomic_load() and std::atomic_store()*/
+    std::shared_ptr<const Snapshot> snapshot;
+
+    /** The number of commands submitted to, and applied by, this shard*/
+    std::atomic<uint64_t> submitted;
+    std::atomic<uint64_t> applied;
+
+    /** The number of updates this shard was unable to apply*/
+    std::atomic<uint64_t> dropped;
+
+    /** Set by the worker while it is waiting for new commands*/
+    std::atomic<bool> sleeping;
+
+    /** Used (only) to put the worker to sleep when its queue is empty, and to wait for it in flush()*/
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_applied;
+
+    std::thread worker;
+
+    Shard(const LogSurvivalFunction& log_survival_function) : bank(log_survival_function), snapshot(new Snapshot), submitted(0), applied(0), dropped(0), sleeping(false) {}
+  };
+
+  /** The survival time prior p_T() shared by all filters, used to answer queries*/
+  LogSurvivalFunction logS_;
+
+  std::vector<std::unique_ptr<Shard> > shards_;
+
+  /** Set when the manager is being destroyed, to stop the workers*/
+  std::atomic<bool> stop_;
+
+  /** Return the shard responsible for feature 'id'*/
+  Shard& shard_for(FeatureID id) const
+  {
+    return *shards_[shard_index(id)];
+  }
+
+  /** Append 'command' to the queue of the shard responsible for it, waking that shard's worker if necessary*/
+  void submit(Command& command);
+
+  /** The main loop of the worker thread for shard 'shard'*/
+  void run_worker(Shard& shard);
+
+  /** Apply the (drained) commands 'commands' to 'shard', and publish a new snapshot*/
+  void apply(Shard& shard, std::vector<Command>& commands);
+
+  /** Construct a snapshot of the current state of 'shard', recording that 'version' commands have been applied to it.  If 'membership_changed' is true, features have been added to or removed from the shard since the last snapshot, and every chunk is rebuilt; otherwise only the chunks containing shard.updated_slots are copied, and the rest are shared with the previous snapshot.*/
+  std::shared_ptr<const Snapshot> take_snapshot(Shard& shard, bool membership_changed, uint64_t version) const;
+
+ public:
+
+  /** Constructor accepting the survival time prior p_T() shared by all filters, and the number of shards (and therefore worker threads) across which to distribute the features.  If 'num_shards' is 0, one shard is created per hardware thread.*/
+  PersistenceFilterManager(const LogSurvivalFunction& log_survival_function, size_t num_shards = 0);
+
+  /** Add a new feature with ID 'id' whose filter is initialized at 'initialization_time'.  If the feature already exists when this command is applied, it is ignored.*/
+  void add(FeatureID id, double initialization_time = 0.0);
+
+  /** Remove the feature with ID 'id'*/
+  void remove(FeatureID id);
+
+  /** Submit a new detector output for feature 'id'.  The arguments have the same meaning as in PersistenceFilter::update(); P_M and P_F are validated immediately, throwing std::domain_error if either is not a probability.*/
+  void update(FeatureID id, bool detector_output, double observation_time, double P_M, double P_F);
+
+  /** Block until every command submitted (by any thread) before this call has been applied and published*/
+  void flush();
+
+  /** Return the number of shards*/
+  size_t num_shards() const
+  {
+    return shards_.size();
+  }
+
+  /** Return the index of the shard responsible for feature 'id'*/
+  size_t shard_index(FeatureID id) const;
+
+  /** Return the most recently published snapshot of shard 'shard'*/
+  std::shared_ptr<const Snapshot> snapshot(size_t shard) const
+  {
+    return std::atomic_load(&shards_[shard]->snapshot);
+  }
+
+  /** Return true if feature 'id' is present in the most recently published snapshot*/
+  bool contains(FeatureID id) const;
+
+  /** Return the number of features in the most recently published snapshots*/
+  size_t size() const;
+
+  /** Compute the posterior feature persistence probability p(X_t = 1 | Y_{1:N}) for feature 'id' at time t >= tN, using the most recently published snapshot.  Throws std::out_of_range if the feature is not present in the snapshot.*/
+  double predict(FeatureID id, double prediction_time) const;
+
+  /** Return the number of updates that were discarded, either because they were older than the last observation incorporated by their feature's filter, or because their feature did not exist*/
+  uint64_t dropped_updates() const;
+
+  /** Stops the worker threads, after they have applied all previously-submitted commands*/
+  ~PersistenceFilterManager();
+
+ private:
+  PersistenceFilterManager(const PersistenceFilterManager&);
+  PersistenceFilterManager& operator=(const PersistenceFilterManager&);
+};
+
+#endif //__PERSISTENCE_FILTER_MANAGER_H__
@@ -0,0 +1,88 @@
+#ifndef __PERSISTENCE_FILTER_MATH_H__
+#define __PERSISTENCE_FILTER_MATH_H__
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "persistence_filter_instrumentation.h"
+
+
+/** Log-domain arithmetic used throughout the persistence filter.
+ *
+ * These routines are built only on the C++ standard math library, and are
+ * fully reentrant:  unlike the GSL special functions, they never consult the
+ * process-wide GSL error handler.  Numerical underflow is handled by clamping
+ * arguments into range and selecting the limiting value, rather than by
+ * inspecting error codes, so that the common path is free of data-dependent
+ * branches.
+ */
+
+
+/** The argument below which exp() underflows (this is GSL_LOG_DBL_MIN, the threshold used by gsl_sf_exp_e)*/
+#define PERSISTENCE_FILTER_LOG_DBL_MIN (-7.0839641853226408e+02)
+
+/** Computes exp(x), returning exactly 0 whenever the result would underflow the normalized double-precision range (x < PERSISTENCE_FILTER_LOG_DBL_MIN)*/
+inline double clamped_exp(double x)
+{
+  double result = std::exp(std::max(x, PERSISTENCE_FILTER_LOG_DBL_MIN));
+  return (x < PERSISTENCE_FILTER_LOG_DBL_MIN) ? 0.0 : result;
+}
+
+/** Computes log(1 + exp(x)) in a numerically stable way, for x <= 0*/
+inline double log1pexp(double x)
+{
+  return std::log1p(clamped_exp(x));
+}
+
+/** Computes log(1 - exp(x)) in a numerically stable way, for x <= 0.  (This is log1mexp from M. Maechler, "Accurately Computing log(1 - exp(-|a|))", 2012.)*/
+inline double log1mexp(double x)
+{
+  // For x > -log(2), exp(x) > 1/2, so we compute 1 - exp(x) = -expm1(x) directly to avoid cancellation
+  return (x > -0.69314718055994530942) ? std::log(-std::expm1(x)) : std::log1p(-clamped_exp(x));
+}
+
+/**Computes log(x + y) from log(x), log(y) in a numerically stable way.  If either input is NaN, the result is NaN.*/
+inline double logsum(double logx, double logy)
+{
+  // Using the fact that
+  //
+  // log(x + y) = log(x(1+ y /x)) = log(x) + log(1 + y/x)
+  //
+  // with y <= x.  (We form log(y/x) = -|log(x) - log(y)| directly from the
+  // inputs, rather than from their minimum and maximum, since std::max() and
+  // std::min() would discard a NaN input.)
+  double hi = std::max(logx, logy);
+  double diff = -std::fabs(logx - logy);
+
+  // If x = y = 0 then log(y/x) is NaN; in that case we take y/x = 0, so that we return log(0) = -infinity
+  bool both_zero = (logx == -HUGE_VAL) && (logy == -HUGE_VAL);
+  PERSISTENCE_FILTER_COUNT_FALLBACK_IF(both_zero, DEGENERATE_LOG_ARITHMETIC);
+  diff = both_zero ? -HUGE_VAL : diff;
+
+  // A NaN input leaves diff (and hence the result) NaN
+  return hi + log1pexp(diff);
+}
+
+/**Computes log(x - y) from log(x), log(y) in a numerically stable way.  Note that here we require x >= y (std::domain_error is thrown otherwise).  If either input is NaN, the result is NaN.*/
+inline double logdiff(double logx, double logy)
+{
+  // Input checking
+  if(logy > logx)
+    {
+      throw std::domain_error("logx must be greater than or equal to logy");
+    }
+
+  // We exploit the chain of equalities
+  // log(x - y) = log(x * (1 - y/x)) = log(x) + log(1 - y/x) = log(x) + log(1 - exp(logy - logx))
+
+  // As in logsum(), if x = y = 0 we take y/x = 0, so that we return log(0) = -infinity; a NaN input leaves diff (and hence the result) NaN
+  double diff = logy - logx;
+  bool both_zero = (logx == -HUGE_VAL) && (logy == -HUGE_VAL);
+  PERSISTENCE_FILTER_COUNT_FALLBACK_IF(both_zero, DEGENERATE_LOG_ARITHMETIC);
+  diff = both_zero ? -HUGE_VAL : diff;
+
+  return logx + log1mexp(diff);
+}
+
+#endif //__PERSISTENCE_FILTER_MATH_H__
@@ -0,0 +1,117 @@
+#ifndef __PERSISTENCE_FILTER_MONTE_CARLO_H__
+#define __PERSISTENCE_FILTER_MONTE_CARLO_H__
+
+#include <cstddef>
+#include <random>
+#include <stdint.h>
+#include <vector>
+
+#include "persistence_filter_priors.h"
+
+
+/** Monte Carlo evaluation of persistence filters on simulated data.
+ *
+ * This is the C++ counterpart of the experiments in
+ * persistence_estimator_mean_L1_errors.ipynb and
+ * persistence_estimator_precision_and_recall.ipynb.  Each trial samples a
+ * feature survival time uniformly from [0, simulation_length], a set of
+ * observation times from the bursty revisitation process of
+ * sample_observation_times() in experiments/persistence_filter_test_utils.py,
+ * and a detector output at each observation time (as generate_observations()
+ * does).  It then runs one persistence filter for each of the priors being
+ * evaluated, together with the empirical estimator (which believes the last
+ * detector output), evaluates each estimator's belief at the query times
+ * 0, query_interval, 2 * query_interval, ... < simulation_length, and scores
+ * it against the ground truth by:
+ *
+ * - its mean absolute error (the L1 error computed using the trapezoid rule,
+ *   divided by the length of the query interval), and
+ *
+ * - for each classification threshold, the precision and recall of the
+ *   feature ABSENCE classifications obtained by declaring the feature absent
+ *   whenever its belief is less than the threshold.  (A trial in which no
+ *   absences are predicted yields no precision value, and one in which the
+ *   feature never disappears yields no recall value; these are excluded from
+ *   the averages, as in the notebooks.)
+ *
+ * Trials are distributed over a pool of worker threads.  Each trial draws its
+ * random numbers from its own generator, seeded from the settings' seed and
+ * the index of the trial, and the per-trial metrics are reduced in a fixed
+ * order; the results are therefore a deterministic function of the settings,
+ * independent of the number of threads.  (Running several settings with the
+ * same seed evaluates them on common random numbers, which reduces the
+ * variance of comparisons between them.)
+ */
+
+
+/** The parameters of a Monte Carlo evaluation*/
+struct MonteCarloSettings
+{
+  /** The length of each simulated trial*/
+  double simulation_length;
+
+  /** The parameters of the revisitation process:  the rate of the exponentially-distributed intervals between revisits, the rate of the exponentially-distributed intervals between observations within a revisit, and the probability of leaving after each observation*/
+  double lambda_r;
+  double lambda_o;
+  double p_N;
+
+  /** The detector's missed detection and false alarm probabilities (used both to simulate the detector outputs and by the filters)*/
+  double P_M;
+  double P_F;
+
+  /** The spacing of the query times at which the estimators are scored*/
+  double query_interval;
+
+  /** The belief thresholds at which to compute precision and recall*/
+  std::vector<double> thresholds;
+
+  /** The number of trials to run*/
+  size_t num_trials;
+
+  /** The seed from which each trial's random number generator is derived*/
+  uint64_t seed;
+
+  /** The number of worker threads to use (0 to use one per hardware thread)*/
+  size_t num_threads;
+
+  /** Construct settings with the "standard" values used in the experiment notebooks*/
+  MonteCarloSettings() : simulation_length(1000), lambda_r(1.0 / 50), lambda_o(1), p_N(1.0 / 5), P_M(.1), P_F(.1), query_interval(.1), thresholds({.01, .05, .1, .15, .2, .25, .3, .35, .4, .45, .5}), num_trials(100), seed(0), num_threads(0) {}
+};
+
+
+/** The metrics accumulated for one estimator over all of the trials*/
+struct MonteCarloMetrics
+{
+  /** The mean (over trials) of the mean absolute error, and its sample standard deviation*/
+  double mean_absolute_error;
+  double mean_absolute_error_stddev;
+
+  /** The mean (over the trials for which it was defined) of the absence precision and recall at each threshold, and the numbers of such trials*/
+  std::vector<double> precisions;
+  std::vector<double> recalls;
+  std::vector<size_t> num_precisions;
+  std::vector<size_t> num_recalls;
+};
+
+
+/** The results of a Monte Carlo evaluation*/
+struct MonteCarloResults
+{
+  /** The metrics of the persistence filter using each of the evaluated priors, in the order in which the priors were given*/
+  std::vector<MonteCarloMetrics> filters;
+
+  /** The metrics of the empirical estimator*/
+  MonteCarloMetrics empirical_estimator;
+
+  /** The number of trials run*/
+  size_t num_trials;
+};
+
+
+/** Sample a set of observation times in [0, simulation_length] from the bursty revisitation process of sample_observation_times() in experiments/persistence_filter_test_utils.py (see MonteCarloSettings), writing them in increasing order to 'observation_times'*/
+void sample_observation_times(double lambda_r, double lambda_o, double p_N, double simulation_length, std::mt19937_64& rng, std::vector<double>& observation_times);
+
+/** Evaluate a persistence filter using each of the 'priors', together with the empirical estimator, over settings.num_trials simulated trials.  Throws std::domain_error if the settings are invalid.  The priors are evaluated concurrently from several threads, and must be safe to use in this way.*/
+MonteCarloResults run_monte_carlo_evaluation(const MonteCarloSettings& settings, const std::vector<LogSurvivalFunction>& priors);
+
+#endif //__PERSISTENCE_FILTER_MONTE_CARLO_H__
@@ -0,0 +1,96 @@
+#ifndef __PERSISTENCE_FILTER_MPSC_QUEUE_H__
+#define __PERSISTENCE_FILTER_MPSC_QUEUE_H__
+
+#include <atomic>
+
+
+/** An unbounded, lock-free, multiple-producer single-consumer FIFO queue.
+ *
+ * This is D. Vyukov's intrusive MPSC queue:  producers link new nodes onto the
+ * head of a singly-linked list with a single atomic exchange, while the (sole)
+ * consumer pops nodes from the tail without any atomic read-modify-write
+ * operations.  push() is wait-free; try_pop() is lock-free, but may
+ * transiently report an empty queue while a producer is between its exchange
+ * and the store that links its node into the list.
+ *
+ * push() may be called from any number of threads concurrently; try_pop() and
+ * empty() may only be called from a single consumer thread at a time.  T must
+ * be default-constructible (for the queue's stub node) and copy-assignable.
+ */
+
+template<typename T>
+class MPSCQueue
+{
+ protected:
+
+  struct Node
+  {
+    std::atomic<Node*> next;
+    T value;
+
+    Node() : next(nullptr) {}
+    Node(const T& v) : next(nullptr), value(v) {}
+  };
+
+  /** The most recently pushed node (producers' end)*/
+  std::atomic<Node*> head_;
+
+  /** The stub node preceding the oldest unconsumed element (consumer's end)*/
+  Node* tail_;
+
+ public:
+
+  MPSCQueue() : head_(new Node), tail_(head_.load()) {}
+
+  /** Append 'value' to the queue.  Safe to call from any thread.*/
+  void push(const T& value)
+  {
+    Node* node = new Node(value);
+
+    // The exchange is sequentially consistent, so that a producer which
+    // subsequently checks whether the consumer is sleeping cannot miss a
+    // consumer that checked empty() before going to sleep.
+    Node* prev = head_.exchange(node);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  /** Pop the oldest element of the queue into 'value', returning false if no element is currently available.  Consumer thread only.*/
+  bool try_pop(T& value)
+  {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if(!next)
+      {
+	return false;
+      }
+
+    // 'next' becomes the new stub node
+    value = next->value;
+    tail_ = next;
+    delete tail;
+    return true;
+  }
+
+  /** Return true if no push() has begun whose element has not yet been popped.  Consumer thread only.*/
+  bool empty() const
+  {
+    return head_.load() == tail_;
+  }
+
+  ~MPSCQueue()
+  {
+    Node* node = tail_;
+    while(node)
+      {
+	Node* next = node->next.load(std::memory_order_relaxed);
+	delete node;
+	node = next;
+      }
+  }
+
+ private:
+  MPSCQueue(const MPSCQueue&);
+  MPSCQueue& operator=(const MPSCQueue&);
+};
+
+#endif //__PERSISTENCE_FILTER_MPSC_QUEUE_H__
@@ -0,0 +1,167 @@
+#ifndef __PERSISTENCE_FILTER_POOL_H__
+#define __PERSISTENCE_FILTER_POOL_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "persistence_filter.h"
+
+
+/** An arena from which persistence filters are created and destroyed.
+ *
+ * Filters are constructed in place in large blocks of storage, and the slots
+ * of destroyed filters are threaded onto a free list for reuse, so once the
+ * pool has grown to the size of the map, feature churn performs no heap
+ * allocation at all.  (Together with a prior that is copied without
+ * allocating, e.g. a LogSurvivalFunction or a SurvivalPriorReference, create()
+ * is then allocation-free.)  Blocks are only released when the pool is
+ * destroyed, at which point any filters still alive are destroyed too.
+ *
+ * A pool is not thread-safe:  a multi-threaded mapper should give each thread
+ * its own pool, so that threads creating and destroying filters never contend
+ * for a shared allocator.  A filter must be destroyed by the pool that
+ * created it.
+ */
+
+template<typename Filter>
+class BasicPersistenceFilterPool
+{
+ protected:
+
+  /** Storage for one filter, which holds the next free slot while it is unoccupied*/
+  union Slot
+  {
+    Slot* next;
+    typename std::aligned_storage<sizeof(Filter), alignof(Filter)>::type storage;
+  };
+
+  std::vector<std::unique_ptr<Slot[]> > blocks_;
+
+  /** The number of slots in each block*/
+  size_t block_size_;
+
+  /** The head of the free list*/
+  Slot* free_;
+
+  /** The number of live filters, and the total number of slots*/
+  size_t size_;
+  size_t capacity_;
+
+  void add_block()
+  {
+    std::unique_ptr<Slot[]> block(new Slot[block_size_]);
+    blocks_.push_back(std::move(block));
+
+    // Thread the new slots onto the free list, in address order
+    Slot* slots = blocks_.back().get();
+    for(size_t k = block_size_; k-- > 0;)
+      {
+	slots[k].next = free_;
+	free_ = &slots[k];
+      }
+    capacity_ += block_size_;
+  }
+
+ public:
+
+  /** Construct an empty pool, which allocates storage for 'block_size' filters at a time*/
+  BasicPersistenceFilterPool(size_t block_size = 1024) : block_size_(std::max<size_t>(block_size, 1)), free_(nullptr), size_(0), capacity_(0) {}
+
+  /** Ensure that the pool has room for 'num_filters' filters without further allocation*/
+  void reserve(size_t num_filters)
+  {
+    while(capacity_ < num_filters)
+      add_block();
+  }
+
+  /** Construct a filter from 'args' (the arguments of one of Filter's constructors) in the pool's storage*/
+  template<typename... Args>
+    Filter* create(Args&&... args)
+  {
+    if(!free_)
+      add_block();
+
+    Slot* slot = free_;
+    Slot* next = slot->next;
+    Filter* filter;
+    try
+      {
+	filter = new (&slot->storage) Filter(std::forward<Args>(args)...);
+      }
+    catch(...)
+      {
+	// Constructing the filter may have overwritten the link to the next free slot
+	slot->next = next;
+	throw;
+      }
+
+    free_ = next;
+    ++size_;
+    return filter;
+  }
+
+  /** Destroy 'filter' (which must have been created by this pool), returning its storage to the pool*/
+  void destroy(Filter* filter)
+  {
+    filter->~Filter();
+
+    Slot* slot = reinterpret_cast<Slot*>(filter);
+    slot->next = free_;
+    free_ = slot;
+    --size_;
+  }
+
+  /** Return the number of live filters*/
+  size_t size() const
+  {
+    return size_;
+  }
+
+  /** Return the number of filters the pool can hold before it must allocate*/
+  size_t capacity() const
+  {
+    return capacity_;
+  }
+
+  /** Destroys any filters that are still alive, and releases the pool's storage*/
+  ~BasicPersistenceFilterPool()
+  {
+    if(size_ == 0)
+      return;
+
+    // The live filters occupy exactly the slots that are not on the free list
+    std::vector<Slot*> free_slots;
+    free_slots.reserve(capacity_ - size_);
+    for(Slot* slot = free_; slot; slot = slot->next)
+      free_slots.push_back(slot);
+    std::sort(free_slots.begin(), free_slots.end());
+
+    for(size_t b = 0; b < blocks_.size(); ++b)
+      {
+	for(size_t k = 0; k < block_size_; ++k)
+	  {
+	    Slot* slot = &blocks_[b][k];
+	    if(!std::binary_search(free_slots.begin(), free_slots.end(), slot))
+	      reinterpret_cast<Filter*>(&slot->storage)->~Filter();
+	  }
+      }
+  }
+
+ private:
+  BasicPersistenceFilterPool(const BasicPersistenceFilterPool&);
+  BasicPersistenceFilterPool& operator=(const BasicPersistenceFilterPool&);
+};
+
+
+/** A pool of persistence filters with type-erased survival time priors*/
+typedef BasicPersistenceFilterPool<PersistenceFilter> PersistenceFilterPool;
+
+/** A pool of persistence filters referring to a shared survival time prior*/
+typedef BasicPersistenceFilterPool<SharedPriorPersistenceFilter> SharedPriorPersistenceFilterPool;
+
+#endif //__PERSISTENCE_FILTER_POOL_H__
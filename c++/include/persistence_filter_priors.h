@@ -0,0 +1,575 @@
+#ifndef __PERSISTENCE_FILTER_PRIORS_H__
+#define __PERSISTENCE_FILTER_PRIORS_H__
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "persistence_filter_utils.h"
+
+
+/** Survival-time priors for use with BasicPersistenceFilter.
+ *
+ * A survival prior is any copyable callable object that accepts an elapsed
+ * time t >= 0 and returns log S_T(t), the natural logarithm of the survival
+ * function of the survival time prior p_T().  BasicPersistenceFilter is
+ * templated on the type of its prior, so that when the prior's type is known
+ * at compile time, evaluating it involves no indirect calls.  This header
+ * provides priors with closed-form log-survival functions, together with
+ * LogSurvivalFunction, a type-erased prior that can hold any of them (or any
+ * other callable), and which is used by PersistenceFilter.
+ *
+ * Each of the priors defined here can also describe itself by a
+ * SurvivalPriorDescriptor (a kind together with its numerical parameters),
+ * which allows it to be saved alongside filter state and reconstructed later.
+ *
+ * A prior may optionally provide a method log_survival_ratio(t0, t1)
+ * returning log(S_T(t1) / S_T(t0)) in closed form, which the filter's update
+ * uses (via the log_survival_ratio() function below) in place of subtracting
+ * log S_T(t0) from log S_T(t1).  The exponential and piecewise-constant
+ * hazard priors provide one, which is more accurate over long gaps, where
+ * log S_T(t0) and log S_T(t1) are large and nearly equal.
+ */
+
+
+/** A serializable description of a survival time prior*/
+struct SurvivalPriorDescriptor
+{
+  /** The family of the prior.  (These values are stored in snapshot files, so existing ones must never be renumbered.)*/
+  enum Kind
+  {
+    CUSTOM = 0,  // An arbitrary callable, which cannot be reconstructed from a descriptor
+    GENERAL_PURPOSE = 1,  // parameters = {lambda_l, lambda_u}
+    EXPONENTIAL = 2,  // parameters = {rate}
+    WEIBULL = 3,  // parameters = {shape, scale}
+    PIECEWISE_CONSTANT_HAZARD = 4  // parameters = {breakpoints..., rates...}
+  };
+
+  Kind kind;
+  std::vector<double> parameters;
+
+  SurvivalPriorDescriptor(Kind prior_kind = CUSTOM, const std::vector<double>& prior_parameters = std::vector<double>()) : kind(prior_kind), parameters(prior_parameters) {}
+};
+
+
+/** The general-purpose survival time prior developed in the RSS workshop paper "Towards Lifelong Feature-Based Mapping in Semi-Static Environments", evaluated using log_general_purpose_survival_function().  (See also GeneralPurposeLogSurvivalTable, a faster tabulated version of the same prior.)*/
+class GeneralPurposeSurvivalPrior
+{
+ protected:
+  double lambda_l_;
+  double lambda_u_;
+
+ public:
+  GeneralPurposeSurvivalPrior(double lambda_l, double lambda_u) : lambda_l_(lambda_l), lambda_u_(lambda_u)
+    {
+      if(lambda_l >= lambda_u)
+	{
+	  throw std::domain_error("Parameter lambda_u must be greater than lambda_l");
+	}
+    }
+
+  double operator()(double t) const
+  {
+    return log_general_purpose_survival_function(t, lambda_l_, lambda_u_);
+  }
+
+  double lambda_l() const
+  {
+    return lambda_l_;
+  }
+
+  double lambda_u() const
+  {
+    return lambda_u_;
+  }
+
+  SurvivalPriorDescriptor descriptor() const
+  {
+    return SurvivalPriorDescriptor(SurvivalPriorDescriptor::GENERAL_PURPOSE, {lambda_l_, lambda_u_});
+  }
+};
+
+
+/** The exponential survival time prior with rate parameter 'rate' (i.e. a constant hazard rate), for which log S_T(t) = -rate * t*/
+class ExponentialSurvivalPrior
+{
+ protected:
+  double rate_;
+
+ public:
+  ExponentialSurvivalPrior(double rate) : rate_(rate)
+    {
+      if(rate <= 0)
+	{
+	  throw std::domain_error("Rate parameter must be positive");
+	}
+    }
+
+  double operator()(double t) const
+  {
+    // Input checking
+    if(t < 0)
+      {
+	throw std::domain_error("Survival functions are defined on the nonnegative real line (t >= 0)");
+      }
+
+    return -rate_ * t;
+  }
+
+  /** Return log(S_T(t1) / S_T(t0)) = -rate * (t1 - t0), for 0 <= t0 <= t1*/
+  double log_survival_ratio(double t0, double t1) const
+  {
+    // Input checking
+    if( (t0 < 0) || (t1 < t0) )
+      {
+	throw std::domain_error("Interval endpoints must satisfy 0 <= t0 <= t1");
+      }
+
+    return -rate_ * (t1 - t0);
+  }
+
+  double rate() const
+  {
+    return rate_;
+  }
+
+  SurvivalPriorDescriptor descriptor() const
+  {
+    return SurvivalPriorDescriptor(SurvivalPriorDescriptor::EXPONENTIAL, {rate_});
+  }
+};
+
+
+/** The Weibull survival time prior with shape parameter 'shape' and scale parameter 'scale', for which log S_T(t) = -(t / scale)^shape*/
+class WeibullSurvivalPrior
+{
+ protected:
+  double shape_;
+  double scale_;
+
+ public:
+  WeibullSurvivalPrior(double shape, double scale) : shape_(shape), scale_(scale)
+    {
+      if( (shape <= 0) || (scale <= 0) )
+	{
+	  throw std::domain_error("Shape and scale parameters must be positive");
+	}
+    }
+
+  double operator()(double t) const
+  {
+    // Input checking
+    if(t < 0)
+      {
+	throw std::domain_error("Survival functions are defined on the nonnegative real line (t >= 0)");
+      }
+
+    return -std::pow(t / scale_, shape_);
+  }
+
+  double shape() const
+  {
+    return shape_;
+  }
+
+  double scale() const
+  {
+    return scale_;
+  }
+
+  SurvivalPriorDescriptor descriptor() const
+  {
+    return SurvivalPriorDescriptor(SurvivalPriorDescriptor::WEIBULL, {shape_, scale_});
+  }
+};
+
+
+/** A survival time prior with a piecewise-constant hazard rate:  the hazard rate is rates[k] on the interval [breakpoints[k], breakpoints[k+1]) (with the last rate applying on [breakpoints.back(), infinity)), so that log S_T(t) is minus the integral of the hazard rate over [0, t], a piecewise-linear function of t.  The breakpoints must begin at 0 and be strictly increasing, and the rates must be nonnegative.  The breakpoints, rates, and cumulative hazards at the breakpoints are shared between copies, so copying the prior is cheap.*/
+class PiecewiseConstantHazardSurvivalPrior
+{
+ protected:
+  struct Pieces
+  {
+    std::vector<double> breakpoints;
+    std::vector<double> rates;
+    std::vector<double> cumulative_hazards;  // The integral of the hazard rate over [0, breakpoints[k]]
+  };
+
+  std::shared_ptr<const Pieces> pieces_;
+
+  /** Return the index of the piece containing t >= 0*/
+  size_t piece(double t) const
+  {
+    const std::vector<double>& b = pieces_->breakpoints;
+    return std::upper_bound(b.begin(), b.end(), t) - b.begin() - 1;
+  }
+
+  /** Return H(t1) - H(t0), the integral of the hazard rate over [t0, t1], for 0 <= t0 <= t1*/
+  double hazard_increment(double t0, double t1) const
+  {
+    // Input checking
+    if( (t0 < 0) || (t1 < t0) )
+      {
+	throw std::domain_error("Interval endpoints must satisfy 0 <= t0 <= t1");
+      }
+
+    const std::vector<double>& b = pieces_->breakpoints;
+    const std::vector<double>& r = pieces_->rates;
+    const std::vector<double>& H = pieces_->cumulative_hazards;
+    size_t k0 = piece(t0);
+    size_t k1 = piece(t1);
+
+    // Accumulate H(t1) - H(t0) as a sum of nonnegative terms, rather than subtracting the cumulative hazards at t0 and t1
+    return (k0 == k1) ? r[k0] * (t1 - t0) : r[k0] * (b[k0 + 1] - t0) + (H[k1] - H[k0 + 1]) + r[k1] * (t1 - b[k1]);
+  }
+
+ public:
+  PiecewiseConstantHazardSurvivalPrior(const std::vector<double>& breakpoints, const std::vector<double>& rates)
+    {
+      if(breakpoints.empty() || (breakpoints.size() != rates.size()) )
+	{
+	  throw std::domain_error("A piecewise-constant hazard prior requires the same (nonzero) number of breakpoints and rates");
+	}
+
+      if(breakpoints[0] != 0)
+	{
+	  throw std::domain_error("The first breakpoint must be 0");
+	}
+
+      std::shared_ptr<Pieces> pieces(new Pieces);
+      pieces->breakpoints = breakpoints;
+      pieces->rates = rates;
+      pieces->cumulative_hazards.resize(breakpoints.size());
+      pieces->cumulative_hazards[0] = 0;
+      for(size_t k = 0; k < breakpoints.size(); ++k)
+	{
+	  if(!(rates[k] >= 0) || std::isinf(rates[k]))
+	    {
+	      throw std::domain_error("Hazard rates must be finite and nonnegative");
+	    }
+	  if(k > 0)
+	    {
+	      if(!(breakpoints[k] > breakpoints[k - 1]) || std::isinf(breakpoints[k]))
+		{
+		  throw std::domain_error("Breakpoints must be finite and strictly increasing");
+		}
+	      pieces->cumulative_hazards[k] = pieces->cumulative_hazards[k - 1] + rates[k - 1] * (breakpoints[k] - breakpoints[k - 1]);
+	    }
+	}
+      pieces_ = pieces;
+    }
+
+  double operator()(double t) const
+  {
+    // Input checking
+    if(t < 0)
+      {
+	throw std::domain_error("Survival functions are defined on the nonnegative real line (t >= 0)");
+      }
+
+    size_t k = piece(t);
+    return -(pieces_->cumulative_hazards[k] + pieces_->rates[k] * (t - pieces_->breakpoints[k]));
+  }
+
+  /** Return log(S_T(t1) / S_T(t0)) = -(H(t1) - H(t0)), for 0 <= t0 <= t1*/
+  double log_survival_ratio(double t0, double t1) const
+  {
+    return -hazard_increment(t0, t1);
+  }
+
+  const std::vector<double>& breakpoints() const
+  {
+    return pieces_->breakpoints;
+  }
+
+  const std::vector<double>& rates() const
+  {
+    return pieces_->rates;
+  }
+
+  SurvivalPriorDescriptor descriptor() const
+  {
+    SurvivalPriorDescriptor d(SurvivalPriorDescriptor::PIECEWISE_CONSTANT_HAZARD, pieces_->breakpoints);
+    d.parameters.insert(d.parameters.end(), pieces_->rates.begin(), pieces_->rates.end());
+    return d;
+  }
+};
+
+
+/** Return the descriptor of 'survival_prior':  the result of its descriptor() method if it has one, or a CUSTOM descriptor otherwise.  (The second argument selects between these overloads, and should be 0.)*/
+template<typename SurvivalPrior>
+auto describe_survival_prior(const SurvivalPrior& survival_prior, int) -> decltype(survival_prior.descriptor())
+{
+  return survival_prior.descriptor();
+}
+
+template<typename SurvivalPrior>
+SurvivalPriorDescriptor describe_survival_prior(const SurvivalPrior&, long)
+{
+  return SurvivalPriorDescriptor();
+}
+
+/** The tabulated general-purpose prior describes the same prior as GeneralPurposeSurvivalPrior*/
+inline SurvivalPriorDescriptor describe_survival_prior(const GeneralPurposeLogSurvivalTable& table, int)
+{
+  return SurvivalPriorDescriptor(SurvivalPriorDescriptor::GENERAL_PURPOSE, {table.lambda_l(), table.lambda_u()});
+}
+
+
+/** Return log(S_T(t1) / S_T(t0)) for 0 <= t0 <= t1, given logS0 = log S_T(t0) and logS1 = log S_T(t1):  the result of the prior's log_survival_ratio() method if it has one, or logS1 - logS0 otherwise.  (The last argument selects between these overloads, and should be 0.)*/
+template<typename SurvivalPrior>
+auto log_survival_ratio(const SurvivalPrior& survival_prior, double t0, double t1, double, double, int) -> decltype(survival_prior.log_survival_ratio(t0, t1))
+{
+  return survival_prior.log_survival_ratio(t0, t1);
+}
+
+template<typename SurvivalPrior>
+double log_survival_ratio(const SurvivalPrior&, double, double, double logS0, double logS1, long)
+{
+  return logS1 - logS0;
+}
+
+/** Return a function computing the prior's closed-form log_survival_ratio() if it has one, or an empty function otherwise.  (The second argument selects between these overloads, and should be 0.)*/
+template<typename SurvivalPrior>
+auto log_survival_ratio_function(const SurvivalPrior& survival_prior, int) -> decltype(survival_prior.log_survival_ratio(0.0, 0.0), std::function<double(double, double)>())
+{
+  return [survival_prior](double t0, double t1) { return survival_prior.log_survival_ratio(t0, t1); };
+}
+
+template<typename SurvivalPrior>
+std::function<double(double, double)> log_survival_ratio_function(const SurvivalPrior&, long)
+{
+  return std::function<double(double, double)>();
+}
+
+
+/** A type-erased survival prior, which can hold any callable object returning log S_T(t) (a std::function, a lambda, or one of the priors above).  This is the prior type used by PersistenceFilter.  If the wrapped prior provides a closed-form log_survival_ratio(), it is retained as well; exponential priors are evaluated inline, without any indirect calls.  The wrapped prior is immutable and shared between copies, so copying a LogSurvivalFunction (and hence constructing a PersistenceFilter from one) never allocates.*/
+class LogSurvivalFunction
+{
+ protected:
+  struct Implementation
+  {
+    std::function<double(double)> logS;
+    SurvivalPriorDescriptor descriptor;
+
+    /** The wrapped prior's closed-form log_survival_ratio() (empty if it has none)*/
+    std::function<double(double, double)> log_survival_ratio;
+  };
+
+  std::shared_ptr<const Implementation> implementation_;
+
+  /** The rate of the wrapped prior if it is exponential, and 0 otherwise*/
+  double exponential_rate_;
+
+  template<typename LogSurvival>
+    static std::shared_ptr<const Implementation> wrap(const LogSurvival& log_survival_function)
+  {
+    std::shared_ptr<Implementation> implementation = std::make_shared<Implementation>();
+    implementation->logS = log_survival_function;
+    implementation->descriptor = describe_survival_prior(log_survival_function, 0);
+    implementation->log_survival_ratio = log_survival_ratio_function(log_survival_function, 0);
+    return implementation;
+  }
+
+ public:
+
+  /** Construct from any callable object accepting and returning a double.  If the object is one of the priors above, its descriptor is retained.*/
+  template<typename LogSurvival, typename = typename std::enable_if<!std::is_same<typename std::decay<LogSurvival>::type, LogSurvivalFunction>::value>::type>
+    LogSurvivalFunction(const LogSurvival& log_survival_function) : implementation_(wrap(log_survival_function)),
+    exponential_rate_( (implementation_->descriptor.kind == SurvivalPriorDescriptor::EXPONENTIAL) ? implementation_->descriptor.parameters[0] : 0.0) {}
+
+  /** Reconstruct the prior described by 'descriptor'.  Throws std::invalid_argument if the descriptor is CUSTOM (or unrecognized), or has the wrong number of parameters for its kind.*/
+  static LogSurvivalFunction from_descriptor(const SurvivalPriorDescriptor& descriptor)
+  {
+    const std::vector<double>& p = descriptor.parameters;
+    switch(descriptor.kind)
+      {
+      case SurvivalPriorDescriptor::GENERAL_PURPOSE:
+	if(p.size() == 2)
+	  return LogSurvivalFunction(GeneralPurposeSurvivalPrior(p[0], p[1]));
+	break;
+      case SurvivalPriorDescriptor::EXPONENTIAL:
+	if(p.size() == 1)
+	  return LogSurvivalFunction(ExponentialSurvivalPrior(p[0]));
+	break;
+      case SurvivalPriorDescriptor::WEIBULL:
+	if(p.size() == 2)
+	  return LogSurvivalFunction(WeibullSurvivalPrior(p[0], p[1]));
+	break;
+      case SurvivalPriorDescriptor::PIECEWISE_CONSTANT_HAZARD:
+	if( (p.size() > 0) && (p.size() % 2 == 0) )
+	  return LogSurvivalFunction(PiecewiseConstantHazardSurvivalPrior(std::vector<double>(p.begin(), p.begin() + p.size() / 2), std::vector<double>(p.begin() + p.size() / 2, p.end())));
+	break;
+      default:
+	throw std::invalid_argument("Unable to reconstruct a survival prior from a CUSTOM descriptor");
+      }
+
+    throw std::invalid_argument("Survival prior descriptor has the wrong number of parameters for its kind");
+  }
+
+  double operator()(double t) const
+  {
+    if(exponential_rate_ > 0)
+      {
+	// Input checking
+	if(t < 0)
+	  {
+	    throw std::domain_error("Survival functions are defined on the nonnegative real line (t >= 0)");
+	  }
+
+	return -exponential_rate_ * t;
+      }
+
+    return implementation_->logS(t);
+  }
+
+  /** Return log(S_T(t1) / S_T(t0)) for 0 <= t0 <= t1, given logS0 = log S_T(t0) and logS1 = log S_T(t1), using the wrapped prior's closed form if it has one (and logS1 - logS0 otherwise)*/
+  double log_survival_ratio(double t0, double t1, double logS0, double logS1) const
+  {
+    if(exponential_rate_ > 0)
+      {
+	// Input checking
+	if( (t0 < 0) || (t1 < t0) )
+	  {
+	    throw std::domain_error("Interval endpoints must satisfy 0 <= t0 <= t1");
+	  }
+
+	return -exponential_rate_ * (t1 - t0);
+      }
+
+    const Implementation& implementation = *implementation_;
+    return implementation.log_survival_ratio ? implementation.log_survival_ratio(t0, t1) : logS1 - logS0;
+  }
+
+  /** Return the wrapped function*/
+  const std::function<double(double)>& function() const
+  {
+    return implementation_->logS;
+  }
+
+  /** Return the descriptor of the wrapped prior (CUSTOM if it is not one of the priors above)*/
+  const SurvivalPriorDescriptor& descriptor() const
+  {
+    return implementation_->descriptor;
+  }
+};
+
+
+/** A non-owning reference to a survival prior stored elsewhere, which must outlive every copy of the reference.  Filters holding a reference (such as SharedPriorPersistenceFilter) are constructed, copied and destroyed without allocating or modifying any shared reference count, so that many threads may create and destroy them concurrently without contention.*/
+template<typename SurvivalPrior>
+class SurvivalPriorReference
+{
+ protected:
+  const SurvivalPrior* prior_;
+
+ public:
+  SurvivalPriorReference(const SurvivalPrior& survival_prior) : prior_(&survival_prior) {}
+
+  /** A reference to a temporary would dangle*/
+  SurvivalPriorReference(const SurvivalPrior&&) = delete;
+
+  double operator()(double t) const
+  {
+    return (*prior_)(t);
+  }
+
+  /** Return the referenced prior*/
+  const SurvivalPrior& prior() const
+  {
+    return *prior_;
+  }
+
+  SurvivalPriorDescriptor descriptor() const
+  {
+    return describe_survival_prior(*prior_, 0);
+  }
+};
+
+
+/** Priors such as LogSurvivalFunction, which decide for themselves whether to compute log_survival_ratio() in closed form, accept the values of log S_T(t0) and log S_T(t1) as well*/
+template<typename SurvivalPrior>
+auto log_survival_ratio(const SurvivalPrior& survival_prior, double t0, double t1, double logS0, double logS1, int) -> decltype(survival_prior.log_survival_ratio(t0, t1, logS0, logS1))
+{
+  return survival_prior.log_survival_ratio(t0, t1, logS0, logS1);
+}
+
+/** A reference computes log_survival_ratio() as its referenced prior does*/
+template<typename SurvivalPrior>
+double log_survival_ratio(const SurvivalPriorReference<SurvivalPrior>& reference, double t0, double t1, double logS0, double logS1, int)
+{
+  return log_survival_ratio(reference.prior(), t0, t1, logS0, logS1, 0);
+}
+
+
+/** Given a log-survival function 'log_survival_function' (which is non-increasing), find the earliest time t >= t_min at which log S_T(t) <= log_s, to within an absolute tolerance of 'tolerance' * max(1, t).  The returned time always satisfies log S_T(t) <= log_s (so it may overestimate the exact crossing time by up to the tolerance, but never underestimates it).  Returns +infinity if log S_T(t) never falls to log_s.*/
+template<typename LogSurvival>
+double inverse_log_survival(const LogSurvival& log_survival_function, double log_s, double t_min, double tolerance = 1e-9)
+{
+  // The function whose root we seek
+  double f_lo = log_survival_function(t_min) - log_s;
+  if(f_lo <= 0)
+    {
+      return t_min;
+    }
+
+  // Bracket the crossing time by repeatedly doubling the search interval
+  double t_lo = t_min;
+  double step = std::max(t_min, 1.0);
+  double t_hi = t_min + step;
+  double f_hi = log_survival_function(t_hi) - log_s;
+  while(f_hi > 0)
+    {
+      t_lo = t_hi;
+      f_lo = f_hi;
+      step *= 2;
+      t_hi = t_min + step;
+      if(!(t_hi < std::numeric_limits<double>::max()))
+	{
+	  return std::numeric_limits<double>::infinity();
+	}
+      f_hi = log_survival_function(t_hi) - log_s;
+    }
+
+  // Refine the bracket [t_lo, t_hi] (with f(t_lo) > 0 >= f(t_hi)) using the
+  // Illinois variant of the method of false position, which converges
+  // superlinearly for smooth functions but, unlike the secant method, always
+  // retains a bracket.  We fall back to bisection if the interpolated point
+  // is not strictly inside the bracket.
+  int side = 0;
+  for(int iteration = 0; (iteration < 256) && (t_hi - t_lo > tolerance * std::max(1.0, t_hi)); ++iteration)
+    {
+      double t = t_hi - f_hi * (t_hi - t_lo) / (f_hi - f_lo);
+      if( !(t > t_lo) || !(t < t_hi) )
+	{
+	  t = 0.5 * (t_lo + t_hi);
+	}
+
+      double f = log_survival_function(t) - log_s;
+      if(f > 0)
+	{
+	  t_lo = t;
+	  f_lo = f;
+	  if(side == -1)
+	    f_hi *= 0.5;
+	  side = -1;
+	}
+      else
+	{
+	  t_hi = t;
+	  f_hi = f;
+	  if(side == 1)
+	    f_lo *= 0.5;
+	  side = 1;
+	}
+    }
+
+  return t_hi;
+}
+
+#endif //__PERSISTENCE_FILTER_PRIORS_H__
@@ -0,0 +1,125 @@
+#ifndef __PERSISTENCE_FILTER_PRUNING_INDEX_H__
+#define __PERSISTENCE_FILTER_PRUNING_INDEX_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "persistence_filter_bank.h"
+
+
+/** This class indexes the features of a PersistenceFilterBank by the time at
+ * which their posterior persistence probabilities will fall below a fixed
+ * threshold, so that a map can be pruned without predicting every feature on
+ * every cycle.
+ *
+ * Between observations, a filter's posterior p(X_t = 1 | Y_{1:N}) is
+ * proportional to S_T(t - t_init), and is therefore non-increasing in t.  The
+ * time at which it crosses the threshold is thus fixed until the filter's next
+ * update, and can be computed once (by inverting the survival function) and
+ * stored in a min-heap.  After updating (or adding) a feature in the bank,
+ * call update() to recompute its crossing time; pop_expired(t) then returns
+ * the k features whose beliefs have fallen below the threshold by time t in
+ * O(k log N) time.
+ *
+ * Superseded heap entries are invalidated lazily (each feature carries a
+ * generation counter), and the heap is rebuilt whenever stale entries come to
+ * outnumber live ones.
+ */
+
+class PersistencePruningIndex
+{
+ public:
+
+  /** The type used to identify features*/
+  typedef PersistenceFilterBank::FeatureID FeatureID;
+
+ protected:
+
+  struct Entry
+  {
+    double crossing_time;
+    FeatureID id;
+    uint64_t generation;
+
+    /** Orders entries so that std::push_heap() and friends build a min-heap on crossing_time*/
+    bool operator<(const Entry& other) const
+    {
+      return crossing_time > other.crossing_time;
+    }
+  };
+
+  struct Record
+  {
+    double crossing_time;
+    uint64_t generation;
+  };
+
+  /** The bank whose features are indexed*/
+  const PersistenceFilterBank& bank_;
+
+  /** The natural logarithm of the persistence probability threshold*/
+  double log_threshold_;
+
+  /** The relative tolerance to which crossing times are computed*/
+  double tolerance_;
+
+  /** A min-heap of (possibly stale) crossing times*/
+  std::vector<Entry> heap_;
+
+  /** The current crossing time and generation for each indexed feature*/
+  std::unordered_map<FeatureID, Record> records_;
+
+  /** The generation assigned to the next heap entry*/
+  uint64_t next_generation_;
+
+  /** Rebuild the heap from records_, discarding stale entries*/
+  void rebuild();
+
+ public:
+
+  /** Constructor accepting the bank whose features are to be indexed (which must outlive the index), the persistence probability threshold below which a feature is considered to have vanished, and the relative tolerance to which crossing times are computed.  The index is initially empty; call update() or update_all() to populate it.*/
+  PersistencePruningIndex(const PersistenceFilterBank& bank, double threshold, double tolerance = 1e-9);
+
+  /** Compute the time at which the belief for feature 'id' (in its current state in the bank) falls below the threshold.  This is never earlier than the feature's last observation time, and is +infinity if the belief never falls below the threshold.*/
+  double compute_crossing_time(FeatureID id) const;
+
+  /** Recompute the crossing time for feature 'id'; call this after adding or updating the feature in the bank*/
+  void update(FeatureID id);
+
+  /** Recompute the crossing times of every live feature in the bank*/
+  void update_all();
+
+  /** Stop tracking feature 'id'; returns false if it was not being tracked*/
+  bool remove(FeatureID id);
+
+  /** Remove from the index every feature whose belief has fallen below the threshold by time 'prediction_time', appending their IDs to 'expired' in order of crossing time.  Returns the number of features removed.*/
+  size_t pop_expired(double prediction_time, std::vector<FeatureID>& expired);
+
+  /** Return the stored crossing time of feature 'id', throwing std::out_of_range if it is not being tracked*/
+  double crossing_time(FeatureID id) const;
+
+  /** Return the earliest crossing time of any tracked feature (+infinity if none)*/
+  double next_crossing_time();
+
+  /** Return true if feature 'id' is being tracked*/
+  bool contains(FeatureID id) const
+  {
+    return records_.find(id) != records_.end();
+  }
+
+  /** Return the number of features being tracked*/
+  size_t size() const
+  {
+    return records_.size();
+  }
+
+  /** Return the persistence probability threshold*/
+  double threshold() const;
+
+  /** Nothing to do here*/
+  ~PersistencePruningIndex() {}
+};
+
+#endif //__PERSISTENCE_FILTER_PRUNING_INDEX_H__
@@ -0,0 +1,238 @@
+#ifndef __PERSISTENCE_FILTER_REORDERING_H__
+#define __PERSISTENCE_FILTER_REORDERING_H__
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+#include <boost/optional.hpp>
+
+#include "persistence_filter.h"
+
+
+/** A persistence filter that accepts observations arriving out of order, so
+ * long as they are not too far out of order.
+ *
+ * The filter retains a log of its most recent 'window_capacity' observations,
+ * together with the state of the filter immediately before each was
+ * incorporated.  An observation that is at least as recent as the last one
+ * incorporated is applied exactly as by BasicPersistenceFilter::update() (plus
+ * an O(1) append to the log).  A late observation is inserted into the log at
+ * its proper place:  the filter is rolled back to the state saved before the
+ * first later observation, and only that suffix of the recursion is
+ * recomputed.  The result is identical to having received the observations in
+ * timestamp order.
+ *
+ * A late observation can only be reintegrated if it is no older than the
+ * state saved with the oldest observation in the log (see
+ * earliest_reorderable_time()); older observations cause update() to throw
+ * std::domain_error, as BasicPersistenceFilter::update() does.
+ */
+
+template<typename SurvivalPrior>
+class BasicReorderingPersistenceFilter : protected BasicPersistenceFilter<SurvivalPrior>
+{
+ protected:
+
+  typedef BasicPersistenceFilter<SurvivalPrior> Filter;
+
+  /** The state of the filter (apart from its prior and initialization time) at some point in its history*/
+  struct State
+  {
+    double tN;
+    double logS_tN;
+    double logpY_tN;
+    boost::optional<double> logLY;
+    double logpY;
+  };
+
+  /** An observation, together with the state of the filter immediately before it was incorporated*/
+  struct Entry
+  {
+    bool detector_output;
+    double observation_time;
+    double P_M;
+    double P_F;
+    State state;
+  };
+
+  /** A ring buffer holding the most recent observations, in timestamp order*/
+  std::vector<Entry> log_;
+
+  /** The index in log_ of the oldest observation, and the number of observations in the log*/
+  size_t log_begin_;
+  size_t log_size_;
+
+  /** Return the i-th oldest observation in the log*/
+  Entry& entry(size_t i)
+  {
+    return log_[(log_begin_ + i) % log_.size()];
+  }
+
+  const Entry& entry(size_t i) const
+  {
+    return log_[(log_begin_ + i) % log_.size()];
+  }
+
+  State save_state() const
+  {
+    State state;
+    state.tN = this->tN_;
+    state.logS_tN = this->logS_tN_;
+    state.logpY_tN = this->logpY_tN_;
+    state.logLY = this->logLY_;
+    state.logpY = this->logpY_;
+    return state;
+  }
+
+  void restore_state(const State& state)
+  {
+    this->tN_ = state.tN;
+    this->logS_tN_ = state.logS_tN;
+    this->logpY_tN_ = state.logpY_tN;
+    this->logLY_ = state.logLY;
+    this->logpY_ = state.logpY;
+  }
+
+  /** Save the filter's state into 'e', and then incorporate the observation it holds*/
+  void apply(Entry& e)
+  {
+    e.state = save_state();
+    Filter::update(e.detector_output, e.observation_time, e.P_M, e.P_F);
+  }
+
+ public:
+
+  /** Constructor accepting the survival time prior p_T() (as for BasicPersistenceFilter), the initialization time, and the number of recent observations to retain for reordering*/
+  BasicReorderingPersistenceFilter(const SurvivalPrior& log_survival_function, double initialization_time = 0.0, size_t window_capacity = 16) : Filter(log_survival_function, initialization_time), log_(window_capacity), log_begin_(0), log_size_(0) {}
+
+  /** Updates the filter by incorporating a new detector output, which may be older than the most recently incorporated one.  The arguments have the same meaning as in BasicPersistenceFilter::update().  Throws std::domain_error if the observation is older than earliest_reorderable_time().*/
+  void update(bool detector_output, double observation_time, double P_M, double P_F);
+
+  /** Return the earliest observation time that update() can accept*/
+  double earliest_reorderable_time() const
+  {
+    return (log_size_ > 0) ? entry(0).state.tN : this->tN_;
+  }
+
+  /** Return the maximum number of observations retained for reordering*/
+  size_t window_capacity() const
+  {
+    return log_.size();
+  }
+
+  /** Return the number of observations currently retained for reordering*/
+  size_t window_size() const
+  {
+    return log_size_;
+  }
+
+  /** Return the underlying filter*/
+  const Filter& filter() const
+  {
+    return *this;
+  }
+
+  using Filter::predict;
+  using Filter::logS;
+  using Filter::shifted_logS;
+  using Filter::last_observation_time;
+  using Filter::initialization_time;
+  using Filter::likelihood;
+  using Filter::evidence;
+  using Filter::evidence_lower_sum;
+
+  /** Nothing to do here*/
+  ~BasicReorderingPersistenceFilter() {}
+};
+
+
+/** The reordering persistence filter with a type-erased survival time prior*/
+typedef BasicReorderingPersistenceFilter<LogSurvivalFunction> ReorderingPersistenceFilter;
+
+
+template<typename SurvivalPrior>
+void BasicReorderingPersistenceFilter<SurvivalPrior>::update(bool detector_output, double observation_time, double P_M, double P_F)
+{
+  // Input checking:
+  if(observation_time < earliest_reorderable_time())
+    {
+      throw std::domain_error("Current observation is older than the reorder window permits (observation_time >= earliest_reorderable_time)");
+    }
+
+  if( (P_M < 0) || (P_M > 1) )
+    {
+      throw std::domain_error("Probability of missed detection must be between 0 and 1");
+    }
+
+  if( (P_F < 0) || (P_F > 1) )
+    {
+      throw std::domain_error("Probability of false alarm must be between 0 and 1");
+    }
+
+  if(log_.empty())
+    {
+      // Reordering is disabled
+      Filter::update(detector_output, observation_time, P_M, P_F);
+      return;
+    }
+
+  // Find the position at which the new observation belongs:  after every
+  // logged observation whose time does not exceed its own
+  size_t position = log_size_;
+  while( (position > 0) && (entry(position - 1).observation_time > observation_time) )
+    {
+      --position;
+    }
+
+  // Roll the filter back to its state before the first later observation
+  if(position < log_size_)
+    {
+      restore_state(entry(position).state);
+    }
+
+  // Make room for the new observation, discarding the oldest one if the log is full
+  if(log_size_ < log_.size())
+    {
+      ++log_size_;
+    }
+  else if(position > 0)
+    {
+      log_begin_ = (log_begin_ + 1) % log_.size();
+      --position;
+    }
+  else
+    {
+      // The log is full and the new observation is older than every logged
+      // one, so it is the one that would be discarded:  incorporate it without
+      // logging it, and then replay the log
+      Filter::update(detector_output, observation_time, P_M, P_F);
+      for(size_t i = 0; i < log_size_; ++i)
+	{
+	  apply(entry(i));
+	}
+      return;
+    }
+
+  for(size_t i = log_size_ - 1; i > position; --i)
+    {
+      entry(i) = entry(i - 1);
+    }
+
+  Entry& e = entry(position);
+  e.detector_output = detector_output;
+  e.observation_time = observation_time;
+  e.P_M = P_M;
+  e.P_F = P_F;
+
+  // Recompute the suffix of the recursion
+  for(size_t i = position; i < log_size_; ++i)
+    {
+      apply(entry(i));
+    }
+}
+
+
+// ReorderingPersistenceFilter is explicitly instantiated in persistence_filter.cc
+extern template class BasicReorderingPersistenceFilter<LogSurvivalFunction>;
+
+#endif //__PERSISTENCE_FILTER_REORDERING_H__
@@ -0,0 +1,184 @@
+#ifndef __PERSISTENCE_FILTER_REVISIT_SCHEDULER_H__
+#define __PERSISTENCE_FILTER_REVISIT_SCHEDULER_H__
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "persistence_filter_bank.h"
+
+
+/** This class ranks the features of a PersistenceFilterBank by how much a
+ * new observation of each would be expected to tell us about its persistence,
+ * so that a robot can decide which parts of its map are most worth revisiting.
+ *
+ * If the posterior belief for a feature at the candidate revisit time t is
+ * p = p(X_t = 1 | Y_{1:N}), then a detector with missed-detection and
+ * false-alarm probabilities P_M and P_F reports y = 1 with probability
+ *
+ *   q = p(y = 1 | Y_{1:N}) = (1 - P_M) p + P_F (1 - p),
+ *
+ * and by Bayes' rule the belief at time t after incorporating y is
+ *
+ *   p(X_t = 1 | Y_{1:N}, y = 1) = (1 - P_M) p / q,
+ *   p(X_t = 1 | Y_{1:N}, y = 0) = P_M p / (1 - q),
+ *
+ * which is exactly the belief that PersistenceFilter::update() followed by
+ * predict(t) would produce.  Each feature is scored by the expected reduction
+ * in the uncertainty of its belief, measured either as the mutual information
+ * between X_t and y (the expected reduction in the entropy of the belief), or
+ * as the expected reduction in the variance p (1 - p) of X_t.
+ *
+ * The tracked features are kept in a binary max-heap indexed by bank slot, so
+ * that next_targets() returns the k highest-scoring features in O(k log k)
+ * time.  A feature's score depends only upon its own filter state (and the
+ * fixed candidate time and detector model), so after updating (or adding) a
+ * feature in the bank, call update() to rescore it in O(log N) time; this
+ * allocates nothing once the scheduler's per-slot arrays cover the bank.
+ * Changing the candidate time changes every belief, and (since the score of a
+ * feature first rises and then falls as its belief decays) reorders the
+ * features arbitrarily, so set_candidate_time() rescores the entire map in a
+ * single batched prediction and restores the heap in place, in O(N) time.
+ *
+ * Slot indices change when the bank is compacted, so call update_all() after
+ * PersistenceFilterBank::compact().
+ */
+
+class PersistenceRevisitScheduler
+{
+ public:
+
+  /** The type used to identify features*/
+  typedef PersistenceFilterBank::FeatureID FeatureID;
+
+  /** The measures of the expected reduction in belief uncertainty by which features can be ranked*/
+  enum Criterion
+  {
+    /** The mutual information (in nats) between X_t and the detector output y*/
+    INFORMATION_GAIN,
+
+    /** The expected reduction in the variance p (1 - p) of X_t*/
+    VARIANCE_REDUCTION
+  };
+
+ protected:
+
+  /** Marks slots whose features are not tracked*/
+  static const size_t NOT_TRACKED = static_cast<size_t>(-1);
+
+  /** The bank whose features are scheduled*/
+  const PersistenceFilterBank& bank_;
+
+  /** The detector model for the hypothetical observations*/
+  double P_M_;
+  double P_F_;
+
+  /** The time at which the next observations are expected to be made*/
+  double candidate_time_;
+
+  Criterion criterion_;
+
+  /** The slots of the tracked features, arranged as a binary heap in order of decreasing score*/
+  std::vector<size_t> heap_;
+
+  /** The position in heap_ of each slot's feature, or NOT_TRACKED*/
+  std::vector<size_t> heap_position_;
+
+  /** The current score of the feature tracked in each slot*/
+  std::vector<double> scores_;
+
+  /** The ID of the feature tracked in each slot (which outlives its removal from the bank)*/
+  std::vector<FeatureID> ids_;
+
+  /** The slot tracking each tracked feature (entries are only allocated when a feature is first tracked)*/
+  std::unordered_map<FeatureID, size_t> tracked_slots_;
+
+  /** Scratch storage for update_all(), retained between calls to avoid reallocation*/
+  std::vector<double> beliefs_;
+
+  /** Return true if the feature in slot 'a' is ranked ahead of that in slot 'b':  by decreasing score, breaking ties by ID so that the ranking is deterministic*/
+  bool ranks_before(size_t a, size_t b) const
+  {
+    return (scores_[a] > scores_[b]) || ( (scores_[a] == scores_[b]) && (ids_[a] < ids_[b]) );
+  }
+
+  /** Move the slot at position 'i' of heap_ towards the root or the leaves until the heap is ordered again*/
+  void sift_up(size_t i);
+  void sift_down(size_t i);
+
+  /** Extend the per-slot arrays to cover every slot in the bank*/
+  void cover_bank_slots();
+
+  /** Remove the feature tracked in slot 'slot' from the heap*/
+  void untrack_slot(size_t slot);
+
+  /** Score a feature whose belief at the candidate time is 'belief'*/
+  double score_belief(double belief) const;
+
+  /** Set the score of the feature in slot 'slot', inserting it into the heap if it is not yet tracked*/
+  void set_score(size_t slot, double score);
+
+ public:
+
+  /** Constructor accepting the bank whose features are to be scheduled (which must outlive the scheduler), the missed-detection and false-alarm probabilities P_M and P_F of the detector that will make the new observations, the candidate time at which they will be made, and the criterion by which features are ranked.  The scheduler is initially empty; call update() or update_all() to populate it.*/
+  PersistenceRevisitScheduler(const PersistenceFilterBank& bank, double P_M, double P_F, double candidate_time, Criterion criterion = INFORMATION_GAIN);
+
+  /** Compute the beliefs p(X_t = 1 | Y_{1:N}, y) that a filter whose belief at time t is 'belief' would hold after incorporating a detector output y obtained at time t, writing the belief following y = 1 into 'belief_if_detected' and that following y = 0 into 'belief_if_missed'.  Returns the predictive probability q = p(y = 1 | Y_{1:N}).*/
+  static double hypothetical_beliefs(double belief, double P_M, double P_F, double& belief_if_detected, double& belief_if_missed);
+
+  /** Return the mutual information (in nats) between X_t and a detector output y obtained at time t, for a filter whose belief at time t is 'belief'*/
+  static double expected_information_gain(double belief, double P_M, double P_F);
+
+  /** Return the expected reduction in the variance of X_t from a detector output y obtained at time t, for a filter whose belief at time t is 'belief'*/
+  static double expected_variance_reduction(double belief, double P_M, double P_F);
+
+  /** Compute the score of feature 'id' (in its current state in the bank).  A feature whose last observation is more recent than the candidate time is scored at the time of that observation.*/
+  double compute_score(FeatureID id) const;
+
+  /** Recompute the score of feature 'id'; call this after adding or updating the feature in the bank*/
+  void update(FeatureID id);
+
+  /** Recompute the scores of every live feature in the bank*/
+  void update_all();
+
+  /** Stop tracking feature 'id' (which may already have been removed from the bank); returns false if it was not being tracked*/
+  bool remove(FeatureID id);
+
+  /** Append the IDs of the (at most) 'k' highest-scoring features to 'targets', in order of decreasing score.  Returns the number of IDs appended.*/
+  size_t next_targets(size_t k, std::vector<FeatureID>& targets) const;
+
+  /** Return the stored score of feature 'id', throwing std::out_of_range if it is not being tracked*/
+  double score(FeatureID id) const;
+
+  /** Return the highest score of any tracked feature (0 if none)*/
+  double best_score() const
+  {
+    return heap_.empty() ? 0 : scores_[heap_[0]];
+  }
+
+  /** Change the candidate time at which the next observations will be made, and rescore every live feature in the bank*/
+  void set_candidate_time(double candidate_time);
+
+  /** Return the candidate time at which the next observations will be made*/
+  double candidate_time() const
+  {
+    return candidate_time_;
+  }
+
+  /** Return true if feature 'id' is being tracked*/
+  bool contains(FeatureID id) const
+  {
+    return tracked_slots_.find(id) != tracked_slots_.end();
+  }
+
+  /** Return the number of features being tracked*/
+  size_t size() const
+  {
+    return heap_.size();
+  }
+
+  /** Nothing to do here*/
+  ~PersistenceRevisitScheduler() {}
+};
+
+#endif //__PERSISTENCE_FILTER_REVISIT_SCHEDULER_H__
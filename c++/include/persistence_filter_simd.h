@@ -0,0 +1,69 @@
+#ifndef __PERSISTENCE_FILTER_SIMD_H__
+#define __PERSISTENCE_FILTER_SIMD_H__
+
+#include <cstddef>
+
+struct DetectorLikelihoods;
+
+/** Batched versions of the log-domain arithmetic used by the persistence
+ * filter.  Each kernel is implemented three times:  a scalar fallback built on
+ * the routines in persistence_filter_math.h (logsum(), logdiff() and
+ * log1mexp()) and, for fused_log_update_batch(), on the fused kernel
+ * fused_log_update() in persistence_filter_detector_model.h; and AVX2 and
+ * AVX-512 implementations that are selected at runtime according to the
+ * capabilities of the host CPU.
+ *
+ * The vectorized implementations use their own polynomial approximations of
+ * exp(), expm1() and log1p(), which are accurate to within 1, 1 and 2 units in
+ * the last place (ULP), respectively.  Consequently, the results of the batched kernels
+ * agree with those of the scalar fallback to within
+ * PERSISTENCE_FILTER_SIMD_MAX_ULP ULP, measured as follows:
+ *
+ * - exp_batch:  ULP of the result.
+ * - logsum_batch:  ULP of max(|logx|, |logy|, 1), the scale of the
+ *   intermediates in log(x) + log1p(y/x).
+ * - logdiff_batch:  ULP of max(|logx|, 1).  (As in log1mexp(), 1 - y/x is
+ *   computed as -expm1(logy - logx) when y/x > 1/2, so that it does not
+ *   suffer cancellation.)
+ * - fused_log_update_batch:  ULP of max(|log_scale|, 1), where log_scale is
+ *   the larger of logLY and logpY_tN + logS0 (the scale by which
+ *   fused_log_update() divides its sums).
+ *
+ * These bounds hold for exponents in [-708.39, 709].  Exponents below -708.39
+ * (the point at which GSL reports underflow) produce exactly 0, matching the
+ * scalar fallback; exponents above 709 saturate to +infinity.
+ */
+
+/** The maximum discrepancy (in the ULP measures described above) between the results of the vectorized kernels and the scalar fallback*/
+#define PERSISTENCE_FILTER_SIMD_MAX_ULP 4
+
+/** The instruction sets for which kernels are available*/
+enum SIMDInstructionSet
+  {
+    SIMD_SCALAR = 0,
+    SIMD_AVX2 = 1,
+    SIMD_AVX512 = 2
+  };
+
+/** Return the instruction set that the batched kernels currently dispatch to.  By default this is the most capable instruction set supported by the host CPU.*/
+SIMDInstructionSet simd_instruction_set();
+
+/** Select the instruction set that the batched kernels dispatch to (e.g. in order to compare against the scalar fallback).  Requests for an instruction set that the host CPU does not support fall back to the best supported one.  Returns the instruction set actually selected.*/
+SIMDInstructionSet set_simd_instruction_set(SIMDInstructionSet instruction_set);
+
+/** Return the most capable instruction set supported by the host CPU*/
+SIMDInstructionSet best_supported_simd_instruction_set();
+
+/** Computes out[i] = logsum(logx[i], logy[i]) for i = 0, ..., n - 1.  'out' may alias either input.*/
+void logsum_batch(const double* logx, const double* logy, double* out, size_t n);
+
+/** Computes out[i] = logdiff(logx[i], logy[i]) for i = 0, ..., n - 1.  As with logdiff(), we require logx[i] >= logy[i]; otherwise std::domain_error is thrown before any output is written.  'out' may alias either input.*/
+void logdiff_batch(const double* logx, const double* logy, double* out, size_t n);
+
+/** Computes out[i] = exp(x[i]) for i = 0, ..., n - 1, returning 0 wherever the exponential underflows.  'out' may alias 'x'.*/
+void exp_batch(const double* x, double* out, size_t n);
+
+/** Computes fused_log_update(logLY[i], logpY_tN[i], logS0[i], logS1[i], log_ratio[i], likelihoods[detector_outputs[i] ? 1 : 0], updated_logLY[i], updated_logpY[i]) for i = 0, ..., n - 1, where likelihoods[0] and likelihoods[1] are the likelihoods of the detector outputs false and true.  The vectorized kernels evaluate the scaled sums for a whole vector of filters at once, and recompute any element whose sums underflow with fused_log_update() itself.  The outputs may alias any of the inputs.*/
+void fused_log_update_batch(const double* logLY, const double* logpY_tN, const double* logS0, const double* logS1, const double* log_ratio, const unsigned char* detector_outputs, const DetectorLikelihoods* likelihoods, double* updated_logLY, double* updated_logpY, size_t n);
+
+#endif //__PERSISTENCE_FILTER_SIMD_H__
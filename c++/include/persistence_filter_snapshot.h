@@ -0,0 +1,158 @@
+#ifndef __PERSISTENCE_FILTER_SNAPSHOT_H__
+#define __PERSISTENCE_FILTER_SNAPSHOT_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+#include "persistence_filter_bank.h"
+#include "persistence_filter_priors.h"
+
+
+/** Binary snapshots of the state of a PersistenceFilterBank.
+ *
+ * A snapshot file consists of a 64-byte header, the parameters of the
+ * survival prior (num_prior_parameters doubles, starting at
+ * prior_parameters_offset), and six arrays, each holding one entry per
+ * feature and each beginning on a 64-byte boundary:
+ *
+ *   ids                      uint64_t, in strictly increasing order
+ *   initialization_times     double
+ *   last_observation_times   double
+ *   log_likelihoods          double    log p(Y_{1:N} | t_N)
+ *   log_evidence_lower_sums  double    log L(Y_{1:N}) (-infinity before the first observation)
+ *   log_evidences            double    log p(Y_{1:N})
+ *
+ * Numbers are stored in the byte order of the machine that wrote the file;
+ * the header records this so that a mismatch is detected on loading.  The
+ * header also records the survival prior's SurvivalPriorDescriptor, so that
+ * banks whose prior is one of the built-in ones can be restored without
+ * re-specifying it.
+ *
+ * Because the arrays are stored exactly as they are laid out in memory, a
+ * PersistenceFilterSnapshot can memory-map a file and answer queries directly
+ * from the mapped pages (so that "loading" costs only a handful of system
+ * calls and a pass over the IDs to check their order), or bulk-copy it into a
+ * PersistenceFilterBank for further updating.
+ */
+
+
+/** The current version of the snapshot file format*/
+#define PERSISTENCE_FILTER_SNAPSHOT_VERSION 2
+
+/** The layout of the header at the start of each snapshot file*/
+struct PersistenceFilterSnapshotHeader
+{
+  char magic[8];  // "PFSNAP\r\n"
+  uint32_t version;  // PERSISTENCE_FILTER_SNAPSHOT_VERSION
+  uint32_t byte_order;  // 0x01020304, as written by the producing machine
+  uint64_t num_features;
+  uint32_t prior_kind;  // A SurvivalPriorDescriptor::Kind
+  uint32_t num_prior_parameters;
+  uint64_t prior_parameters_offset;  // The offset of the prior's parameters from the start of the file
+  uint64_t reserved;
+  uint64_t data_offset;  // The offset of the first array from the start of the file
+  uint64_t array_stride;  // The distance in bytes between the starts of consecutive arrays
+};
+
+
+/** Write the state of every live feature in 'bank' to the snapshot file 'filename'.  The file is written and synced under a temporary name, then renamed over 'filename' and its directory synced, so that when this returns the new snapshot is durably stored, and an existing snapshot is never left partially overwritten.  Throws std::runtime_error on I/O failure, after removing the temporary file.*/
+void save_persistence_filter_snapshot(const PersistenceFilterBank& bank, const std::string& filename);
+
+
+/** A read-only, memory-mapped view of a snapshot file.  Queries are answered directly from the mapped file (locating features by binary search); restore() copies its contents into a PersistenceFilterBank.*/
+class PersistenceFilterSnapshot
+{
+ public:
+
+  /** The type used to identify features*/
+  typedef PersistenceFilterBank::FeatureID FeatureID;
+
+ protected:
+
+  /** The mapped file*/
+  void* mapping_;
+  size_t mapping_size_;
+
+  const PersistenceFilterSnapshotHeader* header_;
+
+  /** The survival prior recorded in the file*/
+  SurvivalPriorDescriptor descriptor_;
+
+  const FeatureID* ids_;
+  const double* init_time_;
+  const double* tN_;
+  const double* logpY_tN_;
+  const double* logLY_;
+  const double* logpY_;
+
+  /** The survival time prior shared by all of the filters in the snapshot*/
+  LogSurvivalFunction logS_;
+
+  /** Map and validate the file 'filename', returning its prior descriptor*/
+  static SurvivalPriorDescriptor map_file(const std::string& filename, void*& mapping, size_t& mapping_size);
+
+  /** Set the array pointers from mapping_*/
+  void locate_arrays();
+
+  /** Return the index of feature 'id', throwing std::out_of_range if it is not present*/
+  size_t checked_index(FeatureID id) const;
+
+ public:
+
+  /** Map the snapshot file 'filename', reconstructing its survival prior from the descriptor stored in the file.  Throws std::runtime_error if the file cannot be mapped or is not a valid snapshot (including if its IDs are not strictly increasing), and std::invalid_argument if its prior is CUSTOM.*/
+  PersistenceFilterSnapshot(const std::string& filename);
+
+  /** Map the snapshot file 'filename', using 'log_survival_function' as the prior (which is necessary if the file's prior is CUSTOM)*/
+  PersistenceFilterSnapshot(const std::string& filename, const LogSurvivalFunction& log_survival_function);
+
+  /** Return the number of features in the snapshot*/
+  size_t size() const
+  {
+    return header_->num_features;
+  }
+
+  /** Return the descriptor of the survival prior recorded in the file*/
+  const SurvivalPriorDescriptor& descriptor() const
+  {
+    return descriptor_;
+  }
+
+  /** Return the function computing the logarithm of the survival function*/
+  const LogSurvivalFunction& logS() const
+  {
+    return logS_;
+  }
+
+  /** Return the index of feature 'id' in the (sorted) arrays below, or size() if it is not present*/
+  size_t find(FeatureID id) const;
+
+  /** Return true if the snapshot contains feature 'id'*/
+  bool contains(FeatureID id) const
+  {
+    return find(id) < size();
+  }
+
+  /** The mapped arrays, each of length size()*/
+  const FeatureID* ids() const { return ids_; }
+  const double* initialization_times() const { return init_time_; }
+  const double* last_observation_times() const { return tN_; }
+  const double* log_likelihoods() const { return logpY_tN_; }
+  const double* log_evidence_lower_sums() const { return logLY_; }
+  const double* log_evidences() const { return logpY_; }
+
+  /** Compute the posterior feature persistence probability p(X_t = 1 | Y_{1:N}) for feature 'id' at time t >= tN.  Throws std::out_of_range if there is no such feature.*/
+  double predict(FeatureID id, double prediction_time) const;
+
+  /** Add every feature in the snapshot to 'bank'.  Throws std::invalid_argument (leaving the bank unmodified) if the bank already contains any of them.*/
+  void restore(PersistenceFilterBank& bank) const;
+
+  /** Unmap the file*/
+  ~PersistenceFilterSnapshot();
+
+ private:
+  PersistenceFilterSnapshot(const PersistenceFilterSnapshot&);
+  PersistenceFilterSnapshot& operator=(const PersistenceFilterSnapshot&);
+};
+
+#endif //__PERSISTENCE_FILTER_SNAPSHOT_H__
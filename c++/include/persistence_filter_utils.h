@@ -1,14 +1,94 @@
 #ifndef __PERSISTENCE_FILTER_UTILS_H__
 #define __PERSISTENCE_FILTER_UTILS_H__
 
-/**This function implements the survival function for the general-purpose survival-time prior developed in the RSS workshop paper "Towards Lifelong Feature-Based Mapping in Semi-Static Environments".*/
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// logsum() and logdiff() are defined (inline) here
+#include "persistence_filter_math.h"
+
+/**This function implements the survival function for the general-purpose survival-time prior developed in the RSS workshop paper "Towards Lifelong Feature-Based Mapping in Semi-Static Environments".  Throws std::domain_error unless t >= 0 and 0 < lambda_l < lambda_u.*/
 double log_general_purpose_survival_function(double t, double lambda_l, double lambda_u);
 
-/**Computes log(x + y) from log(x), log(y) in a numerically stable way.*/
-double logsum(double logx, double logy);
-  
-/**Computes log(x - y) from log(x), log(y) in a numerically stable way.  Note that here we require x > y.*/
-double logdiff(double logx, double logy);
+/**A precomputed approximation of log_general_purpose_survival_function() for a fixed pair (lambda_l, lambda_u).
+ *
+ * Evaluating the general-purpose survival function directly requires two exponential integrals and several logarithms.  This class instead tabulates log S_T(t) once, at construction, so that each subsequent evaluation costs a single logarithm and a short polynomial.  The domain t >= 0 is split into three regions:
+ *
+ * - For small t (lambda_u * t < 0.05), we use the convergent power series for S_T(t) = [E1(lambda_l t) - E1(lambda_u t)] / log(lambda_u / lambda_l), truncated after the t^8 term.
+ * - For large t (lambda_l * t > 50), we use the asymptotic expansion E1(x) ~ exp(-x) / x * sum_k (-1)^k k! / x^k, truncated after the x^-16 term.
+ * - In between, we use a piecewise Chebyshev interpolant of log S_T(t) in the variable log(t), on uniformly-spaced pieces so that locating the correct piece takes O(1) time.  The number of pieces is doubled until the interpolant agrees with the exact value to within the requested tolerance at every test point (the Chebyshev-Lobatto points of each piece, which interleave the interpolation nodes, and the points midway between them).
+ *
+ * The accuracy bound is absolute in log-space (and hence relative in S_T(t)).  The maximum error observed during construction is available through max_error().
+ *
+ * Instances are cheap to copy (the coefficient table is shared), and are callable, so that they can be passed directly to PersistenceFilter in place of a std::bind of log_general_purpose_survival_function.
+ */
+class GeneralPurposeLogSurvivalTable
+{
+ protected:
+
+  /** The tabulated data, which is shared between copies*/
+  struct Table
+  {
+    double lambda_l;
+    double lambda_u;
+
+    /** Power series for the small-t region:  S_T(t) - 1 = t * (small_t_coeffs[0] + small_t_coeffs[1] * t + ...) for t < t_lo*/
+    double t_lo;
+    std::vector<double> small_t_coeffs;
+
+    /** Piecewise Chebyshev interpolant over u = log(t) in [u_lo, u_hi]; piece i holds coefficients [i * (degree + 1), (i + 1) * (degree + 1))*/
+    double u_lo;
+    double u_hi;
+    double inv_piece_width;
+    size_t num_pieces;
+    std::vector<double> chebyshev_coeffs;
+
+    /** The start of the large-t region*/
+    double t_hi;
+
+    /** log(log(lambda_u / lambda_l)), the normalization constant of the prior*/
+    double log_log_ratio;
+
+    /** The maximum absolute error (in log S_T) observed at the test points during construction*/
+    double max_error;
+  };
+
+  std::shared_ptr<const Table> table_;
+
+ public:
+
+  /** The degree of the Chebyshev interpolant on each piece*/
+  static const size_t DEGREE = 15;
+
+  /** Construct the table for the general-purpose prior with parameters lambda_l < lambda_u, so that the tabulated log-survival function agrees with the exact one to within 'tolerance' (absolute error in log S_T).  Throws std::domain_error if the parameters are invalid, or if the tolerance cannot be met.*/
+  GeneralPurposeLogSurvivalTable(double lambda_l, double lambda_u, double tolerance = 1e-12);
+
+  /** Evaluate log S_T(t)*/
+  double operator()(double t) const;
+
+  double lambda_l() const
+  {
+    return table_->lambda_l;
+  }
+
+  double lambda_u() const
+  {
+    return table_->lambda_u;
+  }
+
+  /** Return the number of Chebyshev pieces used to cover the intermediate region*/
+  size_t num_pieces() const
+  {
+    return table_->num_pieces;
+  }
+
+  /** Return the maximum absolute error in log S_T observed while verifying the table at construction*/
+  double max_error() const
+  {
+    return table_->max_error;
+  }
+};
 
 
 #endif //__PERSISTENCE_FILTER_UTILS_H__
@@ -0,0 +1,447 @@
+#include "persistence_filter_bank.h"
+#include "persistence_filter_log_survival_cache.h"
+#include "persistence_filter_utils.h"
+#include "persistence_filter_simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+// The cache of log-survival values used by the batch operations.  Each
+// thread has its own, so that concurrent (const) batch queries remain safe,
+// and it is cleared at the start of every batch, so that it never mixes the
+// values of different banks' priors.
+static LogSurvivalCache& batch_log_survival_cache()
+{
+  static thread_local LogSurvivalCache cache;
+  cache.clear();
+  return cache;
+}
+
+size_t PersistenceFilterBank::checked_slot(FeatureID id) const
+{
+  std::unordered_map<FeatureID, size_t>::const_iterator it = slots_.find(id);
+  if(it == slots_.end())
+    {
+      throw std::out_of_range("No feature with the requested ID is stored in this PersistenceFilterBank");
+    }
+  return it->second;
+}
+
+void PersistenceFilterBank::reserve(size_t num_features)
+{
+  ids_.reserve(num_features);
+  live_.reserve(num_features);
+  init_time_.reserve(num_features);
+  tN_.reserve(num_features);
+  logS_tN_.reserve(num_features);
+  logpY_tN_.reserve(num_features);
+  logLY_.reserve(num_features);
+  observed_.reserve(num_features);
+  logpY_.reserve(num_features);
+  slots_.reserve(num_features);
+}
+
+size_t PersistenceFilterBank::add(FeatureID id, double initialization_time)
+{
+  if(contains(id))
+    {
+      throw std::invalid_argument("A feature with the requested ID is already stored in this PersistenceFilterBank");
+    }
+
+  size_t slot = ids_.size();
+
+  // Initialize the new filter's state exactly as PersistenceFilter's constructor does
+  ids_.push_back(id);
+  live_.push_back(1);
+  init_time_.push_back(initialization_time);
+  tN_.push_back(initialization_time);
+  logS_tN_.push_back(0.0);
+  logpY_tN_.push_back(0.0);
+  logLY_.push_back(-std::numeric_limits<double>::infinity());
+  observed_.push_back(0);
+  logpY_.push_back(0.0);
+
+  slots_[id] = slot;
+  return slot;
+}
+
+void PersistenceFilterBank::append(size_t num_features, const FeatureID* ids, const double* initialization_times, const double* last_observation_times, const double* log_likelihoods, const double* log_evidence_lower_sums, const double* log_evidences)
+{
+  size_t first_slot = ids_.size();
+
+  // Register the new IDs first, so that the bank can be restored if one of them is a duplicate
+  slots_.reserve(slots_.size() + num_features);
+  for(size_t i = 0; i < num_features; ++i)
+    {
+      if(!slots_.insert(std::make_pair(ids[i], first_slot + i)).second)
+	{
+	  for(size_t j = 0; j < i; ++j)
+	    {
+	      slots_.erase(ids[j]);
+	    }
+	  throw std::invalid_argument("A feature with the requested ID is already stored in this PersistenceFilterBank");
+	}
+    }
+
+  ids_.insert(ids_.end(), ids, ids + num_features);
+  live_.insert(live_.end(), num_features, 1);
+  init_time_.insert(init_time_.end(), initialization_times, initialization_times + num_features);
+  tN_.insert(tN_.end(), last_observation_times, last_observation_times + num_features);
+  logpY_tN_.insert(logpY_tN_.end(), log_likelihoods, log_likelihoods + num_features);
+  logLY_.insert(logLY_.end(), log_evidence_lower_sums, log_evidence_lower_sums + num_features);
+  logpY_.insert(logpY_.end(), log_evidences, log_evidences + num_features);
+
+  // Recover the observation flags and the cached values of the prior from the restored states
+  observed_.resize(ids_.size());
+  logS_tN_.resize(ids_.size());
+  for(size_t slot = first_slot; slot < ids_.size(); ++slot)
+    {
+      restore_observed(slot);
+    }
+}
+
+bool PersistenceFilterBank::remove(FeatureID id)
+{
+  std::unordered_map<FeatureID, size_t>::iterator it = slots_.find(id);
+  if(it == slots_.end())
+    {
+      return false;
+    }
+
+  live_[it->second] = 0;
+  slots_.erase(it);
+  return true;
+}
+
+void PersistenceFilterBank::compact()
+{
+  // Nothing to do if there are no dead slots
+  if(slots_.size() == ids_.size())
+    {
+      return;
+    }
+
+  // Slide each live slot down over the dead ones preceding it
+  size_t dest = 0;
+  for(size_t src = 0; src < ids_.size(); ++src)
+    {
+      if(!live_[src])
+	{
+	  continue;
+	}
+
+      if(dest != src)
+	{
+	  ids_[dest] = ids_[src];
+	  live_[dest] = 1;
+	  init_time_[dest] = init_time_[src];
+	  tN_[dest] = tN_[src];
+	  logS_tN_[dest] = logS_tN_[src];
+	  logpY_tN_[dest] = logpY_tN_[src];
+	  logLY_[dest] = logLY_[src];
+	  observed_[dest] = observed_[src];
+	  logpY_[dest] = logpY_[src];
+
+	  slots_[ids_[dest]] = dest;
+	}
+      ++dest;
+    }
+
+  ids_.resize(dest);
+  live_.resize(dest);
+  init_time_.resize(dest);
+  tN_.resize(dest);
+  logS_tN_.resize(dest);
+  logpY_tN_.resize(dest);
+  logLY_.resize(dest);
+  observed_.resize(dest);
+  logpY_.resize(dest);
+}
+
+void PersistenceFilterBank::update_slot(size_t slot, bool detector_output, double observation_time, double P_M, double P_F)
+{
+  PERSISTENCE_FILTER_INSTRUMENT_CALL(BANK_UPDATE);
+
+  // Input checking:
+  if(observation_time < tN_[slot])
+    {
+      throw std::domain_error("Current observation must be at least as recent as the last incorporated observation (observation_time >= last_observation_time)");
+    }
+
+  if( (P_M < 0) || (P_M > 1) )
+    {
+      throw std::domain_error("Probability of missed detection must be between 0 and 1");
+    }
+
+  if( (P_F < 0) || (P_F > 1) )
+    {
+      throw std::domain_error("Probability of false alarm must be between 0 and 1");
+    }
+
+  update_slot_likelihoods(slot, observation_time, DetectorLikelihoods::compute(detector_output, P_M, P_F));
+}
+
+void PersistenceFilterBank::update_slot(size_t slot, bool detector_output, double observation_time, const DetectorModel& detector_model)
+{
+  PERSISTENCE_FILTER_INSTRUMENT_CALL(BANK_UPDATE);
+
+  // Input checking (the model's error rates were validated when it was constructed):
+  if(observation_time < tN_[slot])
+    {
+      throw std::domain_error("Current observation must be at least as recent as the last incorporated observation (observation_time >= last_observation_time)");
+    }
+
+  update_slot_likelihoods(slot, observation_time, detector_model.likelihoods(detector_output));
+}
+
+void PersistenceFilterBank::update_slot_likelihoods(size_t slot, double observation_time, const DetectorLikelihoods& likelihoods)
+{
+  // This is the same recursion as PersistenceFilter::update(); see that function for details.
+  double logS1 = shifted_logS(slot, observation_time);
+  PERSISTENCE_FILTER_COUNT_FALLBACK_IF(!observed_[slot] && (logS1 < PERSISTENCE_FILTER_LOG_DBL_MIN), SURVIVAL_UNDERFLOW);
+  double log_ratio = logS_.log_survival_ratio(tN_[slot] - init_time_[slot], observation_time - init_time_[slot], logS_tN_[slot], logS1);
+
+  fused_log_update(logLY_[slot], logpY_tN_[slot], logS_tN_[slot], logS1, log_ratio, likelihoods, logLY_[slot], logpY_[slot]);
+
+  //Update the measurement likelihood pY_tN
+  logpY_tN_[slot] += likelihoods.log_present;
+
+  //Update the current observation time
+  tN_[slot] = observation_time;
+  logS_tN_[slot] = logS1;
+  observed_[slot] = 1;
+}
+
+double PersistenceFilterBank::predict_slot(size_t slot, double prediction_time) const
+{
+  PERSISTENCE_FILTER_INSTRUMENT_CALL(BANK_PREDICT);
+
+  // Input checking
+  if(prediction_time < tN_[slot])
+    {
+      throw std::domain_error("Prediction time must be at least as recent as the last incorporated observation (prediction_time >= last_observation_time)");
+    }
+
+  double log_belief = logpY_tN_[slot] - logpY_[slot] + shifted_logS(slot, prediction_time);
+  PERSISTENCE_FILTER_COUNT_FALLBACK_IF(log_belief < PERSISTENCE_FILTER_LOG_DBL_MIN, BELIEF_UNDERFLOW);
+  return clamped_exp(log_belief);
+}
+
+template<typename DetectorOutputs>
+void PersistenceFilterBank::update_batch_impl(const FeatureID* ids, const DetectorOutputs& detector_outputs, size_t num_features, double observation_time, double P_M, double P_F)
+{
+  PERSISTENCE_FILTER_INSTRUMENT_CALL(BANK_UPDATE_BATCH);
+
+  // Input checking (we validate the entire batch before modifying any filter)
+  if( (P_M < 0) || (P_M > 1) )
+    {
+      throw std::domain_error("Probability of missed detection must be between 0 and 1");
+    }
+
+  if( (P_F < 0) || (P_F > 1) )
+    {
+      throw std::domain_error("Probability of false alarm must be between 0 and 1");
+    }
+
+  if(num_features == 0)
+    {
+      return;
+    }
+
+  batch_slots_.resize(num_features);
+  for(size_t i = 0; i < num_features; ++i)
+    {
+      batch_slots_[i] = checked_slot(ids[i]);
+      if(observation_time < tN_[batch_slots_[i]])
+	{
+	  throw std::domain_error("Current observation must be at least as recent as the last incorporated observation (observation_time >= last_observation_time)");
+	}
+    }
+
+  // If a feature appears more than once in this batch, its updates must be
+  // applied one after the other, so we fall back to the sequential path
+  batch_sorted_slots_.assign(batch_slots_.begin(), batch_slots_.end());
+  std::sort(batch_sorted_slots_.begin(), batch_sorted_slots_.end());
+  if(std::adjacent_find(batch_sorted_slots_.begin(), batch_sorted_slots_.end()) != batch_sorted_slots_.end())
+    {
+      PERSISTENCE_FILTER_COUNT_FALLBACK_IF(true, BANK_BATCH_SEQUENTIAL);
+      for(size_t i = 0; i < num_features; ++i)
+	update_slot(batch_slots_[i], detector_outputs[i], observation_time, P_M, P_F);
+      return;
+    }
+
+  // Since every observation in the batch shares the same detector error
+  // rates, we only need to compute the likelihoods of each detector output once
+  DetectorLikelihoods likelihoods[2] = {DetectorLikelihoods::compute(false, P_M, P_F), DetectorLikelihoods::compute(true, P_M, P_F)};
+
+  // Gather each filter's state together with the shifted log-survival
+  // function at its previous observation time (saved by the previous update)
+  // and at the current one.  For a filter that has not yet incorporated any
+  // observations, the saved value is log S_T(0) = 0, which together with
+  // log L(Y_{1:0}) = -infinity reduces the recursion to the special case of
+  // the first observation.  Features initialized at the same time share their
+  // elapsed times, so we memoize the prior's values.
+  LogSurvivalCache& cache = batch_log_survival_cache();
+  batch_logLY_.resize(num_features);
+  batch_logpY_tN_.resize(num_features);
+  batch_logS0_.resize(num_features);
+  batch_logS1_.resize(num_features);
+  batch_log_ratio_.resize(num_features);
+  batch_detector_outputs_.resize(num_features);
+  for(size_t i = 0; i < num_features; ++i)
+    {
+      size_t slot = batch_slots_[i];
+      double t0 = tN_[slot] - init_time_[slot];
+      double t1 = observation_time - init_time_[slot];
+      batch_logLY_[i] = logLY_[slot];
+      batch_logpY_tN_[i] = logpY_tN_[slot];
+      batch_logS0_[i] = logS_tN_[slot];
+      batch_logS1_[i] = cache_log_survival_ ? cache(logS_, t1) : logS_(t1);
+      batch_log_ratio_[i] = logS_.log_survival_ratio(t0, t1, batch_logS0_[i], batch_logS1_[i]);
+      batch_detector_outputs_[i] = detector_outputs[i] ? 1 : 0;
+      PERSISTENCE_FILTER_COUNT_FALLBACK_IF(!observed_[slot] && (batch_logS1_[i] < PERSISTENCE_FILTER_LOG_DBL_MIN), SURVIVAL_UNDERFLOW);
+    }
+
+  // The same fused recursion as update_slot_likelihoods(), for the entire
+  // batch at once (we reuse batch_logLY_ and batch_log_ratio_ to hold the
+  // updated lower sums and evidence)
+  fused_log_update_batch(&batch_logLY_[0], &batch_logpY_tN_[0], &batch_logS0_[0], &batch_logS1_[0], &batch_log_ratio_[0], &batch_detector_outputs_[0], likelihoods, &batch_logLY_[0], &batch_log_ratio_[0], num_features);
+  for(size_t i = 0; i < num_features; ++i)
+    {
+      size_t slot = batch_slots_[i];
+      logLY_[slot] = batch_logLY_[i];
+      logpY_[slot] = batch_log_ratio_[i];
+
+      //Update the measurement likelihood pY_tN
+      logpY_tN_[slot] += likelihoods[batch_detector_outputs_[i]].log_present;
+
+      //Update the current observation time
+      tN_[slot] = observation_time;
+      logS_tN_[slot] = batch_logS1_[i];
+      observed_[slot] = 1;
+    }
+}
+
+void PersistenceFilterBank::update_batch(const FeatureID* ids, const bool* detector_outputs, size_t num_features, double observation_time, double P_M, double P_F)
+{
+  update_batch_impl(ids, detector_outputs, num_features, observation_time, P_M, P_F);
+}
+
+void PersistenceFilterBank::update_batch(const std::vector<FeatureID>& ids, const std::vector<bool>& detector_outputs, double observation_time, double P_M, double P_F)
+{
+  if(ids.size() != detector_outputs.size())
+    {
+      throw std::invalid_argument("The number of feature IDs must match the number of detector outputs");
+    }
+
+  if(!ids.empty())
+    {
+      update_batch_impl(&ids[0], detector_outputs, ids.size(), observation_time, P_M, P_F);
+    }
+}
+
+void PersistenceFilterBank::predict_batch(const FeatureID* ids, size_t num_features, double prediction_time, double* beliefs) const
+{
+  PERSISTENCE_FILTER_INSTRUMENT_CALL(BANK_PREDICT_BATCH);
+
+  LogSurvivalCache& cache = batch_log_survival_cache();
+  for(size_t i = 0; i < num_features; ++i)
+    {
+      size_t slot = checked_slot(ids[i]);
+
+      // Input checking
+      if(prediction_time < tN_[slot])
+	{
+	  throw std::domain_error("Prediction time must be at least as recent as the last incorporated observation (prediction_time >= last_observation_time)");
+	}
+
+      double t = prediction_time - init_time_[slot];
+      beliefs[i] = logpY_tN_[slot] - logpY_[slot] + (cache_log_survival_ ? cache(logS_, t) : logS_(t));
+      PERSISTENCE_FILTER_COUNT_FALLBACK_IF(beliefs[i] < PERSISTENCE_FILTER_LOG_DBL_MIN, BELIEF_UNDERFLOW);
+    }
+
+  exp_batch(beliefs, beliefs, num_features);
+}
+
+void PersistenceFilterBank::predict_batch(const std::vector<FeatureID>& ids, double prediction_time, std::vector<double>& beliefs) const
+{
+  beliefs.resize(ids.size());
+  if(!ids.empty())
+    {
+      predict_batch(&ids[0], ids.size(), prediction_time, &beliefs[0]);
+    }
+}
+
+void PersistenceFilterBank::predict_many(const FeatureID* ids, size_t num_features, const double* prediction_times, size_t num_times, double* beliefs) const
+{
+  PERSISTENCE_FILTER_INSTRUMENT_CALL(BANK_PREDICT_BATCH);
+
+  // Input checking (only the earliest prediction time need be compared with each feature's last observation)
+  if(num_times == 0)
+    {
+      for(size_t i = 0; i < num_features; ++i)
+	checked_slot(ids[i]);
+      return;
+    }
+
+  double earliest_time = *std::min_element(prediction_times, prediction_times + num_times);
+  for(size_t i = 0; i < num_features; ++i)
+    {
+      if(earliest_time < tN_[checked_slot(ids[i])])
+	{
+	  throw std::domain_error("Prediction time must be at least as recent as the last incorporated observation (prediction_time >= last_observation_time)");
+	}
+    }
+
+  LogSurvivalCache& cache = batch_log_survival_cache();
+  for(size_t i = 0; i < num_features; ++i)
+    {
+      size_t slot = checked_slot(ids[i]);
+
+      // The log-likelihood ratio is the same at every prediction time
+      double log_ratio = logpY_tN_[slot] - logpY_[slot];
+      double* row = beliefs + i * num_times;
+      for(size_t j = 0; j < num_times; ++j)
+	{
+	  double t = prediction_times[j] - init_time_[slot];
+	  row[j] = log_ratio + (cache_log_survival_ ? cache(logS_, t) : logS_(t));
+	  PERSISTENCE_FILTER_COUNT_FALLBACK_IF(row[j] < PERSISTENCE_FILTER_LOG_DBL_MIN, BELIEF_UNDERFLOW);
+	}
+    }
+
+  exp_batch(beliefs, beliefs, num_features * num_times);
+}
+
+void PersistenceFilterBank::predict_many(const std::vector<FeatureID>& ids, const std::vector<double>& prediction_times, std::vector<double>& beliefs) const
+{
+  beliefs.resize(ids.size() * prediction_times.size());
+  if(!ids.empty())
+    {
+      predict_many(&ids[0], ids.size(), prediction_times.empty() ? nullptr : &prediction_times[0], prediction_times.size(), beliefs.empty() ? nullptr : &beliefs[0]);
+    }
+}
+
+void PersistenceFilterBank::predict_all(double prediction_time, double* beliefs) const
+{
+  PERSISTENCE_FILTER_INSTRUMENT_CALL(BANK_PREDICT_BATCH);
+
+  LogSurvivalCache& cache = batch_log_survival_cache();
+  for(size_t slot = 0; slot < ids_.size(); ++slot)
+    {
+      if(live_[slot] && (prediction_time >= tN_[slot]))
+	{
+	  double t = prediction_time - init_time_[slot];
+	  beliefs[slot] = logpY_tN_[slot] - logpY_[slot] + (cache_log_survival_ ? cache(logS_, t) : logS_(t));
+	  PERSISTENCE_FILTER_COUNT_FALLBACK_IF(beliefs[slot] < PERSISTENCE_FILTER_LOG_DBL_MIN, BELIEF_UNDERFLOW);
+	}
+      else
+	{
+	  beliefs[slot] = std::numeric_limits<double>::quiet_NaN();
+	}
+    }
+
+  // NaN arguments propagate through exp_batch()
+  exp_batch(beliefs, beliefs, ids_.size());
+}
@@ -0,0 +1,682 @@
+/** Benchmarks for the persistence filter library.
+ *
+ * Usage:  persistence_filter_bench [--format=json|csv] [--filter=SUBSTRING] [--min-time=SECONDS] [--features=N] [--threads=N]
+ *
+ * Each benchmark is run repeatedly until at least --min-time seconds of
+ * measured time have accumulated, and reports the number of operations
+ * performed, the mean time per operation, the throughput, and the number (and
+ * total size) of heap allocations per operation.  Setup work (constructing
+ * filters, generating inputs, etc.) is excluded from both the timings and the
+ * allocation counts.  Results are written to stdout as JSON (the default) or
+ * CSV, for comparison across revisions.  If the library was built with
+ * PERSISTENCE_FILTER_INSTRUMENTATION, its instrumentation report (covering
+ * every benchmark) is written to stderr at the end.
+ *
+ * The "micro" benchmarks time individual library calls; the "macro"
+ * benchmarks time whole-map scenarios over --features features:  batched
+ * updates and predictions in a PersistenceFilterBank, bursty revisitation
+ * patterns generated by sample_observation_times() (as in the Monte Carlo
+ * experiments), and concurrent ingest through a PersistenceFilterManager
+ * with --threads producer threads.
+ */
+
+#include "persistence_filter.h"
+#include "persistence_filter_bank.h"
+#include "persistence_filter_group_index.h"
+#include "persistence_filter_instrumentation.h"
+#include "persistence_filter_journal.h"
+#include "persistence_filter_manager.h"
+#include "persistence_filter_monte_carlo.h"
+#include "persistence_filter_pool.h"
+#include "persistence_filter_revisit_scheduler.h"
+#include "persistence_filter_simd.h"
+#include "persistence_filter_utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/// ALLOCATION COUNTING
+
+static std::atomic<uint64_t> num_allocations(0);
+static std::atomic<uint64_t> num_bytes_allocated(0);
+
+void* operator new(size_t size)
+{
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  num_bytes_allocated.fetch_add(size, std::memory_order_relaxed);
+
+  void* p = std::malloc(size ? size : 1);
+  if(!p)
+    {
+      throw std::bad_alloc();
+    }
+  return p;
+}
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+  std::free(p);
+}
+
+
+/// MEASUREMENT
+
+/** Accumulates the time and allocations within the measured regions of a benchmark*/
+class Measurement
+{
+ protected:
+  std::chrono::steady_clock::time_point start_time_;
+  uint64_t start_allocations_;
+  uint64_t start_bytes_;
+
+ public:
+  double seconds;
+  uint64_t allocations;
+  uint64_t bytes;
+
+  Measurement() : seconds(0.0), allocations(0), bytes(0) {}
+
+  /** Begin a measured region*/
+  void start()
+  {
+    start_allocations_ = num_allocations.load();
+    start_bytes_ = num_bytes_allocated.load();
+    start_time_ = std::chrono::steady_clock::now();
+  }
+
+  /** End a measured region*/
+  void stop()
+  {
+    std::chrono::steady_clock::time_point stop_time = std::chrono::steady_clock::now();
+    seconds += std::chrono::duration<double>(stop_time - start_time_).count();
+    allocations += num_allocations.load() - start_allocations_;
+    bytes += num_bytes_allocated.load() - start_bytes_;
+  }
+};
+
+/** A benchmark body performs one run of its workload, bracketing the part to be timed with calls to Measurement::start() and stop(), and returns the number of operations performed*/
+typedef std::function<uint64_t(Measurement&)> Benchmark;
+
+struct Result
+{
+  std::string name;
+  uint64_t operations;
+  double seconds;
+  uint64_t allocations;
+  uint64_t bytes;
+};
+
+struct Options
+{
+  std::string format;
+  std::string filter;
+  double min_time;
+  size_t num_features;
+  size_t num_threads;
+
+  Options() : format("json"), min_time(0.5), num_features(1000000), num_threads(std::max<size_t>(2, std::thread::hardware_concurrency())) {}
+};
+
+static Options options;
+static std::vector<Result> results;
+
+// Prevents the compiler from discarding the results of benchmarked computations
+static volatile double sink;
+
+static void run(const std::string& name, const Benchmark& benchmark)
+{
+  if(name.find(options.filter) == std::string::npos)
+    {
+      return;
+    }
+
+  Measurement measurement;
+  uint64_t operations = 0;
+  do
+    {
+      operations += benchmark(measurement);
+    }
+  while(measurement.seconds < options.min_time);
+
+  Result result;
+  result.name = name;
+  result.operations = operations;
+  result.seconds = measurement.seconds;
+  result.allocations = measurement.allocations;
+  result.bytes = measurement.bytes;
+  results.push_back(result);
+
+  std::fprintf(stderr, "%-48s %12.2f ns/op\n", name.c_str(), 1e9 * result.seconds / result.operations);
+}
+
+
+/// INPUTS
+
+static const double lambda_l = .01;
+static const double lambda_u = 1;
+static const double P_M = .2;
+static const double P_F = .01;
+
+static double log_general_purpose_prior(double t)
+{
+  return log_general_purpose_survival_function(t, lambda_l, lambda_u);
+}
+
+
+/// MICROBENCHMARKS
+
+static const size_t MICRO_BATCH = 4096;
+
+static void run_micro_benchmarks()
+{
+  std::mt19937_64 rng(0);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  // Pairs of log-probabilities, with logx >= logy
+  std::vector<double> logx(MICRO_BATCH), logy(MICRO_BATCH);
+  for(size_t i = 0; i < MICRO_BATCH; ++i)
+    {
+      double a = -50 * uniform(rng), b = -50 * uniform(rng);
+      logx[i] = std::max(a, b);
+      logy[i] = std::min(a, b);
+    }
+
+  // Times spread log-uniformly over [1e-3, 1e4]
+  std::vector<double> times(MICRO_BATCH);
+  for(size_t i = 0; i < MICRO_BATCH; ++i)
+    {
+      times[i] = std::pow(10.0, -3 + 7 * uniform(rng));
+    }
+
+  run("micro/logsum", [&](Measurement& m) {
+      double sum = 0;
+      m.start();
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	sum += logsum(logx[i], logy[i]);
+      m.stop();
+      sink = sum;
+      return MICRO_BATCH;
+    });
+
+  run("micro/logdiff", [&](Measurement& m) {
+      double sum = 0;
+      m.start();
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	sum += logdiff(logx[i], logy[i]);
+      m.stop();
+      sink = sum;
+      return MICRO_BATCH;
+    });
+
+  std::vector<double> out(MICRO_BATCH);
+  run("micro/logsum_batch", [&](Measurement& m) {
+      m.start();
+      logsum_batch(&logx[0], &logy[0], &out[0], MICRO_BATCH);
+      m.stop();
+      sink = out[0];
+      return MICRO_BATCH;
+    });
+
+  run("micro/logdiff_batch", [&](Measurement& m) {
+      m.start();
+      logdiff_batch(&logx[0], &logy[0], &out[0], MICRO_BATCH);
+      m.stop();
+      sink = out[0];
+      return MICRO_BATCH;
+    });
+
+  run("micro/log_general_purpose_survival_function", [&](Measurement& m) {
+      double sum = 0;
+      m.start();
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	sum += log_general_purpose_survival_function(times[i], lambda_l, lambda_u);
+      m.stop();
+      sink = sum;
+      return MICRO_BATCH;
+    });
+
+  GeneralPurposeLogSurvivalTable table(lambda_l, lambda_u);
+  run("micro/general_purpose_log_survival_table", [&](Measurement& m) {
+      double sum = 0;
+      m.start();
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	sum += table(times[i]);
+      m.stop();
+      sink = sum;
+      return MICRO_BATCH;
+    });
+
+  // Filter updates, each run applying MICRO_BATCH updates to a fresh filter
+  std::vector<bool> detections(MICRO_BATCH);
+  for(size_t i = 0; i < MICRO_BATCH; ++i)
+    {
+      detections[i] = uniform(rng) < .7;
+    }
+
+  run("micro/update", [&](Measurement& m) {
+      PersistenceFilter filter(log_general_purpose_prior);
+      m.start();
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	filter.update(detections[i], .01 * (i + 1), P_M, P_F);
+      m.stop();
+      sink = filter.evidence();
+      return MICRO_BATCH;
+    });
+
+  run("micro/update_tabulated_prior", [&](Measurement& m) {
+      BasicPersistenceFilter<GeneralPurposeLogSurvivalTable> filter(table);
+      m.start();
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	filter.update(detections[i], .01 * (i + 1), P_M, P_F);
+      m.stop();
+      sink = filter.evidence();
+      return MICRO_BATCH;
+    });
+
+  // Updates with a (type-erased) exponential prior, which take the closed-form path
+  LogSurvivalFunction exponential_prior = ExponentialSurvivalPrior(.1);
+  run("micro/update_exponential_prior", [&](Measurement& m) {
+      PersistenceFilter filter(exponential_prior);
+      m.start();
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	filter.update(detections[i], .01 * (i + 1), P_M, P_F);
+      m.stop();
+      sink = filter.evidence();
+      return MICRO_BATCH;
+    });
+
+  // Updates through a fixed-rate detector model, whose log-likelihoods are precomputed
+  DetectorModel detector(P_M, P_F);
+  run("micro/update_detector_model", [&](Measurement& m) {
+      PersistenceFilter filter(exponential_prior);
+      m.start();
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	filter.update(detections[i], .01 * (i + 1), detector);
+      m.stop();
+      sink = filter.evidence();
+      return MICRO_BATCH;
+    });
+
+  // Feature churn:  creating and destroying MICRO_BATCH filters sharing one prior
+  LogSurvivalFunction shared_prior(GeneralPurposeSurvivalPrior(lambda_l, lambda_u));
+  std::vector<PersistenceFilter*> heap_filters(MICRO_BATCH);
+  run("micro/filter_churn", [&](Measurement& m) {
+      m.start();
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	heap_filters[i] = new PersistenceFilter(shared_prior, .01 * i);
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	delete heap_filters[i];
+      m.stop();
+      return MICRO_BATCH;
+    });
+
+  PersistenceFilterPool pool;
+  pool.reserve(MICRO_BATCH);
+  std::vector<PersistenceFilter*> pooled_filters(MICRO_BATCH);
+  run("micro/pooled_filter_churn", [&](Measurement& m) {
+      m.start();
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	pooled_filters[i] = pool.create(shared_prior, .01 * i);
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	pool.destroy(pooled_filters[i]);
+      m.stop();
+      return MICRO_BATCH;
+    });
+
+  SharedPriorPersistenceFilterPool shared_prior_pool;
+  shared_prior_pool.reserve(MICRO_BATCH);
+  std::vector<SharedPriorPersistenceFilter*> shared_prior_filters(MICRO_BATCH);
+  run("micro/pooled_shared_prior_filter_churn", [&](Measurement& m) {
+      m.start();
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	shared_prior_filters[i] = shared_prior_pool.create(shared_prior, .01 * i);
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	shared_prior_pool.destroy(shared_prior_filters[i]);
+      m.stop();
+      return MICRO_BATCH;
+    });
+
+  PersistenceFilter predicting_filter(log_general_purpose_prior);
+  predicting_filter.update(true, 1e-3, P_M, P_F);
+  run("micro/predict", [&](Measurement& m) {
+      double sum = 0;
+      m.start();
+      for(size_t i = 0; i < MICRO_BATCH; ++i)
+	sum += predicting_filter.predict(times[i]);
+      m.stop();
+      sink = sum;
+      return MICRO_BATCH;
+    });
+
+  std::vector<double> curve(MICRO_BATCH);
+  run("micro/predict_many", [&](Measurement& m) {
+      m.start();
+      predicting_filter.predict_many(&times[0], MICRO_BATCH, &curve[0]);
+      m.stop();
+      sink = curve[0];
+      return MICRO_BATCH;
+    });
+}
+
+
+/// MACROBENCHMARKS
+
+static void run_macro_benchmarks()
+{
+  const size_t N = options.num_features;
+  const std::string size_suffix = "/" + std::to_string(N);
+
+  std::mt19937_64 rng(1);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  // WHOLE-MAP BATCHED UPDATES AND PREDICTIONS
+  {
+    PersistenceFilterBank bank(GeneralPurposeLogSurvivalTable(lambda_l, lambda_u));
+    bank.reserve(N);
+    std::vector<PersistenceFilterBank::FeatureID> ids(N);
+    std::vector<bool> detections(N);
+    for(size_t i = 0; i < N; ++i)
+      {
+	ids[i] = i;
+	bank.add(i, 10 * uniform(rng));
+	detections[i] = uniform(rng) < .7;
+      }
+
+    double time = 10;
+    run("macro/bank_update_batch" + size_suffix, [&](Measurement& m) {
+	time += 1;
+	m.start();
+	bank.update_batch(ids, detections, time, P_M, P_F);
+	m.stop();
+	return N;
+      });
+
+    // The same updates, each journaled (with a synchronous group commit every 4096 records)
+    {
+      const std::string journal_filename = "persistence_filter_bench.journal";
+      std::remove(journal_filename.c_str());
+      PersistenceFilterJournal journal(journal_filename);
+      run("macro/bank_update_batch_journaled" + size_suffix, [&](Measurement& m) {
+	  time += 1;
+	  m.start();
+	  bank.update_batch(ids, detections, time, P_M, P_F);
+	  journal.log_update_batch(bank, &ids[0], N);
+	  journal.commit();
+	  m.stop();
+	  return N;
+	});
+      journal.checkpoint(bank, journal_filename + ".snapshot");
+      std::remove(journal_filename.c_str());
+      std::remove((journal_filename + ".snapshot").c_str());
+    }
+
+    std::vector<double> beliefs(N);
+    run("macro/bank_predict_all" + size_suffix, [&](Measurement& m) {
+	m.start();
+	bank.predict_all(time + 1, &beliefs[0]);
+	m.stop();
+	sink = beliefs[0];
+	return N;
+      });
+
+    // Belief curves over 32 horizons for (up to) the first 65536 features
+    const size_t num_curves = std::min<size_t>(N, 65536);
+    std::vector<double> horizons(32), curves(num_curves * horizons.size());
+    for(size_t j = 0; j < horizons.size(); ++j)
+      horizons[j] = time + 1 + 10 * j;
+    run("macro/bank_predict_many_32_horizons" + size_suffix, [&](Measurement& m) {
+	m.start();
+	bank.predict_many(&ids[0], num_curves, &horizons[0], horizons.size(), &curves[0]);
+	m.stop();
+	sink = curves[0];
+	return num_curves * horizons.size();
+      });
+
+    // Re-observing a few features and rescoring them, then choosing the next 16 targets
+    PersistenceRevisitScheduler scheduler(bank, P_M, P_F, time + 1);
+    scheduler.update_all();
+    std::vector<PersistenceFilterBank::FeatureID> targets;
+    run("macro/revisit_scheduler_update" + size_suffix, [&](Measurement& m) {
+	const size_t num_updates = 64;
+	targets.clear();
+	m.start();
+	for(size_t k = 0; k < num_updates; ++k)
+	  {
+	    PersistenceFilterBank::FeatureID id = ids[static_cast<size_t>(uniform(rng) * N) % N];
+	    bank.update(id, uniform(rng) < .7, time, P_M, P_F);
+	    scheduler.update(id);
+	  }
+	scheduler.next_targets(16, targets);
+	m.stop();
+	sink = static_cast<double>(targets[0]);
+	return num_updates;
+      });
+  }
+
+  // WHOLE-MAP BATCHED UPDATES OF FEATURES INITIALIZED IN A FEW FRAMES:  the
+  // features share a handful of initialization times, so that the batch
+  // evaluates the (untabulated) prior at only a few distinct elapsed times
+  {
+    PersistenceFilterBank bank(GeneralPurposeSurvivalPrior(lambda_l, lambda_u));
+    bank.reserve(N);
+    std::vector<PersistenceFilterBank::FeatureID> ids(N);
+    std::vector<bool> detections(N);
+    for(size_t i = 0; i < N; ++i)
+      {
+	ids[i] = i;
+	bank.add(i, static_cast<double>(i % 10));
+	detections[i] = uniform(rng) < .7;
+      }
+
+    double time = 10;
+    run("macro/bank_update_batch_shared_init" + size_suffix, [&](Measurement& m) {
+	time += 1;
+	m.start();
+	bank.update_batch(ids, detections, time, P_M, P_F);
+	m.stop();
+	return N;
+      });
+
+    // Group summaries over 64 regions in 8 parent regions:  re-observing a few
+    // features, then computing the expected count of every region
+    const size_t num_regions = 64;
+    PersistenceGroupIndex group_index(bank);
+    for(size_t g = 0; g < num_regions / 8; ++g)
+      group_index.add_group(num_regions + g);
+    for(size_t g = 0; g < num_regions; ++g)
+      group_index.add_group(g, num_regions + g / 8);
+    for(size_t i = 0; i < N; ++i)
+      group_index.assign(ids[i], i % num_regions);
+
+    run("macro/group_index_update_and_count" + size_suffix, [&](Measurement& m) {
+	const size_t num_updates = 64;
+	double count = 0;
+	m.start();
+	for(size_t k = 0; k < num_updates; ++k)
+	  {
+	    PersistenceFilterBank::FeatureID id = ids[static_cast<size_t>(uniform(rng) * N) % N];
+	    bank.update(id, uniform(rng) < .7, time, P_M, P_F);
+	    group_index.update(id);
+	  }
+	for(size_t g = 0; g < num_regions; ++g)
+	  count += group_index.expected_count(g, time + 1);
+	m.stop();
+	sink = count;
+	return num_updates;
+      });
+  }
+
+  // BURSTY REVISITS:  features are observed in short bursts separated by long
+  // gaps, and the observations of all features are interleaved in time order
+  {
+    const double lambda_r = 1.0 / 50, lambda_o = 1.0, p_N = .3, simulation_length = 500;
+    const size_t num_features = std::max<size_t>(1, N / 32);  // ~ 33 observations per feature
+
+    struct Event
+    {
+      double time;
+      PersistenceFilterBank::FeatureID id;
+      bool detection;
+    };
+
+    std::vector<Event> events;
+    std::vector<double> observation_times;
+    for(size_t i = 0; i < num_features; ++i)
+      {
+	sample_observation_times(lambda_r, lambda_o, p_N, simulation_length, rng, observation_times);
+	double survival_time = simulation_length * uniform(rng) * 2;
+	for(size_t k = 0; k < observation_times.size(); ++k)
+	  {
+	    Event event;
+	    event.time = observation_times[k];
+	    event.id = i;
+	    event.detection = (observation_times[k] <= survival_time) ? (uniform(rng) > P_M) : (uniform(rng) < P_F);
+	    events.push_back(event);
+	  }
+      }
+    std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.time < b.time; });
+
+    run("macro/bank_bursty_revisits" + size_suffix, [&](Measurement& m) {
+	PersistenceFilterBank bank(GeneralPurposeLogSurvivalTable(lambda_l, lambda_u));
+	bank.reserve(num_features);
+	for(size_t i = 0; i < num_features; ++i)
+	  bank.add(i);
+
+	m.start();
+	for(size_t k = 0; k < events.size(); ++k)
+	  bank.update(events[k].id, events[k].detection, events[k].time, P_M, P_F);
+	m.stop();
+	return events.size();
+      });
+  }
+
+  // MULTI-THREADED INGEST:  several producer threads submit updates for
+  // disjoint sets of features to a PersistenceFilterManager
+  {
+    const size_t num_threads = options.num_threads;
+    const size_t updates_per_thread = std::max<size_t>(1, N / num_threads);
+    const size_t num_features = std::max<size_t>(num_threads, N / 16);
+
+    run("macro/manager_ingest" + size_suffix + "/threads:" + std::to_string(num_threads), [&](Measurement& m) {
+	PersistenceFilterManager manager(GeneralPurposeLogSurvivalTable(lambda_l, lambda_u), num_threads);
+	for(size_t i = 0; i < num_features; ++i)
+	  manager.add(i);
+	manager.flush();
+
+	m.start();
+	std::vector<std::thread> producers;
+	for(size_t p = 0; p < num_threads; ++p)
+	  {
+	    producers.push_back(std::thread([&manager, p, num_threads, num_features, updates_per_thread]() {
+		  // Producer p owns the features congruent to p modulo num_threads, and observes them in round-robin order
+		  size_t features_per_thread = num_features / num_threads;
+		  for(size_t k = 0; k < updates_per_thread; ++k)
+		    {
+		      size_t id = p + num_threads * (k % features_per_thread);
+		      manager.update(id, (k % 3) != 0, 1.0 + k / features_per_thread, P_M, P_F);
+		    }
+		}));
+	  }
+	for(size_t p = 0; p < num_threads; ++p)
+	  producers[p].join();
+	manager.flush();
+	m.stop();
+
+	return num_threads * updates_per_thread;
+      });
+  }
+}
+
+
+/// OUTPUT
+
+static void write_results()
+{
+  const char* simd_names[] = {"scalar", "avx2", "avx512"};
+
+  if(options.format == "csv")
+    {
+      std::printf("name,operations,ns_per_op,ops_per_s,allocations_per_op,bytes_allocated_per_op\n");
+      for(size_t i = 0; i < results.size(); ++i)
+	{
+	  const Result& r = results[i];
+	  std::printf("%s,%llu,%.6g,%.6g,%.6g,%.6g\n", r.name.c_str(), static_cast<unsigned long long>(r.operations), 1e9 * r.seconds / r.operations, r.operations / r.seconds, static_cast<double>(r.allocations) / r.operations, static_cast<double>(r.bytes) / r.operations);
+	}
+    }
+  else
+    {
+      std::printf("{\n  \"context\": {\"simd\": \"%s\", \"hardware_threads\": %u, \"features\": %llu, \"threads\": %llu},\n  \"benchmarks\": [\n", simd_names[simd_instruction_set()], std::thread::hardware_concurrency(), static_cast<unsigned long long>(options.num_features), static_cast<unsigned long long>(options.num_threads));
+      for(size_t i = 0; i < results.size(); ++i)
+	{
+	  const Result& r = results[i];
+	  std::printf("    {\"name\": \"%s\", \"operations\": %llu, \"ns_per_op\": %.6g, \"ops_per_s\": %.6g, \"allocations_per_op\": %.6g, \"bytes_allocated_per_op\": %.6g}%s\n", r.name.c_str(), static_cast<unsigned long long>(r.operations), 1e9 * r.seconds / r.operations, r.operations / r.seconds, static_cast<double>(r.allocations) / r.operations, static_cast<double>(r.bytes) / r.operations, (i + 1 < results.size()) ? "," : "");
+	}
+      std::printf("  ]\n}\n");
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+  for(int i = 1; i < argc; ++i)
+    {
+      std::string arg(argv[i]);
+      std::string value = (arg.find('=') != std::string::npos) ? arg.substr(arg.find('=') + 1) : "";
+
+      if(arg.compare(0, 9, "--format=") == 0)
+	options.format = value;
+      else if(arg.compare(0, 9, "--filter=") == 0)
+	options.filter = value;
+      else if(arg.compare(0, 11, "--min-time=") == 0)
+	options.min_time = std::atof(value.c_str());
+      else if(arg.compare(0, 11, "--features=") == 0)
+	options.num_features = std::max<long long>(1, std::atoll(value.c_str()));
+      else if(arg.compare(0, 10, "--threads=") == 0)
+	options.num_threads = std::max<long long>(1, std::atoll(value.c_str()));
+      else
+	{
+	  std::fprintf(stderr, "Usage: %s [--format=json|csv] [--filter=SUBSTRING] [--min-time=SECONDS] [--features=N] [--threads=N]\n", argv[0]);
+	  return 1;
+	}
+    }
+
+  if( (options.format != "json") && (options.format != "csv") )
+    {
+      std::fprintf(stderr, "Unknown output format '%s'\n", options.format.c_str());
+      return 1;
+    }
+
+  run_micro_benchmarks();
+  run_macro_benchmarks();
+  write_results();
+
+  if(PersistenceFilterInstrumentation::enabled())
+    {
+      PersistenceFilterInstrumentation::report().write(std::cerr);
+    }
+
+  return 0;
+}
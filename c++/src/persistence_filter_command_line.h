@@ -0,0 +1,84 @@
+#ifndef __PERSISTENCE_FILTER_COMMAND_LINE_H__
+#define __PERSISTENCE_FILTER_COMMAND_LINE_H__
+
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "persistence_filter_priors.h"
+
+
+/** Argument parsing shared by the command-line tools*/
+
+
+/** Parse a comma-separated list of numbers, throwing std::invalid_argument if any item is not a number*/
+inline std::vector<double> parse_number_list(const std::string& value)
+{
+  std::vector<double> list;
+  size_t start = 0;
+  while(start <= value.size())
+    {
+      size_t end = value.find(',', start);
+      if(end == std::string::npos)
+	end = value.size();
+
+      std::string item = value.substr(start, end - start);
+      char* item_end;
+      double x = std::strtod(item.c_str(), &item_end);
+      if(item.empty() || (*item_end != '\0'))
+	{
+	  throw std::invalid_argument("Unable to parse '" + value + "' as a list of numbers");
+	}
+      list.push_back(x);
+      start = end + 1;
+    }
+  return list;
+}
+
+/** Parse a nonnegative integer, throwing std::invalid_argument if 'value' is not one (including if it has a sign) or is too large to represent*/
+inline size_t parse_count(const std::string& value)
+{
+  // strtoull() would skip leading whitespace, and accept (and negate) a leading '-', so we require a leading digit
+  bool ok = !value.empty() && (value[0] >= '0') && (value[0] <= '9');
+  unsigned long long n = 0;
+  if(ok)
+    {
+      char* end;
+      errno = 0;
+      n = std::strtoull(value.c_str(), &end, 10);
+      ok = (*end == '\0') && (errno != ERANGE) && (n <= std::numeric_limits<size_t>::max());
+    }
+
+  if(!ok)
+    {
+      throw std::invalid_argument("Unable to parse '" + value + "' as a nonnegative integer");
+    }
+  return n;
+}
+
+/** Parse a survival prior specification of the form KIND:PARAMETERS, where KIND is one of general-purpose (lambda_l,lambda_u), exponential (rate), weibull (shape,scale) or piecewise (breakpoints...,rates...)*/
+inline LogSurvivalFunction parse_survival_prior(const std::string& specification)
+{
+  size_t colon = specification.find(':');
+  std::string kind = specification.substr(0, colon);
+  std::vector<double> parameters = (colon == std::string::npos) ? std::vector<double>() : parse_number_list(specification.substr(colon + 1));
+
+  SurvivalPriorDescriptor descriptor;
+  if(kind == "general-purpose")
+    descriptor = SurvivalPriorDescriptor(SurvivalPriorDescriptor::GENERAL_PURPOSE, parameters);
+  else if(kind == "exponential")
+    descriptor = SurvivalPriorDescriptor(SurvivalPriorDescriptor::EXPONENTIAL, parameters);
+  else if(kind == "weibull")
+    descriptor = SurvivalPriorDescriptor(SurvivalPriorDescriptor::WEIBULL, parameters);
+  else if(kind == "piecewise")
+    descriptor = SurvivalPriorDescriptor(SurvivalPriorDescriptor::PIECEWISE_CONSTANT_HAZARD, parameters);
+  else
+    throw std::invalid_argument("Unknown prior kind '" + kind + "'");
+
+  return LogSurvivalFunction::from_descriptor(descriptor);
+}
+
+#endif //__PERSISTENCE_FILTER_COMMAND_LINE_H__
@@ -0,0 +1,132 @@
+/** Monte Carlo evaluation of persistence filters on simulated data.
+ *
+ * Usage:  persistence_filter_evaluate [OPTIONS]
+ *
+ *   --prior=KIND:PARAMETERS   A survival prior to evaluate (may be repeated); KIND is one of
+ *                             general-purpose (lambda_l,lambda_u), exponential (rate),
+ *                             weibull (shape,scale) or piecewise (breakpoints...,rates...).
+ *                             Defaults to general-purpose:0.001,1.
+ *   --P_M=LIST                Missed detection probabilities to sweep (default .1)
+ *   --P_F=LIST                False alarm probabilities to sweep (default .1)
+ *   --lambda-r=LIST           Revisitation rates to sweep (default .02)
+ *   --lambda-o=RATE           Observation rate within each revisit (default 1)
+ *   --p-N=P                   Probability of leaving after each observation (default .2)
+ *   --simulation-length=T     Length of each trial (default 1000)
+ *   --query-interval=DT       Spacing of the query times (default .1)
+ *   --thresholds=LIST         Belief thresholds for precision and recall (default .01,.05,.1,...,.5)
+ *   --trials=N                Number of trials per setting (default 100)
+ *   --seed=S                  Random seed (default 0)
+ *   --threads=N               Number of worker threads (default:  one per hardware thread)
+ *
+ * (LIST is a comma-separated list of numbers.)  Every combination of the
+ * swept parameters is evaluated by run_monte_carlo_evaluation() using the
+ * same seed, and the results are written to stdout as CSV, with one row per
+ * setting, estimator and threshold.
+ */
+
+#include "persistence_filter_command_line.h"
+#include "persistence_filter_monte_carlo.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+static void write_row(const MonteCarloSettings& settings, const std::string& estimator, const MonteCarloMetrics& metrics)
+{
+  for(size_t k = 0; k < settings.thresholds.size(); ++k)
+    {
+      std::printf("%g,%g,%g,%s,%g,%.9g,%.9g,%.9g,%.9g,%llu,%llu\n", settings.P_M, settings.P_F, settings.lambda_r, estimator.c_str(), settings.thresholds[k], metrics.mean_absolute_error, metrics.mean_absolute_error_stddev, metrics.precisions[k], metrics.recalls[k], static_cast<unsigned long long>(metrics.num_precisions[k]), static_cast<unsigned long long>(metrics.num_recalls[k]));
+    }
+
+  if(settings.thresholds.empty())
+    {
+      std::printf("%g,%g,%g,%s,,%.9g,%.9g,,,0,0\n", settings.P_M, settings.P_F, settings.lambda_r, estimator.c_str(), metrics.mean_absolute_error, metrics.mean_absolute_error_stddev);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+  MonteCarloSettings settings;
+  std::vector<std::string> prior_names;
+  std::vector<LogSurvivalFunction> priors;
+  std::vector<double> P_M_values(1, settings.P_M), P_F_values(1, settings.P_F), lambda_r_values(1, settings.lambda_r);
+
+  try
+    {
+      for(int i = 1; i < argc; ++i)
+	{
+	  std::string arg(argv[i]);
+	  size_t equals = arg.find('=');
+	  std::string name = arg.substr(0, equals);
+	  std::string value = (equals != std::string::npos) ? arg.substr(equals + 1) : "";
+
+	  if(name == "--prior")
+	    {
+	      priors.push_back(parse_survival_prior(value));
+	      prior_names.push_back(value);
+	    }
+	  else if(name == "--P_M")
+	    P_M_values = parse_number_list(value);
+	  else if(name == "--P_F")
+	    P_F_values = parse_number_list(value);
+	  else if(name == "--lambda-r")
+	    lambda_r_values = parse_number_list(value);
+	  else if(name == "--lambda-o")
+	    settings.lambda_o = std::atof(value.c_str());
+	  else if(name == "--p-N")
+	    settings.p_N = std::atof(value.c_str());
+	  else if(name == "--simulation-length")
+	    settings.simulation_length = std::atof(value.c_str());
+	  else if(name == "--query-interval")
+	    settings.query_interval = std::atof(value.c_str());
+	  else if(name == "--thresholds")
+	    settings.thresholds = value.empty() ? std::vector<double>() : parse_number_list(value);
+	  else if(name == "--trials")
+	    settings.num_trials = std::strtoull(value.c_str(), nullptr, 10);
+	  else if(name == "--seed")
+	    settings.seed = std::strtoull(value.c_str(), nullptr, 10);
+	  else if(name == "--threads")
+	    settings.num_threads = std::strtoull(value.c_str(), nullptr, 10);
+	  else
+	    {
+	      std::fprintf(stderr, "Usage: %s [--prior=KIND:PARAMETERS]... [--P_M=LIST] [--P_F=LIST] [--lambda-r=LIST] [--lambda-o=RATE] [--p-N=P] [--simulation-length=T] [--query-interval=DT] [--thresholds=LIST] [--trials=N] [--seed=S] [--threads=N]\n", argv[0]);
+	      return 1;
+	    }
+	}
+
+      if(priors.empty())
+	{
+	  priors.push_back(parse_survival_prior("general-purpose:0.001,1"));
+	  prior_names.push_back("general-purpose:0.001,1");
+	}
+
+      std::printf("P_M,P_F,lambda_r,estimator,threshold,mean_absolute_error,mean_absolute_error_stddev,precision,recall,num_precisions,num_recalls\n");
+      for(size_t a = 0; a < P_M_values.size(); ++a)
+	for(size_t b = 0; b < P_F_values.size(); ++b)
+	  for(size_t c = 0; c < lambda_r_values.size(); ++c)
+	    {
+	      settings.P_M = P_M_values[a];
+	      settings.P_F = P_F_values[b];
+	      settings.lambda_r = lambda_r_values[c];
+
+	      MonteCarloResults results = run_monte_carlo_evaluation(settings, priors);
+	      for(size_t p = 0; p < priors.size(); ++p)
+		{
+		  // Quote the prior's name, which may contain commas
+		  write_row(settings, "\"" + prior_names[p] + "\"", results.filters[p]);
+		}
+	      write_row(settings, "empirical", results.empirical_estimator);
+	      std::fflush(stdout);
+	    }
+    }
+  catch(const std::exception& e)
+    {
+      std::fprintf(stderr, "%s: %s\n", argv[0], e.what());
+      return 1;
+    }
+
+  return 0;
+}
@@ -0,0 +1,655 @@
+#include "persistence_filter_group_index.h"
+#include "persistence_filter_math.h"
+#include "persistence_filter_priors.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+
+const size_t PersistenceGroupIndex::DEFAULT_NUM_BUCKETS;
+
+// A cohort's sum is recomputed once its largest coefficient falls this far (in nats) below the scale
+// relative to which it is summed, which bounds the relative error accumulated by cancellation
+static const double LOG_RESCALE_MARGIN = 16 * 0.69314718055994530942;
+
+// The contribution c / exp(log_scale) of a member with coefficient c to the sum of a cohort
+static double scaled_coefficient(double log_coefficient, double log_scale)
+{
+  return (log_coefficient == -std::numeric_limits<double>::infinity()) ? 0.0 : std::exp(log_coefficient - log_scale);
+}
+
+PersistenceGroupIndex::Cohort PersistenceGroupIndex::empty_cohort()
+{
+  Cohort cohort;
+  cohort.count = 0;
+  cohort.log_scale = -std::numeric_limits<double>::infinity();
+  cohort.sum = 0;
+  cohort.min_log_coefficient = std::numeric_limits<double>::infinity();
+  cohort.max_log_coefficient = -std::numeric_limits<double>::infinity();
+  return cohort;
+}
+
+void PersistenceGroupIndex::add_to_cohort(Cohort& cohort, double log_coefficient)
+{
+  if(log_coefficient > cohort.log_scale)
+    {
+      // Rescale the sum so that the new coefficient is the largest term
+      cohort.sum = scaled_coefficient(cohort.log_scale, log_coefficient) * cohort.sum;
+      cohort.log_scale = log_coefficient;
+    }
+  cohort.sum += scaled_coefficient(log_coefficient, cohort.log_scale);
+  cohort.min_log_coefficient = std::min(cohort.min_log_coefficient, log_coefficient);
+  cohort.max_log_coefficient = std::max(cohort.max_log_coefficient, log_coefficient);
+  ++cohort.count;
+}
+
+void PersistenceGroupIndex::merge_cohort(Cohort& into, const Cohort& from)
+{
+  if(from.count == 0)
+    return;
+
+  double log_scale = std::max(into.log_scale, from.log_scale);
+  into.sum = scaled_coefficient(into.log_scale, log_scale) * into.sum + scaled_coefficient(from.log_scale, log_scale) * from.sum;
+  into.log_scale = log_scale;
+  into.min_log_coefficient = std::min(into.min_log_coefficient, from.min_log_coefficient);
+  into.max_log_coefficient = std::max(into.max_log_coefficient, from.max_log_coefficient);
+  into.count += from.count;
+}
+
+PersistenceGroupIndex::Bucket PersistenceGroupIndex::empty_bucket()
+{
+  Bucket bucket;
+  bucket.count = 0;
+  bucket.min_log_coefficient = std::numeric_limits<double>::infinity();
+  bucket.max_log_coefficient = -std::numeric_limits<double>::infinity();
+  bucket.earliest_initialization_time = std::numeric_limits<double>::infinity();
+  bucket.latest_initialization_time = -std::numeric_limits<double>::infinity();
+  return bucket;
+}
+
+void PersistenceGroupIndex::add_to_bucket(Bucket& bucket, double initialization_time, const Cohort& cohort)
+{
+  bucket.count += cohort.count;
+  bucket.min_log_coefficient = std::min(bucket.min_log_coefficient, cohort.min_log_coefficient);
+  bucket.max_log_coefficient = std::max(bucket.max_log_coefficient, cohort.max_log_coefficient);
+  bucket.earliest_initialization_time = std::min(bucket.earliest_initialization_time, initialization_time);
+  bucket.latest_initialization_time = std::max(bucket.latest_initialization_time, initialization_time);
+}
+
+PersistenceGroupIndex::PersistenceGroupIndex(const PersistenceFilterBank& bank, double time_quantum, size_t num_buckets) : bank_(bank), time_quantum_(time_quantum), num_buckets_(num_buckets), first_quantum_(std::numeric_limits<double>::quiet_NaN())
+{
+  // Input checking
+  if(!(time_quantum > 0) || std::isinf(time_quantum))
+    {
+      throw std::domain_error("Time quantum must be positive and finite");
+    }
+
+  if(num_buckets == 0)
+    {
+      throw std::domain_error("Number of buckets per group must be positive");
+    }
+}
+
+PersistenceGroupIndex::Group& PersistenceGroupIndex::checked_group(GroupID group)
+{
+  std::unordered_map<GroupID, Group>::iterator it = groups_.find(group);
+  if(it == groups_.end())
+    {
+      throw std::out_of_range("No group with the requested ID exists in this PersistenceGroupIndex");
+    }
+  return it->second;
+}
+
+const PersistenceGroupIndex::Group& PersistenceGroupIndex::checked_group(GroupID group) const
+{
+  std::unordered_map<GroupID, Group>::const_iterator it = groups_.find(group);
+  if(it == groups_.end())
+    {
+      throw std::out_of_range("No group with the requested ID exists in this PersistenceGroupIndex");
+    }
+  return it->second;
+}
+
+void PersistenceGroupIndex::check_prediction_time(const Group& group, double prediction_time)
+{
+  if(prediction_time < group.latest_observation_time)
+    {
+      throw std::domain_error("Prediction time must be at least as recent as the last incorporated observation of every feature in the group (prediction_time >= latest_observation_time)");
+    }
+}
+
+void PersistenceGroupIndex::add_group(GroupID group)
+{
+  Group new_group;
+  new_group.has_parent = false;
+  new_group.parent = 0;
+  new_group.buckets.assign(num_buckets_, empty_bucket());
+  new_group.size = 0;
+  new_group.latest_observation_time = -std::numeric_limits<double>::infinity();
+
+  if(!groups_.insert(std::make_pair(group, new_group)).second)
+    {
+      throw std::invalid_argument("A group with the requested ID already exists in this PersistenceGroupIndex");
+    }
+}
+
+void PersistenceGroupIndex::add_group(GroupID group, GroupID parent)
+{
+  // Since a parent must exist before its children, the groups always form a forest
+  checked_group(parent);
+  add_group(group);
+
+  Group& new_group = groups_[group];
+  new_group.has_parent = true;
+  new_group.parent = parent;
+  groups_[parent].children.push_back(group);
+}
+
+std::map<double, PersistenceGroupIndex::Cohort>::const_iterator PersistenceGroupIndex::first_cohort(const std::map<double, Cohort>& cohorts, size_t bucket) const
+{
+  // Start from the time at which the bucket nominally starts, and correct for the rounding of bucket_of() at the boundary
+  std::map<double, Cohort>::const_iterator it = cohorts.lower_bound((first_quantum_ + bucket) * time_quantum_);
+  while(it != cohorts.begin())
+    {
+      std::map<double, Cohort>::const_iterator previous = it;
+      if(bucket_of((--previous)->first) < bucket)
+	break;
+      it = previous;
+    }
+  while( (it != cohorts.end()) && (bucket_of(it->first) < bucket) )
+    {
+      ++it;
+    }
+  return it;
+}
+
+void PersistenceGroupIndex::cover(double initialization_time)
+{
+  double quantum = std::floor(initialization_time / time_quantum_);
+  if( (quantum >= first_quantum_) && (quantum - first_quantum_ < num_buckets_) )
+    {
+      return;
+    }
+
+  // The top-level groups' cohorts span the initialization times of every assigned feature
+  double earliest = initialization_time, latest = initialization_time;
+  for(std::unordered_map<GroupID, Group>::const_iterator it = groups_.begin(); it != groups_.end(); ++it)
+    {
+      const Group& group = it->second;
+      if(!group.has_parent && !group.cohorts.empty())
+	{
+	  earliest = std::min(earliest, group.cohorts.begin()->first);
+	  latest = std::max(latest, group.cohorts.rbegin()->first);
+	}
+    }
+
+  while(std::floor(latest / time_quantum_) - std::floor(earliest / time_quantum_) >= num_buckets_)
+    {
+      time_quantum_ *= 2;
+    }
+  first_quantum_ = std::floor(earliest / time_quantum_);
+
+  // The cohorts are unaffected by the quantum, so only the bounds need to be recomputed
+  for(std::unordered_map<GroupID, Group>::iterator it = groups_.begin(); it != groups_.end(); ++it)
+    {
+      Group& group = it->second;
+      std::fill(group.buckets.begin(), group.buckets.end(), empty_bucket());
+      for(std::map<double, Cohort>::const_iterator cohort = group.cohorts.begin(); cohort != group.cohorts.end(); ++cohort)
+	{
+	  add_to_bucket(group.buckets[bucket_of(cohort->first)], cohort->first, cohort->second);
+	}
+    }
+}
+
+PersistenceGroupIndex::Membership PersistenceGroupIndex::compute_membership(FeatureID id, GroupID group) const
+{
+  size_t slot = bank_.slot(id);
+
+  Membership membership;
+  membership.group = group;
+  membership.initialization_time = bank_.initialization_time_slot(slot);
+  membership.last_observation_time = bank_.last_observation_time_slot(slot);
+
+  // c = p(Y_{1:N} | t_N) / p(Y_{1:N}); a filter whose evidence has vanished (having incorporated an impossible observation) contributes nothing
+  membership.log_coefficient = bank_.log_likelihood_slot(slot) - bank_.log_evidence_slot(slot);
+  if(std::isnan(membership.log_coefficient))
+    {
+      membership.log_coefficient = -std::numeric_limits<double>::infinity();
+    }
+
+  return membership;
+}
+
+void PersistenceGroupIndex::rescale_own_cohort(Group& group, double initialization_time)
+{
+  Member first = {initialization_time, -std::numeric_limits<double>::infinity(), 0};
+  Member last = {initialization_time, std::numeric_limits<double>::infinity(), std::numeric_limits<FeatureID>::max()};
+  std::set<Member>::const_iterator begin = group.members.lower_bound(first), end = group.members.upper_bound(last);
+
+  Cohort& cohort = group.own_cohorts[initialization_time];
+  cohort = empty_cohort();
+  for(std::set<Member>::const_iterator it = begin; it != end; ++it)
+    {
+      add_to_cohort(cohort, it->log_coefficient);
+    }
+}
+
+void PersistenceGroupIndex::recompute_cohort(Group& group, double initialization_time)
+{
+  Cohort cohort = empty_cohort();
+  std::map<double, Cohort>::const_iterator own = group.own_cohorts.find(initialization_time);
+  if(own != group.own_cohorts.end())
+    {
+      cohort = own->second;
+    }
+
+  for(std::vector<GroupID>::const_iterator child = group.children.begin(); child != group.children.end(); ++child)
+    {
+      const std::map<double, Cohort>& child_cohorts = groups_[*child].cohorts;
+      std::map<double, Cohort>::const_iterator it = child_cohorts.find(initialization_time);
+      if(it != child_cohorts.end())
+	{
+	  merge_cohort(cohort, it->second);
+	}
+    }
+
+  if(cohort.count == 0)
+    {
+      group.cohorts.erase(initialization_time);
+    }
+  else
+    {
+      group.cohorts[initialization_time] = cohort;
+    }
+}
+
+void PersistenceGroupIndex::recompute_bucket(Group& group, size_t bucket) const
+{
+  Bucket& bounds = group.buckets[bucket];
+  bounds = empty_bucket();
+  for(std::map<double, Cohort>::const_iterator it = first_cohort(group.cohorts, bucket); (it != group.cohorts.end()) && (bucket_of(it->first) == bucket); ++it)
+    {
+      add_to_bucket(bounds, it->first, it->second);
+    }
+}
+
+void PersistenceGroupIndex::recompute_latest_observation_time(Group& group)
+{
+  group.latest_observation_time = group.observation_times.empty() ? -std::numeric_limits<double>::infinity() : *group.observation_times.rbegin();
+  for(std::vector<GroupID>::const_iterator child = group.children.begin(); child != group.children.end(); ++child)
+    {
+      group.latest_observation_time = std::max(group.latest_observation_time, groups_[*child].latest_observation_time);
+    }
+}
+
+void PersistenceGroupIndex::insert_contribution(FeatureID id, const Membership& membership)
+{
+  double initialization_time = membership.initialization_time;
+  double log_coefficient = membership.log_coefficient;
+  cover(initialization_time);
+
+  Group& own_group = groups_[membership.group];
+  Member member = {initialization_time, log_coefficient, id};
+  own_group.members.insert(member);
+  own_group.observation_times.insert(membership.last_observation_time);
+  add_to_cohort(own_group.own_cohorts.insert(std::make_pair(initialization_time, empty_cohort())).first->second, log_coefficient);
+
+  size_t bucket = bucket_of(initialization_time);
+  GroupID group_id = membership.group;
+  while(true)
+    {
+      Group& group = groups_[group_id];
+      Cohort& cohort = group.cohorts.insert(std::make_pair(initialization_time, empty_cohort())).first->second;
+      add_to_cohort(cohort, log_coefficient);
+
+      // The bounds of the bucket need only take in the new member
+      Cohort single = empty_cohort();
+      add_to_cohort(single, log_coefficient);
+      add_to_bucket(group.buckets[bucket], initialization_time, single);
+
+      ++group.size;
+      group.latest_observation_time = std::max(group.latest_observation_time, membership.last_observation_time);
+
+      if(!group.has_parent)
+	break;
+      group_id = group.parent;
+    }
+}
+
+void PersistenceGroupIndex::erase_contribution(FeatureID id, const Membership& membership)
+{
+  double initialization_time = membership.initialization_time;
+  double log_coefficient = membership.log_coefficient;
+
+  Group& own_group = groups_[membership.group];
+  Member member = {initialization_time, log_coefficient, id};
+  own_group.members.erase(member);
+  own_group.observation_times.erase(own_group.observation_times.find(membership.last_observation_time));
+
+  // The smallest and largest coefficients of the group's own members in this cohort are the ends of its range in 'members'
+  std::map<double, Cohort>::iterator own = own_group.own_cohorts.find(initialization_time);
+  Cohort& own_cohort = own->second;
+  if(--own_cohort.count == 0)
+    {
+      own_group.own_cohorts.erase(own);
+    }
+  else
+    {
+      Member first = {initialization_time, -std::numeric_limits<double>::infinity(), 0};
+      Member last = {initialization_time, std::numeric_limits<double>::infinity(), std::numeric_limits<FeatureID>::max()};
+      own_cohort.sum -= scaled_coefficient(log_coefficient, own_cohort.log_scale);
+      own_cohort.min_log_coefficient = own_group.members.lower_bound(first)->log_coefficient;
+      own_cohort.max_log_coefficient = (--own_group.members.upper_bound(last))->log_coefficient;
+      if(own_cohort.max_log_coefficient < own_cohort.log_scale - LOG_RESCALE_MARGIN)
+	{
+	  rescale_own_cohort(own_group, initialization_time);
+	}
+    }
+
+  size_t bucket = bucket_of(initialization_time);
+  GroupID group_id = membership.group;
+  while(true)
+    {
+      Group& group = groups_[group_id];
+      std::map<double, Cohort>::iterator it = group.cohorts.find(initialization_time);
+      Cohort& cohort = it->second;
+      if(--cohort.count == 0)
+	{
+	  group.cohorts.erase(it);
+	}
+      else if( (log_coefficient <= cohort.min_log_coefficient) || (log_coefficient >= cohort.max_log_coefficient) )
+	{
+	  // The member was one of the cohort's extremes (and may have set its scale), so we recompute it from the cohorts below
+	  recompute_cohort(group, initialization_time);
+	}
+      else
+	{
+	  cohort.sum -= scaled_coefficient(log_coefficient, cohort.log_scale);
+	}
+
+      Bucket& bounds = group.buckets[bucket];
+      if(--bounds.count == 0)
+	{
+	  bounds = empty_bucket();
+	}
+      else if( (log_coefficient <= bounds.min_log_coefficient) || (log_coefficient >= bounds.max_log_coefficient) ||
+	       (initialization_time <= bounds.earliest_initialization_time) || (initialization_time >= bounds.latest_initialization_time) )
+	{
+	  recompute_bucket(group, bucket);
+	}
+
+      --group.size;
+      if(membership.last_observation_time >= group.latest_observation_time)
+	{
+	  recompute_latest_observation_time(group);
+	}
+
+      if(!group.has_parent)
+	break;
+      group_id = group.parent;
+    }
+}
+
+void PersistenceGroupIndex::assign(FeatureID id, GroupID group)
+{
+  checked_group(group);
+  Membership membership = compute_membership(id, group);
+
+  std::unordered_map<FeatureID, Membership>::iterator it = memberships_.find(id);
+  if(it != memberships_.end())
+    {
+      erase_contribution(id, it->second);
+      it->second = membership;
+    }
+  else
+    {
+      memberships_.insert(std::make_pair(id, membership));
+    }
+
+  insert_contribution(id, membership);
+}
+
+void PersistenceGroupIndex::update(FeatureID id)
+{
+  std::unordered_map<FeatureID, Membership>::iterator it = memberships_.find(id);
+  if(it == memberships_.end())
+    {
+      throw std::out_of_range("No feature with the requested ID has been assigned to a group in this PersistenceGroupIndex");
+    }
+
+  Membership membership = compute_membership(id, it->second.group);
+  erase_contribution(id, it->second);
+  it->second = membership;
+  insert_contribution(id, membership);
+}
+
+void PersistenceGroupIndex::update_batch(const FeatureID* ids, size_t num_features)
+{
+  for(size_t i = 0; i < num_features; ++i)
+    {
+      if(contains(ids[i]))
+	{
+	  update(ids[i]);
+	}
+    }
+}
+
+bool PersistenceGroupIndex::remove(FeatureID id)
+{
+  std::unordered_map<FeatureID, Membership>::iterator it = memberships_.find(id);
+  if(it == memberships_.end())
+    {
+      return false;
+    }
+
+  erase_contribution(id, it->second);
+  memberships_.erase(it);
+  return true;
+}
+
+double PersistenceGroupIndex::expected_count(GroupID group_id, double prediction_time) const
+{
+  const Group& group = checked_group(group_id);
+  check_prediction_time(group, prediction_time);
+
+  // The members of each cohort contribute S_T(t - t_init) times the sum of their coefficients
+  double count = 0;
+  for(std::map<double, Cohort>::const_iterator it = group.cohorts.begin(); it != group.cohorts.end(); ++it)
+    {
+      const Cohort& cohort = it->second;
+      count += clamped_exp(cohort.log_scale + bank_.logS()(prediction_time - it->first)) * std::max(cohort.sum, 0.0);
+    }
+
+  return count;
+}
+
+bool PersistenceGroupIndex::belief_bounds(GroupID group_id, double prediction_time, double& lower, double& upper) const
+{
+  const Group& group = checked_group(group_id);
+  check_prediction_time(group, prediction_time);
+
+  if(group.size == 0)
+    {
+      return false;
+    }
+
+  // Every member of a bucket initialized at t_init in [t_0, t_1] has a belief between
+  // c_min S_T(t - t_0) and c_max S_T(t - t_1), so we need only examine the cohorts of the
+  // buckets whose bounds extend beyond the extremes found so far (and within each cohort,
+  // the members with the smallest and largest coefficients have the extreme beliefs)
+  const LogSurvivalFunction& logS = bank_.logS();
+  double log_lower = std::numeric_limits<double>::infinity();
+  double log_upper = -std::numeric_limits<double>::infinity();
+  for(size_t b = 0; b < num_buckets_; ++b)
+    {
+      const Bucket& bounds = group.buckets[b];
+      if(bounds.count == 0)
+	continue;
+
+      if(bounds.earliest_initialization_time == bounds.latest_initialization_time)
+	{
+	  // A single cohort, whose bounds are exact
+	  double log_survival = logS(prediction_time - bounds.earliest_initialization_time);
+	  log_lower = std::min(log_lower, bounds.min_log_coefficient + log_survival);
+	  log_upper = std::max(log_upper, bounds.max_log_coefficient + log_survival);
+	  continue;
+	}
+
+      if( (bounds.min_log_coefficient + logS(prediction_time - bounds.earliest_initialization_time) >= log_lower) &&
+	  (bounds.max_log_coefficient + logS(prediction_time - bounds.latest_initialization_time) <= log_upper) )
+	continue;
+
+      for(std::map<double, Cohort>::const_iterator it = first_cohort(group.cohorts, b); (it != group.cohorts.end()) && (bucket_of(it->first) == b); ++it)
+	{
+	  double log_survival = logS(prediction_time - it->first);
+	  log_lower = std::min(log_lower, it->second.min_log_coefficient + log_survival);
+	  log_upper = std::max(log_upper, it->second.max_log_coefficient + log_survival);
+	}
+    }
+
+  lower = clamped_exp(log_lower);
+  upper = clamped_exp(log_upper);
+  return true;
+}
+
+size_t PersistenceGroupIndex::features_above(GroupID group_id, double prediction_time, double threshold, std::vector<FeatureID>& features) const
+{
+  const Group& group = checked_group(group_id);
+  check_prediction_time(group, prediction_time);
+
+  // A bucket can only hold such features if its largest coefficient times S_T(t - t_1),
+  // for its latest initialization time t_1, exceeds the threshold
+  const LogSurvivalFunction& logS = bank_.logS();
+  double log_threshold = std::log(threshold);
+  std::vector<size_t> candidate_buckets;
+  for(size_t b = 0; b < num_buckets_; ++b)
+    {
+      const Bucket& bounds = group.buckets[b];
+      if( (bounds.count > 0) && (bounds.max_log_coefficient + logS(prediction_time - bounds.latest_initialization_time) > log_threshold) )
+	{
+	  candidate_buckets.push_back(b);
+	}
+    }
+
+  // Visit the members of 'group' and its descendants in those buckets
+  size_t num_features = 0;
+  std::vector<const Group*> pending(1, &group);
+  while(!pending.empty() && !candidate_buckets.empty())
+    {
+      const Group& current = *pending.back();
+      pending.pop_back();
+      for(std::vector<GroupID>::const_iterator child = current.children.begin(); child != current.children.end(); ++child)
+	{
+	  pending.push_back(&groups_.find(*child)->second);
+	}
+
+      for(std::vector<size_t>::const_iterator b = candidate_buckets.begin(); b != candidate_buckets.end(); ++b)
+	{
+	  for(std::map<double, Cohort>::const_iterator it = first_cohort(current.own_cohorts, *b); (it != current.own_cohorts.end()) && (bucket_of(it->first) == *b); ++it)
+	    {
+	      // The threshold on the coefficients of the cohort's members, log(threshold) - log S_T(t - t_init)
+	      double log_coefficient_threshold = log_threshold - logS(prediction_time - it->first);
+	      if(it->second.max_log_coefficient <= log_coefficient_threshold)
+		continue;
+
+	      // Visit the cohort's members in order of decreasing coefficient, stopping at the first that does not exceed the threshold
+	      Member last = {it->first, std::numeric_limits<double>::infinity(), std::numeric_limits<FeatureID>::max()};
+	      std::set<Member>::const_reverse_iterator member(current.members.upper_bound(last));
+	      for(; (member != current.members.rend()) && (member->initialization_time == it->first) && (member->log_coefficient > log_coefficient_threshold); ++member)
+		{
+		  features.push_back(member->id);
+		  ++num_features;
+		}
+	    }
+	}
+    }
+
+  return num_features;
+}
+
+double PersistenceGroupIndex::crossing_time(GroupID group_id, double threshold, double prediction_time, double tolerance) const
+{
+  // Input checking
+  if( (threshold <= 0) || (threshold > 1) )
+    {
+      throw std::domain_error("Persistence probability threshold must be in the range (0, 1]");
+    }
+
+  const Group& group = checked_group(group_id);
+  check_prediction_time(group, prediction_time);
+
+  // The member of each cohort with the smallest coefficient c is the first whose belief
+  // c S_T(t - t_init) falls to the threshold, once log S_T(t - t_init) <= log(threshold) - log c.
+  // We first search for the crossing time of the cohort whose least-believed member has the
+  // smallest belief now (within the bucket with the smallest lower bound on the beliefs of
+  // its members), which is usually the earliest.  Any other cohort can only cross earlier if
+  // its least-believed member's belief has already fallen to the threshold by then, which
+  // the bounds of its bucket rule out for most buckets without examining their cohorts.
+  const LogSurvivalFunction& logS = bank_.logS();
+  double log_threshold = std::log(threshold);
+  size_t first = num_buckets_;
+  double lowest = std::numeric_limits<double>::infinity();
+  for(size_t b = 0; b < num_buckets_; ++b)
+    {
+      const Bucket& bounds = group.buckets[b];
+      if(bounds.count == 0)
+	continue;
+
+      double log_belief = bounds.min_log_coefficient + logS(prediction_time - bounds.earliest_initialization_time);
+      if(log_belief < lowest)
+	{
+	  lowest = log_belief;
+	  first = b;
+	}
+    }
+
+  if(first == num_buckets_)
+    {
+      return std::numeric_limits<double>::infinity();
+    }
+
+  std::map<double, Cohort>::const_iterator least = group.cohorts.end();
+  lowest = std::numeric_limits<double>::infinity();
+  for(std::map<double, Cohort>::const_iterator it = first_cohort(group.cohorts, first); (it != group.cohorts.end()) && (bucket_of(it->first) == first); ++it)
+    {
+      double log_belief = it->second.min_log_coefficient + logS(prediction_time - it->first);
+      if( (least == group.cohorts.end()) || (log_belief < lowest) )
+	{
+	  lowest = log_belief;
+	  least = it;
+	}
+    }
+
+  double earliest = least->first + inverse_log_survival(logS, log_threshold - least->second.min_log_coefficient, prediction_time - least->first, tolerance);
+  for(size_t b = 0; b < num_buckets_; ++b)
+    {
+      const Bucket& bounds = group.buckets[b];
+      if(bounds.count == 0)
+	continue;
+
+      if( std::isfinite(earliest) && (bounds.min_log_coefficient + logS(earliest - bounds.earliest_initialization_time) > log_threshold) )
+	continue;
+
+      for(std::map<double, Cohort>::const_iterator it = first_cohort(group.cohorts, b); (it != group.cohorts.end()) && (bucket_of(it->first) == b); ++it)
+	{
+	  if( (it == least) || (std::isfinite(earliest) && (it->second.min_log_coefficient + logS(earliest - it->first) > log_threshold)) )
+	    continue;
+
+	  earliest = std::min(earliest, it->first + inverse_log_survival(logS, log_threshold - it->second.min_log_coefficient, prediction_time - it->first, tolerance));
+	}
+    }
+
+  return earliest;
+}
+
+PersistenceGroupIndex::GroupID PersistenceGroupIndex::group(FeatureID id) const
+{
+  std::unordered_map<FeatureID, Membership>::const_iterator it = memberships_.find(id);
+  if(it == memberships_.end())
+    {
+      throw std::out_of_range("No feature with the requested ID has been assigned to a group in this PersistenceGroupIndex");
+    }
+  return it->second.group;
+}
@@ -0,0 +1,224 @@
+#include "persistence_filter_instrumentation.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+
+thread_local PersistenceFilterInstrumentation::ThreadCounters* PersistenceFilterInstrumentation::thread_counters_ = nullptr;
+std::atomic<uint64_t> PersistenceFilterInstrumentation::sampling_period_(64);
+
+const size_t PersistenceFilterInstrumentation::NUM_LATENCY_BUCKETS;
+
+typedef PersistenceFilterInstrumentation::ThreadCounters ThreadCounters;
+typedef PersistenceFilterInstrumentation::Report Report;
+
+
+/// THREAD REGISTRY
+
+// The counters of every live thread that has recorded anything, together
+// with the accumulated counts of the threads that have since exited
+struct Registry
+{
+  std::mutex mutex;
+  std::vector<ThreadCounters*> threads;
+  Report retired;
+
+  Registry()
+  {
+    std::memset(&retired, 0, sizeof(retired));
+  }
+};
+
+// The registry is intentionally never destroyed, so that threads exiting during static destruction can still retire their counters
+static Registry& registry()
+{
+  static Registry* r = new Registry;
+  return *r;
+}
+
+template<typename Visitor>
+static void for_each_counter(ThreadCounters& counters, Report& report, Visitor visit)
+{
+  for(size_t e = 0; e < PersistenceFilterInstrumentation::NUM_ENTRY_POINTS; ++e)
+    {
+      visit(counters.calls[e], report.calls[e]);
+      for(size_t k = 0; k < PersistenceFilterInstrumentation::NUM_LATENCY_BUCKETS; ++k)
+	visit(counters.latency_histogram[e][k], report.latency_histogram[e][k]);
+    }
+  for(size_t f = 0; f < PersistenceFilterInstrumentation::NUM_FALLBACKS; ++f)
+    {
+      visit(counters.fallbacks[f], report.fallbacks[f]);
+    }
+}
+
+static void accumulate(ThreadCounters& counters, Report& report)
+{
+  for_each_counter(counters, report, [](std::atomic<uint64_t>& counter, uint64_t& total) { total += counter.load(std::memory_order_relaxed); });
+}
+
+static void clear(ThreadCounters& counters)
+{
+  Report unused;
+  for_each_counter(counters, unused, [](std::atomic<uint64_t>& counter, uint64_t&) { counter.store(0, std::memory_order_relaxed); });
+}
+
+// Owned by each registered thread; retires the thread's counters when it exits
+struct PersistenceFilterInstrumentation::ThreadRegistration
+{
+  ThreadCounters* counters;
+
+  ThreadRegistration() : counters(nullptr) {}
+
+  ~ThreadRegistration()
+  {
+    if(!counters)
+      return;
+
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    accumulate(*counters, r.retired);
+    r.threads.erase(std::find(r.threads.begin(), r.threads.end(), counters));
+    delete counters;
+    thread_counters_ = nullptr;
+  }
+};
+
+ThreadCounters& PersistenceFilterInstrumentation::register_thread()
+{
+  static thread_local ThreadRegistration thread_registration;
+
+  ThreadCounters* counters = new ThreadCounters;
+  clear(*counters);
+
+  Registry& r = registry();
+  {
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.threads.push_back(counters);
+  }
+
+  thread_registration.counters = counters;
+  thread_counters_ = counters;
+  return *counters;
+}
+
+void PersistenceFilterInstrumentation::record_latency(ThreadCounters& counters, EntryPoint entry_point, int64_t nanoseconds)
+{
+  // The bucket index is floor(log2(nanoseconds))
+  size_t bucket = (nanoseconds > 1) ? 63 - __builtin_clzll(static_cast<unsigned long long>(nanoseconds)) : 0;
+  increment(counters.latency_histogram[entry_point][std::min(bucket, NUM_LATENCY_BUCKETS - 1)]);
+}
+
+
+/// REPORTING
+
+bool PersistenceFilterInstrumentation::enabled()
+{
+#ifdef PERSISTENCE_FILTER_INSTRUMENTATION
+  return true;
+#else
+  return false;
+#endif
+}
+
+Report PersistenceFilterInstrumentation::report()
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+
+  Report report = r.retired;
+  for(size_t i = 0; i < r.threads.size(); ++i)
+    {
+      accumulate(*r.threads[i], report);
+    }
+  return report;
+}
+
+void PersistenceFilterInstrumentation::reset()
+{
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+
+  std::memset(&r.retired, 0, sizeof(r.retired));
+  for(size_t i = 0; i < r.threads.size(); ++i)
+    {
+      clear(*r.threads[i]);
+    }
+}
+
+uint64_t PersistenceFilterInstrumentation::sampling_period()
+{
+  return sampling_period_.load();
+}
+
+void PersistenceFilterInstrumentation::set_sampling_period(uint64_t period)
+{
+  if( (period == 0) || ( (period & (period - 1)) != 0) )
+    {
+      throw std::invalid_argument("Sampling period must be a power of 2");
+    }
+  sampling_period_.store(period);
+}
+
+const char* PersistenceFilterInstrumentation::name(EntryPoint entry_point)
+{
+  static const char* names[NUM_ENTRY_POINTS] = {"filter_update", "filter_predict", "bank_update", "bank_predict", "bank_update_batch", "bank_predict_batch", "general_purpose_survival_function"};
+  return names[entry_point];
+}
+
+const char* PersistenceFilterInstrumentation::name(Fallback fallback)
+{
+  static const char* names[NUM_FALLBACKS] = {"e1_asymptotic_expansion", "survival_underflow", "belief_underflow", "degenerate_log_arithmetic", "bank_batch_sequential", "fused_update_unscaled"};
+  return names[fallback];
+}
+
+uint64_t Report::num_samples(PersistenceFilterInstrumentation::EntryPoint entry_point) const
+{
+  uint64_t n = 0;
+  for(size_t k = 0; k < PersistenceFilterInstrumentation::NUM_LATENCY_BUCKETS; ++k)
+    {
+      n += latency_histogram[entry_point][k];
+    }
+  return n;
+}
+
+double Report::latency_quantile(PersistenceFilterInstrumentation::EntryPoint entry_point, double q) const
+{
+  uint64_t n = num_samples(entry_point);
+  if(n == 0)
+    {
+      return 0.0;
+    }
+
+  // The number of samples that must lie at or below the quantile
+  uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * n + 0.5));
+  uint64_t cumulative = 0;
+  for(size_t k = 0; k < PersistenceFilterInstrumentation::NUM_LATENCY_BUCKETS; ++k)
+    {
+      cumulative += latency_histogram[entry_point][k];
+      if(cumulative >= rank)
+	{
+	  return static_cast<double>(2ULL << k);
+	}
+    }
+  return static_cast<double>(2ULL << (PersistenceFilterInstrumentation::NUM_LATENCY_BUCKETS - 1));
+}
+
+void Report::write(std::ostream& out) const
+{
+  out << std::left << std::setw(36) << "entry point" << std::right << std::setw(14) << "calls" << std::setw(10) << "samples" << std::setw(12) << "p50 (ns)" << std::setw(12) << "p99 (ns)" << std::endl;
+  for(size_t e = 0; e < PersistenceFilterInstrumentation::NUM_ENTRY_POINTS; ++e)
+    {
+      PersistenceFilterInstrumentation::EntryPoint entry_point = static_cast<PersistenceFilterInstrumentation::EntryPoint>(e);
+      out << std::left << std::setw(36) << PersistenceFilterInstrumentation::name(entry_point) << std::right << std::setw(14) << calls[e] << std::setw(10) << num_samples(entry_point) << std::setw(12) << latency_quantile(entry_point, .5) << std::setw(12) << latency_quantile(entry_point, .99) << std::endl;
+    }
+
+  out << std::left << std::setw(36) << "fallback" << std::right << std::setw(14) << "count" << std::endl;
+  for(size_t f = 0; f < PersistenceFilterInstrumentation::NUM_FALLBACKS; ++f)
+    {
+      out << std::left << std::setw(36) << PersistenceFilterInstrumentation::name(static_cast<PersistenceFilterInstrumentation::Fallback>(f)) << std::right << std::setw(14) << fallbacks[f] << std::endl;
+    }
+}
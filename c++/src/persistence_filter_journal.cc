@@ -0,0 +1,295 @@
+#include "persistence_filter_journal.h"
+#include "persistence_filter_snapshot.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static const char JOURNAL_MAGIC[8] = {'P', 'F', 'J', 'R', 'N', 'L', '\r', '\n'};
+static const uint32_t JOURNAL_BYTE_ORDER = 0x01020304;
+
+// The number of records read from the file at a time
+static const size_t JOURNAL_READ_SIZE = 4096;
+
+static_assert(sizeof(PersistenceFilterJournalHeader) == 32, "PersistenceFilterJournalHeader must occupy exactly 32 bytes");
+static_assert(sizeof(PersistenceFilterJournalRecord) == 48, "PersistenceFilterJournalRecord must occupy exactly 48 bytes");
+
+// Mix the fields of 'record' (other than the checksum itself) into a 32-bit hash
+static uint32_t record_checksum(const PersistenceFilterJournalRecord& record)
+{
+  uint64_t words[5];
+  words[0] = record.kind;
+  std::memcpy(&words[1], &record.last_observation_time, sizeof(double));
+  std::memcpy(&words[2], &record.log_likelihood, sizeof(double));
+  std::memcpy(&words[3], &record.log_evidence_lower_sum, sizeof(double));
+  std::memcpy(&words[4], &record.log_evidence, sizeof(double));
+
+  uint64_t h = record.id ^ 0xCBF29CE484222325ULL;
+  for(size_t i = 0; i < 5; ++i)
+    {
+      h = (h ^ words[i]) * 0x9E3779B97F4A7C15ULL;
+      h ^= h >> 29;
+    }
+  return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+static bool is_valid_record(const PersistenceFilterJournalRecord& record)
+{
+  return (record.kind >= PersistenceFilterJournalRecord::ADD) && (record.kind <= PersistenceFilterJournalRecord::REMOVE) && (record.checksum == record_checksum(record));
+}
+
+// Read up to 'num_records' records starting with record 'first' into 'records', returning the number of complete records read
+static size_t read_records(int fd, const std::string& filename, size_t first, size_t num_records, PersistenceFilterJournalRecord* records)
+{
+  char* data = reinterpret_cast<char*>(records);
+  size_t size = num_records * sizeof(PersistenceFilterJournalRecord);
+  off_t offset = sizeof(PersistenceFilterJournalHeader) + first * sizeof(PersistenceFilterJournalRecord);
+
+  size_t total = 0;
+  while(total < size)
+    {
+      ssize_t n = pread(fd, data + total, size - total, offset + total);
+      if(n < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  throw std::runtime_error("Error reading journal file " + filename + ": " + std::strerror(errno));
+	}
+      if(n == 0)
+	break;
+      total += n;
+    }
+  return total / sizeof(PersistenceFilterJournalRecord);
+}
+
+
+PersistenceFilterJournal::PersistenceFilterJournal(const std::string& filename, size_t group_size, bool sync) : filename_(filename), group_size_(group_size > 0 ? group_size : 1), sync_(sync), num_committed_(0)
+{
+  fd_ = open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if(fd_ < 0)
+    {
+      throw std::runtime_error("Unable to open journal file " + filename + ": " + std::strerror(errno));
+    }
+
+  try
+    {
+      struct stat status;
+      if(fstat(fd_, &status) != 0)
+	{
+	  throw std::runtime_error("Unable to stat journal file " + filename);
+	}
+
+      if(status.st_size == 0)
+	{
+	  // A new journal
+	  PersistenceFilterJournalHeader header;
+	  std::memset(&header, 0, sizeof(header));
+	  std::memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+	  header.version = PERSISTENCE_FILTER_JOURNAL_VERSION;
+	  header.byte_order = JOURNAL_BYTE_ORDER;
+	  header.record_size = sizeof(Record);
+	  write_fully(&header, sizeof(header));
+	  if(sync_ && (fdatasync(fd_) != 0))
+	    {
+	      throw std::runtime_error("Unable to sync journal file " + filename);
+	    }
+	}
+      else
+	{
+	  // Validate the header
+	  PersistenceFilterJournalHeader header;
+	  const char* error = nullptr;
+	  if( (static_cast<size_t>(status.st_size) < sizeof(header)) || (pread(fd_, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) )
+	    error = " is too short to contain a header";
+	  else if(std::memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0)
+	    error = " is not a persistence filter journal";
+	  else if(header.byte_order != JOURNAL_BYTE_ORDER)
+	    error = " was written on a machine with a different byte order";
+	  else if( (header.version != PERSISTENCE_FILTER_JOURNAL_VERSION) || (header.record_size != sizeof(Record)) )
+	    error = " has an unsupported format version";
+
+	  if(error)
+	    {
+	      throw std::runtime_error("Journal file " + filename + error);
+	    }
+
+	  // Find the end of the last intact record, discarding anything after it
+	  std::vector<Record> records(JOURNAL_READ_SIZE);
+	  bool intact = true;
+	  while(intact)
+	    {
+	      size_t n = read_records(fd_, filename, num_committed_, records.size(), records.data());
+	      size_t k = 0;
+	      while( (k < n) && is_valid_record(records[k]) )
+		++k;
+	      num_committed_ += k;
+	      intact = (k == records.size());
+	    }
+
+	  off_t end = sizeof(PersistenceFilterJournalHeader) + num_committed_ * sizeof(Record);
+	  if( (status.st_size != end) && (ftruncate(fd_, end) != 0) )
+	    {
+	      throw std::runtime_error("Unable to truncate the torn tail of journal file " + filename);
+	    }
+	}
+    }
+  catch(...)
+    {
+      close(fd_);
+      throw;
+    }
+
+  buffer_.reserve(group_size_);
+}
+
+PersistenceFilterJournal::~PersistenceFilterJournal()
+{
+  try
+    {
+      commit();
+    }
+  catch(...)
+    {
+    }
+  close(fd_);
+}
+
+void PersistenceFilterJournal::write_fully(const void* data, size_t size)
+{
+  const char* bytes = static_cast<const char*>(data);
+  while(size > 0)
+    {
+      ssize_t n = write(fd_, bytes, size);
+      if(n < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  throw std::runtime_error("Error writing journal file " + filename_ + ": " + std::strerror(errno));
+	}
+      bytes += n;
+      size -= n;
+    }
+}
+
+void PersistenceFilterJournal::push(Record& record)
+{
+  record.checksum = record_checksum(record);
+  buffer_.push_back(record);
+  if(buffer_.size() >= group_size_)
+    {
+      commit();
+    }
+}
+
+void PersistenceFilterJournal::log_state(Record::Kind kind, const PersistenceFilterBank& bank, size_t slot)
+{
+  Record record;
+  record.id = bank.id(slot);
+  record.kind = kind;
+  record.last_observation_time = bank.last_observation_time_slot(slot);
+  record.log_likelihood = bank.log_likelihood_slot(slot);
+  record.log_evidence_lower_sum = bank.log_evidence_lower_sum_slot(slot);
+  record.log_evidence = bank.log_evidence_slot(slot);
+  push(record);
+}
+
+void PersistenceFilterJournal::log_update_batch(const PersistenceFilterBank& bank, const FeatureID* ids, size_t num_features)
+{
+  for(size_t i = 0; i < num_features; ++i)
+    {
+      log_state(Record::UPDATE, bank, bank.slot(ids[i]));
+    }
+}
+
+void PersistenceFilterJournal::log_remove(FeatureID id)
+{
+  Record record;
+  std::memset(&record, 0, sizeof(record));
+  record.id = id;
+  record.kind = Record::REMOVE;
+  push(record);
+}
+
+void PersistenceFilterJournal::commit()
+{
+  if(buffer_.empty())
+    {
+      return;
+    }
+
+  write_fully(buffer_.data(), buffer_.size() * sizeof(Record));
+  num_committed_ += buffer_.size();
+  buffer_.clear();
+
+  if(sync_ && (fdatasync(fd_) != 0))
+    {
+      throw std::runtime_error("Unable to sync journal file " + filename_);
+    }
+}
+
+void PersistenceFilterJournal::checkpoint(const PersistenceFilterBank& bank, const std::string& snapshot_filename)
+{
+  commit();
+  save_persistence_filter_snapshot(bank, snapshot_filename);
+
+  // save_persistence_filter_snapshot() returns only once the snapshot (and its
+  // new directory entry) are durably stored, so the journal records it
+  // supersedes can now be discarded
+  if(ftruncate(fd_, sizeof(PersistenceFilterJournalHeader)) != 0)
+    {
+      throw std::runtime_error("Unable to truncate journal file " + filename_);
+    }
+  num_committed_ = 0;
+
+  if(sync_ && (fdatasync(fd_) != 0))
+    {
+      throw std::runtime_error("Unable to sync journal file " + filename_);
+    }
+}
+
+size_t PersistenceFilterJournal::replay(PersistenceFilterBank& bank) const
+{
+  std::vector<Record> records(JOURNAL_READ_SIZE);
+  size_t num_applied = 0;
+  while(num_applied < num_committed_)
+    {
+      size_t n = read_records(fd_, filename_, num_applied, std::min(records.size(), num_committed_ - num_applied), records.data());
+      if(n == 0)
+	{
+	  throw std::runtime_error("Journal file " + filename_ + " is shorter than expected");
+	}
+
+      for(size_t k = 0; k < n; ++k)
+	{
+	  const Record& record = records[k];
+	  switch(record.kind)
+	    {
+	    case Record::ADD:
+	      // The feature may be present already if we are replaying over a snapshot that reflects this record
+	      bank.remove(record.id);
+	      bank.add(record.id, record.last_observation_time);
+	      break;
+
+	    case Record::UPDATE:
+	      if(bank.contains(record.id))
+		{
+		  bank.set_state_slot(bank.slot(record.id), record.last_observation_time, record.log_likelihood, record.log_evidence_lower_sum, record.log_evidence);
+		}
+	      break;
+
+	    case Record::REMOVE:
+	      bank.remove(record.id);
+	      break;
+	    }
+	}
+      num_applied += n;
+    }
+
+  return num_applied;
+}
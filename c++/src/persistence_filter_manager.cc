@@ -0,0 +1,425 @@
+#include "persistence_filter_manager.h"
+#include "persistence_filter_math.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+
+// The largest number of commands a worker drains from its queue before applying them and publishing a snapshot
+static const size_t MAX_BATCH_SIZE = 4096;
+
+
+/// SNAPSHOTS
+
+const size_t PersistenceFilterManager::SNAPSHOT_CHUNK_SIZE;
+
+size_t PersistenceFilterManager::Snapshot::find(FeatureID id) const
+{
+  // Find the last chunk whose first ID is at most 'id', then search within it
+  std::vector<std::shared_ptr<const SnapshotChunk> >::const_iterator chunk_it = std::upper_bound(chunks.begin(), chunks.end(), id, [](FeatureID id, const std::shared_ptr<const SnapshotChunk>& chunk) { return id < chunk->ids.front(); });
+  if(chunk_it == chunks.begin())
+    {
+      return num_features;
+    }
+  --chunk_it;
+
+  const std::vector<FeatureID>& chunk_ids = (*chunk_it)->ids;
+  std::vector<FeatureID>::const_iterator it = std::lower_bound(chunk_ids.begin(), chunk_ids.end(), id);
+  return ( (it != chunk_ids.end()) && (*it == id) ) ? (chunk_it - chunks.begin()) * SNAPSHOT_CHUNK_SIZE + (it - chunk_ids.begin()) : num_features;
+}
+
+// Construct a chunk holding the states of the features in 'order[begin:end)'
+static std::shared_ptr<const PersistenceFilterManager::SnapshotChunk> make_chunk(const PersistenceFilterBank& bank, const std::vector<size_t>& order, size_t begin, size_t end)
+{
+  std::shared_ptr<PersistenceFilterManager::SnapshotChunk> chunk(new PersistenceFilterManager::SnapshotChunk);
+  size_t n = end - begin;
+  chunk->ids.resize(n);
+  chunk->initialization_time.resize(n);
+  chunk->last_observation_time.resize(n);
+  chunk->log_likelihood.resize(n);
+  chunk->log_evidence.resize(n);
+
+  for(size_t i = 0; i < n; ++i)
+    {
+      size_t slot = order[begin + i];
+      chunk->ids[i] = bank.id(slot);
+      chunk->initialization_time[i] = bank.initialization_time_slot(slot);
+      chunk->last_observation_time[i] = bank.last_observation_time_slot(slot);
+      chunk->log_likelihood[i] = bank.log_likelihood_slot(slot);
+      chunk->log_evidence[i] = bank.log_evidence_slot(slot);
+    }
+
+  return chunk;
+}
+
+std::shared_ptr<const PersistenceFilterManager::Snapshot> PersistenceFilterManager::take_snapshot(Shard& shard, bool membership_changed, uint64_t version) const
+{
+  PersistenceFilterBank& bank = shard.bank;
+  size_t n = shard.order.size();
+
+  std::shared_ptr<Snapshot> snapshot(new Snapshot);
+  snapshot->version = version;
+
+  if(membership_changed)
+    {
+      // Squeeze out removed features once they make up most of the bank
+      if(2 * bank.size() < bank.num_slots())
+	{
+	  bank.compact();
+	}
+
+      shard.order.clear();
+      for(size_t slot = 0; slot < bank.num_slots(); ++slot)
+	{
+	  if(bank.is_live(slot))
+	    {
+	      shard.order.push_back(slot);
+	    }
+	}
+
+      std::sort(shard.order.begin(), shard.order.end(), [&bank](size_t a, size_t b) { return bank.id(a) < bank.id(b); });
+
+      n = shard.order.size();
+      shard.position.resize(bank.num_slots());
+      for(size_t i = 0; i < n; ++i)
+	{
+	  shard.position[shard.order[i]] = i;
+	}
+
+      // Every chunk must be rebuilt
+      snapshot->chunks.reserve( (n + SNAPSHOT_CHUNK_SIZE - 1) / SNAPSHOT_CHUNK_SIZE);
+      for(size_t begin = 0; begin < n; begin += SNAPSHOT_CHUNK_SIZE)
+	{
+	  snapshot->chunks.push_back(make_chunk(bank, shard.order, begin, std::min(begin + SNAPSHOT_CHUNK_SIZE, n)));
+	}
+      shard.stale_chunks.assign(snapshot->chunks.size(), 0);
+    }
+  else
+    {
+      // Share the previous snapshot's chunks, replacing those containing an updated feature
+      snapshot->chunks = std::atomic_load(&shard.snapshot)->chunks;
+
+      for(size_t k = 0; k < shard.updated_slots.size(); ++k)
+	{
+	  size_t c = shard.position[shard.updated_slots[k]] / SNAPSHOT_CHUNK_SIZE;
+	  if(!shard.stale_chunks[c])
+	    {
+	      shard.stale_chunks[c] = 1;
+	      size_t begin = c * SNAPSHOT_CHUNK_SIZE;
+	      snapshot->chunks[c] = make_chunk(bank, shard.order, begin, std::min(begin + SNAPSHOT_CHUNK_SIZE, n));
+	    }
+	}
+
+      for(size_t k = 0; k < shard.updated_slots.size(); ++k)
+	{
+	  shard.stale_chunks[shard.position[shard.updated_slots[k]] / SNAPSHOT_CHUNK_SIZE] = 0;
+	}
+    }
+
+  snapshot->num_features = n;
+  shard.updated_slots.clear();
+
+  return snapshot;
+}
+
+
+/// CONSTRUCTION AND DESTRUCTION
+
+PersistenceFilterManager::PersistenceFilterManager(const LogSurvivalFunction& log_survival_function, size_t num_shards) : logS_(log_survival_function), stop_(false)
+{
+  if(num_shards == 0)
+    {
+      num_shards = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+
+  for(size_t i = 0; i < num_shards; ++i)
+    {
+      shards_.push_back(std::unique_ptr<Shard>(new Shard(log_survival_function)));
+    }
+
+  // Start the workers only once every shard has been constructed
+  for(size_t i = 0; i < num_shards; ++i)
+    {
+      Shard* shard = shards_[i].get();
+      shard->worker = std::thread([this, shard]() { run_worker(*shard); });
+    }
+}
+
+PersistenceFilterManager::~PersistenceFilterManager()
+{
+  stop_.store(true);
+
+  for(size_t i = 0; i < shards_.size(); ++i)
+    {
+      Shard& shard = *shards_[i];
+      {
+	std::lock_guard<std::mutex> lock(shard.mutex);
+      }
+      shard.work_available.notify_one();
+      shard.worker.join();
+    }
+}
+
+
+/// SUBMISSION
+
+size_t PersistenceFilterManager::shard_index(FeatureID id) const
+{
+  // Mix the bits of the ID (using the finalizer of the SplitMix64 generator),
+  // so that IDs with regular strides are still spread evenly over the shards
+  uint64_t z = id;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z = z ^ (z >> 31);
+
+  return z % shards_.size();
+}
+
+void PersistenceFilterManager::submit(Command& command)
+{
+  Shard& shard = shard_for(command.id);
+
+  command.sequence = shard.submitted.fetch_add(1);
+  shard.queue.push(command);
+
+  // If the worker went to sleep before it could see this command, wake it up.
+  // (The worker sets 'sleeping' before its final check of the queue, and both
+  // that check and the push above are sequentially consistent, so at least
+  // one of the two threads sees the other's write.)
+  if(shard.sleeping.load())
+    {
+      {
+	std::lock_guard<std::mutex> lock(shard.mutex);
+      }
+      shard.work_available.notify_one();
+    }
+}
+
+void PersistenceFilterManager::add(FeatureID id, double initialization_time)
+{
+  Command command;
+  command.type = Command::ADD;
+  command.id = id;
+  command.time = initialization_time;
+  command.detector_output = false;
+  command.P_M = command.P_F = 0.0;
+
+  submit(command);
+}
+
+void PersistenceFilterManager::remove(FeatureID id)
+{
+  Command command;
+  command.type = Command::REMOVE;
+  command.id = id;
+  command.time = 0.0;
+  command.detector_output = false;
+  command.P_M = command.P_F = 0.0;
+
+  submit(command);
+}
+
+void PersistenceFilterManager::update(FeatureID id, bool detector_output, double observation_time, double P_M, double P_F)
+{
+  // Input checking (the ordering of observation times can only be checked by the worker)
+  if( (P_M < 0) || (P_M > 1) )
+    {
+      throw std::domain_error("Probability of missed detection must be between 0 and 1");
+    }
+
+  if( (P_F < 0) || (P_F > 1) )
+    {
+      throw std::domain_error("Probability of false alarm must be between 0 and 1");
+    }
+
+  Command command;
+  command.type = Command::UPDATE;
+  command.id = id;
+  command.time = observation_time;
+  command.detector_output = detector_output;
+  command.P_M = P_M;
+  command.P_F = P_F;
+
+  submit(command);
+}
+
+void PersistenceFilterManager::flush()
+{
+  for(size_t i = 0; i < shards_.size(); ++i)
+    {
+      Shard& shard = *shards_[i];
+      uint64_t target = shard.submitted.load();
+
+      std::unique_lock<std::mutex> lock(shard.mutex);
+      shard.work_applied.wait(lock, [&shard, target]() { return shard.applied.load() >= target; });
+    }
+}
+
+
+/// WORKERS
+
+void PersistenceFilterManager::run_worker(Shard& shard)
+{
+  std::vector<Command> commands;
+  commands.reserve(MAX_BATCH_SIZE);
+
+  for(;;)
+    {
+      // Drain the queue
+      commands.clear();
+      Command command;
+      while( (commands.size() < MAX_BATCH_SIZE) && shard.queue.try_pop(command) )
+	{
+	  commands.push_back(command);
+	}
+
+      if(!commands.empty())
+	{
+	  apply(shard, commands);
+	  continue;
+	}
+
+      if(!shard.queue.empty())
+	{
+	  // A producer is part-way through a push; its command will be available momentarily
+	  std::this_thread::yield();
+	  continue;
+	}
+
+      if(stop_.load())
+	{
+	  return;
+	}
+
+      // Nothing to do, so go to sleep until a producer (or the destructor) wakes us
+      std::unique_lock<std::mutex> lock(shard.mutex);
+      shard.sleeping.store(true);
+      shard.work_available.wait(lock, [this, &shard]() { return !shard.queue.empty() || stop_.load(); });
+      shard.sleeping.store(false);
+    }
+}
+
+void PersistenceFilterManager::apply(Shard& shard, std::vector<Command>& commands)
+{
+  PersistenceFilterBank& bank = shard.bank;
+  bool membership_changed = false;
+  uint64_t dropped = 0;
+
+  // Sort each run of updates between consecutive ADD and REMOVE commands by
+  // observation time.  (Commands are popped in the order in which they were
+  // pushed, which can differ slightly from their sequence numbers, so we sort
+  // by sequence number first.)
+  std::sort(commands.begin(), commands.end(), [](const Command& a, const Command& b) { return a.sequence < b.sequence; });
+
+  std::vector<Command>::iterator run_begin = commands.begin();
+  while(run_begin != commands.end())
+    {
+      std::vector<Command>::iterator run_end = run_begin;
+      while( (run_end != commands.end()) && (run_end->type == Command::UPDATE) )
+	{
+	  ++run_end;
+	}
+
+      // Order updates by observation time, breaking ties by submission order
+      std::sort(run_begin, run_end, [](const Command& a, const Command& b) { return (a.time < b.time) || ( (a.time == b.time) && (a.sequence < b.sequence) ); });
+
+      for(std::vector<Command>::iterator it = run_begin; it != run_end; ++it)
+	{
+	  if(!bank.contains(it->id))
+	    {
+	      ++dropped;
+	      continue;
+	    }
+
+	  size_t slot = bank.slot(it->id);
+	  if(it->time < bank.last_observation_time_slot(slot))
+	    {
+	      ++dropped;
+	      continue;
+	    }
+
+	  bank.update_slot(slot, it->detector_output, it->time, it->P_M, it->P_F);
+	  shard.updated_slots.push_back(slot);
+	}
+
+      if(run_end == commands.end())
+	{
+	  break;
+	}
+
+      // Apply the ADD or REMOVE command that ended this run
+      if(run_end->type == Command::ADD)
+	{
+	  if(!bank.contains(run_end->id))
+	    {
+	      bank.add(run_end->id, run_end->time);
+	      membership_changed = true;
+	    }
+	}
+      else
+	{
+	  membership_changed |= bank.remove(run_end->id);
+	}
+
+      run_begin = run_end + 1;
+    }
+
+  // Publish the new state
+  std::shared_ptr<const Snapshot> snapshot = take_snapshot(shard, membership_changed, shard.applied.load() + commands.size());
+  std::atomic_store(&shard.snapshot, snapshot);
+
+  shard.dropped.fetch_add(dropped);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.applied.fetch_add(commands.size());
+  }
+  shard.work_applied.notify_all();
+}
+
+
+/// QUERIES
+
+bool PersistenceFilterManager::contains(FeatureID id) const
+{
+  std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&shard_for(id).snapshot);
+  return snapshot->find(id) < snapshot->size();
+}
+
+size_t PersistenceFilterManager::size() const
+{
+  size_t n = 0;
+  for(size_t i = 0; i < shards_.size(); ++i)
+    {
+      n += snapshot(i)->size();
+    }
+  return n;
+}
+
+double PersistenceFilterManager::predict(FeatureID id, double prediction_time) const
+{
+  std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&shard_for(id).snapshot);
+
+  size_t i = snapshot->find(id);
+  if(i == snapshot->size())
+    {
+      throw std::out_of_range("No feature with the requested ID is present in the current PersistenceFilterManager snapshot");
+    }
+
+  // Input checking
+  if(prediction_time < snapshot->last_observation_time(i))
+    {
+      throw std::domain_error("Prediction time must be at least as recent as the last incorporated observation (prediction_time >= last_observation_time)");
+    }
+
+  return clamped_exp(snapshot->log_likelihood(i) - snapshot->log_evidence(i) + logS_(prediction_time - snapshot->initialization_time(i)));
+}
+
+uint64_t PersistenceFilterManager::dropped_updates() const
+{
+  uint64_t n = 0;
+  for(size_t i = 0; i < shards_.size(); ++i)
+    {
+      n += shards_[i]->dropped.load();
+    }
+  return n;
+}
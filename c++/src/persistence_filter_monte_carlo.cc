@@ -0,0 +1,314 @@
+#include "persistence_filter_monte_carlo.h"
+#include "persistence_filter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+
+// Trials are grouped into blocks of this many consecutive trials; each block's
+// metrics are summed in trial order, and the block sums are then combined in
+// block order, so that the results do not depend upon which thread ran which
+// block
+static const size_t TRIALS_PER_BLOCK = 64;
+
+
+void sample_observation_times(double lambda_r, double lambda_o, double p_N, double simulation_length, std::mt19937_64& rng, std::vector<double>& observation_times)
+{
+  std::exponential_distribution<double> revisit_interval(lambda_r);
+  std::exponential_distribution<double> observation_interval(lambda_o);
+  std::geometric_distribution<int> num_extra_observations(p_N);
+
+  observation_times.clear();
+  double current_time = 0;
+  while(current_time < simulation_length)
+    {
+      // Sample the number of observations obtained on this revisit, and their times
+      int N = 1 + num_extra_observations(rng);
+      for(int i = 0; i < N; ++i)
+	{
+	  current_time += observation_interval(rng);
+	  if(current_time <= simulation_length)
+	    {
+	      observation_times.push_back(current_time);
+	    }
+	}
+
+      // Sample a revisitation interval
+      current_time += revisit_interval(rng);
+    }
+}
+
+
+/// SCORING
+
+// Sums of the per-trial metrics of one estimator over a set of trials
+struct MetricSums
+{
+  double absolute_error;
+  double squared_absolute_error;
+  std::vector<double> precision;
+  std::vector<double> recall;
+  std::vector<size_t> num_precisions;
+  std::vector<size_t> num_recalls;
+
+  MetricSums(size_t num_thresholds = 0) : absolute_error(0), squared_absolute_error(0), precision(num_thresholds, 0.0), recall(num_thresholds, 0.0), num_precisions(num_thresholds, 0), num_recalls(num_thresholds, 0) {}
+
+  void add(const MetricSums& other)
+  {
+    absolute_error += other.absolute_error;
+    squared_absolute_error += other.squared_absolute_error;
+    for(size_t k = 0; k < precision.size(); ++k)
+      {
+	precision[k] += other.precision[k];
+	recall[k] += other.recall[k];
+	num_precisions[k] += other.num_precisions[k];
+	num_recalls[k] += other.num_recalls[k];
+      }
+  }
+};
+
+// Score the beliefs of one estimator at the query times against the ground truth (the feature is present at the query times preceding 'num_present'), adding the results to 'sums'
+static void score(const std::vector<double>& query_times, size_t num_present, const std::vector<double>& beliefs, const std::vector<double>& thresholds, MetricSums& sums)
+{
+  const size_t n = query_times.size();
+
+  // Mean absolute error, using the trapezoid rule
+  double L1_error = 0;
+  for(size_t j = 0; j + 1 < n; ++j)
+    {
+      double e0 = std::fabs( (j < num_present ? 1.0 : 0.0) - beliefs[j]);
+      double e1 = std::fabs( (j + 1 < num_present ? 1.0 : 0.0) - beliefs[j + 1]);
+      L1_error += .5 * (e0 + e1) * (query_times[j + 1] - query_times[j]);
+    }
+  double mean_absolute_error = (n > 1) ? L1_error / (query_times[n - 1] - query_times[0]) : std::fabs( (num_present > 0 ? 1.0 : 0.0) - beliefs[0]);
+  sums.absolute_error += mean_absolute_error;
+  sums.squared_absolute_error += mean_absolute_error * mean_absolute_error;
+
+  // Precision and recall of the absence classifications
+  size_t num_true_absences = n - num_present;
+  for(size_t k = 0; k < thresholds.size(); ++k)
+    {
+      size_t num_predicted_absences = 0, num_correct_predicted_absences = 0;
+      for(size_t j = 0; j < n; ++j)
+	{
+	  if(beliefs[j] < thresholds[k])
+	    {
+	      ++num_predicted_absences;
+	      if(j >= num_present)
+		{
+		  ++num_correct_predicted_absences;
+		}
+	    }
+	}
+
+      if(num_predicted_absences > 0)
+	{
+	  sums.precision[k] += static_cast<double>(num_correct_predicted_absences) / num_predicted_absences;
+	  ++sums.num_precisions[k];
+	}
+      if(num_true_absences > 0)
+	{
+	  sums.recall[k] += static_cast<double>(num_correct_predicted_absences) / num_true_absences;
+	  ++sums.num_recalls[k];
+	}
+    }
+}
+
+static MonteCarloMetrics finalize(const MetricSums& sums, size_t num_trials)
+{
+  MonteCarloMetrics metrics;
+  metrics.mean_absolute_error = sums.absolute_error / num_trials;
+  double variance = (num_trials > 1) ? (sums.squared_absolute_error - num_trials * metrics.mean_absolute_error * metrics.mean_absolute_error) / (num_trials - 1) : 0.0;
+  metrics.mean_absolute_error_stddev = std::sqrt(std::max(variance, 0.0));
+
+  for(size_t k = 0; k < sums.precision.size(); ++k)
+    {
+      metrics.precisions.push_back(sums.num_precisions[k] > 0 ? sums.precision[k] / sums.num_precisions[k] : std::nan(""));
+      metrics.recalls.push_back(sums.num_recalls[k] > 0 ? sums.recall[k] / sums.num_recalls[k] : std::nan(""));
+    }
+  metrics.num_precisions = sums.num_precisions;
+  metrics.num_recalls = sums.num_recalls;
+  return metrics;
+}
+
+
+/// SIMULATION
+
+// The buffers used by a worker thread, which are reused from trial to trial
+struct TrialWorkspace
+{
+  std::vector<double> observation_times;
+  std::unique_ptr<bool[]> detector_outputs;
+  size_t detector_outputs_capacity;
+  std::vector<double> beliefs;
+
+  TrialWorkspace() : detector_outputs_capacity(0) {}
+};
+
+// Run trial 'trial', adding the metrics of the filter using each of the 'priors' to filter_sums, and those of the empirical estimator to empirical_sums
+static void run_trial(const MonteCarloSettings& settings, const std::vector<LogSurvivalFunction>& priors, const std::vector<double>& query_times, size_t trial, TrialWorkspace& workspace, std::vector<MetricSums>& filter_sums, MetricSums& empirical_sums)
+{
+  std::seed_seq seed_sequence({static_cast<uint32_t>(settings.seed), static_cast<uint32_t>(settings.seed >> 32), static_cast<uint32_t>(trial), static_cast<uint32_t>(static_cast<uint64_t>(trial) >> 32)});
+  std::mt19937_64 rng(seed_sequence);
+
+  // Sample a survival time, observation times, and detector outputs
+  double survival_time = std::uniform_real_distribution<double>(0.0, settings.simulation_length)(rng);
+  sample_observation_times(settings.lambda_r, settings.lambda_o, settings.p_N, settings.simulation_length, rng, workspace.observation_times);
+
+  const std::vector<double>& t = workspace.observation_times;
+  const size_t num_observations = t.size();
+  if(workspace.detector_outputs_capacity < num_observations)
+    {
+      workspace.detector_outputs_capacity = std::max(num_observations, 2 * workspace.detector_outputs_capacity);
+      workspace.detector_outputs.reset(new bool[workspace.detector_outputs_capacity]);
+    }
+  bool* Y = workspace.detector_outputs.get();
+
+  std::bernoulli_distribution detection(1 - settings.P_M), false_alarm(settings.P_F);
+  for(size_t i = 0; i < num_observations; ++i)
+    {
+      Y[i] = (t[i] <= survival_time) ? detection(rng) : false_alarm(rng);
+    }
+
+  // The feature is present at the query times preceding num_present
+  size_t num_present = std::upper_bound(query_times.begin(), query_times.end(), survival_time) - query_times.begin();
+
+  // Run the persistence filters
+  std::vector<double>& beliefs = workspace.beliefs;
+  beliefs.resize(query_times.size());
+  for(size_t p = 0; p < priors.size(); ++p)
+    {
+      PersistenceFilter filter(priors[p]);
+      run_persistence_filter(filter, num_observations, Y, t.data(), &settings.P_M, 0, &settings.P_F, 0, query_times.size(), query_times.data(), beliefs.data());
+      score(query_times, num_present, beliefs, settings.thresholds, filter_sums[p]);
+    }
+
+  // Run the empirical estimator, which believes the feature is present until it is first observed, and thereafter believes the last detector output
+  size_t i = 0;
+  for(size_t j = 0; j < query_times.size(); ++j)
+    {
+      for(; (i < num_observations) && (t[i] <= query_times[j]); ++i) {}
+      beliefs[j] = (i == 0 || Y[i - 1]) ? 1.0 : 0.0;
+    }
+  score(query_times, num_present, beliefs, settings.thresholds, empirical_sums);
+}
+
+MonteCarloResults run_monte_carlo_evaluation(const MonteCarloSettings& settings, const std::vector<LogSurvivalFunction>& priors)
+{
+  // Input checking
+  if( !(settings.simulation_length > 0) || !(settings.query_interval > 0) )
+    {
+      throw std::domain_error("Simulation length and query interval must be positive");
+    }
+
+  if( !(settings.lambda_r > 0) || !(settings.lambda_o > 0) )
+    {
+      throw std::domain_error("Revisitation and observation rates must be positive");
+    }
+
+  if( !(settings.p_N > 0) || !(settings.p_N <= 1) )
+    {
+      throw std::domain_error("Probability of leaving after each observation must be in (0, 1]");
+    }
+
+  if( !(settings.P_M >= 0) || !(settings.P_M <= 1) )
+    {
+      throw std::domain_error("Probability of missed detection must be between 0 and 1");
+    }
+
+  if( !(settings.P_F >= 0) || !(settings.P_F <= 1) )
+    {
+      throw std::domain_error("Probability of false alarm must be between 0 and 1");
+    }
+
+  if(settings.num_trials == 0)
+    {
+      throw std::domain_error("Number of trials must be positive");
+    }
+
+  // The query times 0, query_interval, 2 * query_interval, ... < simulation_length
+  std::vector<double> query_times(static_cast<size_t>(std::ceil(settings.simulation_length / settings.query_interval)));
+  for(size_t j = 0; j < query_times.size(); ++j)
+    {
+      query_times[j] = j * settings.query_interval;
+    }
+
+  const size_t num_blocks = (settings.num_trials + TRIALS_PER_BLOCK - 1) / TRIALS_PER_BLOCK;
+  const size_t num_estimators = priors.size() + 1;  // The last is the empirical estimator
+  std::vector<std::vector<MetricSums> > block_sums(num_blocks, std::vector<MetricSums>(num_estimators, MetricSums(settings.thresholds.size())));
+
+  // Run the blocks of trials on a pool of worker threads
+  std::atomic<size_t> next_block(0);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto worker = [&]() {
+    TrialWorkspace workspace;
+    try
+      {
+	for(size_t b = next_block++; b < num_blocks; b = next_block++)
+	  {
+	    std::vector<MetricSums>& sums = block_sums[b];
+	    size_t end = std::min(settings.num_trials, (b + 1) * TRIALS_PER_BLOCK);
+	    for(size_t trial = b * TRIALS_PER_BLOCK; trial < end; ++trial)
+	      {
+		run_trial(settings, priors, query_times, trial, workspace, sums, sums.back());
+	      }
+	  }
+      }
+    catch(...)
+      {
+	// Record the error, and stop the other workers
+	std::lock_guard<std::mutex> lock(error_mutex);
+	if(!error)
+	  {
+	    error = std::current_exception();
+	  }
+	next_block = num_blocks;
+      }
+  };
+
+  size_t num_threads = (settings.num_threads > 0) ? settings.num_threads : std::max<size_t>(1, std::thread::hardware_concurrency());
+  num_threads = std::min(num_threads, num_blocks);
+
+  std::vector<std::thread> threads;
+  for(size_t k = 1; k < num_threads; ++k)
+    {
+      threads.push_back(std::thread(worker));
+    }
+  worker();
+  for(size_t k = 0; k < threads.size(); ++k)
+    {
+      threads[k].join();
+    }
+
+  if(error)
+    {
+      std::rethrow_exception(error);
+    }
+
+  // Reduce the block sums in block order
+  std::vector<MetricSums> totals(num_estimators, MetricSums(settings.thresholds.size()));
+  for(size_t b = 0; b < num_blocks; ++b)
+    {
+      for(size_t e = 0; e < num_estimators; ++e)
+	{
+	  totals[e].add(block_sums[b][e]);
+	}
+    }
+
+  MonteCarloResults results;
+  results.num_trials = settings.num_trials;
+  for(size_t p = 0; p < priors.size(); ++p)
+    {
+      results.filters.push_back(finalize(totals[p], settings.num_trials));
+    }
+  results.empirical_estimator = finalize(totals.back(), settings.num_trials);
+  return results;
+}
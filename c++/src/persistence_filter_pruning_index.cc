@@ -0,0 +1,154 @@
+#include "persistence_filter_pruning_index.h"
+#include "persistence_filter_priors.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+
+PersistencePruningIndex::PersistencePruningIndex(const PersistenceFilterBank& bank, double threshold, double tolerance) : bank_(bank), next_generation_(0)
+{
+  // Input checking
+  if( (threshold <= 0) || (threshold > 1) )
+    {
+      throw std::domain_error("Persistence probability threshold must be in the range (0, 1]");
+    }
+
+  if(!(tolerance > 0))
+    {
+      throw std::domain_error("Tolerance must be positive");
+    }
+
+  log_threshold_ = std::log(threshold);
+  tolerance_ = tolerance;
+}
+
+double PersistencePruningIndex::threshold() const
+{
+  return std::exp(log_threshold_);
+}
+
+double PersistencePruningIndex::compute_crossing_time(FeatureID id) const
+{
+  size_t slot = bank_.slot(id);
+  double init_time = bank_.initialization_time_slot(slot);
+
+  // Since p(X_t = 1 | Y_{1:N}) = p(Y_{1:N} | t_N) * S_T(t - t_init) / p(Y_{1:N}), the
+  // belief falls to the threshold once log S_T(t - t_init) <= log(threshold) + log p(Y_{1:N}) - log p(Y_{1:N} | t_N)
+  double log_s = log_threshold_ + bank_.log_evidence_slot(slot) - bank_.log_likelihood_slot(slot);
+
+  return init_time + inverse_log_survival(bank_.logS(), log_s, bank_.last_observation_time_slot(slot) - init_time, tolerance_);
+}
+
+void PersistencePruningIndex::update(FeatureID id)
+{
+  Record& record = records_[id];
+  record.crossing_time = compute_crossing_time(id);
+  record.generation = next_generation_++;
+
+  // The entry holding this feature's previous crossing time (if any) is now stale
+  Entry entry;
+  entry.crossing_time = record.crossing_time;
+  entry.id = id;
+  entry.generation = record.generation;
+  heap_.push_back(entry);
+  std::push_heap(heap_.begin(), heap_.end());
+
+  if(heap_.size() > 2 * records_.size() + 16)
+    {
+      rebuild();
+    }
+}
+
+void PersistencePruningIndex::update_all()
+{
+  records_.clear();
+  heap_.clear();
+
+  for(size_t slot = 0; slot < bank_.num_slots(); ++slot)
+    {
+      if(bank_.is_live(slot))
+	{
+	  Record& record = records_[bank_.id(slot)];
+	  record.crossing_time = compute_crossing_time(bank_.id(slot));
+	  record.generation = next_generation_++;
+	}
+    }
+
+  rebuild();
+}
+
+bool PersistencePruningIndex::remove(FeatureID id)
+{
+  // The feature's heap entry is discarded lazily
+  return records_.erase(id) > 0;
+}
+
+void PersistencePruningIndex::rebuild()
+{
+  heap_.clear();
+  heap_.reserve(records_.size());
+  for(std::unordered_map<FeatureID, Record>::const_iterator it = records_.begin(); it != records_.end(); ++it)
+    {
+      Entry entry;
+      entry.crossing_time = it->second.crossing_time;
+      entry.id = it->first;
+      entry.generation = it->second.generation;
+      heap_.push_back(entry);
+    }
+  std::make_heap(heap_.begin(), heap_.end());
+}
+
+size_t PersistencePruningIndex::pop_expired(double prediction_time, std::vector<FeatureID>& expired)
+{
+  size_t num_expired = 0;
+  while(!heap_.empty() && (heap_.front().crossing_time <= prediction_time))
+    {
+      Entry entry = heap_.front();
+      std::pop_heap(heap_.begin(), heap_.end());
+      heap_.pop_back();
+
+      // Skip entries that have been superseded by a later update, or whose feature has been removed
+      std::unordered_map<FeatureID, Record>::iterator it = records_.find(entry.id);
+      if( (it == records_.end()) || (it->second.generation != entry.generation) )
+	{
+	  continue;
+	}
+
+      records_.erase(it);
+      expired.push_back(entry.id);
+      ++num_expired;
+    }
+
+  return num_expired;
+}
+
+double PersistencePruningIndex::crossing_time(FeatureID id) const
+{
+  std::unordered_map<FeatureID, Record>::const_iterator it = records_.find(id);
+  if(it == records_.end())
+    {
+      throw std::out_of_range("No feature with the requested ID is tracked by this PersistencePruningIndex");
+    }
+  return it->second.crossing_time;
+}
+
+double PersistencePruningIndex::next_crossing_time()
+{
+  // Discard stale entries from the top of the heap
+  while(!heap_.empty())
+    {
+      const Entry& entry = heap_.front();
+      std::unordered_map<FeatureID, Record>::const_iterator it = records_.find(entry.id);
+      if( (it != records_.end()) && (it->second.generation == entry.generation) )
+	{
+	  return entry.crossing_time;
+	}
+
+      std::pop_heap(heap_.begin(), heap_.end());
+      heap_.pop_back();
+    }
+
+  return std::numeric_limits<double>::infinity();
+}
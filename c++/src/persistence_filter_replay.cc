@@ -0,0 +1,188 @@
+/** Replay of a detection log through a map of persistence filters.
+ *
+ * Usage:  persistence_filter_replay [OPTIONS] LOG
+ *
+ *   --prior=KIND:PARAMETERS     The survival prior shared by every feature (see
+ *                               persistence_filter_evaluate; default general-purpose:0.001,1)
+ *   --queries=LIST              Times at which to report every feature's belief
+ *   --query-interval=DT         Also report beliefs at DT, 2 DT, ..., up to the last observation
+ *   --initialization-time=T     Initialize every filter at time T, rather than at its feature's
+ *                               first observation
+ *   --shards=N                  Number of threads applying updates (default:  one per hardware
+ *                               thread, less the parsing thread)
+ *
+ * LOG is a text file (or '-' for standard input) with one observation per
+ * line, in the comma-separated columns feature_id,t,y,P_M,P_F, where
+ * feature_id is a nonnegative integer less than 2^64, y is the detector output
+ * (0 or 1), and P_M and P_F are the detector's error rates for this
+ * observation.  The observations must be sorted by time.  A header line, blank lines, and lines
+ * beginning with '#' are skipped.  A feature's filter is created when it is
+ * first observed.
+ *
+ * For each query time q, the belief p(X_q = 1 | Y) of every feature observed
+ * no later than q, given all of its observations made no later than q, is
+ * written to stdout as CSV (query_time,feature_id,belief), in order of
+ * feature ID.  Throughput statistics are written to stderr.
+ *
+ * The log is memory-mapped (or streamed, if it cannot be mapped) and parsed
+ * on the main thread, which partitions the observations by feature ID into
+ * fixed-size chunks for the shard threads.  Each shard owns a
+ * PersistenceFilterBank, and applies each run of observations sharing a
+ * timestamp and error rates as a single batch update.  Chunks are recycled
+ * through a small per-shard pool, so that once the pipeline is running it
+ * performs no allocation, and the parser blocks (rather than buffering
+ * without bound) whenever a shard falls behind.
+ */
+
+#include "persistence_filter_command_line.h"
+#include "persistence_filter_replay.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/// INPUT
+
+// Replay a log from a file descriptor that cannot be mapped, reading it in blocks
+static void stream(int fd, Replay& replay)
+{
+  std::vector<char> buffer(2 * REPLAY_STREAM_BLOCK_SIZE);
+  size_t size = 0;
+  for(;;)
+    {
+      if(buffer.size() - size < REPLAY_STREAM_BLOCK_SIZE)
+	buffer.resize(2 * buffer.size());  // A line longer than the block size
+
+      ssize_t n = read(fd, &buffer[size], REPLAY_STREAM_BLOCK_SIZE);
+      if(n < 0)
+	throw std::runtime_error(std::string("Error reading log: ") + std::strerror(errno));
+
+      size += n;
+      const char* end = replay.parse(&buffer[0], &buffer[0] + size, n == 0);
+      size_t remainder = &buffer[0] + size - end;
+      std::memmove(&buffer[0], end, remainder);
+      size = remainder;
+
+      if(n == 0)
+	return;
+    }
+}
+
+static void replay_file(const std::string& path, Replay& replay)
+{
+  if(path == "-")
+    {
+      stream(0, replay);
+      return;
+    }
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw std::runtime_error("Unable to open '" + path + "': " + std::strerror(errno));
+
+  struct stat st;
+  void* data = MAP_FAILED;
+  if( (fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0) )
+    data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  try
+    {
+      if(data != MAP_FAILED)
+	{
+	  madvise(data, st.st_size, MADV_SEQUENTIAL);
+	  const char* begin = static_cast<const char*>(data);
+	  replay.parse(begin, begin + st.st_size, true);
+	  munmap(data, st.st_size);
+	}
+      else
+	{
+	  stream(fd, replay);
+	}
+    }
+  catch(...)
+    {
+      if(data != MAP_FAILED)
+	munmap(data, st.st_size);
+      close(fd);
+      throw;
+    }
+  close(fd);
+}
+
+
+int main(int argc, char* argv[])
+{
+  LogSurvivalFunction prior = parse_survival_prior("general-purpose:0.001,1");
+  std::vector<double> query_times;
+  double query_interval = 0;
+  double initialization_time = std::numeric_limits<double>::quiet_NaN();
+  size_t num_shards = std::max<size_t>(2, std::thread::hardware_concurrency()) - 1;
+  std::string path;
+
+  try
+    {
+      for(int i = 1; i < argc; ++i)
+	{
+	  std::string arg(argv[i]);
+	  size_t equals = arg.find('=');
+	  std::string name = arg.substr(0, equals);
+	  std::string value = (equals != std::string::npos) ? arg.substr(equals + 1) : "";
+
+	  if(name == "--prior")
+	    prior = parse_survival_prior(value);
+	  else if(name == "--queries")
+	    query_times = parse_number_list(value);
+	  else if(name == "--query-interval")
+	    query_interval = std::atof(value.c_str());
+	  else if(name == "--initialization-time")
+	    initialization_time = std::atof(value.c_str());
+	  else if(name == "--shards")
+	    num_shards = std::max<size_t>(1, parse_count(value));
+	  else if( ( (arg == "-") || (arg.compare(0, 1, "-") != 0) ) && path.empty())
+	    path = arg;
+	  else
+	    {
+	      path.clear();
+	      break;
+	    }
+	}
+
+      if(path.empty())
+	{
+	  std::fprintf(stderr, "Usage: %s [--prior=KIND:PARAMETERS] [--queries=LIST] [--query-interval=DT] [--initialization-time=T] [--shards=N] LOG\n", argv[0]);
+	  return 1;
+	}
+
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+      Replay replay(prior, num_shards, query_times, query_interval, initialization_time);
+      std::printf("query_time,feature_id,belief\n");
+      replay_file(path, replay);
+      replay.finish();
+      std::fflush(stdout);
+
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::fprintf(stderr, "%s: replayed %llu observations of %llu features in %.3f s (%.0f observations/s)\n", argv[0], static_cast<unsigned long long>(replay.num_observations()), static_cast<unsigned long long>(replay.num_features()), seconds, replay.num_observations() / seconds);
+    }
+  catch(const std::exception& e)
+    {
+      std::fprintf(stderr, "%s: %s\n", argv[0], e.what());
+      return 1;
+    }
+
+  return 0;
+}
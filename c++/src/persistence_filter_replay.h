@@ -0,0 +1,542 @@
+#ifndef __PERSISTENCE_FILTER_REPLAY_H__
+#define __PERSISTENCE_FILTER_REPLAY_H__
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "persistence_filter_bank.h"
+
+
+/** The pipeline behind persistence_filter_replay (see persistence_filter_replay.cc for the log format):  a Replay parses observation lines on the calling thread and hands them, partitioned by feature ID, to the ReplayShard threads that apply them*/
+
+
+// The number of observations in each chunk, and the number of chunks per shard
+static const size_t REPLAY_CHUNK_SIZE = 4096;
+static const size_t REPLAY_CHUNKS_PER_SHARD = 4;
+
+// The size of the blocks in which a log that cannot be mapped is read
+static const size_t REPLAY_STREAM_BLOCK_SIZE = 1 << 20;
+
+
+struct ReplayObservation
+{
+  PersistenceFilterBank::FeatureID id;
+  double time;
+  double P_M;
+  double P_F;
+  bool detector_output;
+};
+
+// A batch of observations passed from the parser to a shard
+struct ReplayChunk
+{
+  std::vector<ReplayObservation> observations;
+
+  // If set, the shard reports the beliefs of its features at 'query_time' after applying the observations
+  bool query;
+  double query_time;
+
+  ReplayChunk() : query(false), query_time(0)
+  {
+    observations.reserve(REPLAY_CHUNK_SIZE);
+  }
+};
+
+
+/// SHARDS
+
+class ReplayShard
+{
+ public:
+
+  /** The type used to identify features*/
+  typedef PersistenceFilterBank::FeatureID FeatureID;
+
+ protected:
+  PersistenceFilterBank bank_;
+
+  // The time at which each filter is initialized (NaN to initialize it at its first observation)
+  double initialization_time_;
+
+  ReplayChunk chunks_[REPLAY_CHUNKS_PER_SHARD];
+
+  // Chunks submitted by the parser (a ring buffer), and chunks free for the parser to fill
+  ReplayChunk* pending_[REPLAY_CHUNKS_PER_SHARD];
+  size_t pending_begin_;
+  size_t num_pending_;
+  std::vector<ReplayChunk*> free_;
+
+  size_t queries_answered_;
+  bool done_;
+  std::exception_ptr error_;
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+
+  // Scratch storage for the worker
+  std::vector<FeatureID> batch_ids_;
+  std::vector<bool> batch_outputs_;
+  std::vector<double> beliefs_;
+
+  // The result of the last query, sorted by feature ID
+  std::vector<std::pair<FeatureID, double> > query_results_;
+
+  std::thread worker_;
+
+  void apply(const ReplayChunk& chunk);
+  void answer_query(double query_time);
+  void run();
+
+ public:
+  ReplayShard(const LogSurvivalFunction& log_survival_function, double initialization_time) : bank_(log_survival_function), initialization_time_(initialization_time), pending_begin_(0), num_pending_(0), queries_answered_(0), done_(false)
+    {
+      for(size_t k = 0; k < REPLAY_CHUNKS_PER_SHARD; ++k)
+	free_.push_back(&chunks_[k]);
+
+      worker_ = std::thread(&ReplayShard::run, this);
+    }
+
+  /** Return an empty chunk for the parser to fill, waiting for one to become free if necessary*/
+  ReplayChunk* acquire();
+
+  /** Pass a filled chunk to the worker*/
+  void submit(ReplayChunk* chunk);
+
+  /** Wait until the worker has answered 'num_queries' queries, and return the results of the last.  Rethrows any exception raised by the worker.*/
+  const std::vector<std::pair<FeatureID, double> >& wait_for_query(size_t num_queries);
+
+  /** Stop the worker once it has applied every submitted chunk, and rethrow any exception it raised*/
+  void finish();
+
+  /** Return the number of features in the shard (only once the worker has been stopped)*/
+  size_t num_features() const
+  {
+    return bank_.size();
+  }
+
+  ~ReplayShard()
+  {
+    if(worker_.joinable())
+      {
+	{
+	  std::lock_guard<std::mutex> lock(mutex_);
+	  done_ = true;
+	}
+	changed_.notify_all();
+	worker_.join();
+      }
+  }
+};
+
+inline ReplayChunk* ReplayShard::acquire()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this]() { return !free_.empty(); });
+  ReplayChunk* chunk = free_.back();
+  free_.pop_back();
+  lock.unlock();
+
+  chunk->observations.clear();
+  chunk->query = false;
+  return chunk;
+}
+
+inline void ReplayShard::submit(ReplayChunk* chunk)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_[(pending_begin_ + num_pending_) % REPLAY_CHUNKS_PER_SHARD] = chunk;
+    ++num_pending_;
+  }
+  changed_.notify_all();
+}
+
+inline void ReplayShard::run()
+{
+  for(;;)
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      changed_.wait(lock, [this]() { return (num_pending_ > 0) || done_; });
+      if(num_pending_ == 0)
+	return;
+
+      ReplayChunk* chunk = pending_[pending_begin_];
+      pending_begin_ = (pending_begin_ + 1) % REPLAY_CHUNKS_PER_SHARD;
+      --num_pending_;
+      bool failed = static_cast<bool>(error_);
+      lock.unlock();
+
+      // After an error, we keep draining chunks (without applying them), so that the parser does not block
+      if(!failed)
+	{
+	  try
+	    {
+	      apply(*chunk);
+	      if(chunk->query)
+		answer_query(chunk->query_time);
+	    }
+	  catch(...)
+	    {
+	      lock.lock();
+	      error_ = std::current_exception();
+	      lock.unlock();
+	    }
+	}
+
+      lock.lock();
+      free_.push_back(chunk);
+      if(chunk->query)
+	++queries_answered_;
+      lock.unlock();
+      changed_.notify_all();
+    }
+}
+
+inline void ReplayShard::apply(const ReplayChunk& chunk)
+{
+  const std::vector<ReplayObservation>& z = chunk.observations;
+  size_t i = 0;
+  while(i < z.size())
+    {
+      // Gather the run of observations sharing this one's time and error rates into a single batch
+      batch_ids_.clear();
+      batch_outputs_.clear();
+      size_t j = i;
+      for(; (j < z.size()) && (z[j].time == z[i].time) && (z[j].P_M == z[i].P_M) && (z[j].P_F == z[i].P_F); ++j)
+	{
+	  if(!bank_.contains(z[j].id))
+	    {
+	      bank_.add(z[j].id, std::isnan(initialization_time_) ? z[j].time : initialization_time_);
+	    }
+	  batch_ids_.push_back(z[j].id);
+	  batch_outputs_.push_back(z[j].detector_output);
+	}
+
+      bank_.update_batch(batch_ids_, batch_outputs_, z[i].time, z[i].P_M, z[i].P_F);
+      i = j;
+    }
+}
+
+inline void ReplayShard::answer_query(double query_time)
+{
+  beliefs_.resize(bank_.num_slots());
+  if(!beliefs_.empty())
+    {
+      bank_.predict_all(query_time, &beliefs_[0]);
+    }
+
+  query_results_.clear();
+  for(size_t slot = 0; slot < bank_.num_slots(); ++slot)
+    {
+      if(bank_.is_live(slot))
+	query_results_.push_back(std::make_pair(bank_.id(slot), beliefs_[slot]));
+    }
+  std::sort(query_results_.begin(), query_results_.end());
+}
+
+inline const std::vector<std::pair<ReplayShard::FeatureID, double> >& ReplayShard::wait_for_query(size_t num_queries)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this, num_queries]() { return (queries_answered_ >= num_queries) || error_; });
+  if(error_)
+    std::rethrow_exception(error_);
+  return query_results_;
+}
+
+inline void ReplayShard::finish()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+  }
+  changed_.notify_all();
+  worker_.join();
+
+  if(error_)
+    std::rethrow_exception(error_);
+}
+
+
+/// REPLAY
+
+class Replay
+{
+ public:
+
+  /** The type used to identify features*/
+  typedef PersistenceFilterBank::FeatureID FeatureID;
+
+ protected:
+  std::vector<std::unique_ptr<ReplayShard> > shards_;
+
+  // The chunk each shard is currently filling (or nullptr)
+  std::vector<ReplayChunk*> filling_;
+
+  // Query times, sorted, and the index of the next one to answer
+  std::vector<double> query_times_;
+  size_t next_query_;
+
+  // The spacing of the periodic queries (or 0), and the number of them added to query_times_ so far
+  double query_interval_;
+  size_t num_interval_queries_;
+
+  double initialization_time_;
+  double last_time_;
+  size_t num_lines_;
+  size_t num_observations_;
+  bool header_allowed_;
+
+  // The stream to which beliefs are written, and its buffer
+  std::FILE* output_file_;
+  std::string output_;
+
+  size_t shard_index(FeatureID id) const
+  {
+    // Mix the bits of the ID, so that IDs assigned in strides are spread evenly across the shards
+    return static_cast<size_t>( ( (id * 0x9E3779B97F4A7C15ULL) >> 32) % shards_.size());
+  }
+
+  void flush_output()
+  {
+    std::fwrite(output_.data(), 1, output_.size(), output_file_);
+    output_.clear();
+  }
+
+  /** Report the beliefs of every feature at 'query_time', after every observation parsed so far has been applied*/
+  void answer_query(double query_time);
+
+  /** Answer the queries preceding an observation at time t*/
+  void answer_queries_before(double t)
+  {
+    for(;;)
+      {
+	double q = (next_query_ < query_times_.size()) ? query_times_[next_query_] : std::numeric_limits<double>::infinity();
+	if(!(q < t))
+	  return;
+	answer_query(q);
+	++next_query_;
+      }
+  }
+
+  /** Add the periodic queries no later than t_max to the sorted query times*/
+  void add_interval_queries(double t_max)
+  {
+    if(!(query_interval_ > 0))
+      return;
+
+    size_t old_size = query_times_.size();
+    for(; (num_interval_queries_ + 1) * query_interval_ <= t_max; ++num_interval_queries_)
+      query_times_.push_back( (num_interval_queries_ + 1) * query_interval_);
+    if(query_times_.size() > old_size)
+      std::inplace_merge(query_times_.begin() + next_query_, query_times_.begin() + old_size, query_times_.end());
+  }
+
+  /** Parse the line [begin, end), which is followed by a newline or NUL*/
+  void parse_line(const char* begin, const char* end);
+
+ public:
+  /** Replay observations through 'num_shards' shards, answering the queries 'query_times' and one every 'query_interval' (if positive).  Filters are initialized at 'initialization_time', or at their first observations if it is NaN.  Beliefs are written to 'output_file'.*/
+  Replay(const LogSurvivalFunction& log_survival_function, size_t num_shards, const std::vector<double>& query_times, double query_interval, double initialization_time, std::FILE* output_file = stdout) : filling_(num_shards, nullptr), query_times_(query_times), next_query_(0), query_interval_(query_interval), num_interval_queries_(0), initialization_time_(initialization_time), last_time_(-std::numeric_limits<double>::infinity()), num_lines_(0), num_observations_(0), header_allowed_(true), output_file_(output_file)
+    {
+      std::sort(query_times_.begin(), query_times_.end());
+      for(size_t s = 0; s < num_shards; ++s)
+	shards_.push_back(std::unique_ptr<ReplayShard>(new ReplayShard(log_survival_function, initialization_time)));
+      output_.reserve(REPLAY_STREAM_BLOCK_SIZE);
+    }
+
+  /** Parse the complete lines in [begin, end), returning a pointer to the first byte following them.  If 'at_end' is set, a final line without a trailing newline is parsed as well.*/
+  const char* parse(const char* begin, const char* end, bool at_end);
+
+  /** Answer the remaining queries, and stop the shards*/
+  void finish();
+
+  size_t num_observations() const
+  {
+    return num_observations_;
+  }
+
+  /** Return the number of features (only after finish())*/
+  size_t num_features() const
+  {
+    size_t n = 0;
+    for(size_t s = 0; s < shards_.size(); ++s)
+      n += shards_[s]->num_features();
+    return n;
+  }
+};
+
+// A field must begin immediately (strtod() and strtoull() would otherwise skip whitespace, including newlines)
+inline bool starts_replay_field(const char* p)
+{
+  return (*p != ',') && (*p != '\n') && (*p != '\r') && (*p != '\0') && (*p != ' ') && (*p != '\t');
+}
+
+inline void Replay::parse_line(const char* begin, const char* end)
+{
+  ++num_lines_;
+
+  // Skip blank lines and comments
+  if( (begin == end) || (*begin == '#') || ( (*begin == '\r') && (begin + 1 == end) ) )
+    return;
+
+  // Skip a header line
+  bool allow_header = header_allowed_;
+  header_allowed_ = false;
+  if(allow_header && !( (*begin >= '0') && (*begin <= '9') ))
+    return;
+
+  ReplayObservation z;
+  const char* p = begin;
+  char* field_end;
+  bool ok = (*p >= '0') && (*p <= '9');
+  if(ok)
+    {
+      // (The leading digit rules out a sign, which strtoull() would accept and negate)
+      errno = 0;
+      z.id = std::strtoull(p, &field_end, 10);
+      ok = (errno != ERANGE);
+      p = field_end;
+    }
+
+  double fields[4];
+  for(int k = 0; ok && (k < 4); ++k)
+    {
+      ok = (*p == ',') && starts_replay_field(p + 1);
+      if(ok)
+	{
+	  fields[k] = std::strtod(p + 1, &field_end);
+	  ok = (field_end != p + 1);
+	  p = field_end;
+	}
+    }
+  ok = ok && ( (p == end) || ( (*p == '\r') && (p + 1 == end) ) );
+  ok = ok && ( (fields[1] == 0) || (fields[1] == 1) );
+
+  if(!ok)
+    throw std::invalid_argument("line " + std::to_string(num_lines_) + ":  expected feature_id,t,y,P_M,P_F");
+
+  z.time = fields[0];
+  z.detector_output = (fields[1] == 1);
+  z.P_M = fields[2];
+  z.P_F = fields[3];
+
+  // Validate the observation here, so that the shards never fail
+  if(!(z.time >= last_time_))
+    throw std::invalid_argument("line " + std::to_string(num_lines_) + ":  observations must be sorted by time");
+  if(z.time < initialization_time_)
+    throw std::invalid_argument("line " + std::to_string(num_lines_) + ":  observation precedes the initialization time");
+  if( !(z.P_M >= 0) || !(z.P_M <= 1) || !(z.P_F >= 0) || !(z.P_F <= 1) )
+    throw std::invalid_argument("line " + std::to_string(num_lines_) + ":  P_M and P_F must be probabilities");
+
+  if(z.time > last_time_)
+    {
+      add_interval_queries(z.time);
+      answer_queries_before(z.time);
+      last_time_ = z.time;
+    }
+
+  size_t s = shard_index(z.id);
+  ReplayChunk*& chunk = filling_[s];
+  if(!chunk)
+    chunk = shards_[s]->acquire();
+  chunk->observations.push_back(z);
+  if(chunk->observations.size() == REPLAY_CHUNK_SIZE)
+    {
+      shards_[s]->submit(chunk);
+      chunk = nullptr;
+    }
+  ++num_observations_;
+}
+
+inline const char* Replay::parse(const char* begin, const char* end, bool at_end)
+{
+  const char* p = begin;
+  for(;;)
+    {
+      const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+      if(!newline)
+	break;
+      parse_line(p, newline);
+      p = newline + 1;
+    }
+
+  if(at_end && (p < end))
+    {
+      // The last line has no trailing newline, so we copy it to obtain a terminator for strtod()
+      std::string line(p, end);
+      parse_line(line.c_str(), line.c_str() + line.size());
+      p = end;
+    }
+  return p;
+}
+
+inline void Replay::answer_query(double query_time)
+{
+  // Send each shard its partially-filled chunk, marked with the query
+  for(size_t s = 0; s < shards_.size(); ++s)
+    {
+      ReplayChunk* chunk = filling_[s] ? filling_[s] : shards_[s]->acquire();
+      filling_[s] = nullptr;
+      chunk->query = true;
+      chunk->query_time = query_time;
+      shards_[s]->submit(chunk);
+    }
+
+  // Merge the shards' results, which are sorted by feature ID
+  std::vector<const std::vector<std::pair<FeatureID, double> >*> results;
+  std::vector<size_t> positions(shards_.size(), 0);
+  for(size_t s = 0; s < shards_.size(); ++s)
+    results.push_back(&shards_[s]->wait_for_query(next_query_ + 1));
+
+  char line[64];
+  for(;;)
+    {
+      size_t best = shards_.size();
+      for(size_t s = 0; s < shards_.size(); ++s)
+	{
+	  if( (positions[s] < results[s]->size()) && ( (best == shards_.size()) || ( (*results[s])[positions[s]].first < (*results[best])[positions[best]].first) ) )
+	    best = s;
+	}
+      if(best == shards_.size())
+	break;
+
+      const std::pair<FeatureID, double>& result = (*results[best])[positions[best]++];
+      int length = std::snprintf(line, sizeof(line), "%.9g,%llu,%.9g\n", query_time, static_cast<unsigned long long>(result.first), result.second);
+      output_.append(line, length);
+      if(output_.size() >= REPLAY_STREAM_BLOCK_SIZE)
+	flush_output();
+    }
+  flush_output();
+}
+
+inline void Replay::finish()
+{
+  // Answer the queries at or after the last observation
+  add_interval_queries(last_time_);
+  answer_queries_before(std::numeric_limits<double>::infinity());
+
+  for(size_t s = 0; s < shards_.size(); ++s)
+    {
+      if(filling_[s])
+	{
+	  shards_[s]->submit(filling_[s]);
+	  filling_[s] = nullptr;
+	}
+      shards_[s]->finish();
+    }
+}
+
+#endif //__PERSISTENCE_FILTER_REPLAY_H__
@@ -0,0 +1,284 @@
+#include "persistence_filter_revisit_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+/** The entropy (in nats) of a Bernoulli random variable with success probability x*/
+static double binary_entropy(double x)
+{
+  double h = 0;
+  if(x > 0)
+    h -= x * std::log(x);
+  if(x < 1)
+    h -= (1 - x) * std::log1p(-x);
+  return h;
+}
+
+const size_t PersistenceRevisitScheduler::NOT_TRACKED;
+
+PersistenceRevisitScheduler::PersistenceRevisitScheduler(const PersistenceFilterBank& bank, double P_M, double P_F, double candidate_time, Criterion criterion) : bank_(bank), candidate_time_(candidate_time), criterion_(criterion)
+{
+  // Input checking
+  if( (P_M < 0) || (P_M > 1) )
+    {
+      throw std::domain_error("Probability of missed detection must be between 0 and 1");
+    }
+
+  if( (P_F < 0) || (P_F > 1) )
+    {
+      throw std::domain_error("Probability of false alarm must be between 0 and 1");
+    }
+
+  if( (criterion != INFORMATION_GAIN) && (criterion != VARIANCE_REDUCTION) )
+    {
+      throw std::invalid_argument("Unknown scheduling criterion");
+    }
+
+  P_M_ = P_M;
+  P_F_ = P_F;
+}
+
+double PersistenceRevisitScheduler::hypothetical_beliefs(double belief, double P_M, double P_F, double& belief_if_detected, double& belief_if_missed)
+{
+  double q = (1 - P_M) * belief + P_F * (1 - belief);
+
+  // An output that the detector can never produce leaves the belief unchanged
+  belief_if_detected = (q > 0) ? (1 - P_M) * belief / q : belief;
+  belief_if_missed = (q < 1) ? P_M * belief / (1 - q) : belief;
+  return q;
+}
+
+double PersistenceRevisitScheduler::expected_information_gain(double belief, double P_M, double P_F)
+{
+  // I(X_t; y) = H(y) - H(y | X_t)
+  double q = (1 - P_M) * belief + P_F * (1 - belief);
+  double gain = binary_entropy(q) - belief * binary_entropy(P_M) - (1 - belief) * binary_entropy(P_F);
+
+  // Mutual information is nonnegative; a negative value is rounding error
+  return std::max(gain, 0.0);
+}
+
+double PersistenceRevisitScheduler::expected_variance_reduction(double belief, double P_M, double P_F)
+{
+  // By the law of total variance, the expected reduction in Var(X_t) is the
+  // variance of the posterior belief, E[p_y^2] - p^2
+  double q = (1 - P_M) * belief + P_F * (1 - belief);
+  double second_moment = 0;
+  if(q > 0)
+    second_moment += (1 - P_M) * belief * (1 - P_M) * belief / q;
+  if(q < 1)
+    second_moment += P_M * belief * P_M * belief / (1 - q);
+
+  return std::max(second_moment - belief * belief, 0.0);
+}
+
+double PersistenceRevisitScheduler::score_belief(double belief) const
+{
+  return (criterion_ == INFORMATION_GAIN) ? expected_information_gain(belief, P_M_, P_F_) : expected_variance_reduction(belief, P_M_, P_F_);
+}
+
+double PersistenceRevisitScheduler::compute_score(FeatureID id) const
+{
+  size_t slot = bank_.slot(id);
+  return score_belief(bank_.predict_slot(slot, std::max(candidate_time_, bank_.last_observation_time_slot(slot))));
+}
+
+void PersistenceRevisitScheduler::sift_up(size_t i)
+{
+  size_t slot = heap_[i];
+  while(i > 0)
+    {
+      size_t parent = (i - 1) / 2;
+      if(!ranks_before(slot, heap_[parent]))
+	break;
+
+      heap_[i] = heap_[parent];
+      heap_position_[heap_[i]] = i;
+      i = parent;
+    }
+  heap_[i] = slot;
+  heap_position_[slot] = i;
+}
+
+void PersistenceRevisitScheduler::sift_down(size_t i)
+{
+  size_t slot = heap_[i];
+  for(;;)
+    {
+      size_t child = 2 * i + 1;
+      if(child >= heap_.size())
+	break;
+      if( (child + 1 < heap_.size()) && ranks_before(heap_[child + 1], heap_[child]) )
+	++child;
+      if(!ranks_before(heap_[child], slot))
+	break;
+
+      heap_[i] = heap_[child];
+      heap_position_[heap_[i]] = i;
+      i = child;
+    }
+  heap_[i] = slot;
+  heap_position_[slot] = i;
+}
+
+void PersistenceRevisitScheduler::cover_bank_slots()
+{
+  if(heap_position_.size() < bank_.num_slots())
+    {
+      heap_position_.resize(bank_.num_slots(), NOT_TRACKED);
+      scores_.resize(bank_.num_slots());
+      ids_.resize(bank_.num_slots());
+    }
+}
+
+void PersistenceRevisitScheduler::untrack_slot(size_t slot)
+{
+  size_t i = heap_position_[slot];
+  heap_position_[slot] = NOT_TRACKED;
+
+  // Move the last entry into the vacated position, and restore the heap around it
+  size_t last = heap_.back();
+  heap_.pop_back();
+  if(last != slot)
+    {
+      heap_[i] = last;
+      heap_position_[last] = i;
+      sift_up(i);
+      sift_down(heap_position_[last]);
+    }
+}
+
+void PersistenceRevisitScheduler::set_score(size_t slot, double score)
+{
+  scores_[slot] = score;
+  if(heap_position_[slot] == NOT_TRACKED)
+    {
+      heap_.push_back(slot);
+      sift_up(heap_.size() - 1);
+    }
+  else
+    {
+      sift_up(heap_position_[slot]);
+      sift_down(heap_position_[slot]);
+    }
+}
+
+void PersistenceRevisitScheduler::update(FeatureID id)
+{
+  size_t slot = bank_.slot(id);
+  cover_bank_slots();
+
+  std::pair<std::unordered_map<FeatureID, size_t>::iterator, bool> inserted = tracked_slots_.insert(std::make_pair(id, slot));
+  if(!inserted.second && (inserted.first->second != slot))
+    {
+      // The feature was removed from the bank and added again, so it has moved to a new slot
+      untrack_slot(inserted.first->second);
+      inserted.first->second = slot;
+    }
+  ids_[slot] = id;
+
+  set_score(slot, compute_score(id));
+}
+
+void PersistenceRevisitScheduler::update_all()
+{
+  cover_bank_slots();
+
+  beliefs_.resize(bank_.num_slots());
+  if(!beliefs_.empty())
+    {
+      bank_.predict_all(candidate_time_, &beliefs_[0]);
+    }
+
+  // Rebuild the heap in place from the live features' new scores
+  heap_.clear();
+  std::fill(heap_position_.begin(), heap_position_.end(), NOT_TRACKED);
+  for(size_t slot = 0; slot < bank_.num_slots(); ++slot)
+    {
+      if(bank_.is_live(slot))
+	{
+	  // predict_all() returns NaN for features observed after the candidate time
+	  double belief = std::isnan(beliefs_[slot]) ? bank_.predict_slot(slot, bank_.last_observation_time_slot(slot)) : beliefs_[slot];
+	  ids_[slot] = bank_.id(slot);
+	  scores_[slot] = score_belief(belief);
+	  tracked_slots_[ids_[slot]] = slot;
+
+	  heap_position_[slot] = heap_.size();
+	  heap_.push_back(slot);
+	}
+    }
+
+  for(size_t i = heap_.size() / 2; i-- > 0; )
+    {
+      sift_down(i);
+    }
+
+  // Forget the features that are no longer in the bank
+  for(std::unordered_map<FeatureID, size_t>::iterator it = tracked_slots_.begin(); it != tracked_slots_.end(); )
+    {
+      if(bank_.contains(it->first))
+	++it;
+      else
+	it = tracked_slots_.erase(it);
+    }
+}
+
+bool PersistenceRevisitScheduler::remove(FeatureID id)
+{
+  std::unordered_map<FeatureID, size_t>::iterator it = tracked_slots_.find(id);
+  if(it == tracked_slots_.end())
+    {
+      return false;
+    }
+
+  untrack_slot(it->second);
+  tracked_slots_.erase(it);
+  return true;
+}
+
+size_t PersistenceRevisitScheduler::next_targets(size_t k, std::vector<FeatureID>& targets) const
+{
+  // Visit the heap in order of decreasing score, keeping the positions whose parents have been visited in a second (small) heap
+  auto ranks_after = [this](size_t i, size_t j) { return ranks_before(heap_[j], heap_[i]); };
+  std::vector<size_t> frontier;
+  if(!heap_.empty())
+    {
+      frontier.push_back(0);
+    }
+
+  size_t num_targets = 0;
+  while(!frontier.empty() && (num_targets < k))
+    {
+      std::pop_heap(frontier.begin(), frontier.end(), ranks_after);
+      size_t i = frontier.back();
+      frontier.pop_back();
+
+      targets.push_back(ids_[heap_[i]]);
+      ++num_targets;
+
+      for(size_t child = 2 * i + 1; (child <= 2 * i + 2) && (child < heap_.size()); ++child)
+	{
+	  frontier.push_back(child);
+	  std::push_heap(frontier.begin(), frontier.end(), ranks_after);
+	}
+    }
+  return num_targets;
+}
+
+double PersistenceRevisitScheduler::score(FeatureID id) const
+{
+  std::unordered_map<FeatureID, size_t>::const_iterator it = tracked_slots_.find(id);
+  if(it == tracked_slots_.end())
+    {
+      throw std::out_of_range("No feature with the requested ID is tracked by this PersistenceRevisitScheduler");
+    }
+  return scores_[it->second];
+}
+
+void PersistenceRevisitScheduler::set_candidate_time(double candidate_time)
+{
+  candidate_time_ = candidate_time;
+  update_all();
+}
@@ -0,0 +1,654 @@
+#include "persistence_filter_simd.h"
+#include "persistence_filter_detector_model.h"
+#include "persistence_filter_math.h"
+#include "persistence_filter_utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define PERSISTENCE_FILTER_HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+
+// The argument below which exp() underflows (and the vectorized kernels return 0, matching clamped_exp())
+static const double EXP_UNDERFLOW_THRESHOLD = PERSISTENCE_FILTER_LOG_DBL_MIN;
+
+// Arguments above this value saturate to +infinity in the vectorized exp() kernels
+static const double EXP_OVERFLOW_THRESHOLD = 709.0;
+
+
+/// SCALAR FALLBACK
+
+static void logsum_batch_scalar(const double* logx, const double* logy, double* out, size_t n)
+{
+  for(size_t i = 0; i < n; ++i)
+    out[i] = logsum(logx[i], logy[i]);
+}
+
+static void logdiff_batch_scalar(const double* logx, const double* logy, double* out, size_t n)
+{
+  for(size_t i = 0; i < n; ++i)
+    out[i] = logdiff(logx[i], logy[i]);
+}
+
+static void exp_batch_scalar(const double* x, double* out, size_t n)
+{
+  for(size_t i = 0; i < n; ++i)
+    out[i] = clamped_exp(x[i]);
+}
+
+static void fused_log_update_batch_scalar(const double* logLY, const double* logpY_tN, const double* logS0, const double* logS1, const double* log_ratio, const unsigned char* detector_outputs, const DetectorLikelihoods* likelihoods, double* updated_logLY, double* updated_logpY, size_t n)
+{
+  for(size_t i = 0; i < n; ++i)
+    fused_log_update(logLY[i], logpY_tN[i], logS0[i], logS1[i], log_ratio[i], likelihoods[detector_outputs[i] ? 1 : 0], updated_logLY[i], updated_logpY[i]);
+}
+
+
+
+#ifdef PERSISTENCE_FILTER_HAVE_X86_SIMD
+
+// Constants shared by the vectorized exp() and log1p() kernels.
+//
+// exp(x):  We write x = n*ln(2) + r with n integral and |r| <= ln(2)/2, so that
+// exp(x) = 2^n * exp(r).  exp(r) is evaluated using its Taylor series truncated
+// after the r^13 term (the truncation error is below 5e-18 on this interval),
+// and 2^n is constructed directly from its IEEE-754 bit pattern.
+//
+// log1p(u):  We form w = 1 + u together with the rounding error
+// c = (u - (w - 1)) / w, so that log1p(u) = log(w) + c to first order.  Writing
+// w = 2^e * m with m in [sqrt(1/2), sqrt(2)), log(m) = 2 atanh(s) with
+// s = (m - 1) / (m + 1), |s| <= 0.1716, which we evaluate using its Taylor
+// series truncated after the s^21 term.  log(v) is computed in the same way,
+// with w = v and c = 0 (subnormal v are first scaled by 2^54).
+//
+// expm1(x):  For |x| <= ln(2), expm1(x) = x * (1 + x/2 + x^2/6 + ...), which we
+// evaluate using its Taylor series truncated after the x^17 term (the relative
+// truncation error is below 5e-19 on this interval).  logdiff() uses this for
+// y/x = exp(logy - logx) > 1/2, where 1 - y/x suffers cancellation.
+
+static const double LN2_HI = 6.93147180369123816490e-01;
+static const double LN2_LO = 1.90821492927058770002e-10;
+static const double LOG2E = 1.44269504088896338700e+00;
+static const double SQRT2 = 1.41421356237309514547e+00;
+
+// 1.5 * 2^52:  adding this to a small integral double places that integer in the low-order bits of the result
+static const double ROUNDING_MAGIC = 6755399441055744.0;
+
+static const double EXP_COEFFS[] = {1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0, 1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0, 1.0 / 5040.0, 1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 0.5, 1.0, 1.0};
+static const int NUM_EXP_COEFFS = sizeof(EXP_COEFFS) / sizeof(double);
+
+static const double ATANH_COEFFS[] = {2.0 / 21.0, 2.0 / 19.0, 2.0 / 17.0, 2.0 / 15.0, 2.0 / 13.0, 2.0 / 11.0, 2.0 / 9.0, 2.0 / 7.0, 2.0 / 5.0, 2.0 / 3.0};
+static const int NUM_ATANH_COEFFS = sizeof(ATANH_COEFFS) / sizeof(double);
+
+static const double EXPM1_COEFFS[] = {1.0 / 6402373705728000.0, 1.0 / 355687428096000.0, 1.0 / 20922789888000.0, 1.0 / 1307674368000.0, 1.0 / 87178291200.0, 1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0, 1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0, 1.0 / 5040.0, 1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 0.5, 1.0};
+static const int NUM_EXPM1_COEFFS = sizeof(EXPM1_COEFFS) / sizeof(double);
+
+static const double LN2 = 0.69314718055994530942;
+
+// 2^54, which scales subnormal arguments of log() into the normalized range
+static const double TWO_54 = 18014398509481984.0;
+
+static const long long EXP_BIAS = 1023;
+static const long long MANTISSA_MASK = 0x000fffffffffffffLL;
+static const long long ONE_BITS = 0x3ff0000000000000LL;
+
+
+/// FUSED UPDATES
+//
+// The vectorized fused_log_update_batch() kernels copy each block of inputs
+// into a FusedUpdateBlock, padding a partial final block with zeros.  They
+// then evaluate the scaled sums of fused_log_update() for the whole block,
+// and recompute each element that needs the fallback with fused_log_update()
+// itself, before writing the results out.  (Since the inputs are copied first,
+// the outputs may alias them.)
+
+// Room for one AVX-512 vector of each input
+static const size_t FUSED_UPDATE_BLOCK_SIZE = 8;
+
+struct FusedUpdateBlock
+{
+  double logLY[FUSED_UPDATE_BLOCK_SIZE];
+  double logpY_tN[FUSED_UPDATE_BLOCK_SIZE];
+  double logS0[FUSED_UPDATE_BLOCK_SIZE];
+  double logS1[FUSED_UPDATE_BLOCK_SIZE];
+  double log_ratio[FUSED_UPDATE_BLOCK_SIZE];
+
+  // The likelihoods of each element's detector output
+  double present[FUSED_UPDATE_BLOCK_SIZE];
+  double absent[FUSED_UPDATE_BLOCK_SIZE];
+  double log_absent[FUSED_UPDATE_BLOCK_SIZE];
+
+  double updated_logLY[FUSED_UPDATE_BLOCK_SIZE];
+  double updated_logpY[FUSED_UPDATE_BLOCK_SIZE];
+
+  /** Load elements i, ..., i + m - 1 of the inputs*/
+  void load(const double* logLY_in, const double* logpY_tN_in, const double* logS0_in, const double* logS1_in, const double* log_ratio_in, const unsigned char* detector_outputs, const DetectorLikelihoods* likelihoods, size_t i, size_t m)
+  {
+    for(size_t k = 0; k < FUSED_UPDATE_BLOCK_SIZE; ++k)
+      {
+	bool valid = (k < m);
+	const DetectorLikelihoods& l = likelihoods[(valid && detector_outputs[i + k]) ? 1 : 0];
+	logLY[k] = valid ? logLY_in[i + k] : 0.0;
+	logpY_tN[k] = valid ? logpY_tN_in[i + k] : 0.0;
+	logS0[k] = valid ? logS0_in[i + k] : 0.0;
+	logS1[k] = valid ? logS1_in[i + k] : 0.0;
+	log_ratio[k] = valid ? log_ratio_in[i + k] : 0.0;
+	present[k] = l.present;
+	absent[k] = l.absent;
+	log_absent[k] = l.log_absent;
+      }
+  }
+
+  /** Recompute the elements flagged in 'fallback' with fused_log_update(), and store elements i, ..., i + m - 1 of the results*/
+  void store(unsigned fallback, const unsigned char* detector_outputs, const DetectorLikelihoods* likelihoods, double* updated_logLY_out, double* updated_logpY_out, size_t i, size_t m)
+  {
+    for(size_t k = 0; k < m; ++k)
+      {
+	if(fallback & (1u << k))
+	  fused_log_update(logLY[k], logpY_tN[k], logS0[k], logS1[k], log_ratio[k], likelihoods[detector_outputs[i + k] ? 1 : 0], updated_logLY[k], updated_logpY[k]);
+	updated_logLY_out[i + k] = updated_logLY[k];
+	updated_logpY_out[i + k] = updated_logpY[k];
+      }
+  }
+};
+
+
+/// AVX2 KERNELS
+
+#define PF_TARGET_AVX2 __attribute__((target("avx2,fma")))
+
+PF_TARGET_AVX2 static inline __m256d exp_avx2(__m256d x)
+{
+  __m256d xc = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(EXP_UNDERFLOW_THRESHOLD)), _mm256_set1_pd(EXP_OVERFLOW_THRESHOLD));
+
+  // Range reduction
+  __m256d n = _mm256_round_pd(_mm256_mul_pd(xc, _mm256_set1_pd(LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(LN2_HI), xc);
+  r = _mm256_fnmadd_pd(n, _mm256_set1_pd(LN2_LO), r);
+
+  // exp(r)
+  __m256d p = _mm256_set1_pd(EXP_COEFFS[0]);
+  for(int k = 1; k < NUM_EXP_COEFFS; ++k)
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(EXP_COEFFS[k]));
+
+  // 2^n
+  __m256i ni = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(n, _mm256_set1_pd(ROUNDING_MAGIC))), _mm256_castpd_si256(_mm256_set1_pd(ROUNDING_MAGIC)));
+  __m256d scale = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(ni, _mm256_set1_epi64x(EXP_BIAS)), 52));
+
+  __m256d result = _mm256_mul_pd(p, scale);
+
+  // Underflow, overflow, and NaN handling
+  result = _mm256_blendv_pd(result, _mm256_setzero_pd(), _mm256_cmp_pd(x, _mm256_set1_pd(EXP_UNDERFLOW_THRESHOLD), _CMP_LT_OQ));
+  result = _mm256_blendv_pd(result, _mm256_set1_pd(HUGE_VAL), _mm256_cmp_pd(x, _mm256_set1_pd(EXP_OVERFLOW_THRESHOLD), _CMP_GT_OQ));
+  result = _mm256_blendv_pd(result, x, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+  return result;
+}
+
+// Computes log(w) + c for w >= 0, where c is a small correction
+PF_TARGET_AVX2 static inline __m256d log_corrected_avx2(__m256d w, __m256d c)
+{
+  __m256d one = _mm256_set1_pd(1.0);
+
+  // Decompose w = 2^e * m
+  __m256i bits = _mm256_castpd_si256(w);
+  __m256i e = _mm256_sub_epi64(_mm256_srli_epi64(bits, 52), _mm256_set1_epi64x(EXP_BIAS));
+  __m256d m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(MANTISSA_MASK)), _mm256_set1_epi64x(ONE_BITS)));
+  __m256d ed = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(e, _mm256_castpd_si256(_mm256_set1_pd(ROUNDING_MAGIC)))), _mm256_set1_pd(ROUNDING_MAGIC));
+
+  __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(SQRT2), _CMP_GT_OQ);
+  m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+  ed = _mm256_add_pd(ed, _mm256_and_pd(big, one));
+
+  // log(m) = 2s + s^3 * P(s^2)
+  __m256d s = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+  __m256d z = _mm256_mul_pd(s, s);
+  __m256d p = _mm256_set1_pd(ATANH_COEFFS[0]);
+  for(int k = 1; k < NUM_ATANH_COEFFS; ++k)
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(ATANH_COEFFS[k]));
+
+  __m256d lo = _mm256_fmadd_pd(_mm256_mul_pd(s, z), p, _mm256_fmadd_pd(ed, _mm256_set1_pd(LN2_LO), c));
+  __m256d result = _mm256_add_pd(_mm256_fmadd_pd(ed, _mm256_set1_pd(LN2_HI), _mm256_add_pd(s, s)), lo);
+
+  // log(0) = -infinity
+  return _mm256_blendv_pd(result, _mm256_set1_pd(-HUGE_VAL), _mm256_cmp_pd(w, _mm256_setzero_pd(), _CMP_EQ_OQ));
+}
+
+PF_TARGET_AVX2 static inline __m256d log1p_avx2(__m256d u)
+{
+  __m256d one = _mm256_set1_pd(1.0);
+  __m256d w = _mm256_add_pd(one, u);
+  __m256d c = _mm256_div_pd(_mm256_sub_pd(u, _mm256_sub_pd(w, one)), w);
+
+  // log1p(-1) = -infinity; NaN propagates
+  __m256d result = log_corrected_avx2(w, c);
+  return _mm256_blendv_pd(result, u, _mm256_cmp_pd(u, u, _CMP_UNORD_Q));
+}
+
+// Computes log(v) for v >= 0
+PF_TARGET_AVX2 static inline __m256d log_avx2(__m256d v)
+{
+  __m256d subnormal = _mm256_cmp_pd(v, _mm256_set1_pd(2.2250738585072014e-308), _CMP_LT_OQ);
+  __m256d result = log_corrected_avx2(_mm256_blendv_pd(v, _mm256_mul_pd(v, _mm256_set1_pd(TWO_54)), subnormal), _mm256_setzero_pd());
+  result = _mm256_sub_pd(result, _mm256_and_pd(subnormal, _mm256_set1_pd(54 * LN2)));
+  return _mm256_blendv_pd(result, v, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+}
+
+// Computes expm1(x) for |x| <= ln(2)
+PF_TARGET_AVX2 static inline __m256d expm1_avx2(__m256d x)
+{
+  __m256d p = _mm256_set1_pd(EXPM1_COEFFS[0]);
+  for(int k = 1; k < NUM_EXPM1_COEFFS; ++k)
+    p = _mm256_fmadd_pd(p, x, _mm256_set1_pd(EXPM1_COEFFS[k]));
+  return _mm256_mul_pd(x, p);
+}
+
+PF_TARGET_AVX2 static inline __m256d logsum_avx2(__m256d logx, __m256d logy)
+{
+  // As in logsum(), log(y/x) = -|log(x) - log(y)| (setting the sign bit preserves a NaN input), and we take y/x = 0 if x = y = 0
+  __m256d neg_inf = _mm256_set1_pd(-HUGE_VAL);
+  __m256d hi = _mm256_max_pd(logx, logy);
+  __m256d diff = _mm256_or_pd(_mm256_set1_pd(-0.0), _mm256_sub_pd(logx, logy));
+  diff = _mm256_blendv_pd(diff, neg_inf, _mm256_and_pd(_mm256_cmp_pd(logx, neg_inf, _CMP_EQ_OQ), _mm256_cmp_pd(logy, neg_inf, _CMP_EQ_OQ)));
+  return _mm256_add_pd(hi, log1p_avx2(exp_avx2(diff)));
+}
+
+PF_TARGET_AVX2 static inline __m256d logdiff_avx2(__m256d logx, __m256d logy)
+{
+  // As in logdiff(), we take y/x = 0 if x = y = 0
+  __m256d neg_inf = _mm256_set1_pd(-HUGE_VAL);
+  __m256d diff = _mm256_sub_pd(logy, logx);
+  diff = _mm256_blendv_pd(diff, neg_inf, _mm256_and_pd(_mm256_cmp_pd(logx, neg_inf, _CMP_EQ_OQ), _mm256_cmp_pd(logy, neg_inf, _CMP_EQ_OQ)));
+  // As in log1mexp(), we compute 1 - y/x = -expm1(logy - logx) directly when y/x > 1/2
+  __m256d near = _mm256_cmp_pd(diff, _mm256_set1_pd(-LN2), _CMP_GT_OQ);
+  __m256d log_near = log_avx2(_mm256_sub_pd(_mm256_setzero_pd(), expm1_avx2(_mm256_max_pd(diff, _mm256_set1_pd(-LN2)))));
+  __m256d log_far = log1p_avx2(_mm256_sub_pd(_mm256_setzero_pd(), exp_avx2(diff)));
+  return _mm256_add_pd(logx, _mm256_blendv_pd(log_far, log_near, near));
+}
+
+// Applies the binary kernel 'op' to n elements, padding the final partial vector
+#define PF_APPLY_BINARY_AVX2(op, x, y, out, n)				\
+  {									\
+    size_t i = 0;							\
+    for(; i + 4 <= n; i += 4)						\
+      _mm256_storeu_pd(out + i, op(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i))); \
+    if(i < n)								\
+      {									\
+	double xb[4] = {0.0, 0.0, 0.0, 0.0}, yb[4] = {0.0, 0.0, 0.0, 0.0}, ob[4]; \
+	std::memcpy(xb, x + i, (n - i) * sizeof(double));		\
+	std::memcpy(yb, y + i, (n - i) * sizeof(double));		\
+	_mm256_storeu_pd(ob, op(_mm256_loadu_pd(xb), _mm256_loadu_pd(yb))); \
+	std::memcpy(out + i, ob, (n - i) * sizeof(double));		\
+      }									\
+  }
+
+PF_TARGET_AVX2 static void logsum_batch_avx2(const double* logx, const double* logy, double* out, size_t n)
+{
+  PF_APPLY_BINARY_AVX2(logsum_avx2, logx, logy, out, n);
+}
+
+PF_TARGET_AVX2 static void logdiff_batch_avx2(const double* logx, const double* logy, double* out, size_t n)
+{
+  PF_APPLY_BINARY_AVX2(logdiff_avx2, logx, logy, out, n);
+}
+
+PF_TARGET_AVX2 static inline __m256d exp_binary_avx2(__m256d x, __m256d)
+{
+  return exp_avx2(x);
+}
+
+PF_TARGET_AVX2 static void exp_batch_avx2(const double* x, double* out, size_t n)
+{
+  PF_APPLY_BINARY_AVX2(exp_binary_avx2, x, x, out, n);
+}
+
+// Evaluates the scaled sums of fused_log_update() for the first four elements of 'block', returning a bit mask of the elements that need the fallback
+PF_TARGET_AVX2 static inline unsigned fused_log_update_avx2(FusedUpdateBlock& block)
+{
+  __m256d one = _mm256_set1_pd(1.0);
+  __m256d log_ratio = _mm256_loadu_pd(block.log_ratio);
+
+  // S_T(t_{N+1}) / S_T(t_N) and 1 - S_T(t_{N+1}) / S_T(t_N), using expm1() when the ratio exceeds 1/2
+  __m256d clipped = _mm256_blendv_pd(log_ratio, _mm256_setzero_pd(), _mm256_cmp_pd(log_ratio, _mm256_setzero_pd(), _CMP_GT_OQ));
+  __m256d near = _mm256_cmp_pd(clipped, _mm256_set1_pd(-LN2), _CMP_GT_OQ);
+  __m256d near_mass = _mm256_sub_pd(_mm256_setzero_pd(), expm1_avx2(_mm256_max_pd(clipped, _mm256_set1_pd(-LN2))));
+  __m256d far_ratio = exp_avx2(clipped);
+  __m256d mass = _mm256_blendv_pd(_mm256_sub_pd(one, far_ratio), near_mass, near);
+  __m256d ratio = _mm256_blendv_pd(far_ratio, _mm256_sub_pd(one, near_mass), near);
+
+  // Scale by the larger of L(Y_{1:N}) and p(Y_{1:N} | t_N) S_T(t_N)
+  __m256d logLY = _mm256_loadu_pd(block.logLY);
+  __m256d log_upper = _mm256_add_pd(_mm256_loadu_pd(block.logpY_tN), _mm256_loadu_pd(block.logS0));
+  __m256d lower_is_larger = _mm256_cmp_pd(logLY, log_upper, _CMP_GE_OQ);
+  __m256d log_scale = _mm256_blendv_pd(log_upper, logLY, lower_is_larger);
+  __m256d smaller = exp_avx2(_mm256_blendv_pd(_mm256_sub_pd(logLY, log_upper), _mm256_sub_pd(log_upper, logLY), lower_is_larger));
+  __m256d upper = _mm256_blendv_pd(one, smaller, lower_is_larger);
+  __m256d lower_sum = _mm256_blendv_pd(_mm256_add_pd(smaller, mass), _mm256_add_pd(one, _mm256_mul_pd(smaller, mass)), lower_is_larger);
+  __m256d evidence = _mm256_add_pd(_mm256_mul_pd(lower_sum, _mm256_loadu_pd(block.absent)), _mm256_mul_pd(_mm256_mul_pd(upper, ratio), _mm256_loadu_pd(block.present)));
+
+  __m256d dbl_min = _mm256_set1_pd(std::numeric_limits<double>::min());
+  __m256d scaled = _mm256_and_pd(_mm256_cmp_pd(lower_sum, dbl_min, _CMP_GE_OQ), _mm256_cmp_pd(evidence, dbl_min, _CMP_GE_OQ));
+  scaled = _mm256_and_pd(scaled, _mm256_cmp_pd(_mm256_andnot_pd(_mm256_set1_pd(-0.0), log_scale), _mm256_set1_pd(HUGE_VAL), _CMP_LT_OQ));
+  scaled = _mm256_and_pd(scaled, _mm256_cmp_pd(log_ratio, log_ratio, _CMP_ORD_Q));
+
+  _mm256_storeu_pd(block.updated_logLY, _mm256_add_pd(_mm256_add_pd(log_scale, log_avx2(lower_sum)), _mm256_loadu_pd(block.log_absent)));
+  _mm256_storeu_pd(block.updated_logpY, _mm256_add_pd(log_scale, log_avx2(evidence)));
+  return ~static_cast<unsigned>(_mm256_movemask_pd(scaled)) & 0xfu;
+}
+
+PF_TARGET_AVX2 static void fused_log_update_batch_avx2(const double* logLY, const double* logpY_tN, const double* logS0, const double* logS1, const double* log_ratio, const unsigned char* detector_outputs, const DetectorLikelihoods* likelihoods, double* updated_logLY, double* updated_logpY, size_t n)
+{
+  FusedUpdateBlock block;
+  for(size_t i = 0; i < n; i += 4)
+    {
+      size_t m = std::min<size_t>(4, n - i);
+      block.load(logLY, logpY_tN, logS0, logS1, log_ratio, detector_outputs, likelihoods, i, m);
+      block.store(fused_log_update_avx2(block), detector_outputs, likelihoods, updated_logLY, updated_logpY, i, m);
+    }
+}
+
+
+/// AVX-512 KERNELS
+//
+// These are line-for-line translations of the AVX2 kernels above.
+
+#define PF_TARGET_AVX512 __attribute__((target("avx512f")))
+
+// GCC's AVX-512 intrinsics start from deliberately-undefined registers, which trips -Wmaybe-uninitialized
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+PF_TARGET_AVX512 static inline __m512d exp_avx512(__m512d x)
+{
+  __m512d xc = _mm512_min_pd(_mm512_max_pd(x, _mm512_set1_pd(EXP_UNDERFLOW_THRESHOLD)), _mm512_set1_pd(EXP_OVERFLOW_THRESHOLD));
+
+  __m512d n = _mm512_roundscale_pd(_mm512_mul_pd(xc, _mm512_set1_pd(LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512d r = _mm512_fnmadd_pd(n, _mm512_set1_pd(LN2_HI), xc);
+  r = _mm512_fnmadd_pd(n, _mm512_set1_pd(LN2_LO), r);
+
+  __m512d p = _mm512_set1_pd(EXP_COEFFS[0]);
+  for(int k = 1; k < NUM_EXP_COEFFS; ++k)
+    p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(EXP_COEFFS[k]));
+
+  __m512i ni = _mm512_sub_epi64(_mm512_castpd_si512(_mm512_add_pd(n, _mm512_set1_pd(ROUNDING_MAGIC))), _mm512_castpd_si512(_mm512_set1_pd(ROUNDING_MAGIC)));
+  __m512d scale = _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_add_epi64(ni, _mm512_set1_epi64(EXP_BIAS)), 52));
+
+  __m512d result = _mm512_mul_pd(p, scale);
+
+  result = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_set1_pd(EXP_UNDERFLOW_THRESHOLD), _CMP_LT_OQ), result, _mm512_setzero_pd());
+  result = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, _mm512_set1_pd(EXP_OVERFLOW_THRESHOLD), _CMP_GT_OQ), result, _mm512_set1_pd(HUGE_VAL));
+  result = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(x, x, _CMP_UNORD_Q), result, x);
+  return result;
+}
+
+PF_TARGET_AVX512 static inline __m512d log_corrected_avx512(__m512d w, __m512d c)
+{
+  __m512d one = _mm512_set1_pd(1.0);
+
+  __m512i bits = _mm512_castpd_si512(w);
+  __m512i e = _mm512_sub_epi64(_mm512_srli_epi64(bits, 52), _mm512_set1_epi64(EXP_BIAS));
+  __m512d m = _mm512_castsi512_pd(_mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi64(MANTISSA_MASK)), _mm512_set1_epi64(ONE_BITS)));
+  __m512d ed = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_add_epi64(e, _mm512_castpd_si512(_mm512_set1_pd(ROUNDING_MAGIC)))), _mm512_set1_pd(ROUNDING_MAGIC));
+
+  __mmask8 big = _mm512_cmp_pd_mask(m, _mm512_set1_pd(SQRT2), _CMP_GT_OQ);
+  m = _mm512_mask_mul_pd(m, big, m, _mm512_set1_pd(0.5));
+  ed = _mm512_mask_add_pd(ed, big, ed, one);
+
+  __m512d s = _mm512_div_pd(_mm512_sub_pd(m, one), _mm512_add_pd(m, one));
+  __m512d z = _mm512_mul_pd(s, s);
+  __m512d p = _mm512_set1_pd(ATANH_COEFFS[0]);
+  for(int k = 1; k < NUM_ATANH_COEFFS; ++k)
+    p = _mm512_fmadd_pd(p, z, _mm512_set1_pd(ATANH_COEFFS[k]));
+
+  __m512d lo = _mm512_fmadd_pd(_mm512_mul_pd(s, z), p, _mm512_fmadd_pd(ed, _mm512_set1_pd(LN2_LO), c));
+  __m512d result = _mm512_add_pd(_mm512_fmadd_pd(ed, _mm512_set1_pd(LN2_HI), _mm512_add_pd(s, s)), lo);
+
+  return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(w, _mm512_setzero_pd(), _CMP_EQ_OQ), result, _mm512_set1_pd(-HUGE_VAL));
+}
+
+PF_TARGET_AVX512 static inline __m512d log1p_avx512(__m512d u)
+{
+  __m512d one = _mm512_set1_pd(1.0);
+  __m512d w = _mm512_add_pd(one, u);
+  __m512d c = _mm512_div_pd(_mm512_sub_pd(u, _mm512_sub_pd(w, one)), w);
+
+  __m512d result = log_corrected_avx512(w, c);
+  return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(u, u, _CMP_UNORD_Q), result, u);
+}
+
+PF_TARGET_AVX512 static inline __m512d log_avx512(__m512d v)
+{
+  __mmask8 subnormal = _mm512_cmp_pd_mask(v, _mm512_set1_pd(2.2250738585072014e-308), _CMP_LT_OQ);
+  __m512d result = log_corrected_avx512(_mm512_mask_mul_pd(v, subnormal, v, _mm512_set1_pd(TWO_54)), _mm512_setzero_pd());
+  result = _mm512_mask_sub_pd(result, subnormal, result, _mm512_set1_pd(54 * LN2));
+  return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(v, v, _CMP_UNORD_Q), result, v);
+}
+
+PF_TARGET_AVX512 static inline __m512d expm1_avx512(__m512d x)
+{
+  __m512d p = _mm512_set1_pd(EXPM1_COEFFS[0]);
+  for(int k = 1; k < NUM_EXPM1_COEFFS; ++k)
+    p = _mm512_fmadd_pd(p, x, _mm512_set1_pd(EXPM1_COEFFS[k]));
+  return _mm512_mul_pd(x, p);
+}
+
+PF_TARGET_AVX512 static inline __m512d logsum_avx512(__m512d logx, __m512d logy)
+{
+  __m512d neg_inf = _mm512_set1_pd(-HUGE_VAL);
+  __m512d hi = _mm512_max_pd(logx, logy);
+  __m512d diff = _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(_mm512_set1_pd(-0.0)), _mm512_castpd_si512(_mm512_sub_pd(logx, logy))));
+  diff = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(logx, neg_inf, _CMP_EQ_OQ) & _mm512_cmp_pd_mask(logy, neg_inf, _CMP_EQ_OQ), diff, neg_inf);
+  return _mm512_add_pd(hi, log1p_avx512(exp_avx512(diff)));
+}
+
+PF_TARGET_AVX512 static inline __m512d logdiff_avx512(__m512d logx, __m512d logy)
+{
+  __m512d neg_inf = _mm512_set1_pd(-HUGE_VAL);
+  __m512d diff = _mm512_sub_pd(logy, logx);
+  diff = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(logx, neg_inf, _CMP_EQ_OQ) & _mm512_cmp_pd_mask(logy, neg_inf, _CMP_EQ_OQ), diff, neg_inf);
+  __mmask8 near = _mm512_cmp_pd_mask(diff, _mm512_set1_pd(-LN2), _CMP_GT_OQ);
+  __m512d log_near = log_avx512(_mm512_sub_pd(_mm512_setzero_pd(), expm1_avx512(_mm512_max_pd(diff, _mm512_set1_pd(-LN2)))));
+  __m512d log_far = log1p_avx512(_mm512_sub_pd(_mm512_setzero_pd(), exp_avx512(diff)));
+  return _mm512_add_pd(logx, _mm512_mask_blend_pd(near, log_far, log_near));
+}
+
+// Applies the binary kernel 'op' to n elements, using a masked load/store for the final partial vector
+#define PF_APPLY_BINARY_AVX512(op, x, y, out, n)			\
+  {									\
+    size_t i = 0;							\
+    for(; i + 8 <= n; i += 8)						\
+      _mm512_storeu_pd(out + i, op(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i))); \
+    if(i < n)								\
+      {									\
+	__mmask8 tail = (__mmask8) ((1u << (n - i)) - 1);		\
+	__m512d r = op(_mm512_maskz_loadu_pd(tail, x + i), _mm512_maskz_loadu_pd(tail, y + i)); \
+	_mm512_mask_storeu_pd(out + i, tail, r);			\
+      }									\
+  }
+
+PF_TARGET_AVX512 static void logsum_batch_avx512(const double* logx, const double* logy, double* out, size_t n)
+{
+  PF_APPLY_BINARY_AVX512(logsum_avx512, logx, logy, out, n);
+}
+
+PF_TARGET_AVX512 static void logdiff_batch_avx512(const double* logx, const double* logy, double* out, size_t n)
+{
+  PF_APPLY_BINARY_AVX512(logdiff_avx512, logx, logy, out, n);
+}
+
+PF_TARGET_AVX512 static inline __m512d exp_binary_avx512(__m512d x, __m512d)
+{
+  return exp_avx512(x);
+}
+
+PF_TARGET_AVX512 static void exp_batch_avx512(const double* x, double* out, size_t n)
+{
+  PF_APPLY_BINARY_AVX512(exp_binary_avx512, x, x, out, n);
+}
+
+PF_TARGET_AVX512 static inline unsigned fused_log_update_avx512(FusedUpdateBlock& block)
+{
+  __m512d one = _mm512_set1_pd(1.0);
+  __m512d log_ratio = _mm512_loadu_pd(block.log_ratio);
+
+  __m512d clipped = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(log_ratio, _mm512_setzero_pd(), _CMP_GT_OQ), log_ratio, _mm512_setzero_pd());
+  __mmask8 near = _mm512_cmp_pd_mask(clipped, _mm512_set1_pd(-LN2), _CMP_GT_OQ);
+  __m512d near_mass = _mm512_sub_pd(_mm512_setzero_pd(), expm1_avx512(_mm512_max_pd(clipped, _mm512_set1_pd(-LN2))));
+  __m512d far_ratio = exp_avx512(clipped);
+  __m512d mass = _mm512_mask_blend_pd(near, _mm512_sub_pd(one, far_ratio), near_mass);
+  __m512d ratio = _mm512_mask_blend_pd(near, far_ratio, _mm512_sub_pd(one, near_mass));
+
+  __m512d logLY = _mm512_loadu_pd(block.logLY);
+  __m512d log_upper = _mm512_add_pd(_mm512_loadu_pd(block.logpY_tN), _mm512_loadu_pd(block.logS0));
+  __mmask8 lower_is_larger = _mm512_cmp_pd_mask(logLY, log_upper, _CMP_GE_OQ);
+  __m512d log_scale = _mm512_mask_blend_pd(lower_is_larger, log_upper, logLY);
+  __m512d smaller = exp_avx512(_mm512_mask_blend_pd(lower_is_larger, _mm512_sub_pd(logLY, log_upper), _mm512_sub_pd(log_upper, logLY)));
+  __m512d upper = _mm512_mask_blend_pd(lower_is_larger, one, smaller);
+  __m512d lower_sum = _mm512_mask_blend_pd(lower_is_larger, _mm512_add_pd(smaller, mass), _mm512_add_pd(one, _mm512_mul_pd(smaller, mass)));
+  __m512d evidence = _mm512_add_pd(_mm512_mul_pd(lower_sum, _mm512_loadu_pd(block.absent)), _mm512_mul_pd(_mm512_mul_pd(upper, ratio), _mm512_loadu_pd(block.present)));
+
+  __m512d dbl_min = _mm512_set1_pd(std::numeric_limits<double>::min());
+  __mmask8 scaled = _mm512_cmp_pd_mask(lower_sum, dbl_min, _CMP_GE_OQ) & _mm512_cmp_pd_mask(evidence, dbl_min, _CMP_GE_OQ);
+  scaled &= _mm512_cmp_pd_mask(_mm512_abs_pd(log_scale), _mm512_set1_pd(HUGE_VAL), _CMP_LT_OQ);
+  scaled &= _mm512_cmp_pd_mask(log_ratio, log_ratio, _CMP_ORD_Q);
+
+  _mm512_storeu_pd(block.updated_logLY, _mm512_add_pd(_mm512_add_pd(log_scale, log_avx512(lower_sum)), _mm512_loadu_pd(block.log_absent)));
+  _mm512_storeu_pd(block.updated_logpY, _mm512_add_pd(log_scale, log_avx512(evidence)));
+  return ~static_cast<unsigned>(scaled) & 0xffu;
+}
+
+PF_TARGET_AVX512 static void fused_log_update_batch_avx512(const double* logLY, const double* logpY_tN, const double* logS0, const double* logS1, const double* log_ratio, const unsigned char* detector_outputs, const DetectorLikelihoods* likelihoods, double* updated_logLY, double* updated_logpY, size_t n)
+{
+  FusedUpdateBlock block;
+  for(size_t i = 0; i < n; i += 8)
+    {
+      size_t m = std::min<size_t>(8, n - i);
+      block.load(logLY, logpY_tN, logS0, logS1, log_ratio, detector_outputs, likelihoods, i, m);
+      block.store(fused_log_update_avx512(block), detector_outputs, likelihoods, updated_logLY, updated_logpY, i, m);
+    }
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif //PERSISTENCE_FILTER_HAVE_X86_SIMD
+
+
+/// DISPATCH
+
+SIMDInstructionSet best_supported_simd_instruction_set()
+{
+#ifdef PERSISTENCE_FILTER_HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f"))
+    return SIMD_AVX512;
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return SIMD_AVX2;
+#endif
+  return SIMD_SCALAR;
+}
+
+// The instruction set that the kernels currently dispatch to (-1 until first use)
+static std::atomic<int> active_instruction_set(-1);
+
+SIMDInstructionSet simd_instruction_set()
+{
+  int instruction_set = active_instruction_set.load(std::memory_order_relaxed);
+  if(instruction_set < 0)
+    {
+      instruction_set = best_supported_simd_instruction_set();
+      active_instruction_set.store(instruction_set, std::memory_order_relaxed);
+    }
+  return static_cast<SIMDInstructionSet>(instruction_set);
+}
+
+SIMDInstructionSet set_simd_instruction_set(SIMDInstructionSet instruction_set)
+{
+  SIMDInstructionSet selected = std::min(instruction_set, best_supported_simd_instruction_set());
+  active_instruction_set.store(selected, std::memory_order_relaxed);
+  return selected;
+}
+
+void logsum_batch(const double* logx, const double* logy, double* out, size_t n)
+{
+  switch(simd_instruction_set())
+    {
+#ifdef PERSISTENCE_FILTER_HAVE_X86_SIMD
+    case SIMD_AVX512:
+      logsum_batch_avx512(logx, logy, out, n);
+      break;
+    case SIMD_AVX2:
+      logsum_batch_avx2(logx, logy, out, n);
+      break;
+#endif
+    default:
+      logsum_batch_scalar(logx, logy, out, n);
+    }
+}
+
+void logdiff_batch(const double* logx, const double* logy, double* out, size_t n)
+{
+  // Input checking
+  for(size_t i = 0; i < n; ++i)
+    {
+      if(logy[i] > logx[i])
+	{
+	  throw std::domain_error("logx must be greater than or equal to logy");
+	}
+    }
+
+  switch(simd_instruction_set())
+    {
+#ifdef PERSISTENCE_FILTER_HAVE_X86_SIMD
+    case SIMD_AVX512:
+      logdiff_batch_avx512(logx, logy, out, n);
+      break;
+    case SIMD_AVX2:
+      logdiff_batch_avx2(logx, logy, out, n);
+      break;
+#endif
+    default:
+      logdiff_batch_scalar(logx, logy, out, n);
+    }
+}
+
+void exp_batch(const double* x, double* out, size_t n)
+{
+  switch(simd_instruction_set())
+    {
+#ifdef PERSISTENCE_FILTER_HAVE_X86_SIMD
+    case SIMD_AVX512:
+      exp_batch_avx512(x, out, n);
+      break;
+    case SIMD_AVX2:
+      exp_batch_avx2(x, out, n);
+      break;
+#endif
+    default:
+      exp_batch_scalar(x, out, n);
+    }
+}
+
+void fused_log_update_batch(const double* logLY, const double* logpY_tN, const double* logS0, const double* logS1, const double* log_ratio, const unsigned char* detector_outputs, const DetectorLikelihoods* likelihoods, double* updated_logLY, double* updated_logpY, size_t n)
+{
+  switch(simd_instruction_set())
+    {
+#ifdef PERSISTENCE_FILTER_HAVE_X86_SIMD
+    case SIMD_AVX512:
+      fused_log_update_batch_avx512(logLY, logpY_tN, logS0, logS1, log_ratio, detector_outputs, likelihoods, updated_logLY, updated_logpY, n);
+      break;
+    case SIMD_AVX2:
+      fused_log_update_batch_avx2(logLY, logpY_tN, logS0, logS1, log_ratio, detector_outputs, likelihoods, updated_logLY, updated_logpY, n);
+      break;
+#endif
+    default:
+      fused_log_update_batch_scalar(logLY, logpY_tN, logS0, logS1, log_ratio, detector_outputs, likelihoods, updated_logLY, updated_logpY, n);
+    }
+}
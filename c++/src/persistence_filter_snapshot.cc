@@ -0,0 +1,338 @@
+#include "persistence_filter_snapshot.h"
+#include "persistence_filter_math.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static const char SNAPSHOT_MAGIC[8] = {'P', 'F', 'S', 'N', 'A', 'P', '\r', '\n'};
+static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+// The alignment of each array in the file (a cache line)
+static const uint64_t SNAPSHOT_ALIGNMENT = 64;
+
+// The number of arrays following the header
+static const uint64_t SNAPSHOT_NUM_ARRAYS = 6;
+
+static_assert(sizeof(PersistenceFilterSnapshotHeader) == 64, "PersistenceFilterSnapshotHeader must occupy exactly 64 bytes");
+
+static uint64_t align(uint64_t n)
+{
+  return (n + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+
+/// WRITING
+
+// Write 'size' bytes from 'data' to 'fd', throwing std::runtime_error on failure
+static void write_fully(int fd, const std::string& filename, const void* data, size_t size)
+{
+  const char* bytes = static_cast<const char*>(data);
+  while(size > 0)
+    {
+      ssize_t n = write(fd, bytes, size);
+      if(n < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  throw std::runtime_error("Error writing snapshot file " + filename + ": " + std::strerror(errno));
+	}
+      bytes += n;
+      size -= n;
+    }
+}
+
+// Write the contents of 'buffer', followed by zero padding up to 'stride' bytes
+template<typename T>
+static void write_array(int fd, const std::string& filename, const std::vector<T>& buffer, uint64_t stride)
+{
+  static const char padding[SNAPSHOT_ALIGNMENT] = {0};
+
+  write_fully(fd, filename, buffer.data(), buffer.size() * sizeof(T));
+  write_fully(fd, filename, padding, stride - buffer.size() * sizeof(T));
+}
+
+// Write 'n' doubles gathered from the bank's slots 'slots' through the accessor 'value', followed by zero padding up to 'stride' bytes
+template<typename Value>
+static void write_array(int fd, const std::string& filename, std::vector<double>& buffer, const std::vector<size_t>& slots, Value value, uint64_t stride)
+{
+  for(size_t i = 0; i < slots.size(); ++i)
+    {
+      buffer[i] = value(slots[i]);
+    }
+
+  write_array(fd, filename, buffer, stride);
+}
+
+// Write the snapshot file to the open descriptor 'fd', and wait until it is durably stored
+static void write_snapshot(int fd, const std::string& filename, const PersistenceFilterBank& bank, const std::vector<size_t>& slots, const PersistenceFilterSnapshotHeader& header, const SurvivalPriorDescriptor& descriptor)
+{
+  write_fully(fd, filename, &header, sizeof(header));
+
+  // Prior parameters
+  write_array(fd, filename, descriptor.parameters, header.data_offset - header.prior_parameters_offset);
+
+  // Feature IDs
+  std::vector<PersistenceFilterBank::FeatureID> ids(slots.size());
+  for(size_t i = 0; i < slots.size(); ++i)
+    {
+      ids[i] = bank.id(slots[i]);
+    }
+  write_array(fd, filename, ids, header.array_stride);
+
+  // Filter states
+  std::vector<double> buffer(slots.size());
+  write_array(fd, filename, buffer, slots, [&bank](size_t slot) { return bank.initialization_time_slot(slot); }, header.array_stride);
+  write_array(fd, filename, buffer, slots, [&bank](size_t slot) { return bank.last_observation_time_slot(slot); }, header.array_stride);
+  write_array(fd, filename, buffer, slots, [&bank](size_t slot) { return bank.log_likelihood_slot(slot); }, header.array_stride);
+  write_array(fd, filename, buffer, slots, [&bank](size_t slot) { return bank.log_evidence_lower_sum_slot(slot); }, header.array_stride);
+  write_array(fd, filename, buffer, slots, [&bank](size_t slot) { return bank.log_evidence_slot(slot); }, header.array_stride);
+
+  if(fsync(fd) != 0)
+    {
+      throw std::runtime_error("Unable to sync snapshot file " + filename + ": " + std::strerror(errno));
+    }
+}
+
+void save_persistence_filter_snapshot(const PersistenceFilterBank& bank, const std::string& filename)
+{
+  // Gather the live slots, sorted by feature ID
+  std::vector<size_t> slots;
+  slots.reserve(bank.size());
+  for(size_t slot = 0; slot < bank.num_slots(); ++slot)
+    {
+      if(bank.is_live(slot))
+	{
+	  slots.push_back(slot);
+	}
+    }
+  std::sort(slots.begin(), slots.end(), [&bank](size_t a, size_t b) { return bank.id(a) < bank.id(b); });
+
+  SurvivalPriorDescriptor descriptor = bank.logS().descriptor();
+
+  PersistenceFilterSnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = PERSISTENCE_FILTER_SNAPSHOT_VERSION;
+  header.byte_order = SNAPSHOT_BYTE_ORDER;
+  header.num_features = slots.size();
+  header.prior_kind = descriptor.kind;
+  header.num_prior_parameters = descriptor.parameters.size();
+  header.prior_parameters_offset = sizeof(header);
+  header.data_offset = align(header.prior_parameters_offset + descriptor.parameters.size() * sizeof(double));
+  header.array_stride = align(slots.size() * sizeof(double));
+
+  // Write the snapshot under a temporary name, and make its contents durable before renaming it over the old one
+  std::string temporary_filename = filename + ".tmp";
+  int fd = open(temporary_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0)
+    {
+      throw std::runtime_error("Unable to open snapshot file " + temporary_filename + " for writing: " + std::strerror(errno));
+    }
+
+  try
+    {
+      write_snapshot(fd, temporary_filename, bank, slots, header, descriptor);
+    }
+  catch(...)
+    {
+      close(fd);
+      unlink(temporary_filename.c_str());
+      throw;
+    }
+
+  if(close(fd) != 0)
+    {
+      unlink(temporary_filename.c_str());
+      throw std::runtime_error("Error writing snapshot file " + temporary_filename + ": " + std::strerror(errno));
+    }
+
+  if(std::rename(temporary_filename.c_str(), filename.c_str()) != 0)
+    {
+      unlink(temporary_filename.c_str());
+      throw std::runtime_error("Unable to rename snapshot file " + temporary_filename + " to " + filename);
+    }
+
+  // Make the new directory entry durable too
+  size_t slash = filename.rfind('/');
+  std::string directory = (slash == std::string::npos) ? "." : (slash == 0) ? "/" : filename.substr(0, slash);
+  int directory_fd = open(directory.c_str(), O_RDONLY);
+  bool synced = (directory_fd >= 0) && (fsync(directory_fd) == 0);
+  if(directory_fd >= 0)
+    {
+      close(directory_fd);
+    }
+
+  if(!synced)
+    {
+      throw std::runtime_error("Unable to sync the directory containing snapshot file " + filename);
+    }
+}
+
+
+/// READING
+
+SurvivalPriorDescriptor PersistenceFilterSnapshot::map_file(const std::string& filename, void*& mapping, size_t& mapping_size)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+    {
+      throw std::runtime_error("Unable to open snapshot file " + filename);
+    }
+
+  struct stat status;
+  if( (fstat(fd, &status) != 0) || (static_cast<size_t>(status.st_size) < sizeof(PersistenceFilterSnapshotHeader)) )
+    {
+      close(fd);
+      throw std::runtime_error("Snapshot file " + filename + " is too short to contain a header");
+    }
+
+  mapping_size = status.st_size;
+  mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);  // The mapping remains valid after the descriptor is closed
+  if(mapping == MAP_FAILED)
+    {
+      mapping = nullptr;
+      throw std::runtime_error("Unable to map snapshot file " + filename);
+    }
+
+  // Validate the header
+  const PersistenceFilterSnapshotHeader& header = *static_cast<const PersistenceFilterSnapshotHeader*>(mapping);
+  const char* error = nullptr;
+  if(std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+    error = " is not a persistence filter snapshot";
+  else if(header.byte_order != SNAPSHOT_BYTE_ORDER)
+    error = " was written on a machine with a different byte order";
+  else if( (header.version != 1) && (header.version != PERSISTENCE_FILTER_SNAPSHOT_VERSION) )
+    error = " has an unsupported format version";
+  else if( (header.version > 1) && ( (header.prior_parameters_offset < sizeof(header)) || (header.prior_parameters_offset > header.data_offset) || ( (header.data_offset - header.prior_parameters_offset) / sizeof(double) < header.num_prior_parameters) ) )
+    error = " has an invalid layout";
+  else if( (header.data_offset % SNAPSHOT_ALIGNMENT != 0) || (header.array_stride % SNAPSHOT_ALIGNMENT != 0) || (header.array_stride / sizeof(double) < header.num_features) )
+    error = " has an invalid layout";
+  else if( (header.data_offset > mapping_size) || ( (mapping_size - header.data_offset) / SNAPSHOT_NUM_ARRAYS < header.array_stride) )
+    error = " is truncated";
+  else
+    {
+      // Queries locate features by binary search, so the IDs must be strictly increasing
+      const FeatureID* ids = reinterpret_cast<const FeatureID*>(static_cast<const char*>(mapping) + header.data_offset);
+      if(std::adjacent_find(ids, ids + header.num_features, [](FeatureID a, FeatureID b) { return a >= b; }) != ids + header.num_features)
+	error = " has feature IDs that are not strictly increasing";
+    }
+
+  if(error)
+    {
+      munmap(mapping, mapping_size);
+      mapping = nullptr;
+      throw std::runtime_error("Snapshot file " + filename + error);
+    }
+
+  SurvivalPriorDescriptor descriptor(static_cast<SurvivalPriorDescriptor::Kind>(header.prior_kind));
+  if(header.version == 1)
+    {
+      // Version 1 files stored exactly two parameters in the header, in place
+      // of the prior_parameters_offset and reserved fields (the second of
+      // which was unused by exponential priors)
+      size_t num_parameters = (descriptor.kind == SurvivalPriorDescriptor::CUSTOM) ? 0 : (descriptor.kind == SurvivalPriorDescriptor::EXPONENTIAL) ? 1 : 2;
+      descriptor.parameters.resize(num_parameters);
+      std::memcpy(descriptor.parameters.data(), &header.prior_parameters_offset, num_parameters * sizeof(double));
+    }
+  else
+    {
+      const double* parameters = reinterpret_cast<const double*>(static_cast<const char*>(mapping) + header.prior_parameters_offset);
+      descriptor.parameters.assign(parameters, parameters + header.num_prior_parameters);
+    }
+  return descriptor;
+}
+
+// Reconstruct the prior of a newly-mapped snapshot, unmapping it if this fails
+static LogSurvivalFunction prior_from_descriptor(const SurvivalPriorDescriptor& descriptor, void*& mapping, size_t mapping_size)
+{
+  try
+    {
+      return LogSurvivalFunction::from_descriptor(descriptor);
+    }
+  catch(...)
+    {
+      munmap(mapping, mapping_size);
+      mapping = nullptr;
+      throw;
+    }
+}
+
+PersistenceFilterSnapshot::PersistenceFilterSnapshot(const std::string& filename) : mapping_(nullptr), mapping_size_(0), descriptor_(map_file(filename, mapping_, mapping_size_)), logS_(prior_from_descriptor(descriptor_, mapping_, mapping_size_))
+{
+  locate_arrays();
+}
+
+PersistenceFilterSnapshot::PersistenceFilterSnapshot(const std::string& filename, const LogSurvivalFunction& log_survival_function) : mapping_(nullptr), mapping_size_(0), descriptor_(map_file(filename, mapping_, mapping_size_)), logS_(log_survival_function)
+{
+  locate_arrays();
+}
+
+void PersistenceFilterSnapshot::locate_arrays()
+{
+  const char* base = static_cast<const char*>(mapping_);
+  header_ = reinterpret_cast<const PersistenceFilterSnapshotHeader*>(base);
+
+  const char* data = base + header_->data_offset;
+  uint64_t stride = header_->array_stride;
+  ids_ = reinterpret_cast<const FeatureID*>(data);
+  init_time_ = reinterpret_cast<const double*>(data + stride);
+  tN_ = reinterpret_cast<const double*>(data + 2 * stride);
+  logpY_tN_ = reinterpret_cast<const double*>(data + 3 * stride);
+  logLY_ = reinterpret_cast<const double*>(data + 4 * stride);
+  logpY_ = reinterpret_cast<const double*>(data + 5 * stride);
+}
+
+PersistenceFilterSnapshot::~PersistenceFilterSnapshot()
+{
+  if(mapping_)
+    {
+      munmap(mapping_, mapping_size_);
+    }
+}
+
+size_t PersistenceFilterSnapshot::find(FeatureID id) const
+{
+  const FeatureID* end = ids_ + size();
+  const FeatureID* it = std::lower_bound(ids_, end, id);
+  return ( (it != end) && (*it == id) ) ? (it - ids_) : size();
+}
+
+size_t PersistenceFilterSnapshot::checked_index(FeatureID id) const
+{
+  size_t i = find(id);
+  if(i == size())
+    {
+      throw std::out_of_range("No feature with the requested ID is stored in this PersistenceFilterSnapshot");
+    }
+  return i;
+}
+
+double PersistenceFilterSnapshot::predict(FeatureID id, double prediction_time) const
+{
+  size_t i = checked_index(id);
+
+  // Input checking
+  if(prediction_time < tN_[i])
+    {
+      throw std::domain_error("Prediction time must be at least as recent as the last incorporated observation (prediction_time >= last_observation_time)");
+    }
+
+  return clamped_exp(logpY_tN_[i] - logpY_[i] + logS_(prediction_time - init_time_[i]));
+}
+
+void PersistenceFilterSnapshot::restore(PersistenceFilterBank& bank) const
+{
+  bank.reserve(bank.num_slots() + size());
+  bank.append(size(), ids_, init_time_, tN_, logpY_tN_, logLY_, logpY_);
+}
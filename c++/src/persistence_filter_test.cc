@@ -1,10 +1,32 @@
 #include "persistence_filter.h"
+#include "persistence_filter_bank.h"
+#include "persistence_filter_command_line.h"
+#include "persistence_filter_group_index.h"
+#include "persistence_filter_journal.h"
+#include "persistence_filter_manager.h"
+#include "persistence_filter_monte_carlo.h"
+#include "persistence_filter_pruning_index.h"
+#include "persistence_filter_reordering.h"
+#include "persistence_filter_replay.h"
+#include "persistence_filter_revisit_scheduler.h"
+#include "persistence_filter_simd.h"
+#include "persistence_filter_snapshot.h"
 #include "persistence_filter_utils.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <random>
+#include <stdexcept>
 #include <gsl/gsl_sf_exp.h>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 
 using namespace std;
 
@@ -19,6 +41,141 @@ std::function<double(double)> logS_T = std::bind(log_general_purpose_survival_fu
 
 auto S_T = [](double t) { return gsl_sf_exp(logS_T(t)); };
 
+// The discrepancy between a and b in units in the last place of max(|a|, |b|, scale).  Identical values (including infinities and NaNs) agree exactly.
+double ulp_difference(double a, double b, double scale)
+{
+  if( (a == b) || (std::isnan(a) && std::isnan(b)) )
+    return 0.0;
+  if(!std::isfinite(a) || !std::isfinite(b))
+    return std::numeric_limits<double>::infinity();
+
+  scale = std::max(std::max(std::fabs(a), std::fabs(b)), scale);
+  return std::fabs(a - b) / (std::nextafter(scale, std::numeric_limits<double>::infinity()) - scale);
+}
+
+// Runs the same random sequence of observations through a filter templated on 'prior' and a PersistenceFilter holding the same prior (type-erased), returning the largest difference between their posterior probabilities at each observation time and 1, 10 and 100 time units after it
+template<typename SurvivalPrior>
+double max_templated_filter_difference(const SurvivalPrior& prior)
+{
+  std::mt19937_64 rng(1);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  BasicPersistenceFilter<SurvivalPrior> templated_filter(prior, 1.0);
+  PersistenceFilter type_erased_filter(LogSurvivalFunction(prior), 1.0);
+
+  double max_difference = 0, t = 1.0;
+  for(int i = 0; i < 50; ++i)
+    {
+      bool detector_output = uniform(rng) < .7;
+      double observation_P_M = .5 * uniform(rng), observation_P_F = .5 * uniform(rng);
+      templated_filter.update(detector_output, t, observation_P_M, observation_P_F);
+      type_erased_filter.update(detector_output, t, observation_P_M, observation_P_F);
+      for(double horizon : {0.0, 1.0, 10.0, 100.0})
+	max_difference = std::max(max_difference, std::fabs(templated_filter.predict(t + horizon) - type_erased_filter.predict(t + horizon)));
+      t += 5 * uniform(rng);
+    }
+  return max_difference;
+}
+
+// The largest discrepancies between the summaries maintained by a PersistenceGroupIndex and brute-force computations over its members' filters
+struct GroupIndexDiscrepancies
+{
+  double count;  // Relative to max(1, expected count)
+  double bounds;
+  double crossing_time;  // Relative to max(1, crossing time)
+  size_t features_above;  // Features not on the threshold whose membership in features_above() is wrong
+  size_t latest_observation_times;
+  double final_time_quantum;
+};
+
+// Runs random additions, updates, removals, re-additions and reassignments of 256 features among 8 groups (two top-level groups with three children each), initializing them at integral times if 'aligned' and at arbitrary times otherwise, and compares the index's summaries with brute-force computations.  With only 8 buckets per group, the index must coarsen its quantum as time passes.
+GroupIndexDiscrepancies group_index_discrepancies(const LogSurvivalFunction& prior, bool aligned)
+{
+  std::mt19937_64 rng(3);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  PersistenceFilterBank bank(prior);
+  PersistenceGroupIndex index(bank, 1.0, 8);
+  index.add_group(0);
+  index.add_group(1);
+  for(PersistenceGroupIndex::GroupID g = 2; g < 8; ++g)
+    index.add_group(g, g % 2);
+
+  // Whether 'member_group' is 'group' or one of its descendants
+  auto in_subtree = [](PersistenceGroupIndex::GroupID member_group, PersistenceGroupIndex::GroupID group)
+    {
+      return (member_group == group) || ( (member_group >= 2) && (member_group % 2 == group) );
+    };
+
+  GroupIndexDiscrepancies discrepancies = {0, 0, 0, 0, 0, 0};
+  double t = 0;
+  for(int round = 0; round < 600; ++round)
+    {
+      t += .25;
+      PersistenceFilterBank::FeatureID id = rng() % 256;
+      if(!bank.contains(id))
+	{
+	  bank.add(id, aligned ? std::floor(t) : t - uniform(rng) / 4);
+	  index.assign(id, rng() % 8);
+	}
+      else if(round % 9 == 0)
+	{
+	  bank.remove(id);
+	  index.remove(id);
+	}
+      else if(round % 13 == 0)
+	index.assign(id, rng() % 8);
+      else
+	{
+	  bank.update(id, uniform(rng) < .6, t, P_M, P_F);
+	  index.update(id);
+	}
+
+      if(round % 20 != 19)
+	continue;
+
+      double T = t + 2, log_threshold = std::log(.5);
+      for(PersistenceGroupIndex::GroupID g = 0; g < 8; ++g)
+	{
+	  double count = 0, lower = 1, upper = 0, latest = -std::numeric_limits<double>::infinity(), crossing = std::numeric_limits<double>::infinity();
+	  std::vector<PersistenceFilterBank::FeatureID> above;
+	  for(PersistenceFilterBank::FeatureID member = 0; member < 256; ++member)
+	    {
+	      if(!index.contains(member) || !in_subtree(index.group(member), g))
+		continue;
+
+	      double belief = bank.predict(member, T), t_init = bank.initialization_time(member);
+	      count += belief;
+	      lower = std::min(lower, belief);
+	      upper = std::max(upper, belief);
+	      latest = std::max(latest, bank.last_observation_time(member));
+	      crossing = std::min(crossing, t_init + inverse_log_survival(bank.logS(), log_threshold - (bank.log_likelihood_slot(bank.slot(member)) - bank.log_evidence_slot(bank.slot(member))), T - t_init));
+	      if(belief > .5)
+		above.push_back(member);
+	    }
+
+	  discrepancies.latest_observation_times += (index.latest_observation_time(g) != latest);
+	  discrepancies.count = std::max(discrepancies.count, std::fabs(index.expected_count(g, T) - count) / std::max(1.0, count));
+
+	  double index_lower, index_upper;
+	  if(index.belief_bounds(g, T, index_lower, index_upper))
+	    discrepancies.bounds = std::max(discrepancies.bounds, std::max(std::fabs(index_lower - lower), std::fabs(index_upper - upper)));
+	  if(index.group_size(g) > 0)
+	    discrepancies.crossing_time = std::max(discrepancies.crossing_time, std::fabs(index.crossing_time(g, .5, T) - crossing) / std::max(1.0, crossing));
+
+	  std::vector<PersistenceFilterBank::FeatureID> index_above;
+	  index.features_above(g, T, .5, index_above);
+	  std::sort(above.begin(), above.end());
+	  std::sort(index_above.begin(), index_above.end());
+	  std::vector<PersistenceFilterBank::FeatureID> differing;
+	  std::set_symmetric_difference(above.begin(), above.end(), index_above.begin(), index_above.end(), std::back_inserter(differing));
+	  for(PersistenceFilterBank::FeatureID member : differing)
+	    discrepancies.features_above += (std::fabs(bank.predict(member, T) - .5) > 1e-6);
+	}
+    }
+
+  discrepancies.final_time_quantum = index.time_quantum();
+  return discrepancies;
+}
+
 int main(int argc, char* argv[])
 {
 
@@ -119,5 +276,804 @@ int main(int argc, char* argv[])
   cout<<"Filter evidence p(y_1 = 0, y_2 = 1, y_3 = 0) = "<<filter.evidence()<<endl;
   cout<<"True evidence p(y_1 = 0, y_2 = 1, y_3 = 0) = "<<pY3<<endl;
   cout<<"Filter posterior probability p(X_{t_3} = 1 | y_1 = 0, y_2 = 1, y_3 = 0) = "<<filter.predict(t_3)<<endl;
+  cout<<"True posterior probability p(X_{t_3} = 1 | y_1 = 0, y_2 = 1, y_3 = 0) = "<<posterior3<<endl;
+
+  // The same updates through a fixed-rate detector model
+  DetectorModel detector(P_M, P_F);
+  PersistenceFilter detector_filter(logS_T);
+  detector_filter.update(false, t_1, detector);
+  detector_filter.update(true, t_2, detector);
+  detector_filter.update(false, t_3, detector);
+  cout<<"Detector model filter posterior probability p(X_{t_3} = 1 | y_1 = 0, y_2 = 1, y_3 = 0) = "<<detector_filter.predict(t_3)<<endl<<endl;
+
+
+
+
+  // RUN A RANDOM OBSERVATION SEQUENCE THROUGH FILTERS TEMPLATED ON EACH BUILT-IN PRIOR, AND THROUGH THE TYPE-ERASED PersistenceFilter
+
+  GeneralPurposeSurvivalPrior general_purpose_prior(lambda_l, lambda_u);
+  cout<<"TEMPLATED FILTERS COMPARED WITH PersistenceFilter OVER 50 RANDOM OBSERVATIONS"<<endl;
+  cout<<"Maximum posterior probability difference for GeneralPurposeSurvivalPrior = "<<max_templated_filter_difference(general_purpose_prior)<<endl;
+  cout<<"Maximum posterior probability difference for GeneralPurposeLogSurvivalTable = "<<max_templated_filter_difference(GeneralPurposeLogSurvivalTable(lambda_l, lambda_u))<<endl;
+  cout<<"Maximum posterior probability difference for ExponentialSurvivalPrior = "<<max_templated_filter_difference(ExponentialSurvivalPrior(.05))<<endl;
+  cout<<"Maximum posterior probability difference for WeibullSurvivalPrior = "<<max_templated_filter_difference(WeibullSurvivalPrior(1.5, 20))<<endl;
+  cout<<"Maximum posterior probability difference for PiecewiseConstantHazardSurvivalPrior = "<<max_templated_filter_difference(PiecewiseConstantHazardSurvivalPrior({0, 10, 50}, {.01, .1, .02}))<<endl;
+  cout<<"Maximum posterior probability difference for SurvivalPriorReference<GeneralPurposeSurvivalPrior> = "<<max_templated_filter_difference(SurvivalPriorReference<GeneralPurposeSurvivalPrior>(general_purpose_prior))<<endl<<endl;
+
+
+
+
+  // RUN THE SAME OBSERVATION SEQUENCE THROUGH A PersistenceFilterBank
+
+  PersistenceFilterBank bank(logS_T);
+  bank.add(0);
+  bank.add(1);  // A second feature, which we remove again before compacting the bank
+  bank.add(2);
+  bank.remove(1);
+
+  bank.update(0, false, t_1, P_M, P_F);
+  bank.update(0, true, t_2, P_M, P_F);
+  bank.update(2, true, t_1, P_M, P_F);
+  bank.compact();
+  bank.update(0, false, t_3, P_M, P_F);
+
+  cout<<"FILTER BANK STATE FOR FEATURE 0 AFTER INCORPORATING y_1 = 0, y_2 = 1, y_3 = 0"<<endl;
+  cout<<"Filter bank evidence p(y_1 = 0, y_2 = 1, y_3 = 0) = "<<bank.evidence(0)<<endl;
+  cout<<"True evidence p(y_1 = 0, y_2 = 1, y_3 = 0) = "<<pY3<<endl;
+  cout<<"Filter bank posterior probability p(X_{t_3} = 1 | y_1 = 0, y_2 = 1, y_3 = 0) = "<<bank.predict(0, t_3)<<endl;
+  cout<<"True posterior probability p(X_{t_3} = 1 | y_1 = 0, y_2 = 1, y_3 = 0) = "<<posterior3<<endl;
+
+  // A first observation at the initialization time leaves the lower sum L(Y_{1:1}) = p(y_1 | X = 0) (1 - S_T(0)) = 0, which the next update must not mistake for an unobserved filter
+  PersistenceFilterBank init_time_bank(logS_T);
+  init_time_bank.add(0, t_1);
+  init_time_bank.update(0, true, t_1, P_M, P_F);
+  init_time_bank.update(0, false, t_2, P_M, P_F);
+  PersistenceFilter init_time_filter(logS_T, t_1);
+  init_time_filter.update(true, t_1, P_M, P_F);
+  init_time_filter.update(false, t_2, P_M, P_F);
+
+  // p(y_1 = 1, y_2 = 0) = p(y_1 = 1, y_2 = 0 | T > t_2 - t_1) * p(T > t_2 - t_1) + p(y_1 = 1, y_2 = 0 | T < t_2 - t_1) * p(T < t_2 - t_1)
+  double pY_init = (1 - P_M) * P_M * S_T(t_2 - t_1) + (1 - P_M) * (1 - P_F) * (1 - S_T(t_2 - t_1));
+  double posterior_init = ((1 - P_M) * P_M / pY_init) * S_T(t_2 - t_1);
+
+  cout<<"FILTER BANK STATE AFTER INCORPORATING y_1 = 1 AT THE INITIALIZATION TIME t_1 = 1.0 AND y_2 = 0 at time t_2 = 2.0"<<endl;
+  cout<<"Filter bank posterior probability p(X_{t_2} = 1 | y_1 = 1, y_2 = 0) = "<<init_time_bank.predict(0, t_2)<<endl;
+  cout<<"Filter posterior probability p(X_{t_2} = 1 | y_1 = 1, y_2 = 0) = "<<init_time_filter.predict(t_2)<<endl;
+  cout<<"True posterior probability p(X_{t_2} = 1 | y_1 = 1, y_2 = 0) = "<<posterior_init<<endl<<endl;
+
+  // LOG-DOMAIN ARITHMETIC ON DEGENERATE INPUTS:  x = y = 0 gives log(0) = -infinity, and NaN inputs propagate
+
+  double nan = std::numeric_limits<double>::quiet_NaN(), neg_inf = -std::numeric_limits<double>::infinity();
+  cout<<"LOG-DOMAIN ARITHMETIC ON DEGENERATE INPUTS"<<endl;
+  cout<<"logsum(-inf, -inf), logdiff(-inf, -inf) = "<<logsum(neg_inf, neg_inf)<<", "<<logdiff(neg_inf, neg_inf)<<endl;
+  cout<<"logsum(1, NaN), logsum(NaN, 1), logdiff(1, NaN), logdiff(NaN, 1) = "<<logsum(1, nan)<<", "<<logsum(nan, 1)<<", "<<logdiff(1, nan)<<", "<<logdiff(nan, 1)<<endl;
+  cout<<"GeneralPurposeLogSurvivalTable at t = NaN = "<<GeneralPurposeLogSurvivalTable(lambda_l, lambda_u)(nan)<<endl;
+  try
+    {
+      log_general_purpose_survival_function(1.0, 0.0, lambda_u);
+      cout<<"log_general_purpose_survival_function() accepted lambda_l = 0"<<endl<<endl;
+    }
+  catch(const std::domain_error& e)
+    {
+      cout<<"log_general_purpose_survival_function() with lambda_l = 0 throws std::domain_error:  "<<e.what()<<endl<<endl;
+    }
+
+
+
+  // THE VECTORIZED KERNELS, COMPARED WITH THE SCALAR FALLBACK ON RANDOM INPUTS, IN THE ULP MEASURES OF persistence_filter_simd.h
+
+  std::mt19937_64 rng(0);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  const size_t num_kernel_inputs = 1021;  // Not a multiple of the vector width, so that the partial final vector is exercised too
+  vector<double> kernel_x(num_kernel_inputs), kernel_y(num_kernel_inputs), kernel_e(num_kernel_inputs);
+  for(size_t i = 0; i < num_kernel_inputs; ++i)
+    {
+      kernel_x[i] = -50 * uniform(rng);
+      kernel_y[i] = (i % 7 == 0) ? kernel_x[i] : kernel_x[i] - ((i % 2 == 0) ? 50 : 1e-3) * uniform(rng);
+      if(i % 11 == 0)
+	kernel_y[i] = -std::numeric_limits<double>::infinity();
+      if(i % 13 == 0)
+	kernel_x[i] = kernel_y[i] = -std::numeric_limits<double>::infinity();
+      if(i % 19 == 0)
+	((i % 38 == 0) ? kernel_x[i] : kernel_y[i]) = std::numeric_limits<double>::quiet_NaN();
+      kernel_e[i] = (i % 17 == 0) ? -std::numeric_limits<double>::infinity() : -708.39 + 1417.39 * uniform(rng);
+    }
+
+  SIMDInstructionSet best_instruction_set = simd_instruction_set();
+  vector<double> scalar_logsum(num_kernel_inputs), scalar_logdiff(num_kernel_inputs), scalar_exp(num_kernel_inputs);
+  set_simd_instruction_set(SIMD_SCALAR);
+  logsum_batch(&kernel_x[0], &kernel_y[0], &scalar_logsum[0], num_kernel_inputs);
+  logdiff_batch(&kernel_x[0], &kernel_y[0], &scalar_logdiff[0], num_kernel_inputs);
+  exp_batch(&kernel_e[0], &scalar_exp[0], num_kernel_inputs);
+
+  cout<<"VECTORIZED KERNELS COMPARED WITH THE SCALAR FALLBACK OVER "<<num_kernel_inputs<<" RANDOM INPUTS (INCLUDING -infinity, NaN AND EQUAL ARGUMENTS)"<<endl;
+  for(SIMDInstructionSet instruction_set : {SIMD_AVX2, SIMD_AVX512})
+    {
+      if(instruction_set > best_instruction_set)
+	continue;
+
+      vector<double> simd_logsum(num_kernel_inputs), simd_logdiff(num_kernel_inputs), simd_exp(num_kernel_inputs);
+      set_simd_instruction_set(instruction_set);
+      logsum_batch(&kernel_x[0], &kernel_y[0], &simd_logsum[0], num_kernel_inputs);
+      logdiff_batch(&kernel_x[0], &kernel_y[0], &simd_logdiff[0], num_kernel_inputs);
+      exp_batch(&kernel_e[0], &simd_exp[0], num_kernel_inputs);
+
+      double max_logsum_ulp = 0, max_logdiff_ulp = 0, max_exp_ulp = 0;
+      for(size_t i = 0; i < num_kernel_inputs; ++i)
+	{
+	  double scale = std::isfinite(kernel_x[i]) ? std::fabs(kernel_x[i]) : 1.0;
+	  max_logsum_ulp = std::max(max_logsum_ulp, ulp_difference(simd_logsum[i], scalar_logsum[i], scale));
+	  max_logdiff_ulp = std::max(max_logdiff_ulp, ulp_difference(simd_logdiff[i], scalar_logdiff[i], scale));
+	  max_exp_ulp = std::max(max_exp_ulp, ulp_difference(simd_exp[i], scalar_exp[i], 0.0));
+	}
+      cout<<"Maximum discrepancy for logsum_batch, logdiff_batch, exp_batch with instruction set "<<instruction_set<<" = "<<max_logsum_ulp<<", "<<max_logdiff_ulp<<", "<<max_exp_ulp<<" ULP (bound "<<PERSISTENCE_FILTER_SIMD_MAX_ULP<<")"<<endl;
+    }
+  set_simd_instruction_set(best_instruction_set);
+  cout<<endl;
+
+  // The fused update kernel, on random filter states including unobserved filters (log L(Y) = -infinity, log S_T(t_N) = 0),
+  // filters whose survival function has underflowed (log S_T(t_N) = log S_T(t_{N+1}) = -infinity), and NaN priors
+  std::mt19937_64 fused_rng(2);  // A separate generator, so that the other tests' inputs do not depend on this one's
+  vector<double> fused_logLY(num_kernel_inputs), fused_logpY_tN(num_kernel_inputs), fused_logS0(num_kernel_inputs), fused_logS1(num_kernel_inputs), fused_log_ratio(num_kernel_inputs);
+  vector<unsigned char> fused_outputs(num_kernel_inputs);
+  for(size_t i = 0; i < num_kernel_inputs; ++i)
+    {
+      fused_logLY[i] = (i % 5 == 0) ? -std::numeric_limits<double>::infinity() : -100 * uniform(fused_rng);
+      fused_logpY_tN[i] = -100 * uniform(fused_rng);
+      fused_logS0[i] = (i % 5 == 0) ? 0.0 : -20 * uniform(fused_rng);
+      fused_log_ratio[i] = ((i % 2 == 0) ? -1e-3 : -50) * uniform(fused_rng);
+      if(i % 11 == 0)
+	fused_logS0[i] = fused_log_ratio[i] = -std::numeric_limits<double>::infinity();
+      fused_logS1[i] = fused_logS0[i] + fused_log_ratio[i];
+      if(i % 11 == 0)
+	fused_log_ratio[i] = fused_logS1[i] - fused_logS0[i];
+      if(i % 23 == 0)
+	fused_log_ratio[i] = fused_logS1[i] = std::numeric_limits<double>::quiet_NaN();
+      fused_outputs[i] = (uniform(fused_rng) < .5);
+    }
+  DetectorLikelihoods fused_likelihoods[2] = {DetectorLikelihoods::compute(false, .2, .05), DetectorLikelihoods::compute(true, .2, .05)};
+
+  vector<double> scalar_fused_logLY(num_kernel_inputs), scalar_fused_logpY(num_kernel_inputs);
+  for(size_t i = 0; i < num_kernel_inputs; ++i)
+    fused_log_update(fused_logLY[i], fused_logpY_tN[i], fused_logS0[i], fused_logS1[i], fused_log_ratio[i], fused_likelihoods[fused_outputs[i]], scalar_fused_logLY[i], scalar_fused_logpY[i]);
+
+  size_t fused_nonfinite = 0;
+  for(size_t i = 0; i < num_kernel_inputs; ++i)
+    fused_nonfinite += !std::isfinite(scalar_fused_logLY[i]) || !std::isfinite(scalar_fused_logpY[i]);
+
+  cout<<"FUSED UPDATE KERNEL COMPARED WITH fused_log_update() OVER "<<num_kernel_inputs<<" RANDOM FILTER STATES ("<<fused_nonfinite<<" WITH NON-FINITE RESULTS)"<<endl;
+  for(SIMDInstructionSet instruction_set : {SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512})
+    {
+      if(instruction_set > best_instruction_set)
+	continue;
+
+      // The outputs alias the first two inputs, as they do in PersistenceFilterBank::update_batch()
+      vector<double> simd_fused_logLY = fused_logLY, simd_fused_logpY = fused_logpY_tN;
+      set_simd_instruction_set(instruction_set);
+      fused_log_update_batch(&simd_fused_logLY[0], &simd_fused_logpY[0], &fused_logS0[0], &fused_logS1[0], &fused_log_ratio[0], &fused_outputs[0], fused_likelihoods, &simd_fused_logLY[0], &simd_fused_logpY[0], num_kernel_inputs);
+
+      double max_fused_ulp = 0;
+      for(size_t i = 0; i < num_kernel_inputs; ++i)
+	{
+	  double scale = std::max(std::fabs(fused_logLY[i]), std::fabs(fused_logpY_tN[i] + fused_logS0[i]));
+	  scale = std::isfinite(scale) ? scale : 1.0;
+	  max_fused_ulp = std::max(max_fused_ulp, ulp_difference(simd_fused_logLY[i], scalar_fused_logLY[i], scale));
+	  max_fused_ulp = std::max(max_fused_ulp, ulp_difference(simd_fused_logpY[i], scalar_fused_logpY[i], scale));
+	}
+      cout<<"Maximum discrepancy for fused_log_update_batch with instruction set "<<instruction_set<<" = "<<max_fused_ulp<<" ULP (bound "<<PERSISTENCE_FILTER_SIMD_MAX_ULP<<")"<<endl;
+    }
+  set_simd_instruction_set(best_instruction_set);
+  cout<<endl;
+
+
+  // BATCHED UPDATES AND PREDICTIONS, COMPARED WITH THE SCALAR PATH
+
+  // Each round applies one batch of random detector outputs to a bank, and the same outputs one at a time to a copy of it.  A quarter of the features are observed at their initialization times, and the error rates include P_M = 0 and P_F = 0, which produce -infinity log-likelihoods and lower sums.
+  PersistenceFilterBank batch_bank(logS_T);
+  vector<PersistenceFilterBank::FeatureID> batch_ids;
+  for(PersistenceFilterBank::FeatureID id = 0; id < 256; ++id)
+    {
+      batch_bank.add(id, (id % 4 == 0) ? 0.0 : 10 * uniform(rng));
+      batch_ids.push_back(id);
+    }
+
+  double max_update_ulp = 0, max_predict_ulp = 0;
+  vector<double> batch_beliefs;
+  for(int round = 0; round < 20; ++round)
+    {
+      double observation_time = round;
+      double round_P_M = (round % 5 == 1) ? 0.0 : .5 * uniform(rng);
+      double round_P_F = (round % 5 == 3) ? 0.0 : .5 * uniform(rng);
+
+      // Only the features initialized no later than the observation time can be updated
+      vector<PersistenceFilterBank::FeatureID> round_ids;
+      vector<bool> round_outputs;
+      for(PersistenceFilterBank::FeatureID id : batch_ids)
+	{
+	  if(batch_bank.initialization_time(id) <= observation_time)
+	    {
+	      round_ids.push_back(id);
+	      round_outputs.push_back(uniform(rng) < .5);
+	    }
+	}
+
+      PersistenceFilterBank scalar_bank = batch_bank;
+      batch_bank.update_batch(round_ids, round_outputs, observation_time, round_P_M, round_P_F);
+      for(size_t i = 0; i < round_ids.size(); ++i)
+	scalar_bank.update(round_ids[i], round_outputs[i], observation_time, round_P_M, round_P_F);
+
+      batch_bank.predict_batch(round_ids, observation_time + .5, batch_beliefs);
+      for(size_t i = 0; i < round_ids.size(); ++i)
+	{
+	  size_t slot = batch_bank.slot(round_ids[i]);
+	  max_update_ulp = std::max(max_update_ulp, ulp_difference(batch_bank.log_evidence_lower_sum_slot(slot), scalar_bank.log_evidence_lower_sum_slot(slot), 1.0));
+	  max_update_ulp = std::max(max_update_ulp, ulp_difference(batch_bank.log_evidence_slot(slot), scalar_bank.log_evidence_slot(slot), 1.0));
+	  max_update_ulp = std::max(max_update_ulp, ulp_difference(batch_bank.log_likelihood_slot(slot), scalar_bank.log_likelihood_slot(slot), 1.0));
+	  max_predict_ulp = std::max(max_predict_ulp, ulp_difference(batch_beliefs[i], batch_bank.predict_slot(slot, observation_time + .5), 0.0));
+	}
+    }
+
+  cout<<"BATCHED UPDATES AND PREDICTIONS OVER 20 ROUNDS OF "<<batch_ids.size()<<" FEATURES, COMPARED WITH THE SCALAR PATH"<<endl;
+  cout<<"Maximum discrepancy in log L(Y), log p(Y), log p(Y | T >= t_N) after update_batch() = "<<max_update_ulp<<" ULP (bound "<<PERSISTENCE_FILTER_SIMD_MAX_ULP<<")"<<endl;
+  cout<<"Maximum discrepancy in posterior probabilities from predict_batch() = "<<max_predict_ulp<<" ULP (bound "<<PERSISTENCE_FILTER_SIMD_MAX_ULP<<")"<<endl;
+
+  // An empty batch, on a bank whose batch buffers have never been allocated, is a no-op
+  PersistenceFilterBank empty_batch_bank(logS_T);
+  empty_batch_bank.add(0);
+  empty_batch_bank.update_batch(static_cast<const PersistenceFilterBank::FeatureID*>(nullptr), static_cast<const bool*>(nullptr), 0, 1.0, P_M, P_F);
+  cout<<"Last observation time and posterior probability at t = 1 after an empty update_batch() = "<<empty_batch_bank.last_observation_time(0)<<", "<<empty_batch_bank.predict(0, 1.0)<<" (expected 0, "<<std::exp(logS_T(1.0))<<")"<<endl<<endl;
+
+  // Evaluate the belief curves of both features over several horizons at once
+  std::vector<PersistenceFilterBank::FeatureID> curve_ids = {0, 2};
+  std::vector<double> horizons = {t_3, t_3 + 1, t_3 + 10}, curves;
+  bank.predict_many(curve_ids, horizons, curves);
+  cout<<"Filter bank posterior probabilities for feature 0 at t_3, t_3 + 1, t_3 + 10 = "<<curves[0]<<", "<<curves[1]<<", "<<curves[2]<<endl;
+  cout<<"Filter posterior probabilities at t_3, t_3 + 1, t_3 + 10 = "<<filter.predict(t_3)<<", "<<filter.predict(t_3 + 1)<<", "<<filter.predict(t_3 + 10)<<endl<<endl;
+
+  // Index the bank's features by the time at which their beliefs fall below 1/2
+  PersistencePruningIndex pruning_index(bank, .5);
+  pruning_index.update_all();
+  double crossing_time = pruning_index.crossing_time(0);
+  vector<PersistenceFilterBank::FeatureID> expired;
+  pruning_index.pop_expired(crossing_time, expired);
+
+  cout<<"PRUNING INDEX FOR THRESHOLD 0.5"<<endl;
+  cout<<"Crossing time for feature 0:  "<<crossing_time<<endl;
+  cout<<"Filter bank posterior probability at crossing time:  "<<bank.predict(0, crossing_time)<<endl;
+  cout<<"Features expired by crossing time:  "<<expired.size()<<" (of "<<bank.size()<<")"<<endl<<endl;
+
+  // Rank the bank's features by the information a new observation at t_3 + 1 would provide
+  PersistenceRevisitScheduler scheduler(bank, P_M, P_F, t_3 + 1);
+  scheduler.update_all();
+  vector<PersistenceFilterBank::FeatureID> targets;
+  scheduler.next_targets(1, targets);
+  double belief_if_detected, belief_if_missed;
+  PersistenceRevisitScheduler::hypothetical_beliefs(bank.predict(0, t_3 + 1), P_M, P_F, belief_if_detected, belief_if_missed);
+  PersistenceFilter detected_filter = filter, missed_filter = filter;
+  detected_filter.update(true, t_3 + 1, P_M, P_F);
+  missed_filter.update(false, t_3 + 1, P_M, P_F);
+
+  cout<<"REVISIT SCHEDULER FOR CANDIDATE TIME t_3 + 1"<<endl;
+  cout<<"Expected information gain for features 0, 2:  "<<scheduler.score(0)<<", "<<scheduler.score(2)<<endl;
+  cout<<"Next target:  feature "<<targets[0]<<endl;
+  cout<<"Hypothetical posterior probabilities p(X_{t_3 + 1} = 1 | y_{1:3}, y_4 = 1), p(X_{t_3 + 1} = 1 | y_{1:3}, y_4 = 0) = "<<belief_if_detected<<", "<<belief_if_missed<<endl;
+  cout<<"Filter posterior probabilities after incorporating y_4 = 1, y_4 = 0 = "<<detected_filter.predict(t_3 + 1)<<", "<<missed_filter.predict(t_3 + 1)<<endl<<endl;
+
+  // Interleave updates, removals, re-additions and moves of the candidate time, and compare the scheduler's ranking with one obtained by sorting every tracked feature's score
+  PersistenceFilterBank schedule_bank(logS_T);
+  std::vector<PersistenceFilterBank::FeatureID> tracked_ids;
+  for(PersistenceFilterBank::FeatureID id = 0; id < 256; ++id)
+    {
+      schedule_bank.add(id, 10 * uniform(rng));
+      schedule_bank.update(id, uniform(rng) < .7, 10 + 10 * uniform(rng), P_M, P_F);
+      tracked_ids.push_back(id);
+    }
+  PersistenceRevisitScheduler stressed_scheduler(schedule_bank, P_M, P_F, 20.0);
+  stressed_scheduler.update_all();
+  size_t ranking_mismatches = 0;
+  double max_score_error = 0;
+  for(int round = 0; round < 200; ++round)
+    {
+      PersistenceFilterBank::FeatureID id = rng() % 256;
+      bool tracked = (std::find(tracked_ids.begin(), tracked_ids.end(), id) != tracked_ids.end());
+      if( (round % 10 == 9) && tracked)
+	{
+	  stressed_scheduler.remove(id);
+	  schedule_bank.remove(id);
+	  tracked_ids.erase(std::find(tracked_ids.begin(), tracked_ids.end(), id));
+	}
+      else if(!schedule_bank.contains(id))
+	{
+	  schedule_bank.add(id, stressed_scheduler.candidate_time());
+	  stressed_scheduler.update(id);
+	  tracked_ids.push_back(id);
+	}
+      else if(round % 25 == 24)
+	stressed_scheduler.set_candidate_time(stressed_scheduler.candidate_time() + 1);
+      else
+	{
+	  schedule_bank.update(id, uniform(rng) < .5, stressed_scheduler.candidate_time(), P_M, P_F);
+	  stressed_scheduler.update(id);
+	}
+
+      std::vector<std::pair<double, PersistenceFilterBank::FeatureID> > expected_ranking;
+      for(PersistenceFilterBank::FeatureID tracked_id : tracked_ids)
+	{
+	  expected_ranking.push_back(std::make_pair(-stressed_scheduler.score(tracked_id), tracked_id));
+	  max_score_error = std::max(max_score_error, std::fabs(stressed_scheduler.score(tracked_id) - stressed_scheduler.compute_score(tracked_id)));
+	}
+      std::sort(expected_ranking.begin(), expected_ranking.end());
+
+      std::vector<PersistenceFilterBank::FeatureID> ranked;
+      stressed_scheduler.next_targets(20, ranked);
+      ranking_mismatches += (stressed_scheduler.size() != tracked_ids.size()) || (ranked.size() != 20);
+      for(size_t i = 0; i < ranked.size(); ++i)
+	ranking_mismatches += (ranked[i] != expected_ranking[i].second);
+    }
+
+  cout<<"REVISIT SCHEDULER OVER 200 ROUNDS OF UPDATES, REMOVALS, RE-ADDITIONS AND CANDIDATE TIME CHANGES"<<endl;
+  cout<<"Top-20 rankings differing from a sort of the stored scores:  "<<ranking_mismatches<<endl;
+  cout<<"Maximum difference between stored and recomputed scores:  "<<max_score_error<<endl<<endl;
+
+  // Summarize the bank's features in a group (feature 0) within a parent group (features 0 and 2)
+  PersistenceGroupIndex group_index(bank);
+  group_index.add_group(0);
+  group_index.add_group(1, 0);
+  group_index.assign(0, 1);
+  group_index.assign(2, 0);
+  double lower, upper;
+  group_index.belief_bounds(0, t_3 + 1, lower, upper);
+
+  cout<<"GROUP INDEX AT TIME t_3 + 1"<<endl;
+  cout<<"Expected number of persistent features in groups 0, 1 = "<<group_index.expected_count(0, t_3 + 1)<<", "<<group_index.expected_count(1, t_3 + 1)<<endl;
+  cout<<"Sum of filter bank posterior probabilities for features 0 and 2 = "<<bank.predict(0, t_3 + 1) + bank.predict(2, t_3 + 1)<<endl;
+  cout<<"Posterior probability bounds for group 0 = ["<<lower<<", "<<upper<<"]"<<endl;
+  cout<<"Earliest crossing time for threshold 0.5 in group 0 = "<<group_index.crossing_time(0, .5, t_3)<<endl<<endl;
+
+  // Group summaries under churn must agree with brute-force computations over the members' filters, for any prior and initialization times
+  cout<<"GROUP INDEX OVER 600 RANDOM ADDITIONS, UPDATES, REMOVALS AND REASSIGNMENTS, COMPARED WITH BRUTE FORCE"<<endl;
+  const char* group_index_cases[] = {"general-purpose prior, integral initialization times", "exponential prior, arbitrary initialization times", "general-purpose prior, arbitrary initialization times"};
+  for(int c = 0; c < 3; ++c)
+    {
+      GroupIndexDiscrepancies d = group_index_discrepancies((c == 1) ? LogSurvivalFunction(ExponentialSurvivalPrior(.1)) : LogSurvivalFunction(GeneralPurposeSurvivalPrior(lambda_l, lambda_u)), c == 0);
+      if( (d.count > 1e-12) || (d.bounds > 1e-12) || (d.crossing_time > 1e-9) || (d.features_above > 0) || (d.latest_observation_times > 0) )
+	{
+	  throw std::runtime_error(std::string("PersistenceGroupIndex disagrees with brute force (") + group_index_cases[c] + ")");
+	}
+      cout<<group_index_cases[c]<<":  agrees with brute force (final quantum "<<d.final_time_quantum<<")"<<endl;
+    }
+  cout<<endl;
+
+
+
+  // DELIVER THE SAME OBSERVATIONS OUT OF ORDER TO A ReorderingPersistenceFilter
+
+  ReorderingPersistenceFilter reordering_filter(logS_T);
+  reordering_filter.update(false, t_3, P_M, P_F);
+  reordering_filter.update(true, t_2, P_M, P_F);  // Late
+  reordering_filter.update(false, t_1, P_M, P_F);  // Later still
+
+  cout<<"REORDERING FILTER STATE AFTER INCORPORATING y_3 = 0, y_2 = 1, y_1 = 0 (IN THAT ORDER)"<<endl;
+  cout<<"Reordering filter evidence p(y_1 = 0, y_2 = 1, y_3 = 0) = "<<reordering_filter.evidence()<<endl;
+  cout<<"True evidence p(y_1 = 0, y_2 = 1, y_3 = 0) = "<<pY3<<endl;
+  cout<<"Reordering filter posterior probability p(X_{t_3} = 1 | y_1 = 0, y_2 = 1, y_3 = 0) = "<<reordering_filter.predict(t_3)<<endl;
   cout<<"True posterior probability p(X_{t_3} = 1 | y_1 = 0, y_2 = 1, y_3 = 0) = "<<posterior3<<endl<<endl;
+
+
+
+  // RUN THE SAME OBSERVATION SEQUENCE THROUGH A PersistenceFilterManager
+
+  PersistenceFilterManager manager(logS_T, 2);
+  manager.add(0);
+  manager.update(0, false, t_1, P_M, P_F);
+  manager.update(0, true, t_2, P_M, P_F);
+  manager.update(0, false, t_3, P_M, P_F);
+  manager.flush();  // Wait until the updates are visible to queries
+  manager.update(0, true, t_2, P_M, P_F);  // A late update, which the manager discards
+  manager.flush();
+
+  cout<<"FILTER MANAGER STATE FOR FEATURE 0 AFTER INCORPORATING y_1 = 0, y_2 = 1, y_3 = 0"<<endl;
+  cout<<"Filter manager posterior probability p(X_{t_3} = 1 | y_1 = 0, y_2 = 1, y_3 = 0) = "<<manager.predict(0, t_3)<<endl;
+  cout<<"True posterior probability p(X_{t_3} = 1 | y_1 = 0, y_2 = 1, y_3 = 0) = "<<posterior3<<endl;
+  cout<<"Dropped updates:  "<<manager.dropped_updates()<<endl<<endl;
+
+  // Each round updates a few random features (so that most of the snapshot chunks are shared with the previous snapshot), and every fourth round also removes and re-adds some; the published states must match a bank receiving the same commands
+  PersistenceFilterManager chunked_manager(logS_T, 2);
+  PersistenceFilterBank manager_reference(logS_T);
+  for(PersistenceFilterBank::FeatureID id = 0; id < 1000; ++id)
+    {
+      chunked_manager.add(id);
+      manager_reference.add(id);
+    }
+
+  double max_manager_difference = 0;
+  for(int round = 0; round < 40; ++round)
+    {
+      double observation_time = round + 1;
+      if(round % 4 == 3)
+	{
+	  for(int k = 0; k < 10; ++k)
+	    {
+	      PersistenceFilterBank::FeatureID id = rng() % 1000;
+	      chunked_manager.remove(id);
+	      chunked_manager.add(id, observation_time);
+	      manager_reference.remove(id);
+	      manager_reference.add(id, observation_time);
+	    }
+	}
+
+      for(int k = 0; k < 20; ++k)
+	{
+	  PersistenceFilterBank::FeatureID id = rng() % 1000;
+	  bool output = uniform(rng) < .5;
+	  chunked_manager.update(id, output, observation_time, P_M, P_F);
+	  manager_reference.update(id, output, observation_time, P_M, P_F);
+	}
+      chunked_manager.flush();
+
+      for(PersistenceFilterBank::FeatureID id = 0; id < 1000; ++id)
+	max_manager_difference = std::max(max_manager_difference, fabs(chunked_manager.predict(id, observation_time) - manager_reference.predict(id, observation_time)));
+    }
+
+  cout<<"FILTER MANAGER WITH 1000 FEATURES OVER 40 ROUNDS OF SPARSE UPDATES AND MEMBERSHIP CHANGES, COMPARED WITH A PersistenceFilterBank"<<endl;
+  cout<<"Features in snapshots:  "<<chunked_manager.size()<<endl;
+  cout<<"Maximum difference in posterior probabilities:  "<<max_manager_difference<<endl<<endl;
+
+
+
+  // MONTE CARLO EVALUATION, WHOSE RESULTS SHOULD NOT DEPEND UPON THE NUMBER OF THREADS
+
+  MonteCarloSettings settings;
+  settings.num_trials = 200;
+  settings.num_threads = 1;
+  MonteCarloResults serial_results = run_monte_carlo_evaluation(settings, {logS_T});
+  settings.num_threads = 4;
+  MonteCarloResults parallel_results = run_monte_carlo_evaluation(settings, {logS_T});
+
+  cout<<"MONTE CARLO EVALUATION OVER "<<settings.num_trials<<" TRIALS"<<endl;
+  cout<<"Persistence filter mean absolute error (1 thread) = "<<serial_results.filters[0].mean_absolute_error<<endl;
+  cout<<"Persistence filter mean absolute error (4 threads) = "<<parallel_results.filters[0].mean_absolute_error<<endl;
+  cout<<"Empirical estimator mean absolute error = "<<serial_results.empirical_estimator.mean_absolute_error<<endl<<endl;
+
+
+
+  // CLOSED-FORM SURVIVAL RATIOS, COMPARED WITH SUBTRACTING LOG-SURVIVAL VALUES AFTER A LONG GAP
+
+  // The conditional probability log P(T < t1 | T >= t0) = log(S_T(t0) - S_T(t1)) - log S_T(t0) is the same for both priors, since their hazard rates agree after t = 10
+  ExponentialSurvivalPrior exponential_prior(.1);
+  PiecewiseConstantHazardSurvivalPrior piecewise_prior({0, 10}, {.05, .1});
+  double t0 = 1e6, dt = 1.0 / 1024;
+  double exact = log(-expm1(-.1 * dt));
+
+  cout<<"CONDITIONAL INTERVAL MASS log P(T < t0 + dt | T >= t0) FOR t0 = 1e6, dt = 1/1024"<<endl;
+  cout.precision(17);
+  cout<<"Exponential prior closed form = "<<log1mexp(exponential_prior.log_survival_ratio(t0, t0 + dt))<<endl;
+  cout<<"Exponential prior by subtraction = "<<logdiff(exponential_prior(t0), exponential_prior(t0 + dt)) - exponential_prior(t0)<<endl;
+  cout<<"Piecewise-constant hazard prior closed form = "<<log1mexp(piecewise_prior.log_survival_ratio(t0, t0 + dt))<<endl;
+  cout<<"Piecewise-constant hazard prior by subtraction = "<<logdiff(piecewise_prior(t0), piecewise_prior(t0 + dt)) - piecewise_prior(t0)<<endl;
+  cout<<"True value = "<<exact<<endl<<endl;
+  cout.precision(6);
+
+
+
+  // THE TABULATED GENERAL-PURPOSE SURVIVAL FUNCTION, COMPARED WITH THE EXACT ONE ON A DENSE GRID
+
+  // The grid is uniform in log(t) over [1e-6, 1e9], so that it covers the small-t power series, every Chebyshev piece (at points between the interpolation nodes and the points verified during construction), and the far tail
+  cout<<"TABULATED GENERAL-PURPOSE SURVIVAL FUNCTION COMPARED WITH log_general_purpose_survival_function AT 100001 POINTS IN [1e-6, 1e9]"<<endl;
+  for(const pair<double, double>& lambdas : {make_pair(lambda_l, lambda_u), make_pair(.001, 10.0), make_pair(.5, .6)})
+    {
+      const double tolerance = 1e-12;
+      GeneralPurposeLogSurvivalTable table(lambdas.first, lambdas.second, tolerance);
+      double max_table_error = std::fabs(table(0.0));
+      for(size_t i = 0; i <= 100000; ++i)
+	{
+	  double t = std::exp(std::log(1e-6) + (std::log(1e9) - std::log(1e-6)) * i / 100000);
+	  max_table_error = std::max(max_table_error, std::fabs(table(t) - log_general_purpose_survival_function(t, lambdas.first, lambdas.second)));
+	}
+      cout<<"lambda_l = "<<lambdas.first<<", lambda_u = "<<lambdas.second<<":  maximum absolute error in log S_T = "<<max_table_error<<" (tolerance "<<tolerance<<", "<<table.num_pieces()<<" pieces)"<<endl;
+    }
+
+
+  // SNAPSHOT FILES:  A ROUND TRIP THROUGH save_persistence_filter_snapshot() AND PersistenceFilterSnapshot, AND CORRUPTED FILES
+
+  // The bank has removed features (which are not saved), and features in every state the updates produce
+  PersistenceFilterBank saved_bank(ExponentialSurvivalPrior(.1));
+  for(PersistenceFilterBank::FeatureID id = 0; id < 300; ++id)
+    saved_bank.add(1000 - 3 * id, uniform(rng));
+  for(PersistenceFilterBank::FeatureID id = 0; id < 300; id += 7)
+    saved_bank.remove(1000 - 3 * id);
+  for(int k = 0; k < 2000; ++k)
+    {
+      PersistenceFilterBank::FeatureID id = 1000 - 3 * (rng() % 300);
+      if(saved_bank.contains(id))
+	saved_bank.update(id, uniform(rng) < .5, 1.0 + k / 100.0, (k % 11 == 0) ? 0.0 : P_M, P_F);
+    }
+
+  const std::string snapshot_filename = "persistence_filter_test.snapshot";
+  save_persistence_filter_snapshot(saved_bank, snapshot_filename);
+
+  size_t snapshot_mismatches = 0;
+  {
+    PersistenceFilterSnapshot loaded(snapshot_filename);  // Reconstructs the exponential prior from the file
+    PersistenceFilterBank restored_bank(loaded.logS());
+    loaded.restore(restored_bank);
+
+    snapshot_mismatches += (loaded.size() != saved_bank.size()) + (restored_bank.size() != saved_bank.size());
+    for(size_t slot = 0; slot < saved_bank.num_slots(); ++slot)
+      {
+	if(!saved_bank.is_live(slot))
+	  {
+	    snapshot_mismatches += loaded.contains(saved_bank.id(slot));
+	    continue;
+	  }
+
+	PersistenceFilterBank::FeatureID id = saved_bank.id(slot);
+	size_t restored_slot = restored_bank.slot(id);
+	double t = saved_bank.last_observation_time_slot(slot) + 1;
+	snapshot_mismatches += (loaded.predict(id, t) != saved_bank.predict_slot(slot, t)) + (restored_bank.predict_slot(restored_slot, t) != saved_bank.predict_slot(slot, t));
+	snapshot_mismatches += (restored_bank.log_evidence_lower_sum_slot(restored_slot) != saved_bank.log_evidence_lower_sum_slot(slot)) || (restored_bank.is_observed(restored_slot) != saved_bank.is_observed(slot));
+      }
+  }
+
+  // Read the file back, and write corrupted copies of it:  a bad magic number, a truncation, and swapped IDs (which would break binary search)
+  std::vector<char> snapshot_bytes;
+  {
+    std::ifstream in(snapshot_filename.c_str(), std::ios::binary);
+    snapshot_bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  PersistenceFilterSnapshotHeader snapshot_header;
+  std::memcpy(&snapshot_header, snapshot_bytes.data(), sizeof(snapshot_header));
+
+  std::vector<std::vector<char> > corrupted(3, snapshot_bytes);
+  corrupted[0][0] = 'X';
+  corrupted[1].resize(snapshot_header.data_offset + 3 * snapshot_header.array_stride);
+  std::swap_ranges(corrupted[2].begin() + snapshot_header.data_offset, corrupted[2].begin() + snapshot_header.data_offset + sizeof(PersistenceFilterBank::FeatureID), corrupted[2].begin() + snapshot_header.data_offset + sizeof(PersistenceFilterBank::FeatureID));
+
+  size_t corrupted_rejected = 0;
+  for(const std::vector<char>& bytes : corrupted)
+    {
+      {
+	std::ofstream out(snapshot_filename.c_str(), std::ios::binary | std::ios::trunc);
+	out.write(bytes.data(), bytes.size());
+      }
+
+      try
+	{
+	  PersistenceFilterSnapshot loaded(snapshot_filename);
+	}
+      catch(const std::runtime_error& e)
+	{
+	  cout<<"Rejected corrupted snapshot:  "<<e.what()<<endl;
+	  ++corrupted_rejected;
+	}
+    }
+  std::remove(snapshot_filename.c_str());
+
+  // A snapshot that cannot be renamed into place (here because a directory has its name) must not leave its temporary file behind
+  const std::string blocked_filename = "persistence_filter_test.blocked";
+  mkdir(blocked_filename.c_str(), 0755);
+  bool save_failed = false;
+  try
+    {
+      save_persistence_filter_snapshot(saved_bank, blocked_filename);
+    }
+  catch(const std::runtime_error&)
+    {
+      save_failed = true;
+    }
+  bool temporary_removed = (access((blocked_filename + ".tmp").c_str(), F_OK) != 0);
+  rmdir(blocked_filename.c_str());
+
+  cout<<"SNAPSHOT FILE ROUND TRIP FOR "<<saved_bank.size()<<" FEATURES"<<endl;
+  cout<<"Features whose loaded or restored state differs from the saved one:  "<<snapshot_mismatches<<endl;
+  cout<<"Corrupted snapshots rejected:  "<<corrupted_rejected<<" of "<<corrupted.size()<<endl;
+  cout<<"Failed save threw and removed its temporary file:  "<<( (save_failed && temporary_removed) ? "yes" : "no")<<endl;
+
+
+  // JOURNAL RECOVERY:  A SNAPSHOT SAVED BY checkpoint() PLUS THE REPLAYED JOURNAL MUST REPRODUCE A LIVE BANK
+
+  const std::string journal_filename = "persistence_filter_test.journal";
+  const std::string checkpoint_filename = journal_filename + ".snapshot";
+  std::remove(journal_filename.c_str());
+
+  // Count the features whose state in 'recovered' differs from that in 'live' (including features present in only one of them)
+  auto count_state_mismatches = [](const PersistenceFilterBank& live, const PersistenceFilterBank& recovered)
+    {
+      size_t mismatches = (live.size() != recovered.size());
+      for(size_t slot = 0; slot < live.num_slots(); ++slot)
+	{
+	  if(!live.is_live(slot))
+	    continue;
+	  if(!recovered.contains(live.id(slot)))
+	    {
+	      ++mismatches;
+	      continue;
+	    }
+	  size_t recovered_slot = recovered.slot(live.id(slot));
+	  mismatches += (recovered.initialization_time_slot(recovered_slot) != live.initialization_time_slot(slot)) || (recovered.last_observation_time_slot(recovered_slot) != live.last_observation_time_slot(slot)) || (recovered.log_likelihood_slot(recovered_slot) != live.log_likelihood_slot(slot)) || (recovered.log_evidence_lower_sum_slot(recovered_slot) != live.log_evidence_lower_sum_slot(slot)) || (recovered.log_evidence_slot(recovered_slot) != live.log_evidence_slot(slot)) || (recovered.is_observed(recovered_slot) != live.is_observed(slot));
+	}
+      return mismatches;
+    };
+
+  // Recover a bank from the checkpoint and the journal, as after a crash
+  auto recover = [&]()
+    {
+      PersistenceFilterBank recovered(logS_T);
+      PersistenceFilterSnapshot(checkpoint_filename, logS_T).restore(recovered);
+      PersistenceFilterJournal(journal_filename).replay(recovered);
+      return recovered;
+    };
+
+  PersistenceFilterBank journaled_bank(logS_T);
+  size_t journal_records_replayed = 0, journal_mismatches = 0, torn_mismatches = 0;
+  {
+    PersistenceFilterJournal journal(journal_filename, 16);
+
+    // Before the checkpoint:  additions (some initialized at their first observation time) and updates
+    for(PersistenceFilterBank::FeatureID id = 0; id < 50; ++id)
+      {
+	journaled_bank.add(id, (id % 3 == 0) ? 1.0 : 0.0);
+	journal.log_add(journaled_bank, id);
+      }
+    for(int k = 0; k < 200; ++k)
+      {
+	PersistenceFilterBank::FeatureID id = rng() % 50;
+	journaled_bank.update(id, uniform(rng) < .6, 1.0 + k / 20.0, P_M, P_F);
+	journal.log_update(journaled_bank, id);
+      }
+    journal.checkpoint(journaled_bank, checkpoint_filename);
+
+    // After the checkpoint:  updates, removals, and re-additions of removed features under the same IDs
+    for(int k = 0; k < 300; ++k)
+      {
+	PersistenceFilterBank::FeatureID id = rng() % 60;
+	double t = 11.0 + k / 20.0;
+	if(!journaled_bank.contains(id))
+	  {
+	    journaled_bank.add(id, t);
+	    journal.log_add(journaled_bank, id);
+	  }
+	else if(k % 7 == 0)
+	  {
+	    journaled_bank.remove(id);
+	    journal.log_remove(id);
+	  }
+	else
+	  {
+	    journaled_bank.update(id, uniform(rng) < .6, t, P_M, P_F);
+	    journal.log_update(journaled_bank, id);
+	  }
+      }
+    journal.commit();
+    journal_records_replayed = journal.num_committed();
+  }
+
+  journal_mismatches = count_state_mismatches(journaled_bank, recover());
+
+  // A crash part-way through writing a record leaves a torn tail, which is discarded on opening
+  {
+    std::ofstream out(journal_filename.c_str(), std::ios::binary | std::ios::app);
+    PersistenceFilterJournalRecord torn;
+    std::memset(&torn, 0xAB, sizeof(torn));
+    out.write(reinterpret_cast<const char*>(&torn), sizeof(torn) / 2);
+  }
+  torn_mismatches = count_state_mismatches(journaled_bank, recover());
+  size_t records_after_torn_tail = PersistenceFilterJournal(journal_filename).num_committed();
+
+  std::remove(journal_filename.c_str());
+  std::remove(checkpoint_filename.c_str());
+
+  cout<<"JOURNAL RECOVERY FROM A CHECKPOINT AND "<<journal_records_replayed<<" JOURNAL RECORDS (UPDATES, REMOVALS AND RE-ADDITIONS)"<<endl;
+  cout<<"Features whose recovered state differs from the live bank:  "<<journal_mismatches<<endl;
+  cout<<"After appending a torn record:  "<<torn_mismatches<<" differing features, "<<records_after_torn_tail<<" intact records"<<endl;
+
+  // REPLAYING A DETECTION LOG:  MALFORMED LINES AND ARGUMENTS ARE REJECTED, AND THE REPORTED BELIEFS MATCH A BANK RECEIVING THE SAME OBSERVATIONS
+
+  // Each log begins with a valid observation (so that the malformed line is not skipped as a header)
+  const std::vector<std::string> malformed_logs = {
+    "7,2,1,.1,.1\n8,1,1,.1,.1\n",  // Unsorted times
+    "7,1,1,.1,.1\n8,2,2,.1,.1\n",  // y not in {0, 1}
+    "7,1,1,.1,.1\n8,2,1,1.5,.1\n",  // P_M not a probability
+    "7,1,1,.1,.1\n18446744073709551616,2,1,.1,.1\n",  // ID overflows 64 bits
+    "7,1,1,.1,.1\n-8,2,1,.1,.1\n"};  // Negative ID
+  size_t malformed_rejected = 0;
+  for(const std::string& log : malformed_logs)
+    {
+      try
+	{
+	  Replay replay(LogSurvivalFunction(ExponentialSurvivalPrior(.1)), 2, std::vector<double>(), 0, std::numeric_limits<double>::quiet_NaN());
+	  replay.parse(log.data(), log.data() + log.size(), true);
+	  replay.finish();
+	}
+      catch(const std::invalid_argument& e)
+	{
+	  cout<<"Rejected malformed log:  "<<e.what()<<endl;
+	  ++malformed_rejected;
+	}
+    }
+
+  size_t malformed_counts_rejected = 0;
+  for(const char* count : {"-1", "18446744073709551616", "3x", ""})
+    {
+      try
+	{
+	  parse_count(count);
+	}
+      catch(const std::invalid_argument&)
+	{
+	  ++malformed_counts_rejected;
+	}
+    }
+
+  // A small log over five features, with queries between and after the observations
+  std::string replay_log = "feature_id,t,y,P_M,P_F\n";
+  PersistenceFilterBank replay_reference(ExponentialSurvivalPrior(.1));
+  std::vector<double> replay_queries = {2.5, 5.0, 12.0};
+  std::vector<std::pair<double, std::vector<double> > > expected_beliefs;
+  size_t next_replay_query = 0;
+  for(int k = 0; k < 40; ++k)
+    {
+      double t = 1.0 + k / 4;
+      while( (next_replay_query < replay_queries.size()) && (replay_queries[next_replay_query] < t) )
+	{
+	  double q = replay_queries[next_replay_query++];
+	  std::vector<double> beliefs;
+	  for(PersistenceFilterBank::FeatureID id = 0; id < 5; ++id)
+	    if(replay_reference.contains(id))
+	      beliefs.push_back(replay_reference.predict(id, q));
+	  expected_beliefs.push_back(std::make_pair(q, beliefs));
+	}
+
+      PersistenceFilterBank::FeatureID id = rng() % 5;
+      bool output = uniform(rng) < .6;
+      if(!replay_reference.contains(id))
+	replay_reference.add(id, t);
+      replay_reference.update(id, output, t, P_M, P_F);
+      replay_log += std::to_string(id) + "," + std::to_string(t) + "," + (output ? "1" : "0") + "," + std::to_string(P_M) + "," + std::to_string(P_F) + "\n";
+    }
+  for(; next_replay_query < replay_queries.size(); ++next_replay_query)
+    {
+      double q = replay_queries[next_replay_query];
+      std::vector<double> beliefs;
+      for(PersistenceFilterBank::FeatureID id = 0; id < 5; ++id)
+	if(replay_reference.contains(id))
+	  beliefs.push_back(replay_reference.predict(id, q));
+      expected_beliefs.push_back(std::make_pair(q, beliefs));
+    }
+
+  std::FILE* replay_output = std::tmpfile();
+  {
+    Replay replay(LogSurvivalFunction(ExponentialSurvivalPrior(.1)), 3, replay_queries, 0, std::numeric_limits<double>::quiet_NaN(), replay_output);
+    replay.parse(replay_log.data(), replay_log.data() + replay_log.size(), true);
+    replay.finish();
+  }
+
+  // Compare the reported beliefs (written with 9 significant digits) with the reference
+  std::rewind(replay_output);
+  size_t replay_results = 0, expected_results = 0;
+  double max_replay_difference = 0, query_time, belief;
+  unsigned long long feature_id;
+  std::vector<std::pair<double, std::vector<double> > >::const_iterator expected = expected_beliefs.begin();
+  size_t expected_index = 0;
+  while(std::fscanf(replay_output, "%lf,%llu,%lf\n", &query_time, &feature_id, &belief) == 3)
+    {
+      while( (expected != expected_beliefs.end()) && (expected_index == expected->second.size()) )
+	{
+	  ++expected;
+	  expected_index = 0;
+	}
+      if( (expected == expected_beliefs.end()) || (query_time != expected->first) )
+	break;
+      max_replay_difference = std::max(max_replay_difference, std::fabs(belief - expected->second[expected_index++]));
+      ++replay_results;
+    }
+  std::fclose(replay_output);
+  for(const std::pair<double, std::vector<double> >& query : expected_beliefs)
+    expected_results += query.second.size();
+
+  cout<<"REPLAY OF DETECTION LOGS"<<endl;
+  cout<<"Malformed logs rejected:  "<<malformed_rejected<<" of "<<malformed_logs.size()<<endl;
+  cout<<"Malformed counts rejected by parse_count():  "<<malformed_counts_rejected<<" of 4"<<endl;
+  cout<<"Beliefs reported for "<<replay_queries.size()<<" queries of a "<<replay_reference.size()<<"-feature log:  "<<replay_results<<" (expected "<<expected_results<<")"<<endl;
+  cout<<"Maximum difference from a bank receiving the same observations:  "<<max_replay_difference<<endl;
 }
@@ -1,21 +1,75 @@
 #include "persistence_filter_utils.h"
 
-#include <algorithm> //To get swap function
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
 #include <gsl/gsl_math.h>
-#include <gsl/gsl_sf_log.h>
-#include <gsl/gsl_sf_exp.h>
 #include <gsl/gsl_sf_expint.h>
-#include <gsl/gsl_errno.h>
+
+/// EXPONENTIAL INTEGRAL
+
+// Beyond this argument, we evaluate E1(x) using its asymptotic expansion rather than GSL
+static const double E1_ASYMPTOTIC_THRESHOLD = 60.0;
+
+// The number of terms after the leading one retained in the asymptotic expansion of E1.  The
+// truncation error is bounded by the first omitted term, 17! / x^17 < 1e-16 for x >= 60.
+static const int E1_ASYMPTOTIC_ORDER = 16;
+
+// Computes log(sum_{k=0}^{E1_ASYMPTOTIC_ORDER} (-1)^k k! / x^k), the logarithm of the asymptotic series for x * exp(x) * E1(x)
+static double log_E1_asymptotic_series(double x)
+{
+  double inv_x = 1.0 / x;
+
+  double coeff = 1.0;  // (-1)^k k!
+  for(int k = 1; k <= E1_ASYMPTOTIC_ORDER; ++k)
+    coeff *= -k;
+
+  double series = coeff;
+  for(int k = E1_ASYMPTOTIC_ORDER; k > 0; --k)
+    {
+      coeff /= -k;
+      series = series * inv_x + coeff;
+    }
+
+  return std::log(series);
+}
+
+// Computes log(E1(x)) for x > 0, without underflow
+static double log_expint_E1(double x)
+{
+  if(x <= E1_ASYMPTOTIC_THRESHOLD)
+    {
+      // E1(x) >= exp(-x) / 2 * log(1 + 2/x) is far from underflowing here, so
+      // GSL never invokes its (process-wide) error handler for these arguments
+      gsl_sf_result result;
+      gsl_sf_expint_E1_e(x, &result);
+      return std::log(result.val);
+    }
+  else
+    {
+      PERSISTENCE_FILTER_COUNT_FALLBACK_IF(true, E1_ASYMPTOTIC_EXPANSION);
+      return -x - std::log(x) + log_E1_asymptotic_series(x);
+    }
+}
+
+
+/// GENERAL-PURPOSE SURVIVAL FUNCTION
 
 double log_general_purpose_survival_function(double t, double lambda_l, double lambda_u)
 {
+  PERSISTENCE_FILTER_INSTRUMENT_CALL(GENERAL_PURPOSE_SURVIVAL_FUNCTION);
+
   // Input checking
   if(t < 0)
     {
       throw std::domain_error("Survival functions are defined on the nonnegative real line (t >= 0)");
     }
 
+  if(lambda_l <= 0)
+    {
+      throw std::domain_error("Parameter lambda_l must be positive");
+    }
+
   if(lambda_l >= lambda_u)
     {
       throw std::domain_error("Parameter lambda_u must be greater than lambda_l");
@@ -24,122 +78,195 @@ double log_general_purpose_survival_function(double t, double lambda_l, double l
   // The actual computation...
   if(t > 0)
     {
-      gsl_sf_result result;
-      int status;
-      double log_E1_lambda_l, log_E1_lambda_u;
+      // We compute log(E1(lambda_l * t)) and log(E1(lambda_u * t)) directly in
+      // log-space (switching to the asymptotic expansion of E1 for large
+      // arguments), so neither term can underflow
+      return logdiff(log_expint_E1(lambda_l * t), log_expint_E1(lambda_u * t)) - std::log(std::log(lambda_u / lambda_l));
+    }
+  else
+    {
+      return 0;
+    }
+}
 
-      // Turn off GSL error handling -- we'll use our own for this computation
-      gsl_error_handler_t* error_handler = gsl_set_error_handler_off();
 
+/// GENERAL-PURPOSE LOG-SURVIVAL TABLE
 
-      // COMPUTE log(E1(lambda_l * t))
-      status = gsl_sf_expint_E1_e(lambda_l * t, &result);
-      
-      if(status == GSL_SUCCESS)
-	{
-	  log_E1_lambda_l = gsl_sf_log(result.val);
-	}
-      else
-	{
-	  // Attempting to compute E1(lamda_l * t) directly underflows, so we
-	  // compute a close upper-bound approximation for log(E1(lambda_l * t))
-	  // directly, using the bound E1(x) < exp(-x) * log(1 + 1/x)
-	  log_E1_lambda_l = -lambda_l*t + gsl_sf_log(gsl_sf_log_1plusx( 1.0 / (lambda_l*t)));
-	}
+// The number of terms retained in the power series for S_T(t) in the small-t region.  The
+// truncation error is bounded by (lambda_u * t)^9 / (9 * 9!) < 1e-18 for lambda_u * t < 0.05.
+static const int SMALL_T_ORDER = 8;
+static const double SMALL_T_THRESHOLD = 0.05;
 
-      status = gsl_sf_expint_E1_e(lambda_u * t, &result);
-      
-      if(status == GSL_SUCCESS)
-	{
-	  log_E1_lambda_u = gsl_sf_log(result.val);
-	}
-      else
-	{
-	  // Attempting to compute E_1(lamda_u * t) directly underflows, so we
-	  // compute a close lower-bound approximation for log(E1(lambda_u * t))
-	  // directly, using the bound (1/2) * exp(-x) log(1 + 2/x)
-	  log_E1_lambda_u = -M_LN2 - lambda_u*t + gsl_sf_log(gsl_sf_log_1plusx(2 / (lambda_u*t)));
-	}
+// The initial width (in log(t)) of the Chebyshev pieces, and the largest number of pieces we will try
+static const double INITIAL_PIECE_WIDTH = 0.5;
+static const size_t MAX_NUM_PIECES = 1 << 16;
 
-      // Reset original error handler
-      gsl_set_error_handler(error_handler);
-      return logdiff(log_E1_lambda_l, log_E1_lambda_u) - gsl_sf_log(gsl_sf_log(lambda_u / lambda_l));
-    }
-  else
+// Evaluates the Chebyshev series sum_k coeffs[k] T_k(x) (with the k = 0 term already halved) using Clenshaw's recurrence
+static inline double clenshaw(const double* coeffs, size_t degree, double x)
+{
+  double b1 = 0.0, b2 = 0.0;
+  double two_x = 2.0 * x;
+  for(size_t k = degree; k > 0; --k)
     {
-      return 0;
+      double b0 = coeffs[k] + two_x * b1 - b2;
+      b2 = b1;
+      b1 = b0;
     }
+  return coeffs[0] + x * b1 - b2;
 }
 
-double logsum(double logx, double logy)
+const size_t GeneralPurposeLogSurvivalTable::DEGREE;
+
+GeneralPurposeLogSurvivalTable::GeneralPurposeLogSurvivalTable(double lambda_l, double lambda_u, double tolerance)
 {
-  //Ensure that logy <= logx by swapping them if necessary
-  if(logy > logx)
+  // Input checking
+  if(lambda_l <= 0)
     {
-      std::swap(logx, logy);
+      throw std::domain_error("Parameter lambda_l must be positive");
     }
 
-  // Now logy <= logx, so we can use the fact that 
-  //
-  // log(x + y) = log(x(1+ y /x)) = log(x) + log(1 + y/x)
-  //
-  // with y/x <= 1 to compute the logarithm of the sum stably
+  if(lambda_l >= lambda_u)
+    {
+      throw std::domain_error("Parameter lambda_u must be greater than lambda_l");
+    }
 
-  // Turn off GSL error handling before computing this exponential -- we'll use our own for this computation
-  gsl_error_handler_t* error_handler = gsl_set_error_handler_off(); 
+  if(!(tolerance > 0))
+    {
+      throw std::domain_error("Tolerance must be positive");
+    }
 
-  gsl_sf_result result;
-  int status = gsl_sf_exp_e(logy - logx, &result);
+  std::shared_ptr<Table> table(new Table);
+  table->lambda_l = lambda_l;
+  table->lambda_u = lambda_u;
 
-  // Reset original error handler here
-  gsl_set_error_handler(error_handler);
+  double log_ratio = std::log(lambda_u / lambda_l);
+  table->log_log_ratio = std::log(log_ratio);
 
-  if(status == GSL_SUCCESS)
+  // SMALL-t REGION:  Using E1(x) = -gamma - log(x) - sum_{k >= 1} (-x)^k / (k * k!), we obtain
+  //
+  // S_T(t) = 1 + sum_{k >= 1} (-1)^{k+1} (lambda_l^k - lambda_u^k) t^k / (k * k! * log(lambda_u / lambda_l))
+  table->t_lo = SMALL_T_THRESHOLD / lambda_u;
+  double lambda_l_k = 1.0, lambda_u_k = 1.0, k_factorial = 1.0;
+  for(int k = 1; k <= SMALL_T_ORDER; ++k)
     {
-      return logx + gsl_sf_log_1plusx(result.val);
+      lambda_l_k *= lambda_l;
+      lambda_u_k *= lambda_u;
+      k_factorial *= k;
+      double sign = (k % 2 == 1) ? 1.0 : -1.0;
+      table->small_t_coeffs.push_back(sign * (lambda_l_k - lambda_u_k) / (k * k_factorial * log_ratio));
     }
-  else
+
+  // LARGE-t REGION
+  table->t_hi = E1_ASYMPTOTIC_THRESHOLD / lambda_l;
+
+  // INTERMEDIATE REGION
+  table->u_lo = std::log(table->t_lo);
+  table->u_hi = std::log(table->t_hi);
+
+  // The Chebyshev nodes on [-1, 1] at which we interpolate, and the points at which we verify the interpolant:  the Chebyshev-Lobatto points (which interleave the nodes), and the points midway (in angle) between each node and its neighbouring Lobatto points
+  const size_t n = DEGREE + 1;
+  std::vector<double> nodes(n), test_points(3 * n + 1);
+  for(size_t j = 0; j < n; ++j)
+    nodes[j] = std::cos(M_PI * (j + 0.5) / n);
+  for(size_t j = 0; j <= n; ++j)
+    test_points[j] = std::cos(M_PI * j / n);
+  for(size_t j = 0; j < n; ++j)
     {
-      // If an error is thrown here, it must be because logy - logx is sufficiently negative to cause numerical underflow in the computation of the exponential.  
-      // In that case, y << x, and therefore, using the Taylor series expansion for log(1 - z), we compute
-      //
-      // log(1 - y/x) ~ -y/x ~ 0 
-  
-      return logx;
+      test_points[n + 1 + 2 * j] = std::cos(M_PI * (j + 0.25) / n);
+      test_points[n + 2 + 2 * j] = std::cos(M_PI * (j + 0.75) / n);
     }
+
+  std::vector<double> values(n);
+  size_t num_pieces = std::max<size_t>(1, std::ceil((table->u_hi - table->u_lo) / INITIAL_PIECE_WIDTH));
+  for(;;)
+    {
+      double width = (table->u_hi - table->u_lo) / num_pieces;
+      table->num_pieces = num_pieces;
+      table->inv_piece_width = 1.0 / width;
+      table->chebyshev_coeffs.assign(num_pieces * n, 0.0);
+      table->max_error = 0.0;
+
+      for(size_t i = 0; i < num_pieces; ++i)
+	{
+	  double u_mid = table->u_lo + (i + 0.5) * width;
+	  double* coeffs = &table->chebyshev_coeffs[i * n];
+
+	  // Interpolate at the Chebyshev nodes
+	  for(size_t j = 0; j < n; ++j)
+	    values[j] = log_general_purpose_survival_function(std::exp(u_mid + 0.5 * width * nodes[j]), lambda_l, lambda_u);
+
+	  for(size_t k = 0; k < n; ++k)
+	    {
+	      double sum = 0.0;
+	      for(size_t j = 0; j < n; ++j)
+		sum += values[j] * std::cos(M_PI * k * (j + 0.5) / n);
+	      coeffs[k] = (k == 0 ? 1.0 : 2.0) * sum / n;
+	    }
+
+	  // Verify
+	  for(size_t j = 0; j < test_points.size(); ++j)
+	    {
+	      double t = std::exp(u_mid + 0.5 * width * test_points[j]);
+	      double error = std::fabs(clenshaw(coeffs, DEGREE, test_points[j]) - log_general_purpose_survival_function(t, lambda_l, lambda_u));
+	      table->max_error = std::max(table->max_error, error);
+	    }
+	}
+
+      if(table->max_error <= tolerance)
+	break;
+
+      num_pieces *= 2;
+      if(num_pieces > MAX_NUM_PIECES)
+	{
+	  throw std::domain_error("Unable to tabulate the general-purpose survival function to the requested tolerance");
+	}
+    }
+
+  table_ = table;
 }
 
-double logdiff(double logx, double logy)
+double GeneralPurposeLogSurvivalTable::operator()(double t) const
 {
-  // Input checking
-  if(logy > logx)
+  const Table& table = *table_;
+
+  // NaN fails every comparison below, so we propagate it here
+  if(std::isnan(t))
     {
-      throw std::domain_error("logx must be greater than or equal to logy");
+      return t;
     }
-  
-  // We exploit the chain of equalities
-  // log(x - y) = log(x * (1 - y/x)) = log(x) + log(1 - y/x) = log(1 + (-exp(logy - logx)))
-
-  // Turn off GSL error handling before computing this exponential -- we'll use our own for this computation
-  gsl_error_handler_t* error_handler = gsl_set_error_handler_off(); 
 
-  gsl_sf_result result;
-  int status = gsl_sf_exp_e(logy - logx, &result);
+  if(t < table.t_lo)
+    {
+      // Input checking
+      if(t < 0)
+	{
+	  throw std::domain_error("Survival functions are defined on the nonnegative real line (t >= 0)");
+	}
 
-  // Reset original error handler here
-  gsl_set_error_handler(error_handler);
+      // SMALL-t REGION
+      double series = 0.0;
+      for(size_t k = table.small_t_coeffs.size(); k > 0; --k)
+	series = series * t + table.small_t_coeffs[k - 1];
 
-  if(status == GSL_SUCCESS)
+      return std::log1p(series * t);
+    }
+  else if(t >= table.t_hi)
     {
-      return logx + gsl_sf_log_1plusx(-result.val);
+      // LARGE-t REGION:  log S_T(t) = log E1(lambda_l t) + log(1 - E1(lambda_u t) / E1(lambda_l t)) - log(log(lambda_u / lambda_l))
+      PERSISTENCE_FILTER_COUNT_FALLBACK_IF(true, E1_ASYMPTOTIC_EXPANSION);
+      double x_l = table.lambda_l * t;
+      double x_u = table.lambda_u * t;
+      double log_E1_l = -x_l - std::log(x_l) + log_E1_asymptotic_series(x_l);
+      double log_E1_u = -x_u - std::log(x_u) + log_E1_asymptotic_series(x_u);
+
+      return log_E1_l + std::log1p(-std::exp(log_E1_u - log_E1_l)) - table.log_log_ratio;
     }
   else
     {
-      // If an error is thrown here, it must be because logy - logx is sufficiently negative to cause numerical underflow in the computation of the exponential.  
-      // In that case, y << x, and therefore, using the Taylor series expansion for log(1 - z), we compute
-      //	 
-      // log(1 - y/x) ~ -y/x ~ 0 
+      // INTERMEDIATE REGION
+      double x = (std::log(t) - table.u_lo) * table.inv_piece_width;
+      size_t piece = std::min(static_cast<size_t>(x), table.num_pieces - 1);
 
-      return logx;
+      return clenshaw(&table.chebyshev_coeffs[piece * (DEGREE + 1)], DEGREE, 2.0 * (x - piece) - 1.0);
     }
 }
@@ -2,44 +2,22 @@ from libpython_persistence_filter import *
 from numpy import *
 from scipy.stats import bernoulli
 
-'''This function constructs and runs a Persistence Filter on a given sequence of timestamped observations (with P_M and P_F error rates), and returns the persistence probabilities at the 'query_times'''
+'''This function constructs and runs a Persistence Filter on a given sequence of timestamped observations (with P_M and P_F error rates), and returns the persistence probabilities at the 'query_times' (which must be sorted).  The entire update/predict sweep runs in C++, reading the NumPy arrays in place and writing the results into a preallocated output array.  'logS' may be a Python function or one of the module's native priors (e.g. GeneralPurposeSurvivalPrior); with a native prior the sweep never calls back into the interpreter.'''
 def run_persistence_filter(Y_arr, t_arr, PM_arr, PF_arr, query_times, logS, init_time=0.0):
-    
-    if(not isinstance(PM_arr, (list, ndarray))):
-        PM_arr = repeat(PM_arr, len(Y_arr))
 
-    if(not isinstance(PF_arr, (list, ndarray))):
-        PF_arr = repeat(PF_arr, len(Y_arr))
+    #Error rates may be given either as scalars or as one value per observation
+    if(isinstance(PM_arr, (list, ndarray))):
+        PM_arr = ascontiguousarray(PM_arr, dtype=float64)
+
+    if(isinstance(PF_arr, (list, ndarray))):
+        PF_arr = ascontiguousarray(PF_arr, dtype=float64)
 
     #Construct persistence filter
     pf = PersistenceFilter(logS, init_time)
 
-    #PREDICT:
-
-    #Get the indices of all query_times prior to the first observation
-    mask = query_times < t_arr[0]
-    #Record the predictions for these query times 
-    persistence_probs = map(pf.predict, query_times[mask])
-
-    #UPDATE:
-    pf.update(asscalar(Y_arr[0]), t_arr[0], PM_arr[0], PF_arr[0])
-
-
-
-    for i in range(len(t_arr) - 1):
-        #Get the indices of all query_times in [ t[i], t[i+1] )
-        
-        #PREDICT:
-        mask = logical_and( (query_times >= t_arr[i]),  (query_times < t_arr[i+1]) )
-        persistence_probs = append(persistence_probs, map(pf.predict, query_times[mask]))
-        
-        #UPDATE:
-        pf.update(asscalar(Y_arr[i+1]), t_arr[i+1], PM_arr[i+1], PF_arr[i+1])
-
-    
-    #PREDICT
-    mask = query_times >= t_arr[len(t_arr)-1]
-    persistence_probs = append(persistence_probs, map(pf.predict, query_times[mask]))
+    #PREDICT and UPDATE, in time order
+    persistence_probs = empty(len(query_times))
+    pf.run_batch(ascontiguousarray(Y_arr, dtype=bool), ascontiguousarray(t_arr, dtype=float64), PM_arr, PF_arr, ascontiguousarray(query_times, dtype=float64), persistence_probs)
 
     return persistence_probs
 
@@ -1,8 +1,15 @@
 #include "persistence_filter.h"
+#include "persistence_filter_monte_carlo.h"
+#include "persistence_filter_priors.h"
 
 #include <iostream>
 #include <functional>
+#include <stdexcept>
+#include <string>
+#include <cstring>
+#include <vector>
 #include <boost/python.hpp>
+#include <boost/python/stl_iterator.hpp>
 
 using namespace boost::python;
 using namespace std;
@@ -28,25 +35,360 @@ boost::shared_ptr<PersistenceFilter> persistence_filter_with_initialization_time
   return boost::shared_ptr<PersistenceFilter>(new PersistenceFilter(wrap_python_function_as_cpp(python_log_survival_function.ptr()), init_time));
 }
 
+// Factory methods for instantiating C++ PersistenceFilters with native C++ survival priors, which are evaluated without calling back into the interpreter
+
+template<typename SurvivalPrior>
+boost::shared_ptr<PersistenceFilter> persistence_filter_from_native_prior(const SurvivalPrior& prior, double init_time)
+{
+  return boost::shared_ptr<PersistenceFilter>(new PersistenceFilter(prior, init_time));
+}
+
+// Returns true if the filter's survival prior is native C++ code (as opposed to a wrapped Python function), so that the filter can be run without holding the GIL
+bool has_native_prior(const PersistenceFilter& filter)
+{
+  return filter.logS().descriptor().kind != SurvivalPriorDescriptor::CUSTOM;
+}
+
+// Releases the GIL for the lifetime of this object, if 'release' is true
+class ScopedGILRelease
+{
+ protected:
+  PyThreadState* state_;
+
+ public:
+  ScopedGILRelease(bool release) : state_(release ? PyEval_SaveThread() : nullptr) {}
+
+  ~ScopedGILRelease()
+  {
+    if(state_)
+      PyEval_RestoreThread(state_);
+  }
+
+ private:
+  ScopedGILRelease(const ScopedGILRelease&);
+  ScopedGILRelease& operator=(const ScopedGILRelease&);
+};
+
+// Python bindings for the survival priors
+
+std::vector<double> vector_from_python(const object& sequence)
+{
+  return std::vector<double>(stl_input_iterator<double>(sequence), stl_input_iterator<double>());
+}
+
+template<typename T>
+boost::python::list list_from_vector(const std::vector<T>& v)
+{
+  boost::python::list l;
+  for(size_t i = 0; i < v.size(); ++i)
+    l.append(v[i]);
+  return l;
+}
+
+boost::shared_ptr<PiecewiseConstantHazardSurvivalPrior> piecewise_constant_hazard_prior_from_python(const object& breakpoints, const object& rates)
+{
+  return boost::shared_ptr<PiecewiseConstantHazardSurvivalPrior>(new PiecewiseConstantHazardSurvivalPrior(vector_from_python(breakpoints), vector_from_python(rates)));
+}
+
+boost::python::list piecewise_constant_hazard_prior_breakpoints(const PiecewiseConstantHazardSurvivalPrior& prior)
+{
+  return list_from_vector(prior.breakpoints());
+}
+
+boost::python::list piecewise_constant_hazard_prior_rates(const PiecewiseConstantHazardSurvivalPrior& prior)
+{
+  return list_from_vector(prior.rates());
+}
+
+// Monte Carlo evaluation
+
+// Convert one of the native prior objects above into a LogSurvivalFunction, throwing std::invalid_argument if 'prior' is not one of them
+LogSurvivalFunction native_prior_from_python(const object& prior)
+{
+  extract<const GeneralPurposeSurvivalPrior&> general_purpose(prior);
+  if(general_purpose.check())
+    return LogSurvivalFunction(general_purpose());
+
+  extract<const GeneralPurposeLogSurvivalTable&> table(prior);
+  if(table.check())
+    return LogSurvivalFunction(table());
+
+  extract<const ExponentialSurvivalPrior&> exponential(prior);
+  if(exponential.check())
+    return LogSurvivalFunction(exponential());
+
+  extract<const WeibullSurvivalPrior&> weibull(prior);
+  if(weibull.check())
+    return LogSurvivalFunction(weibull());
+
+  extract<const PiecewiseConstantHazardSurvivalPrior&> piecewise(prior);
+  if(piecewise.check())
+    return LogSurvivalFunction(piecewise());
+
+  throw std::invalid_argument("Monte Carlo evaluation requires native survival priors (e.g. GeneralPurposeSurvivalPrior), which can be evaluated without the GIL");
+}
+
+dict metrics_to_python(const MonteCarloMetrics& metrics)
+{
+  dict d;
+  d["mean_absolute_error"] = metrics.mean_absolute_error;
+  d["mean_absolute_error_stddev"] = metrics.mean_absolute_error_stddev;
+  d["precisions"] = list_from_vector(metrics.precisions);
+  d["recalls"] = list_from_vector(metrics.recalls);
+  d["num_precisions"] = list_from_vector(metrics.num_precisions);
+  d["num_recalls"] = list_from_vector(metrics.num_recalls);
+  return d;
+}
+
+// Run a Monte Carlo evaluation of the persistence filter with each of the native 'priors' (see run_monte_carlo_evaluation() in persistence_filter_monte_carlo.h), returning a dict holding a list of the filters' metrics ("filters") and the empirical estimator's metrics ("empirical_estimator")
+dict monte_carlo_evaluation(const object& priors, size_t num_trials, uint64_t seed, size_t num_threads, double P_M, double P_F, double lambda_r, double lambda_o, double p_N, double simulation_length, double query_interval, const object& thresholds)
+{
+  std::vector<LogSurvivalFunction> native_priors;
+  for(stl_input_iterator<object> it(priors), end; it != end; ++it)
+    {
+      native_priors.push_back(native_prior_from_python(*it));
+    }
+
+  MonteCarloSettings settings;
+  settings.num_trials = num_trials;
+  settings.seed = seed;
+  settings.num_threads = num_threads;
+  settings.P_M = P_M;
+  settings.P_F = P_F;
+  settings.lambda_r = lambda_r;
+  settings.lambda_o = lambda_o;
+  settings.p_N = p_N;
+  settings.simulation_length = simulation_length;
+  settings.query_interval = query_interval;
+  if(!thresholds.is_none())
+    settings.thresholds = vector_from_python(thresholds);
+
+  MonteCarloResults results;
+  {
+    ScopedGILRelease release(true);
+    results = run_monte_carlo_evaluation(settings, native_priors);
+  }
+
+  boost::python::list filters;
+  for(size_t p = 0; p < results.filters.size(); ++p)
+    filters.append(metrics_to_python(results.filters[p]));
+
+  dict d;
+  d["filters"] = filters;
+  d["empirical_estimator"] = metrics_to_python(results.empirical_estimator);
+  d["thresholds"] = list_from_vector(settings.thresholds);
+  d["num_trials"] = results.num_trials;
+  return d;
+}
+
+// Zero-copy access to NumPy arrays (or any other object supporting the Python buffer protocol)
+
+// A view of a one-dimensional, C-contiguous buffer whose elements have the struct-module type code 'type_code' ('d' for float64, '?' for bool)
+class BufferView
+{
+ protected:
+  Py_buffer view_;
+
+ public:
+  BufferView(const object& obj, char type_code, bool writable, const char* name)
+  {
+    int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0);
+    if(PyObject_GetBuffer(obj.ptr(), &view_, flags) != 0)
+      {
+	PyErr_Clear();
+	throw std::invalid_argument(std::string("Argument '") + name + "' must be a contiguous" + (writable ? ", writable" : "") + " array");
+      }
+
+    // Accept native-order format strings such as "d", "=d" or "<d" (on little-endian hosts)
+    const char* format = view_.format ? view_.format : "B";
+    if( (format[0] == '@') || (format[0] == '=') || (format[0] == '<') )
+      ++format;
+
+    if( (view_.ndim > 1) || (format[0] != type_code) || (format[1] != '\0') )
+      {
+	PyBuffer_Release(&view_);
+	throw std::invalid_argument(std::string("Argument '") + name + "' must be a one-dimensional array of " + (type_code == 'd' ? "float64" : "bool") + " values");
+      }
+  }
+
+  size_t size() const
+  {
+    return view_.len / view_.itemsize;
+  }
+
+  template<typename T>
+    T* data() const
+    {
+      return static_cast<T*>(view_.buf);
+    }
+
+  ~BufferView()
+  {
+    PyBuffer_Release(&view_);
+  }
+
+ private:
+  BufferView(const BufferView&);
+  BufferView& operator=(const BufferView&);
+};
+
+// A per-observation error rate, which may be given either as an array or as a single value applying to every observation
+class ErrorRates
+{
+ protected:
+  double scalar_;
+  boost::shared_ptr<BufferView> array_;
+
+ public:
+  ErrorRates(const object& obj, size_t num_observations, const char* name)
+  {
+    extract<double> scalar(obj);
+    if(scalar.check())
+      {
+	scalar_ = scalar();
+      }
+    else
+      {
+	array_.reset(new BufferView(obj, 'd', false, name));
+	if(array_->size() != num_observations)
+	  {
+	    throw std::invalid_argument(std::string("Argument '") + name + "' must have one entry per observation");
+	  }
+      }
+  }
+
+  const double* data() const
+  {
+    return array_ ? array_->data<const double>() : &scalar_;
+  }
+
+  size_t stride() const
+  {
+    return array_ ? 1 : 0;
+  }
+};
+
+// Incorporate the observations (detector_outputs[i], observation_times[i], P_M[i], P_F[i]) in order; P_M and P_F may be scalars
+void update_batch(PersistenceFilter& filter, const object& detector_outputs, const object& observation_times, const object& P_M, const object& P_F)
+{
+  BufferView Y(detector_outputs, '?', false, "detector_outputs");
+  BufferView t(observation_times, 'd', false, "observation_times");
+  if(Y.size() != t.size())
+    {
+      throw std::invalid_argument("Arguments 'detector_outputs' and 'observation_times' must have the same length");
+    }
+  ErrorRates PM(P_M, t.size(), "P_M");
+  ErrorRates PF(P_F, t.size(), "P_F");
+
+  ScopedGILRelease release(has_native_prior(filter));
+  run_persistence_filter(filter, t.size(), Y.data<const bool>(), t.data<const double>(), PM.data(), PM.stride(), PF.data(), PF.stride(), 0, nullptr, nullptr);
+}
+
+// Write the posterior persistence probabilities at each of the 'prediction_times' into the preallocated float64 array 'beliefs'
+void predict_batch(const PersistenceFilter& filter, const object& prediction_times, const object& beliefs)
+{
+  BufferView t(prediction_times, 'd', false, "prediction_times");
+  BufferView out(beliefs, 'd', true, "beliefs");
+  if(out.size() != t.size())
+    {
+      throw std::invalid_argument("Arguments 'prediction_times' and 'beliefs' must have the same length");
+    }
+
+  ScopedGILRelease release(has_native_prior(filter));
+  filter.predict_many(t.data<const double>(), t.size(), out.data<double>());
+}
+
+// Run the filter over an entire sequence of observations, writing its beliefs at each of the (sorted) 'query_times' into the preallocated float64 array 'beliefs'.  See run_persistence_filter() in persistence_filter.h.
+void run_batch(PersistenceFilter& filter, const object& detector_outputs, const object& observation_times, const object& P_M, const object& P_F, const object& query_times, const object& beliefs)
+{
+  BufferView Y(detector_outputs, '?', false, "detector_outputs");
+  BufferView t(observation_times, 'd', false, "observation_times");
+  if(Y.size() != t.size())
+    {
+      throw std::invalid_argument("Arguments 'detector_outputs' and 'observation_times' must have the same length");
+    }
+  ErrorRates PM(P_M, t.size(), "P_M");
+  ErrorRates PF(P_F, t.size(), "P_F");
+
+  BufferView q(query_times, 'd', false, "query_times");
+  BufferView out(beliefs, 'd', true, "beliefs");
+  if(out.size() != q.size())
+    {
+      throw std::invalid_argument("Arguments 'query_times' and 'beliefs' must have the same length");
+    }
+
+  ScopedGILRelease release(has_native_prior(filter));
+  run_persistence_filter(filter, t.size(), Y.data<const bool>(), t.data<const double>(), PM.data(), PM.stride(), PF.data(), PF.stride(), q.size(), q.data<const double>(), out.data<double>());
+}
+
 // Python interface to the C++ PersistenceFilter implementation
 BOOST_PYTHON_MODULE(libpython_persistence_filter)
 {
   //def("test_passthrough", eval_function_at_point_5)
 
+  // Native survival priors.  Each is callable (returning log S_T(t)), and can be passed to the PersistenceFilter constructor in place of a Python function.
+  class_<GeneralPurposeSurvivalPrior>("GeneralPurposeSurvivalPrior", "The general-purpose survival time prior developed in the RSS workshop paper 'Towards Lifelong Feature-Based Mapping in Semi-Static Environments', with rate parameters lambda_l < lambda_u.", init<double, double>((boost::python::arg("lambda_l"), boost::python::arg("lambda_u"))))
+    .def("__call__", &GeneralPurposeSurvivalPrior::operator())
+    .def("lambda_l", &GeneralPurposeSurvivalPrior::lambda_l)
+    .def("lambda_u", &GeneralPurposeSurvivalPrior::lambda_u)
+    ;
+
+  class_<GeneralPurposeLogSurvivalTable>("GeneralPurposeLogSurvivalTable", "A tabulated version of GeneralPurposeSurvivalPrior, accurate to within 'tolerance' in log S_T(t), which is considerably faster to evaluate.", init<double, double, optional<double> >((boost::python::arg("lambda_l"), boost::python::arg("lambda_u"), boost::python::arg("tolerance"))))
+    .def("__call__", &GeneralPurposeLogSurvivalTable::operator())
+    .def("lambda_l", &GeneralPurposeLogSurvivalTable::lambda_l)
+    .def("lambda_u", &GeneralPurposeLogSurvivalTable::lambda_u)
+    ;
+
+  class_<ExponentialSurvivalPrior>("ExponentialSurvivalPrior", "The exponential survival time prior (constant hazard rate 'rate').", init<double>((boost::python::arg("rate"))))
+    .def("__call__", &ExponentialSurvivalPrior::operator())
+    .def("rate", &ExponentialSurvivalPrior::rate)
+    ;
+
+  class_<WeibullSurvivalPrior>("WeibullSurvivalPrior", "The Weibull survival time prior, for which log S_T(t) = -(t / scale)^shape.", init<double, double>((boost::python::arg("shape"), boost::python::arg("scale"))))
+    .def("__call__", &WeibullSurvivalPrior::operator())
+    .def("shape", &WeibullSurvivalPrior::shape)
+    .def("scale", &WeibullSurvivalPrior::scale)
+    ;
+
+  class_<PiecewiseConstantHazardSurvivalPrior, boost::shared_ptr<PiecewiseConstantHazardSurvivalPrior> >("PiecewiseConstantHazardSurvivalPrior", "A survival time prior whose hazard rate is rates[k] on [breakpoints[k], breakpoints[k+1]), with breakpoints[0] = 0 and the last rate applying thereafter.", no_init)
+    .def("__init__", make_constructor(&piecewise_constant_hazard_prior_from_python, default_call_policies(), (boost::python::arg("breakpoints"), boost::python::arg("rates"))))
+    .def("__call__", &PiecewiseConstantHazardSurvivalPrior::operator())
+    .def("breakpoints", &piecewise_constant_hazard_prior_breakpoints)
+    .def("rates", &piecewise_constant_hazard_prior_rates)
+    ;
+
   class_<PersistenceFilter, boost::shared_ptr<PersistenceFilter> >("PersistenceFilter", no_init)  // Declare this class without a default constructor...
 
     // ... and then bind custom "factory methods" to the __init__ function that can wrap passed-in native Python functions as instances of std::function<double(double)> before being passed in to the C++ PersistenceFilter class's constructor.
     .def("__init__", make_constructor(&persistence_filter_from_python) )
-    .def("__init__", make_constructor(&persistence_filter_with_initialization_time_from_python))
+    .def("__init__", make_constructor(&persistence_filter_with_initialization_time_from_python, default_call_policies(), (boost::python::arg("log_survival_function"), boost::python::arg("initialization_time"))))
+
+    // Constructors accepting the native priors above (registered last, so that Boost.Python tries them before the generic Python-callable constructors)
+    .def("__init__", make_constructor(&persistence_filter_from_native_prior<GeneralPurposeSurvivalPrior>, default_call_policies(), (boost::python::arg("log_survival_function"), boost::python::arg("initialization_time") = 0.0)))
+    .def("__init__", make_constructor(&persistence_filter_from_native_prior<GeneralPurposeLogSurvivalTable>, default_call_policies(), (boost::python::arg("log_survival_function"), boost::python::arg("initialization_time") = 0.0)))
+    .def("__init__", make_constructor(&persistence_filter_from_native_prior<ExponentialSurvivalPrior>, default_call_policies(), (boost::python::arg("log_survival_function"), boost::python::arg("initialization_time") = 0.0)))
+    .def("__init__", make_constructor(&persistence_filter_from_native_prior<WeibullSurvivalPrior>, default_call_policies(), (boost::python::arg("log_survival_function"), boost::python::arg("initialization_time") = 0.0)))
+    .def("__init__", make_constructor(&persistence_filter_from_native_prior<PiecewiseConstantHazardSurvivalPrior>, default_call_policies(), (boost::python::arg("log_survival_function"), boost::python::arg("initialization_time") = 0.0)))
   
-    .def("update", &PersistenceFilter::update)
+    .def("update", static_cast<void (PersistenceFilter::*)(bool, double, double, double)>(&PersistenceFilter::update))
     .def("predict", &PersistenceFilter::predict)
     .def("last_observation_time", &PersistenceFilter::last_observation_time)
     .def("initialization_time", &PersistenceFilter::initialization_time)
     .def("likelihood", &PersistenceFilter::likelihood)
     .def("evidence", &PersistenceFilter::evidence)
     .def("evidence_lower_sum", &PersistenceFilter::evidence_lower_sum)
+    .def("has_native_prior", &has_native_prior)
+
+    // Batch operations on NumPy arrays (accessed in place via the buffer protocol):  float64 arrays for times, error rates and beliefs, and bool arrays for detector outputs.  If the filter has a native prior, these release the GIL while they run.
+    .def("update_batch", &update_batch, (boost::python::arg("detector_outputs"), boost::python::arg("observation_times"), boost::python::arg("P_M"), boost::python::arg("P_F")))
+    .def("predict_batch", &predict_batch, (boost::python::arg("prediction_times"), boost::python::arg("beliefs")))
+    .def("run_batch", &run_batch, (boost::python::arg("detector_outputs"), boost::python::arg("observation_times"), boost::python::arg("P_M"), boost::python::arg("P_F"), boost::python::arg("query_times"), boost::python::arg("beliefs")))
 
     ;
+
+  // Multithreaded Monte Carlo evaluation on simulated data; the defaults are the "standard" settings of the experiment notebooks
+  MonteCarloSettings defaults;
+  def("monte_carlo_evaluation", &monte_carlo_evaluation, (boost::python::arg("priors"), boost::python::arg("num_trials") = defaults.num_trials, boost::python::arg("seed") = defaults.seed, boost::python::arg("num_threads") = defaults.num_threads, boost::python::arg("P_M") = defaults.P_M, boost::python::arg("P_F") = defaults.P_F, boost::python::arg("lambda_r") = defaults.lambda_r, boost::python::arg("lambda_o") = defaults.lambda_o, boost::python::arg("p_N") = defaults.p_N, boost::python::arg("simulation_length") = defaults.simulation_length, boost::python::arg("query_interval") = defaults.query_interval, boost::python::arg("thresholds") = object()),
+      "Evaluates persistence filters using each of the native 'priors', together with the empirical estimator, on simulated trials (run in parallel, and deterministic for a given seed), returning their mean absolute errors and absence precisions and recalls at each threshold.");
 }
 